@@ -22,6 +22,126 @@
 /** A mapping of channel names to their Channel object. */
 typedef std::unordered_map<std::string, Channel*, irc::insensitive, irc::StrHashComp> ChannelMap;
 
+/** Maintains secondary indices of channels which allow them to be looked up by
+ * name prefix, topic prefix, user count, creation time, and topic set time
+ * without scanning every channel on the network.
+ */
+class CoreExport ChannelIndex final
+{
+public:
+	/** Compares two strings case insensitively in the same order as irc::insensitive_swo.
+	 * @return A negative number if \p lhs is ordered first, a positive number if \p rhs
+	 *         is ordered first, or zero if they are equal.
+	 */
+	static int Compare(const std::string_view& lhs, const std::string_view& rhs);
+
+	/** Orders channels case insensitively by a string property. */
+	template <std::string Channel::*Field>
+	struct FieldCompare final
+	{
+		using is_transparent = void;
+		bool operator()(const Channel* lhs, const Channel* rhs) const { return Compare(lhs->*Field, rhs->*Field) < 0; }
+		bool operator()(const Channel* lhs, const std::string_view& rhs) const { return Compare(lhs->*Field, rhs) < 0; }
+		bool operator()(const std::string_view& lhs, const Channel* rhs) const { return Compare(lhs, rhs->*Field) < 0; }
+	};
+
+	/** A set of channels ordered by name. This is a multiset as names which differ
+	 * can become equal when the case mapping changes.
+	 */
+	typedef std::multiset<Channel*, FieldCompare<&Channel::name>> NameSet;
+
+	/** A set of channels ordered by topic. Channels without a topic are not included. */
+	typedef std::multiset<Channel*, FieldCompare<&Channel::topic>> TopicSet;
+
+	/** A set of channels ordered by a numeric property. */
+	template <typename T>
+	using ValueSet = std::set<std::pair<T, Channel*>>;
+
+private:
+	/** Channels ordered by name. */
+	NameSet names;
+
+	/** Channels which have a topic ordered by topic. */
+	TopicSet topics;
+
+	/** Channels ordered by user count. */
+	ValueSet<size_t> users;
+
+	/** Channels ordered by creation time. */
+	ValueSet<time_t> ages;
+
+	/** Channels which have had a topic set ordered by topic set time. */
+	ValueSet<time_t> topictimes;
+
+	/** The case mapping which the name and topic sets are ordered by. */
+	std::array<unsigned char, UCHAR_MAX + 1> casemap = { };
+
+	/** Reorders the name and topic sets if a module has changed the case mapping. */
+	void CheckCasemap();
+
+	/** Removes a specific channel from a set which can contain other channels that compare equal to it.
+	 * @param set The set to remove the channel from.
+	 * @param chan The channel to remove.
+	 */
+	template <typename Set>
+	static void EraseExact(Set& set, Channel* chan)
+	{
+		auto [begin, end] = set.equal_range(chan);
+		for (auto it = begin; it != end; ++it)
+		{
+			if (*it == chan)
+			{
+				set.erase(it);
+				break;
+			}
+		}
+	}
+
+public:
+	/** Adds a newly created channel to the index.
+	 * @param chan The channel to add.
+	 */
+	void Add(Channel* chan);
+
+	/** Removes a channel which is being destroyed from the index.
+	 * @param chan The channel to remove.
+	 */
+	void Remove(Channel* chan);
+
+	/** Changes the creation time of a channel.
+	 * @param chan The channel to update.
+	 * @param age The new creation time of the channel.
+	 */
+	void ChangeAge(Channel* chan, time_t age);
+
+	/** Updates the user count of a channel.
+	 * @param chan The channel to update.
+	 * @param oldcount The user count the channel was indexed with.
+	 */
+	void ChangeUsers(Channel* chan, size_t oldcount);
+
+	/** Removes the topic of a channel from the index. This must be called before the topic changes. */
+	void RemoveTopic(Channel* chan);
+
+	/** Adds the topic of a channel to the index. This must be called after the topic changes. */
+	void AddTopic(Channel* chan);
+
+	/** Retrieves the channels ordered by name. */
+	const NameSet& GetNames() { CheckCasemap(); return names; }
+
+	/** Retrieves the channels which have a topic ordered by topic. */
+	const TopicSet& GetTopics() { CheckCasemap(); return topics; }
+
+	/** Retrieves the channels ordered by user count. */
+	const ValueSet<size_t>& GetUsers() const { return users; }
+
+	/** Retrieves the channels ordered by creation time. */
+	const ValueSet<time_t>& GetAges() const { return ages; }
+
+	/** Retrieves the channels which have had a topic set ordered by topic set time. */
+	const ValueSet<time_t>& GetTopicTimes() const { return topictimes; }
+};
+
 /** Manages state relating to channels. */
 class CoreExport ChannelManager final
 {
@@ -29,6 +149,9 @@ private:
 	/** A map of channel names to the channel object. */
 	ChannelMap channels;
 
+	/** Secondary indices of the channels in the channel map. */
+	ChannelIndex index;
+
 public:
 	/** Determines whether an channel name is valid. */
 	std::function<bool(const std::string_view&)> IsChannel = DefaultIsChannel;
@@ -50,6 +173,10 @@ public:
 	ChannelMap& GetChans() { return channels; }
 	const ChannelMap& GetChans() const { return channels; }
 
+	/** Retrieves the secondary indices of all channels. */
+	ChannelIndex& GetIndex() { return index; }
+	const ChannelIndex& GetIndex() const { return index; }
+
 	/** Determines whether the specified character is a valid channel prefix.
 	 * @param prefix The channel name prefix to validate.
 	 * @return True if the character is a channel prefix; otherwise, false.
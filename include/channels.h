@@ -293,6 +293,15 @@ public:
 	 */
 	bool CheckBan(User* user, const std::string& banmask);
 
+	/** Check a single ban which has already been parsed for match
+	 */
+	bool CheckBan(User* user, const BanMask& banmask);
+
+	/** Forgets the cached ban status of all members of this channel. This should be called
+	 * when something that might change whether a member is banned changes.
+	 */
+	void ResetBanCache();
+
 	/** Write a NOTICE to all local users on the channel
 	 * @param text Text to send
 	 * @param status The minimum status rank to send this message to.
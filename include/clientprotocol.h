@@ -440,7 +440,8 @@ public:
 	 * @param serializeinfo Information about which exact serialized form of the message is the caller asking for
 	 * (which serializer to use and which tags to include).
 	 * @return Serialized message according to serializeinfo. The returned reference remains valid until the
-	 * next call to this method.
+	 * next call to this method. The buffers themselves are immutable and can be shared by any number of send
+	 * queues. The body is serialized once per serializer and shared between all of the tag selections.
 	 */
 	const SerializedMessage& GetSerialized(const SerializedInfo& serializeinfo) const;
 
@@ -747,13 +748,20 @@ public:
 	 */
 	const SerializedMessage& SerializeForUser(LocalUser* user, Message& msg);
 
-	/** Serialize a high level protocol message into wire format.
-	 * @param msg High level message to serialize. Contains all necessary information about the message, including all possible tags.
-	 * @param tagwl Message tags to include in the serialized message. Tags attached to the message but not included in the whitelist must not
+	/** Serialize the tags of a high level protocol message into wire format.
+	 * @param msg High level message to serialize the tags of. Contains all possible tags.
+	 * @param tagwl Message tags to include in the serialized tags. Tags attached to the message but not included in the whitelist must not
 	 * appear in the output. This is because each user may get a different set of tags for the same message.
+	 * @return The tags in wire format including anything which separates them from the rest of the message or an empty string if no
+	 * tags are included.
+	 */
+	virtual std::string SerializeTags(const Message& msg, const TagSelection& tagwl) const = 0;
+
+	/** Serialize a high level protocol message without its tags into wire format.
+	 * @param msg High level message to serialize.
 	 * @return Protocol message in wire format. Must contain message delimiter as well, if any (e.g. CRLF for RFC1459).
 	 */
-	virtual std::string Serialize(const Message& msg, const TagSelection& tagwl) const = 0;
+	virtual std::string SerializeBody(const Message& msg) const = 0;
 
 	/** Parse a protocol message from wire format.
 	 * @param user Source of the message.
@@ -761,7 +769,7 @@ public:
 	 * @param parseoutput Output of the parser.
 	 * @return True if the message was parsed successfully into parseoutput and should be processed, false to drop the message.
 	 */
-	virtual bool Parse(LocalUser* user, const std::string& line, ParseOutput& parseoutput) = 0;
+	virtual bool Parse(LocalUser* user, const std::string_view& line, ParseOutput& parseoutput) = 0;
 };
 
 inline ClientProtocol::MessageTagData::MessageTagData(MessageTagProvider* prov, const std::string& val, void* data)
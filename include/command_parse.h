@@ -109,7 +109,7 @@ public:
 	 * @param buffer The buffer line to process
 	 * @param user The user to whom this line belongs
 	 */
-	void ProcessBuffer(LocalUser* user, const std::string& buffer);
+	void ProcessBuffer(LocalUser* user, const std::string_view& buffer);
 
 	/** Process a command from a user.
 	 * @param user The user to parse the command for.
@@ -414,6 +414,9 @@ public:
 	/** The connect classes from the server config. */
 	ClassVector Classes;
 
+	/** An index of the connect classes in Classes which users can be automatically assigned to. */
+	ConnectClassIndex ClassIndex;
+
 	/** The configuration read from the command line. */
 	CommandLineConf CommandLine;
 
@@ -480,6 +483,12 @@ public:
 	/** The number of seconds that the server clock can skip by before server operators are warned. */
 	time_t TimeSkipWarn;
 
+	/** Whether to measure the time spent by the main loop and by commands. */
+	bool Profile;
+
+	/** Whether to measure the time spent by module event handlers. */
+	bool ProfileHooks;
+
 	/** The maximum number of targets for a multi-target command (e.g. KICK). */
 	size_t MaxTargets;
 
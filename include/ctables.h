@@ -248,6 +248,9 @@ public:
 	/** The number of times this command has been executed. */
 	unsigned long use_count = 0;
 
+	/** The time spent executing this command if profiling is enabled. */
+	ProfileManager::Counter use_time;
+
 	/** If non-empty then the syntax of the parameter for this command. */
 	std::vector<std::string> syntax;
 
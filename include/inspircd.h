@@ -42,6 +42,7 @@
 #include <array>
 #include <atomic>
 #include <bitset>
+#include <chrono>
 #include <deque>
 #include <functional>
 #include <memory>
@@ -75,6 +76,7 @@ CoreExport extern InspIRCd* ServerInstance;
 #include "dynref.h"
 #include "cull.h"
 #include "extensible.h"
+#include "profiler.h"
 #include "ctables.h"
 #include "numeric.h"
 #include "uid.h"
@@ -136,6 +138,22 @@ public:
 	 */
 	unsigned long Recv = 0;
 
+	/** Total bytes of data which were queued for sending by sharing an existing buffer
+	 */
+	unsigned long SendQShared = 0;
+
+	/** Total bytes of data which were copied into a new buffer when queued for sending
+	 */
+	unsigned long SendQCopied = 0;
+
+	/** Bytes of data which are currently waiting in the send queues of all sockets
+	 */
+	unsigned long SendQ = 0;
+
+	/** Bytes of data which are currently waiting in the receive queues of all sockets
+	 */
+	unsigned long RecvQ = 0;
+
 #ifdef _WIN32
 	/** Cpu usage at last sample
 	*/
@@ -239,6 +257,10 @@ public:
 	 */
 	ServerStats Stats;
 
+	/** Profile manager, measures where the main loop spends its time
+	 */
+	ProfileManager Profiler;
+
 	/**  Server Config class, holds configuration file data
 	 */
 	ServerConfig* Config = nullptr;
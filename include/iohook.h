@@ -33,7 +33,8 @@ public:
 	enum Type
 	{
 		IOH_UNKNOWN,
-		IOH_SSL
+		IOH_SSL,
+		IOH_COMPRESS
 	};
 
 	const Type type;
@@ -159,6 +160,13 @@ public:
 	/** @copydoc IOHook::OnStreamSocketClose */
 	void OnStreamSocketClose(StreamSocket* sock) override { }
 
+	/** Determines whether the hook has read data which it has not yet passed up the hook chain.
+	 * Whilst this is true the next hook in the chain is not read from so that the hook can pass
+	 * the rest of the data up first.
+	 * @return True if the hook has data waiting to be passed up the hook chain; otherwise, false.
+	 */
+	virtual bool HasPendingRead() const { return false; }
+
 	/** Get all queued up data which is ready to go down the hook chain
 	 * @return SendQueue containing all data waiting to go down the hook chain
 	 */
@@ -23,6 +23,89 @@
 
 #include "extension.h"
 
+/** A ban mask in the nick!user\@host format which has been parsed ahead of time so that it
+ * can be matched against users without building and matching strings for every part of it.
+ */
+class CoreExport BanMask final
+{
+private:
+	/** A wildcard pattern which matches one part of a ban mask. */
+	class Pattern final
+	{
+	private:
+		/** The ways in which a pattern can be matched. */
+		enum class Type
+			: uint8_t
+		{
+			/** The pattern only contains asterisks and matches anything. */
+			ANY,
+
+			/** The pattern contains no wildcards and is compared case insensitively. */
+			LITERAL,
+
+			/** The pattern contains wildcards and is matched with InspIRCd::Match. */
+			WILDCARD,
+		};
+
+		/** The pattern to match against. */
+		std::string pattern;
+
+		/** The way in which the pattern is matched. */
+		Type type = Type::ANY;
+
+	public:
+		Pattern() = default;
+
+		/** Initializes a new instance of the Pattern class.
+		 * @param pat The wildcard pattern to match against.
+		 */
+		Pattern(const std::string& pat);
+
+		/** Determines whether the specified string matches this pattern.
+		 * @param str The string to match against.
+		 * @return True if the string matches; otherwise, false.
+		 */
+		bool Matches(const std::string& str) const;
+	};
+
+	/** The mask this ban mask was parsed from. */
+	std::string mask;
+
+	/** Whether the mask is in the nick!user\@host format. */
+	bool hostmask = false;
+
+	/** Whether the part before the \@ contains exactly one ! and can be matched in two parts. */
+	bool split = false;
+
+	/** If split is set then the pattern for the nickname; otherwise, the pattern for nick!user. */
+	Pattern nick;
+
+	/** If split is set then the pattern for the username. */
+	Pattern user;
+
+	/** The pattern for the hostname. */
+	Pattern host;
+
+	/** If the part after the \@ is an IP address or CIDR range then the parsed range. */
+	std::optional<irc::sockets::cidr_mask> cidr;
+
+public:
+	/** Initializes a new instance of the BanMask class.
+	 * @param Mask The mask to parse.
+	 */
+	BanMask(const std::string& Mask);
+
+	/** Retrieves the mask this ban mask was parsed from. */
+	const std::string& GetMask() const { return mask; }
+
+	/** Determines whether the specified user matches the nick!user\@host form of this mask. This
+	 * does not check whether the mask is matched by a module.
+	 * @param u The user to match against.
+	 * @return True if the user matches; otherwise, false.
+	 */
+	bool Matches(User* u) const;
+};
+
 /** The base class for list modes, should be inherited.
  */
 class CoreExport ListModeBase
@@ -36,12 +119,24 @@ public:
 		std::string setter;
 		std::string mask;
 		time_t time;
+
+		/** The mask in its parsed form or nullptr if it has not been matched as a ban yet. */
+		mutable std::shared_ptr<const BanMask> banmask;
+
 		ListItem(const std::string& Mask, const std::string& Setter, time_t Time)
 			: setter(Setter)
 			, mask(Mask)
 			, time(Time)
 		{
 		}
+
+		/** Retrieves the mask of this entry in a form which can be matched against users as a ban. */
+		const BanMask& GetBanMask() const
+		{
+			if (!banmask)
+				banmask = std::make_shared<const BanMask>(mask);
+			return *banmask;
+		}
 	};
 
 	/** Items stored in the channel's list
@@ -58,6 +58,12 @@ public:
 	 */
 	Id id;
 
+	/** The result of the last check of the member against the ban list of the channel or
+	 * std::nullopt if it needs to be checked again. This is reset when the list modes of the
+	 * channel or the details of the user change and should only be used by Channel::IsBanned.
+	 */
+	std::optional<bool> banned;
+
 	/** Converts a string to a Membership::Id
 	 * @param str The string to convert
 	 * @return Raw value of type Membership::Id
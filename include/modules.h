@@ -256,6 +256,9 @@ public:
 	 */
 	bool dying = false;
 
+	/** The time spent in each of the event handlers of this module if profiling is enabled. */
+	std::array<ProfileManager::HookCounter, I_END> hookstats;
+
 	/** A description of this module. */
 	const std::string description;
 
@@ -1202,13 +1205,17 @@ public:
 	do \
 		{ \
 		const Module::List& _handlers = ServerInstance->Modules.EventHandlers[I_ ## EVENT]; \
+		const bool _profile = ServerInstance->Profiler.IsProfilingHooks(); \
 		for (Module::List::const_reverse_iterator _handler = _handlers.rbegin(); _handler != _handlers.rend(); ) \
 		{ \
 			Module* _mod = *_handler++; \
 			try \
 			{ \
 				if (!_mod->dying) \
+				{ \
+					ProfileManager::Stopwatch _stopwatch(_mod->hookstats[I_ ## EVENT], # EVENT, _profile); \
 					_mod->EVENT ARGS; \
+				} \
 			} \
 			catch (const CoreException& _exception_ ## EVENT) \
 			{ \
@@ -1226,6 +1233,7 @@ public:
 	{ \
 		RESULT = MOD_RES_PASSTHRU; \
 		const Module::List& _handlers = ServerInstance->Modules.EventHandlers[I_ ## EVENT]; \
+		const bool _profile = ServerInstance->Profiler.IsProfilingHooks(); \
 		for (Module::List::const_reverse_iterator _handler = _handlers.rbegin(); _handler != _handlers.rend(); ) \
 		{ \
 			Module* _mod = *_handler++; \
@@ -1233,6 +1241,7 @@ public:
 			{ \
 				if (_mod->dying) \
 					continue; \
+				ProfileManager::Stopwatch _stopwatch(_mod->hookstats[I_ ## EVENT], # EVENT, _profile); \
 				RESULT = _mod->EVENT ARGS; \
 				if (RESULT != MOD_RES_PASSTHRU) \
 					break; \
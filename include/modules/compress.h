@@ -0,0 +1,161 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "iohook.h"
+
+namespace Compress
+{
+	class Deflater;
+	class Inflater;
+	class MessageProvider;
+}
+
+/** Base class for I/O hooks which compress the data sent over a socket. Data is passed through
+ * unmodified until compression is started in each direction which allows the protocol running
+ * over the socket to negotiate whether it is used.
+ */
+class CompressIOHook
+	: public IOHookMiddle
+{
+public:
+	/** Retrieves the compression hook of a socket.
+	 * @param sock The socket to retrieve the compression hook of.
+	 * @return Either the compression hook of the socket or nullptr if it does not have one.
+	 */
+	static CompressIOHook* Find(StreamSocket* sock)
+	{
+		IOHook* hook = sock->GetIOHook();
+		while (hook)
+		{
+			if (hook->prov->type == IOHookProvider::IOH_COMPRESS)
+				return static_cast<CompressIOHook*>(hook);
+
+			IOHookMiddle* const iohm = IOHookMiddle::ToMiddleHook(hook);
+			hook = iohm ? iohm->GetNextHook() : nullptr;
+		}
+		return nullptr;
+	}
+
+	CompressIOHook(const std::shared_ptr<IOHookProvider>& hookprov)
+		: IOHookMiddle(hookprov)
+	{
+	}
+
+	/** Retrieves the name of the compression mechanism used by this hook. Both ends of a
+	 * connection must be using the same mechanism to be able to talk to each other.
+	 */
+	virtual const std::string& GetMechanism() const = 0;
+
+	/** Starts compressing the data written to the socket. Data which has already been written
+	 * to the socket is sent uncompressed.
+	 * @param sock The socket which this hook is attached to.
+	 */
+	virtual void StartCompressing(StreamSocket* sock) = 0;
+
+	/** Starts decompressing the data read from the socket.
+	 * @param sock The socket which this hook is attached to.
+	 * @param recvq Data which has already been read from the socket but was sent by the remote
+	 *              end after it started compressing. This will be decompressed in place.
+	 * @return True if decompression was started successfully; otherwise, false.
+	 */
+	virtual bool StartDecompressing(StreamSocket* sock, std::string& recvq) = 0;
+};
+
+/** Compresses data into a raw deflate stream. */
+class Compress::Deflater
+{
+public:
+	virtual ~Deflater() = default;
+
+	/** Compresses some data. The compressed data may be buffered until Flush() is called.
+	 * @param data The data to compress.
+	 * @param out The buffer to append the compressed data to.
+	 * @return True if the data was compressed successfully; otherwise, false.
+	 */
+	virtual bool Compress(const std::string_view& data, std::string& out) = 0;
+
+	/** Writes out all buffered data. The output ends with an empty stored block (00 00 FF FF)
+	 * so that the remote end can decompress everything which has been compressed so far.
+	 * @param out The buffer to append the compressed data to.
+	 * @return True if the data was flushed successfully; otherwise, false.
+	 */
+	virtual bool Flush(std::string& out) = 0;
+
+	/** Discards the history of the stream so the next data is compressed independently. */
+	virtual void Reset() = 0;
+};
+
+/** Decompresses data from a raw deflate stream. */
+class Compress::Inflater
+{
+public:
+	virtual ~Inflater() = default;
+
+	/** Decompresses some data.
+	 * @param data The data to decompress.
+	 * @param out The buffer to append the decompressed data to.
+	 * @param maxlen The maximum length that out is allowed to grow to.
+	 * @return True if the data was decompressed successfully; otherwise, false if the data is
+	 *         malformed or decompressing it would make out longer than maxlen.
+	 */
+	virtual bool Decompress(const std::string_view& data, std::string& out, size_t maxlen) = 0;
+
+	/** Discards the history of the stream so the next data is decompressed independently. */
+	virtual void Reset() = 0;
+};
+
+/** Provider of compressors for protocols which compress individual messages rather than the
+ * whole stream, e.g. the WebSocket permessage-deflate extension.
+ */
+class Compress::MessageProvider
+	: public DataProvider
+{
+public:
+	/** The smallest window size (as a base two logarithm) which can be used. */
+	static constexpr unsigned int MIN_WINDOW_BITS = 9;
+
+	/** The largest window size (as a base two logarithm) which can be used. */
+	static constexpr unsigned int MAX_WINDOW_BITS = 15;
+
+	MessageProvider(Module* mod, const std::string& algorithm)
+		: DataProvider(mod, "compress/" + algorithm)
+	{
+	}
+
+	/** Creates a new compressor.
+	 * @param windowbits The base two logarithm of the window size to compress with.
+	 */
+	virtual std::unique_ptr<Deflater> CreateDeflater(unsigned int windowbits) = 0;
+
+	/** Creates a new decompressor.
+	 * @param windowbits The base two logarithm of the largest window size the data may have been
+	 *                   compressed with.
+	 */
+	virtual std::unique_ptr<Inflater> CreateInflater(unsigned int windowbits) = 0;
+
+	/** Retrieves the approximate amount of memory used by a compressor.
+	 * @param windowbits The base two logarithm of the window size the compressor uses.
+	 */
+	virtual size_t GetDeflaterMemory(unsigned int windowbits) const = 0;
+
+	/** Retrieves the approximate amount of memory used by a decompressor.
+	 * @param windowbits The base two logarithm of the window size the decompressor uses.
+	 */
+	virtual size_t GetInflaterMemory(unsigned int windowbits) const = 0;
+};
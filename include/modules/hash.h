@@ -24,7 +24,57 @@
 
 #pragma once
 
+#include <functional>
+
 #include "stringutils.h"
+#include "threadsocket.h"
+
+/** A callback which is called with the result of an asynchronous hash comparison. */
+typedef std::function<void(bool)> HashCompareCallback;
+
+/** A pool of worker threads which expensive hash comparisons can be offloaded to so that
+ * they do not block the main thread. Results are always delivered on the main thread.
+ */
+class HashWorkerPool final
+{
+private:
+	/** The underlying pool of worker threads. */
+	WorkerPool pool;
+
+public:
+	/** Sets the number of worker threads in this pool. If there are no workers then jobs
+	 * are run synchronously on the main thread.
+	 * @param count The number of worker threads.
+	 */
+	void SetWorkers(size_t count)
+	{
+		pool.SetWorkers(count);
+	}
+
+	/** Waits for all jobs to finish, running any which have not been started yet on the
+	 * main thread. This should be called before anything that the jobs use is destroyed.
+	 */
+	void Flush()
+	{
+		pool.Flush();
+	}
+
+	/** Runs a comparison on a worker thread.
+	 * @param work The comparison to run. This is called on a worker thread so must not touch
+	 *             any state that is not thread safe.
+	 * @param callback The callback to call on the main thread with the result. Comparisons
+	 *                 which had not been started when the pool was destroyed are failed.
+	 */
+	void Submit(const std::function<bool()>& work, const HashCompareCallback& callback)
+	{
+		auto result = std::make_shared<bool>(false);
+		pool.Submit([work, result]() {
+			*result = work();
+		}, [callback, result](bool ran) {
+			callback(ran && *result);
+		});
+	}
+};
 
 class HashProvider
 	: public DataProvider
@@ -51,6 +101,18 @@ public:
 		return InspIRCd::TimingSafeCompare(Generate(input), hash);
 	}
 
+	/** Compares the specified input against a hash without blocking the main thread if
+	 * this provider is expensive enough for that to be worthwhile.
+	 * @param input The input to hash and compare.
+	 * @param hash The hash to compare against.
+	 * @param callback The callback to call with the result. This is always called on the
+	 *                 main thread but may be called before this method returns.
+	 */
+	virtual void CompareAsync(const std::string& input, const std::string& hash, const HashCompareCallback& callback)
+	{
+		callback(Compare(input, hash));
+	}
+
 	std::string Generate(const std::string& data)
 	{
 		return ToPrintable(GenerateRaw(data));
@@ -78,3 +140,26 @@ public:
 		return (!block_size);
 	}
 };
+
+/** Allows checking passwords from the server config without blocking the main thread. */
+class AsyncPasswordChecker
+	: public DataProvider
+{
+public:
+	AsyncPasswordChecker(Module* mod)
+		: DataProvider(mod, "password/async")
+	{
+	}
+
+	/** Checks a password from the server config against a user-specified value.
+	 * @param password The hashed password from the server config.
+	 * @param passwordhash The algorithm the password was hashed with.
+	 * @param value The value specified by the user.
+	 * @param callback The callback to call with the result. This is always called on the
+	 *                 main thread but may be called before this method returns.
+	 * @return True if the check was started and \p callback will be called with the result or
+	 *         false if the password can not be checked asynchronously and the caller should
+	 *         use InspIRCd::CheckPassword instead.
+	 */
+	virtual bool CheckPassword(const std::string& password, const std::string& passwordhash, const std::string& value, const HashCompareCallback& callback) = 0;
+};
@@ -235,6 +235,22 @@ public:
 	}
 };
 
+/** Produces the body of a HTTP response incrementally. This allows large documents to be sent
+ * without building all of them in memory first. The httpd module only asks for more of the
+ * document once the client has received most of what has already been produced.
+ */
+class HTTPDocumentStream
+{
+public:
+	virtual ~HTTPDocumentStream() = default;
+
+	/** Produces the next part of the document.
+	 * @param buffer The buffer to append the next part of the document to.
+	 * @return True if there is more of the document to produce; otherwise, false.
+	 */
+	virtual bool Produce(std::string& buffer) = 0;
+};
+
 /** If you want to reply to HTTP requests, you must return a HTTPDocumentResponse to
  * the httpd module via the HTTPdAPI.
  * When you initialize this class you initialize it with all components required to
@@ -249,6 +265,10 @@ public:
 	Module* const module;
 
 	std::stringstream* document;
+
+	/** If non-null then the document is produced incrementally by this stream instead. */
+	std::unique_ptr<HTTPDocumentStream> stream;
+
 	unsigned int responsecode;
 
 	/** Any extra headers to include with the defaults
@@ -271,6 +291,21 @@ public:
 		, src(req)
 	{
 	}
+
+	/** Initialize a HTTPDocumentResponse with a document which is produced incrementally.
+	 * @param mod A pointer to the module who responded to the request
+	 * @param req The request you obtained from the HTTPRequest at an earlier time
+	 * @param strm The stream which produces the document body. The httpd module takes ownership of it.
+	 * @param response A valid HTTP/1.0 or HTTP/1.1 response code.
+	 */
+	HTTPDocumentResponse(Module* mod, HTTPRequest& req, std::unique_ptr<HTTPDocumentStream>&& strm, unsigned int response)
+		: module(mod)
+		, document(nullptr)
+		, stream(std::move(strm))
+		, responsecode(response)
+		, src(req)
+	{
+	}
 };
 
 class HTTPdAPIBase
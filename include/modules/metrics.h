@@ -0,0 +1,189 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "event.h"
+
+namespace Metrics
+{
+	class EventListener;
+	class EventProvider;
+	class Writer;
+
+	/** The types of metric which can be written. */
+	enum class Type
+		: uint8_t
+	{
+		/** A value which only ever increases, e.g. the number of commands executed. */
+		COUNTER,
+
+		/** A value which can go up and down, e.g. the number of users online. */
+		GAUGE,
+	};
+}
+
+/** Writes metrics in the OpenMetrics text format. Metrics are written as families of
+ * samples which share a name, type, and description but have different label values.
+ * Producing a metric should not involve anything more expensive than reading a value
+ * that is already being kept up to date.
+ */
+class Metrics::Writer final
+{
+private:
+	/** The buffer to write the metrics to. */
+	std::string& buffer;
+
+	/** The name of the current metric family. */
+	std::string family;
+
+	/** The type of the current metric family. */
+	Type type = Type::GAUGE;
+
+	/** Appends a string with backslashes, double quotes, and newlines escaped.
+	 * @param str The string to append.
+	 */
+	void AppendEscaped(const std::string_view& str)
+	{
+		for (const auto chr : str)
+		{
+			switch (chr)
+			{
+				case '\\':
+					buffer.append("\\\\");
+					break;
+				case '"':
+					buffer.append("\\\"");
+					break;
+				case '\n':
+					buffer.append("\\n");
+					break;
+				default:
+					buffer.push_back(chr);
+					break;
+			}
+		}
+	}
+
+	/** Appends the name of a sample in the current metric family. */
+	void AppendName()
+	{
+		buffer.append(family);
+		if (type == Type::COUNTER)
+			buffer.append("_total");
+	}
+
+	/** Appends the value of a sample and ends the line.
+	 * @param value The value to append.
+	 */
+	template<typename Numeric>
+	void AppendValue(Numeric value)
+	{
+		buffer.push_back(' ');
+		buffer.append(INSP_FORMAT("{}", value));
+		buffer.push_back('\n');
+	}
+
+public:
+	/** Creates a new metric writer.
+	 * @param buf The buffer to write the metrics to.
+	 */
+	Writer(std::string& buf)
+		: buffer(buf)
+	{
+	}
+
+	/** Starts a new metric family. All of the samples written until the next call to this
+	 * method belong to this family.
+	 * @param newtype The type of the metric family.
+	 * @param name The name of the metric family. This should be prefixed with "inspircd_" and
+	 *             should not end in "_total".
+	 * @param help A human readable description of the metric family.
+	 */
+	Writer& Family(Type newtype, const std::string& name, const std::string_view& help)
+	{
+		family = name;
+		type = newtype;
+
+		buffer.append("# TYPE ").append(family).append(type == Type::COUNTER ? " counter\n" : " gauge\n");
+		buffer.append("# HELP ").append(family).push_back(' ');
+		AppendEscaped(help);
+		buffer.push_back('\n');
+		return *this;
+	}
+
+	/** Writes a sample without any labels to the current metric family.
+	 * @param value The value of the sample.
+	 */
+	template<typename Numeric>
+	std::enable_if_t<std::is_arithmetic_v<Numeric>, Writer&> Sample(Numeric value)
+	{
+		AppendName();
+		AppendValue(value);
+		return *this;
+	}
+
+	/** Writes a sample with a label to the current metric family.
+	 * @param label The name of the label.
+	 * @param labelvalue The value of the label.
+	 * @param value The value of the sample.
+	 */
+	template<typename Numeric>
+	std::enable_if_t<std::is_arithmetic_v<Numeric>, Writer&> Sample(const char* label, const std::string_view& labelvalue, Numeric value)
+	{
+		AppendName();
+		buffer.append("{").append(label).append("=\"");
+		AppendEscaped(labelvalue);
+		buffer.append("\"}");
+		AppendValue(value);
+		return *this;
+	}
+
+	/** Writes the marker which ends the metrics. */
+	void End()
+	{
+		buffer.append("# EOF\n");
+	}
+};
+
+/** Provider of events for modules to contribute metrics. */
+class Metrics::EventProvider final
+	: public Events::ModuleEventProvider
+{
+public:
+	EventProvider(Module* mod)
+		: Events::ModuleEventProvider(mod, "event/metrics")
+	{
+	}
+};
+
+/** Interface for modules which contribute metrics. */
+class Metrics::EventListener
+	: public Events::ModuleEventListener
+{
+protected:
+	EventListener(Module* mod, unsigned int eventprio = DefaultPriority)
+		: ModuleEventListener(mod, "event/metrics", eventprio)
+	{
+	}
+
+public:
+	/** Called when the metrics are being collected.
+	 * @param writer The writer to write the metrics of this module to.
+	 */
+	virtual void OnCollectMetrics(Writer& writer) = 0;
+};
@@ -30,6 +30,7 @@ namespace Regex
 	class Exception;
 	class MatchCollection;
 	class Pattern;
+	class PatternSet;
 	template<typename> class SimpleEngine;
 
 	/** A list of matches that were captured by index. */
@@ -41,6 +42,9 @@ namespace Regex
 	/** A shared pointer to a regex pattern. */
 	typedef std::shared_ptr<Pattern> PatternPtr;
 
+	/** A shared pointer to a set of regex patterns. */
+	typedef std::shared_ptr<PatternSet> PatternSetPtr;
+
 	/** The options to use when matching a pattern. */
 	enum PatternOptions
 		: uint8_t
@@ -81,6 +85,16 @@ public:
 	 */
 	PatternPtr CreateHuman(const std::string& pattern) const;
 
+	/** Compiles multiple patterns into a set which can be matched against text in a single pass.
+	 * @param patterns The patterns to compile. These must have been created by this engine.
+	 * @return A shared pointer to an instance of the Regex::PatternSet class or nullptr if this
+	 *         engine does not support matching multiple patterns at once.
+	 */
+	virtual PatternSetPtr CreateSet(const std::vector<PatternPtr>& patterns) const
+	{
+		return nullptr;
+	}
+
 	/** Retrieves the name of this regex engine. */
 	const char* GetName() const
 	{
@@ -248,6 +262,22 @@ public:
 	virtual std::optional<MatchCollection> Matches(const std::string& text) = 0;
 };
 
+class Regex::PatternSet
+{
+public:
+	/** Destroys an instance of the PatternSet class. */
+	virtual ~PatternSet() = default;
+
+	/** Attempts to match every pattern in this set against the specified text.
+	 * @param text The text to match against.
+	 * @param matches The vector to store the indices of the matching patterns in. The indices refer to
+	 *                the position of the pattern in the vector the set was created from and are stored
+	 *                in ascending order.
+	 * @return If the text matched at least one pattern then true; otherwise, false.
+	 */
+	virtual bool Matches(const std::string& text, std::vector<size_t>& matches) = 0;
+};
+
 inline Regex::PatternPtr Regex::Engine::CreateHuman(const std::string& pattern) const
 {
 	if (pattern.empty() || pattern[0] != '/')
@@ -30,6 +30,9 @@
 
 #include "iohook.h"
 
+#include <chrono>
+#include <list>
+
 /** ssl_cert is a class which abstracts TLS certificate
  * and key information.
  *
@@ -167,6 +170,175 @@ public:
 		: IOHookProvider(mod, "ssl/" + Name, IOH_SSL)
 	{
 	}
+
+	using IOHookProvider::OnConnect;
+
+	/** Called when an outgoing connection which may resume an earlier TLS session is made.
+	 * @param sock The socket in question.
+	 * @param sessionkey Identifies the remote endpoint. Sessions are only resumed with the
+	 * endpoint they were established with.
+	 */
+	virtual void OnConnect(StreamSocket* sock, const std::string& sessionkey)
+	{
+		OnConnect(sock);
+	}
+};
+
+/** A bounded cache of serialised TLS sessions which TLS modules use for session resumption. */
+class SSLSessionCache final
+{
+private:
+	struct Entry final
+	{
+		/** The identifier of the session. */
+		std::string id;
+
+		/** The serialised session data. */
+		std::string data;
+
+		/** The time at which this session expires. */
+		time_t expires;
+	};
+
+	/** Sessions in the order they were added, oldest first. */
+	std::list<Entry> entries;
+
+	/** Sessions indexed by their identifier. */
+	std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+	/** The maximum number of sessions to cache. */
+	size_t maxsize = 0;
+
+	/** The number of seconds a session is kept for. */
+	unsigned long timeout = 0;
+
+	/** Retrieves the current time. The cache is used by handshake worker threads so this can
+	 * not use ServerInstance->Time() which is only safe to read on the main thread.
+	 */
+	static time_t Now() { return time(nullptr); }
+
+	/** Removes sessions which have expired or which exceed the size of the cache. */
+	void Prune()
+	{
+		while (!entries.empty() && (entries.size() > maxsize || entries.front().expires <= Now()))
+		{
+			index.erase(entries.front().id);
+			entries.pop_front();
+		}
+	}
+
+public:
+	/** Adds a session to the cache, replacing any existing session with the same identifier. */
+	void Add(const std::string& id, const std::string& data)
+	{
+		if (!maxsize || id.empty())
+			return;
+
+		Remove(id);
+		entries.push_back({ id, data, Now() + static_cast<time_t>(timeout) });
+		index[id] = std::prev(entries.end());
+		Prune();
+	}
+
+	/** Retrieves an unexpired session from the cache.
+	 * @return The serialised session data or nullptr if the session is not cached.
+	 */
+	const std::string* Find(const std::string& id) const
+	{
+		auto it = index.find(id);
+		if (it == index.end() || it->second->expires <= Now())
+			return nullptr;
+		return &it->second->data;
+	}
+
+	/** Removes a session from the cache. */
+	void Remove(const std::string& id)
+	{
+		auto it = index.find(id);
+		if (it == index.end())
+			return;
+
+		entries.erase(it->second);
+		index.erase(it);
+	}
+
+	/** Changes the size and session lifetime of the cache. */
+	void SetLimits(size_t size, unsigned long lifetime)
+	{
+		maxsize = size;
+		timeout = lifetime;
+		Prune();
+	}
+
+	/** Retrieves the number of sessions in the cache. */
+	size_t Size() const { return entries.size(); }
+
+	/** Retrieves the number of seconds a session is kept for. */
+	unsigned long GetTimeout() const { return timeout; }
+};
+
+/** Counters for the handshakes which have been performed with a TLS profile. */
+struct SSLHandshakeStats final
+{
+	/** The number of full handshakes. */
+	unsigned long full = 0;
+
+	/** The number of handshakes which resumed an earlier session. */
+	unsigned long resumed = 0;
+
+	/** The time spent processing full handshakes in microseconds. */
+	unsigned long long fulltime = 0;
+
+	/** The time spent processing resumed handshakes in microseconds. */
+	unsigned long long resumedtime = 0;
+
+	/** The number of handshakes which were run on a worker thread. */
+	unsigned long offloaded = 0;
+
+	/** The number of clients which have registered after their handshake. */
+	unsigned long registered = 0;
+
+	/** The total time between accepting and registering clients in microseconds. */
+	unsigned long long registertime = 0;
+
+	/** The longest time between accepting and registering a client in microseconds. */
+	unsigned long long registermax = 0;
+
+	/** Records a completed handshake.
+	 * @param wasresumed Whether the handshake resumed an earlier session.
+	 * @param time The time spent processing the handshake in microseconds.
+	 */
+	void Add(bool wasresumed, unsigned long long time)
+	{
+		if (wasresumed)
+		{
+			resumed++;
+			resumedtime += time;
+		}
+		else
+		{
+			full++;
+			fulltime += time;
+		}
+	}
+
+	/** Records a client which has finished registering.
+	 * @param time The time between accepting and registering the client in microseconds.
+	 */
+	void AddRegistration(unsigned long long time)
+	{
+		registered++;
+		registertime += time;
+		registermax = std::max(registermax, time);
+	}
+
+	/** Formats these counters for display in /STATS. */
+	std::string ToString() const
+	{
+		return INSP_FORMAT("{} full handshakes ({} us avg), {} resumed handshakes ({} us avg), {} ms handshake CPU time, {} offloaded, {} registered ({} ms avg, {} ms max after accept)",
+			full, full ? fulltime / full : 0, resumed, resumed ? resumedtime / resumed : 0, (fulltime + resumedtime) / 1000,
+			offloaded, registered, registered ? registertime / registered / 1000 : 0, registermax / 1000);
+	}
 };
 
 class SSLIOHook
@@ -193,6 +365,12 @@ protected:
 	/** The status of the TLS connection. */
 	Status status = STATUS_NONE;
 
+	/** Whether the handshake resumed an earlier TLS session. */
+	bool resumed = false;
+
+	/** The time at which this hook was created. */
+	const std::chrono::steady_clock::time_point created = std::chrono::steady_clock::now();
+
 	/** Reduce elements in a send queue by appending later elements to the first element until there are no more
 	 * elements to append or a desired length is reached
 	 * @param sendq SendQ to work on
@@ -215,7 +393,7 @@ protected:
 			sendq.pop_front();
 		}
 		while (!sendq.empty() && tmp.length() < targetsize);
-		sendq.push_front(tmp);
+		sendq.push_front(std::move(tmp));
 	}
 
 public:
@@ -267,6 +445,20 @@ public:
 	 */
 	virtual bool GetServerName(std::string& out) const = 0;
 
+	/** Determines whether the handshake resumed an earlier TLS session.
+	 * @return True if the session was resumed; otherwise, false.
+	 */
+	bool IsResumed() const { return resumed; }
+
+	/** Retrieves the time since this hook was created. For incoming connections this is the
+	 * time since the connection was accepted.
+	 * @return The age of this hook in microseconds.
+	 */
+	unsigned long long GetAge() const
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - created).count();
+	}
+
 	/** @copydoc IOHook::IsHookReady */
 	bool IsHookReady() const override { return status == STATUS_OPEN; }
 };
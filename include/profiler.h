@@ -0,0 +1,190 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+/** Measures where the main loop spends its time. Profiling is cheap enough to leave enabled and can be
+ * switched on and off at runtime using the <performance:profile> and <performance:profilehooks> options.
+ */
+class CoreExport ProfileManager final
+{
+public:
+	/** The clock used to take measurements. */
+	typedef std::chrono::steady_clock Clock;
+
+	/** The phases of an iteration of the main loop. */
+	enum Phase
+		: uint8_t
+	{
+		/** Checking for a finished rehash and running the once a second housekeeping. */
+		PHASE_TIMERS,
+
+		/** Dispatching socket events excluding the time spent waiting for them. */
+		PHASE_EVENTS,
+
+		/** Waiting for socket events. */
+		PHASE_IDLE,
+
+		/** Deleting objects which have been culled. */
+		PHASE_CULLS,
+
+		/** Running actions which were deferred until the end of the iteration. */
+		PHASE_ACTIONS,
+
+		/** The number of phases. */
+		PHASE_END,
+	};
+
+	/** The number of buckets in the iteration latency histogram. Bucket N holds iterations which spent
+	 * less than 2^N microseconds doing work and the last bucket holds everything else.
+	 */
+	static constexpr size_t LATENCY_BUCKETS = 24;
+
+	/** Holds the timing statistics for something that is measured repeatedly. */
+	struct Counter
+	{
+		/** The number of times a measurement has been taken. */
+		uint64_t calls = 0;
+
+		/** The total time measured in nanoseconds. */
+		uint64_t total = 0;
+
+		/** The longest time measured in nanoseconds. */
+		uint64_t max = 0;
+
+		/** Records a measurement.
+		 * @param elapsed The time measured in nanoseconds.
+		 */
+		void Add(uint64_t elapsed)
+		{
+			calls++;
+			total += elapsed;
+			if (elapsed > max)
+				max = elapsed;
+		}
+	};
+
+	/** Holds the timing statistics for calls to a module event handler. */
+	struct HookCounter final
+		: Counter
+	{
+		/** The name of the event or nullptr if it has never been measured. */
+		const char* name = nullptr;
+	};
+
+	/** Measures the time between its construction and destruction. */
+	class Stopwatch final
+	{
+	private:
+		/** The counter to record the measurement in or nullptr if profiling is disabled. */
+		Counter* counter;
+
+		/** The time at which the measurement was started. */
+		Clock::time_point start;
+
+	public:
+		Stopwatch(Counter& c, bool enabled)
+			: counter(enabled ? &c : nullptr)
+		{
+			if (counter)
+				start = Clock::now();
+		}
+
+		Stopwatch(HookCounter& c, const char* name, bool enabled)
+			: Stopwatch(c, enabled)
+		{
+			if (counter)
+				c.name = name;
+		}
+
+		~Stopwatch()
+		{
+			if (counter)
+				counter->Add(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+		}
+	};
+
+private:
+	/** Whether the main loop and commands are being profiled. */
+	bool enabled = false;
+
+	/** Whether module event handlers are being profiled. */
+	bool hooks = false;
+
+	/** Whether the measurement of the main loop needs to be restarted at the next iteration. */
+	bool restart = false;
+
+	/** The phase the main loop is currently in. */
+	Phase phase = PHASE_TIMERS;
+
+	/** The time at which the current phase started. */
+	Clock::time_point phasestart;
+
+	/** The time in nanoseconds that the current iteration has spent outside of PHASE_IDLE so far. */
+	uint64_t busy = 0;
+
+	/** The timing statistics for each phase. */
+	std::array<Counter, PHASE_END> phases;
+
+	/** The timing statistics for the time each iteration spent doing work. */
+	Counter iterations;
+
+	/** The number of iterations in each latency bucket. */
+	std::array<uint64_t, LATENCY_BUCKETS> latency = { };
+
+	/** Records the time spent in the current phase and starts a new one. */
+	void SwitchPhase(Phase newphase);
+
+public:
+	/** Determines whether the main loop and commands are being profiled. */
+	bool IsEnabled() const { return enabled; }
+
+	/** Determines whether module event handlers are being profiled. */
+	bool IsProfilingHooks() const { return hooks; }
+
+	/** Enables or disables profiling.
+	 * @param profile Whether to profile the main loop and commands.
+	 * @param profilehooks Whether to profile module event handlers.
+	 */
+	void SetEnabled(bool profile, bool profilehooks);
+
+	/** Ends the current iteration of the main loop and starts the next one. */
+	void BeginIteration();
+
+	/** Moves the main loop into a new phase.
+	 * @param newphase The phase the main loop is moving into.
+	 */
+	void EnterPhase(Phase newphase)
+	{
+		if (enabled && !restart)
+			SwitchPhase(newphase);
+	}
+
+	/** Retrieves the timing statistics for the time each iteration spent doing work. */
+	const Counter& GetIterations() const { return iterations; }
+
+	/** Retrieves the number of iterations in each latency bucket. */
+	const std::array<uint64_t, LATENCY_BUCKETS>& GetLatency() const { return latency; }
+
+	/** Retrieves the timing statistics for each phase. */
+	const std::array<Counter, PHASE_END>& GetPhases() const { return phases; }
+
+	/** Retrieves the name of a phase.
+	 * @param p The phase to retrieve the name of.
+	 */
+	static const char* GetPhaseName(Phase p);
+};
@@ -120,9 +120,88 @@ public:
 	class SendQueue final
 	{
 	public:
-		/** One element of the queue, a continuous buffer
+		/** One element of the queue, a continuous buffer. The underlying bytes are
+		 * immutable which allows a single buffer to be shared between many queues.
 		 */
-		typedef std::string Element;
+		class Element final
+		{
+		private:
+			/** The buffer which contains the data. */
+			std::shared_ptr<const std::string> buffer;
+
+			/** The position in the buffer at which the unsent data starts. */
+			std::string::size_type offset = 0;
+
+			/** The number of bytes at the end of the buffer which are not part of this element. */
+			std::string::size_type trimmed = 0;
+
+		public:
+			typedef std::string::size_type size_type;
+
+			/** Creates a new element which contains a copy of the specified data.
+			 * @param newdata The data to copy into the element.
+			 */
+			Element(const std::string& newdata)
+				: buffer(std::make_shared<const std::string>(newdata))
+			{
+			}
+
+			/** Creates a new element which takes ownership of the specified data.
+			 * @param newdata The data to move into the element.
+			 */
+			Element(std::string&& newdata)
+				: buffer(std::make_shared<const std::string>(std::move(newdata)))
+			{
+			}
+
+			/** Creates a new element which contains a copy of the specified data.
+			 * @param newdata The data to copy into the element.
+			 * @param len The length of the data.
+			 */
+			Element(const char* newdata, size_type len)
+				: buffer(std::make_shared<const std::string>(newdata, len))
+			{
+			}
+
+			/** Creates a new element which shares an existing buffer.
+			 * @param newdata The buffer to share.
+			 */
+			Element(const std::shared_ptr<const std::string>& newdata)
+				: buffer(newdata)
+			{
+			}
+
+			/** Retrieves a pointer to the start of the unsent data. */
+			const char* data() const { return buffer->data() + offset; }
+
+			/** Retrieves the length of the unsent data. */
+			size_type length() const { return buffer->length() - offset - trimmed; }
+
+			/** Retrieves the length of the unsent data. */
+			size_type size() const { return length(); }
+
+			/** Determines whether there is no unsent data. */
+			bool empty() const { return !length(); }
+
+			/** Retrieves an iterator to the start of the unsent data. */
+			const char* begin() const { return data(); }
+
+			/** Retrieves an iterator to the end of the unsent data. */
+			const char* end() const { return data() + length(); }
+
+			/** Retrieves a view of the unsent data. */
+			operator std::string_view() const { return std::string_view(data(), length()); }
+
+			/** Marks bytes at the start of the buffer as sent.
+			 * @param n The number of bytes to mark as sent.
+			 */
+			void erase_front(size_type n) { offset += n; }
+
+			/** Removes bytes from the end of the element without modifying the shared buffer.
+			 * @param n The number of bytes to remove.
+			 */
+			void erase_back(size_type n) { trimmed += n; }
+		};
 
 		/** Sequence container of buffers in the queue
 		 */
@@ -178,7 +257,7 @@ public:
 		void erase_front(Element::size_type n)
 		{
 			nbytes -= n;
-			data.front().erase(0, n);
+			data.front().erase_front(n);
 		}
 
 		/** Insert a new buffer at the beginning of the queue
@@ -215,7 +294,7 @@ public:
 		}
 
 	private:
-		/** Private send queue. Note that individual strings may be shared.
+		/** Private send queue. Note that individual buffers may be shared.
 		 */
 		Container data;
 
@@ -248,6 +327,12 @@ private:
 	/** Error - if nonempty, the socket is dead, and this is the reason. */
 	std::string error;
 
+	/** The size of the send queue when it was last added to the server statistics. */
+	size_t statsendq = 0;
+
+	/** The size of the receive queue when it was last added to the server statistics. */
+	size_t statrecvq = 0;
+
 	/** Check if the socket has an error set, if yes, call OnError
 	 * @param err Error to pass to OnError()
 	 */
@@ -279,6 +364,12 @@ private:
 	 */
 	ssize_t HookChainRead(IOHook* hook, std::string& rq);
 
+	/** Appends a buffer to the send queue and requests a write event.
+	 * @param data The buffer to append.
+	 * @return True if the buffer was queued or false if the socket is dead.
+	 */
+	bool QueueData(const SendQueue::Element& data);
+
 protected:
 	/** The data which has been received from the socket. */
 	std::string recvq;
@@ -335,12 +426,24 @@ public:
 	 */
 	void WriteData(const std::string& data);
 
+	/** Send the given buffer out the socket, either now or when writes unblock.
+	 * Unlike the overload which takes a string the buffer is not copied and may
+	 * be shared with the send queues of other sockets.
+	 */
+	void WriteData(const SendQueue::Element& data);
+
 	/** Retrieves the current size of the send queue. */
 	size_t GetSendQSize() const;
 
 	/** Retrieves the send queue. */
 	SendQueue& GetSendQ() { return sendq; }
 
+	/** Updates the queue sizes in the server statistics. This is called automatically after the
+	 * socket reads or writes data but must be called manually if the receive queue is processed
+	 * at any other time.
+	 */
+	void UpdateQueueStats();
+
 	/**
 	 * Close the socket, remove from socket engine, etc
 	 */
@@ -142,6 +142,27 @@ namespace Percent
 	}
 }
 
+namespace UTF8
+{
+	/** Finds the longest prefix of a byte array which is valid UTF-8. Runs of ASCII are
+	 * checked a word at a time so validating mostly ASCII text is cheap.
+	 * @param data The byte array to validate.
+	 * @param length The length of the byte array.
+	 * @return The length of the valid prefix. This is equal to length if the entire byte
+	 *         array is valid UTF-8.
+	 */
+	CoreExport size_t Validate(const void* data, size_t length);
+
+	/** Determines whether a string is valid UTF-8.
+	 * @param data The string to validate.
+	 * @return True if the string is valid UTF-8; otherwise, false.
+	 */
+	inline bool IsValid(const std::string_view& data)
+	{
+		return Validate(data.data(), data.length()) == data.length();
+	}
+}
+
 namespace Template
 {
 	/** A mapping of variable names to their values. */
@@ -21,6 +21,8 @@
 #pragma once
 
 #include <condition_variable>
+#include <deque>
+#include <functional>
 #include <mutex>
 
 class ThreadSignalSocket;
@@ -82,3 +84,186 @@ public:
 	 */
 	virtual void OnNotify() = 0;
 };
+
+/** A pool of worker threads which expensive work can be offloaded to so that it does not
+ * block the main thread. Callbacks are always called on the main thread.
+ */
+class WorkerPool final
+{
+public:
+	/** A callback which is called on the main thread once a job has finished. The parameter
+	 * is true if the work was run or false if the pool was destroyed before it could be.
+	 */
+	typedef std::function<void(bool)> Callback;
+
+private:
+	/** A job which is waiting to be run or which is waiting for its callback to be called. */
+	struct Job final
+	{
+		/** The work to run on the worker thread. */
+		std::function<void()> work;
+
+		/** The callback to call on the main thread once the work has been run. */
+		Callback callback;
+	};
+
+	class Worker final
+		: public SocketThread
+	{
+	public:
+		/** Jobs which are waiting to be run. MUST HOLD MUTEX. */
+		std::deque<Job> queue;
+
+		/** Jobs which have been run and are waiting for their callback to be called. MUST HOLD MUTEX. */
+		std::deque<Job> results;
+
+		/** Whether this worker should exit. MUST HOLD MUTEX. */
+		bool shutdown = false;
+
+		void OnStart() override
+		{
+			this->LockQueue();
+			while (!this->shutdown)
+			{
+				if (this->queue.empty())
+				{
+					this->WaitForQueue();
+					continue;
+				}
+
+				Job job = std::move(this->queue.front());
+				this->queue.pop_front();
+				this->UnlockQueue();
+
+				job.work();
+
+				this->LockQueue();
+				this->results.push_back(std::move(job));
+				this->NotifyParent();
+			}
+			this->UnlockQueue();
+		}
+
+		void OnNotify() override
+		{
+			this->LockQueue();
+			std::deque<Job> done;
+			done.swap(this->results);
+			this->UnlockQueue();
+
+			for (const auto& job : done)
+				job.callback(true);
+		}
+
+		/** Stops this worker once it has finished any job it is currently running.
+		 * @return The jobs which had not been started yet.
+		 */
+		std::deque<Job> Shutdown()
+		{
+			this->LockQueue();
+			this->shutdown = true;
+			std::deque<Job> pending;
+			pending.swap(this->queue);
+			this->UnlockQueueWakeup();
+
+			this->Stop();
+			this->OnNotify();
+			return pending;
+		}
+	};
+
+	/** The worker threads in this pool. */
+	std::vector<std::unique_ptr<Worker>> workers;
+
+	/** The index of the worker which the next job will be sent to. */
+	size_t nextworker = 0;
+
+	/** Stops all workers in the pool.
+	 * @return The jobs which had not been started yet.
+	 */
+	std::deque<Job> StopWorkers()
+	{
+		std::deque<Job> pending;
+		for (const auto& worker : this->workers)
+		{
+			for (auto& job : worker->Shutdown())
+				pending.push_back(std::move(job));
+		}
+		this->workers.clear();
+		return pending;
+	}
+
+	void StartWorkers(size_t count)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			this->workers.push_back(std::make_unique<Worker>());
+			this->workers.back()->Start();
+		}
+	}
+
+	void Submit(Job&& job)
+	{
+		if (this->workers.empty())
+		{
+			// There are no workers so we have to run the job synchronously.
+			job.work();
+			job.callback(true);
+			return;
+		}
+
+		Worker& worker = *this->workers[this->nextworker++ % this->workers.size()];
+		worker.LockQueue();
+		worker.queue.push_back(std::move(job));
+		worker.UnlockQueueWakeup();
+	}
+
+public:
+	~WorkerPool()
+	{
+		// Any jobs which have not been started yet are never run.
+		for (const auto& job : StopWorkers())
+			job.callback(false);
+	}
+
+	/** Retrieves the number of worker threads in this pool. */
+	size_t GetWorkers() const { return this->workers.size(); }
+
+	/** Sets the number of worker threads in this pool. If there are no workers then jobs
+	 * are run synchronously on the main thread.
+	 * @param count The number of worker threads.
+	 */
+	void SetWorkers(size_t count)
+	{
+		if (count == this->workers.size())
+			return;
+
+		std::deque<Job> pending = StopWorkers();
+		StartWorkers(count);
+		for (auto& job : pending)
+			Submit(std::move(job));
+	}
+
+	/** Waits for all jobs to finish, running any which have not been started yet on the
+	 * main thread. This should be called before anything that the jobs use is destroyed.
+	 */
+	void Flush()
+	{
+		const size_t count = this->workers.size();
+		SetWorkers(0);
+		SetWorkers(count);
+	}
+
+	/** Runs some work on a worker thread.
+	 * @param work The work to run. This is called on a worker thread so must not touch any
+	 *             state that is not thread safe.
+	 * @param callback The callback to call on the main thread once the work has been run.
+	 */
+	void Submit(const std::function<void()>& work, const Callback& callback)
+	{
+		Job job;
+		job.work = work;
+		job.callback = callback;
+		Submit(std::move(job));
+	}
+};
@@ -24,6 +24,7 @@
 
 #pragma once
 
+class BanMask;
 class Channel;
 class ConfigStatus;
 class ConfigTag;
@@ -54,7 +55,22 @@ namespace ClientProtocol
 
 	typedef std::vector<Message*> MessageList;
 	typedef std::vector<std::string> ParamList;
-	typedef std::string SerializedMessage;
+
+	/** A message which has been serialized into wire format. The tags are kept separate from
+	 * the rest of the message so that the latter can be shared by every recipient regardless
+	 * of which tags they receive. Both buffers are immutable and can be shared by send queues.
+	 */
+	struct SerializedMessage final
+	{
+		/** The serialized tags including their separator or nullptr if there are no tags. */
+		std::shared_ptr<const std::string> tags;
+
+		/** The serialized message without any tags. */
+		std::shared_ptr<const std::string> body;
+
+		/** Retrieves the total length of the serialized message. */
+		size_t length() const { return (tags ? tags->length() : 0) + body->length(); }
+	};
 
 	struct CoreExport MessageTagData final
 	{
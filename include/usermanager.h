@@ -30,6 +30,126 @@
 /** A mapping of user nicks or uuids to their User object. */
 typedef std::unordered_map<std::string, User*, irc::insensitive, irc::StrHashComp> UserMap;
 
+/** Maintains secondary indices of fully connected users which allow them to be
+ * looked up by hostname suffix, IP address, and server without scanning every
+ * user on the network.
+ */
+class CoreExport UserIndex final
+{
+public:
+	/** Compares two strings case insensitively starting from the end.
+	 * @return A negative number if \p lhs is ordered first, a positive number if \p rhs
+	 *         is ordered first, or zero if they are equal.
+	 */
+	static int CompareReversed(const std::string_view& lhs, const std::string_view& rhs);
+
+	/** Compares the addresses of two CIDR masks ignoring their lengths.
+	 * @return A negative number if \p lhs is ordered first, a positive number if \p rhs
+	 *         is ordered first, or zero if they are equal.
+	 */
+	static int CompareAddress(const irc::sockets::cidr_mask& lhs, const irc::sockets::cidr_mask& rhs);
+
+	/** Retrieves the address of a user as a CIDR mask that only matches that address. */
+	static irc::sockets::cidr_mask GetAddress(const User* user) { return irc::sockets::cidr_mask(user->client_sa, 128); }
+
+	/** Orders users by their hostname read from right to left so that users
+	 * with the same hostname suffix are next to each other.
+	 */
+	template <bool RealHost>
+	struct HostCompare final
+	{
+		using is_transparent = void;
+
+		static const std::string& GetHost(const User* user) { return RealHost ? user->GetRealHost() : user->GetDisplayedHost(); }
+
+		bool operator()(const User* lhs, const User* rhs) const
+		{
+			const int result = CompareReversed(GetHost(lhs), GetHost(rhs));
+			return result ? result < 0 : std::less<>()(lhs, rhs);
+		}
+
+		bool operator()(const User* lhs, const std::string_view& rhs) const { return CompareReversed(GetHost(lhs), rhs) < 0; }
+		bool operator()(const std::string_view& lhs, const User* rhs) const { return CompareReversed(lhs, GetHost(rhs)) < 0; }
+	};
+
+	/** Orders users by their IP address. */
+	struct AddressCompare final
+	{
+		using is_transparent = void;
+
+		bool operator()(const User* lhs, const User* rhs) const
+		{
+			const int result = CompareAddress(GetAddress(lhs), GetAddress(rhs));
+			return result ? result < 0 : std::less<>()(lhs, rhs);
+		}
+
+		bool operator()(const User* lhs, const irc::sockets::cidr_mask& rhs) const { return CompareAddress(GetAddress(lhs), rhs) < 0; }
+		bool operator()(const irc::sockets::cidr_mask& lhs, const User* rhs) const { return CompareAddress(lhs, GetAddress(rhs)) < 0; }
+	};
+
+	/** Orders users by the server they are on. */
+	struct ServerCompare final
+	{
+		using is_transparent = void;
+
+		bool operator()(const User* lhs, const User* rhs) const
+		{
+			return lhs->server == rhs->server ? std::less<>()(lhs, rhs) : std::less<>()(lhs->server, rhs->server);
+		}
+
+		bool operator()(const User* lhs, const Server* rhs) const { return std::less<>()(lhs->server, rhs); }
+		bool operator()(const Server* lhs, const User* rhs) const { return std::less<>()(lhs, rhs->server); }
+	};
+
+	/** A set of users ordered by their displayed hostname. */
+	typedef std::set<User*, HostCompare<false>> DisplayedHostSet;
+
+	/** A set of users ordered by their real hostname. */
+	typedef std::set<User*, HostCompare<true>> RealHostSet;
+
+	/** A set of users ordered by their IP address. */
+	typedef std::set<User*, AddressCompare> AddressSet;
+
+	/** A set of users ordered by their server. */
+	typedef std::set<User*, ServerCompare> ServerSet;
+
+private:
+	/** Users ordered by their displayed hostname. */
+	DisplayedHostSet displayedhosts;
+
+	/** Users ordered by their real hostname. */
+	RealHostSet realhosts;
+
+	/** Users ordered by their IP address. */
+	AddressSet addresses;
+
+	/** Users ordered by their server. */
+	ServerSet servers;
+
+public:
+	/** Adds a user to the index. This does nothing if the user is not fully connected or is quitting.
+	 * @param user The user to add.
+	 */
+	void Add(User* user);
+
+	/** Removes a user from the index. This must be called before any indexed field of the user changes.
+	 * @param user The user to remove.
+	 */
+	void Remove(User* user);
+
+	/** Retrieves the users ordered by their displayed hostname. */
+	const DisplayedHostSet& GetDisplayedHosts() const { return displayedhosts; }
+
+	/** Retrieves the users ordered by their real hostname. */
+	const RealHostSet& GetRealHosts() const { return realhosts; }
+
+	/** Retrieves the users ordered by their IP address. */
+	const AddressSet& GetAddresses() const { return addresses; }
+
+	/** Retrieves the users ordered by their server. */
+	const ServerSet& GetServers() const { return servers; }
+};
+
 class CoreExport UserManager final
 {
 public:
@@ -72,6 +192,9 @@ private:
 	 */
 	uint64_t already_sent_id = 0;
 
+	/** Secondary indices of the fully connected users. */
+	UserIndex index;
+
 public:
 	/** Constructor, initializes variables
 	 */
@@ -179,6 +302,10 @@ public:
 	 */
 	UserMap& GetUsers() { return clientlist; }
 
+	/** Retrieves the secondary indices of all fully connected users. */
+	UserIndex& GetIndex() { return index; }
+	const UserIndex& GetIndex() const { return index; }
+
 	/** Get a list containing all local users
 	 * @return A const list of local users
 	 */
@@ -144,6 +144,66 @@ public:
 	const std::vector<std::string>& GetHosts() const { return hosts; }
 };
 
+/** Indexes connect classes by the host and IP address masks that they allow so that the
+ * classes a user might be assigned to can be found without checking every class.
+ */
+class CoreExport ConnectClassIndex final
+{
+public:
+	/** A list of connect classes. */
+	typedef std::vector<std::shared_ptr<ConnectClass>> ClassList;
+
+private:
+	/** A list of the positions of connect classes within the indexed list. */
+	typedef std::vector<size_t> PositionList;
+
+	/** A map of connect class positions keyed by a string. */
+	typedef std::unordered_map<std::string, PositionList> PositionMap;
+
+	/** The connect classes which have been indexed in the order they were defined in. */
+	ClassList classes;
+
+	/** The case insensitivity map which the hostname keys were built with. */
+	const unsigned char* casemap = nullptr;
+
+	/** Classes which allow an IP address or CIDR range, keyed by prefix length and then by the masked address. */
+	std::map<unsigned char, PositionMap> cidrclasses;
+
+	/** Classes which allow a hostname without any wildcards, keyed by the folded hostname. */
+	PositionMap hostclasses;
+
+	/** Classes which allow a hostname suffix in the format *.example.com, keyed by the folded suffix including the leading dot. */
+	PositionMap suffixclasses;
+
+	/** Classes which allow a mask that can not be indexed. */
+	PositionList otherclasses;
+
+	/** Adds the positions of the classes which might match an IP address to a list. */
+	void FindAddress(const irc::sockets::sockaddrs& sa, PositionList& positions) const;
+
+	/** Adds the positions of the classes which might match a hostname to a list. */
+	void FindHost(const std::string& host, PositionList& positions) const;
+
+	/** Rebuilds the index from the classes which are currently indexed. */
+	void Rebuild();
+
+public:
+	/** Replaces the contents of the index.
+	 * @param newclasses The connect classes to index.
+	 */
+	void Build(const ClassList& newclasses);
+
+	/** Finds the connect classes which a user might be assigned to. Every class the user can be
+	 * assigned to is guaranteed to be found but OnPreChangeConnectClass still needs to be checked.
+	 * @param user The user to find connect classes for.
+	 * @param candidates The list to store the classes in. These are in the order they were defined in.
+	 */
+	void Find(LocalUser* user, ClassList& candidates);
+
+	/** Retrieves the number of connect classes which are indexed. */
+	size_t size() const { return classes.size(); }
+};
+
 class CoreExport AwayState final
 {
 public:
@@ -310,6 +370,12 @@ public:
 	 */
 	bool CheckPassword(const std::string& pw) const;
 
+	/** Retrieves the password used to log into this oper account. */
+	const auto& GetPassword() const { return password; }
+
+	/** Retrieves the algorithm used to hash the password of this oper account. */
+	const auto& GetPasswordHash() const { return passwordhash; }
+
 	/** Retrieves the name of the underlying oper type. */
 	const auto& GetType() const { return type; }
 };
@@ -571,6 +637,11 @@ public:
 	 */
 	void InvalidateCache();
 
+	/** Forgets the cached ban status of this user on all of their channels. This should be
+	 * called when something that might change whether the user is banned changes.
+	 */
+	void ResetBanCache();
+
 	/** Returns whether this user is currently away or not. If true,
 	 * further information can be found in away->message and away->time
 	 * @return True if the user is away, false otherwise
@@ -757,6 +828,14 @@ class CoreExport UserIOHandler final
 {
 private:
 	size_t checked_until = 0;
+
+	/** Checks whether the specified amount of data can be added to the sendq of the user.
+	 * If it can not then the user will be removed.
+	 * @param length The number of bytes which are being added.
+	 * @return True if the data can be added; otherwise, false.
+	 */
+	bool CanAddWriteBuf(size_t length);
+
 public:
 	LocalUser* const user;
 	UserIOHandler(LocalUser* me)
@@ -775,6 +854,16 @@ public:
 	 * @param data The data to add to the write buffer
 	 */
 	void AddWriteBuf(const std::string& data);
+
+	/** Adds a buffer to the user's write buffer without copying it.
+	 * @param data The buffer to add to the write buffer. This may be shared with the send queues of other users.
+	 */
+	void AddWriteBuf(const StreamSocket::SendQueue::Element& data);
+
+	/** Adds a serialized message to the user's write buffer without copying it.
+	 * @param data The serialized message to add to the write buffer.
+	 */
+	void AddWriteBuf(const ClientProtocol::SerializedMessage& data);
 };
 
 class CoreExport LocalUser final
@@ -789,7 +878,7 @@ private:
 	static ClientProtocol::MessageList sendmsglist;
 
 	/** Add a serialized message to the send queue of the user.
-	 * @param serialized Bytes to add.
+	 * @param serialized Bytes to add. These are shared with the send queues of other users rather than copied.
 	 */
 	void Write(const ClientProtocol::SerializedMessage& serialized);
 
@@ -987,6 +1076,11 @@ inline bool User::IsModeSet(const UserModeReference& moderef) const
 
 inline void User::SetMode(const ModeHandler* mh, bool value)
 {
-	if (mh && mh->GetId() != ModeParser::MODEID_MAX)
+	if (mh && mh->GetId() != ModeParser::MODEID_MAX && modes[mh->GetId()] != value)
+	{
 		modes[mh->GetId()] = value;
+
+		// Extbans can match the modes a user has set.
+		ResetBanCache();
+	}
 }
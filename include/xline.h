@@ -30,6 +30,8 @@ namespace Stats
 	class Context;
 }
 
+class XLineIndex;
+
 /** Contains a username and hostname split into two strings
  */
 typedef std::pair<std::string, std::string> UserHostPair;
@@ -432,6 +434,19 @@ protected:
 	 */
 	XLineContainer lookup_lines;
 
+	/** Indexes of the lines in lookup_lines, keyed by line type. These allow finding the
+	 * lines which might match a user without checking every line of that type.
+	 */
+	std::unordered_map<std::string, std::unique_ptr<XLineIndex>> line_indexes;
+
+	/** The number of times that lines of each type have matched, keyed by line type. */
+	std::map<std::string, unsigned long> line_hits;
+
+	/** Removes a line from the index of its type.
+	 * @param line The line to remove.
+	 */
+	void RemoveFromIndex(XLine* line);
+
 public:
 
 	/** Constructor
@@ -535,6 +550,14 @@ public:
 	 */
 	XLine* MatchesLine(const std::string& type, const std::string& pattern);
 
+	/** Records that a line of the specified type has matched.
+	 * @param type The type of the line which matched.
+	 */
+	void AddHit(const std::string& type) { line_hits[type]++; }
+
+	/** Retrieves the number of times that lines of each type have matched, keyed by line type. */
+	const std::map<std::string, unsigned long>& GetHits() const { return line_hits; }
+
 	/** Expire a line given two iterators which identify it in the main map.
 	 * @param container Iterator to the first level of entries the map
 	 * @param item Iterator to the second level of entries in the map
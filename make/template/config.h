@@ -58,4 +58,7 @@
  /** Whether the clock_gettime() function was available at compile time. */
  %define HAS_CLOCK_GETTIME
 
+ /** Whether the socket engine provides its own Accept(), Recv(), Send(), WriteV() and Shutdown(). */
+ %define HAS_SOCKETENGINE_IO
+
 #endif
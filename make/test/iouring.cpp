@@ -0,0 +1,32 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+int main() {
+	// The socket engine needs multishot receives and provided buffer rings.
+	unsigned int features = IORING_RECV_MULTISHOT | IORING_ACCEPT_MULTISHOT | IORING_REGISTER_PBUF_RING;
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = static_cast<int>(syscall(__NR_io_uring_setup, 1, &params));
+	if (fd >= 0)
+		close(fd);
+	return (fd < 0 || !features);
+}
@@ -55,3 +55,88 @@ bool ChannelManager::IsPrefix(unsigned char prefix) const
 	// TODO: implement support for multiple channel types.
 	return prefix == '#';
 }
+
+int ChannelIndex::Compare(const std::string_view& lhs, const std::string_view& rhs)
+{
+	const size_t maxsize = std::min(lhs.size(), rhs.size());
+	for (size_t idx = 0; idx < maxsize; ++idx)
+	{
+		const unsigned char lchr = national_case_insensitive_map[static_cast<unsigned char>(lhs[idx])];
+		const unsigned char rchr = national_case_insensitive_map[static_cast<unsigned char>(rhs[idx])];
+		if (lchr != rchr)
+			return lchr < rchr ? -1 : 1;
+	}
+	return lhs.size() == rhs.size() ? 0 : (lhs.size() < rhs.size() ? -1 : 1);
+}
+
+void ChannelIndex::CheckCasemap()
+{
+	// The case mapping is compared by value as m_codepage frees and reallocates it.
+	if (!memcmp(casemap.data(), national_case_insensitive_map, casemap.size()))
+		return;
+
+	memcpy(casemap.data(), national_case_insensitive_map, casemap.size());
+
+	// Iterating does not use the comparator so the sets can be read in their stale
+	// order and inserted into new sets which are ordered by the new case mapping.
+	NameSet newnames(names.begin(), names.end());
+	names.swap(newnames);
+
+	TopicSet newtopics(topics.begin(), topics.end());
+	topics.swap(newtopics);
+}
+
+void ChannelIndex::Add(Channel* chan)
+{
+	CheckCasemap();
+	names.insert(chan);
+	users.emplace(chan->GetUsers().size(), chan);
+	ages.emplace(chan->age, chan);
+	AddTopic(chan);
+}
+
+void ChannelIndex::Remove(Channel* chan)
+{
+	CheckCasemap();
+	RemoveTopic(chan);
+	ages.erase(std::make_pair(chan->age, chan));
+	users.erase(std::make_pair(chan->GetUsers().size(), chan));
+	EraseExact(names, chan);
+}
+
+void ChannelIndex::ChangeAge(Channel* chan, time_t age)
+{
+	ages.erase(std::make_pair(chan->age, chan));
+	chan->age = age;
+	ages.emplace(chan->age, chan);
+}
+
+void ChannelIndex::ChangeUsers(Channel* chan, size_t oldcount)
+{
+	users.erase(std::make_pair(oldcount, chan));
+	users.emplace(chan->GetUsers().size(), chan);
+}
+
+void ChannelIndex::RemoveTopic(Channel* chan)
+{
+	if (chan->topicset)
+		topictimes.erase(std::make_pair(chan->topicset, chan));
+
+	if (chan->topic.empty())
+		return;
+
+	CheckCasemap();
+	EraseExact(topics, chan);
+}
+
+void ChannelIndex::AddTopic(Channel* chan)
+{
+	if (chan->topicset)
+		topictimes.emplace(chan->topicset, chan);
+
+	if (!chan->topic.empty())
+	{
+		CheckCasemap();
+		topics.insert(chan);
+	}
+}
@@ -41,6 +41,7 @@ Channel::Channel(const std::string& cname, time_t ts)
 {
 	if (!ServerInstance->Channels.GetChans().emplace(cname, this).second)
 		throw CoreException("Cannot create duplicate channel " + cname);
+	ServerInstance->Channels.GetIndex().Add(this);
 }
 
 void Channel::SetMode(const ModeHandler* mh, bool on)
@@ -51,6 +52,9 @@ void Channel::SetMode(const ModeHandler* mh, bool on)
 
 void Channel::SetTopic(User* u, const std::string& ntopic, time_t topicts, const std::string* setter)
 {
+	ChannelIndex& index = ServerInstance->Channels.GetIndex();
+	index.RemoveTopic(this);
+
 	// Send a TOPIC message to the channel only if the new topic text differs
 	if (this->topic != ntopic)
 	{
@@ -64,6 +68,7 @@ void Channel::SetTopic(User* u, const std::string& ntopic, time_t topicts, const
 		setter = ServerInstance->Config->MaskInTopic ? &u->GetMask() : &u->nick;
 	this->setby.assign(*setter, 0, ServerInstance->Config->Limits.GetMaxMask());
 	this->topicset = topicts;
+	index.AddTopic(this);
 
 	FOREACH_MOD(OnPostTopicChange, (u, this, this->topic));
 }
@@ -75,6 +80,7 @@ Membership* Channel::AddUser(User* user)
 		return nullptr;
 
 	Membership* memb = new(ret.first->second) Membership(user, this);
+	ServerInstance->Channels.GetIndex().ChangeUsers(this, userlist.size() - 1);
 	return memb;
 }
 
@@ -102,6 +108,7 @@ void Channel::CheckDestroy()
 
 	FOREACH_MOD(OnChannelDelete, (this));
 	ServerInstance->Channels.GetChans().erase(iter);
+	ServerInstance->Channels.GetIndex().Remove(this);
 	ServerInstance->GlobalCulls.AddItem(this);
 }
 
@@ -111,6 +118,7 @@ void Channel::DelUser(const MemberMap::iterator& membiter)
 	memb->Cull();
 	memb->~Membership();
 	userlist.erase(membiter);
+	ServerInstance->Channels.GetIndex().ChangeUsers(this, userlist.size() + 1);
 
 	// If this channel became empty then it should be removed
 	CheckDestroy();
@@ -228,6 +236,9 @@ Membership* Channel::ForceJoin(User* user, const std::string* privs, bool bursti
 
 	user->chans.push_front(memb);
 
+	// Extbans can match the channels a user is in.
+	user->ResetBanCache();
+
 	if (privs)
 	{
 		// If the user was granted prefix modes (in the OnUserPreJoin hook, or they're a
@@ -267,16 +278,29 @@ bool Channel::IsBanned(User* user)
 	if (!banlm)
 		return false;
 
+	// Members only need to be checked against the ban list again when
+	// something has changed since the last time they were checked.
+	Membership* memb = GetUser(user);
+	if (memb && memb->banned.has_value())
+		return *memb->banned;
+
+	bool banned = false;
 	const ListModeBase::ModeList* bans = banlm->GetList(this);
 	if (bans)
 	{
 		for (const auto& entry : *bans)
 		{
-			if (CheckBan(user, entry.mask))
-				return true;
+			if (CheckBan(user, entry.GetBanMask()))
+			{
+				banned = true;
+				break;
+			}
 		}
 	}
-	return false;
+
+	if (memb)
+		memb->banned = banned;
+	return banned;
 }
 
 bool Channel::CheckBan(User* user, const std::string& mask)
@@ -286,22 +310,23 @@ bool Channel::CheckBan(User* user, const std::string& mask)
 	if (result != MOD_RES_PASSTHRU)
 		return (result == MOD_RES_DENY);
 
-	std::string::size_type at = mask.find('@');
-	if (at == std::string::npos)
-		return false;
+	return BanMask(mask).Matches(user);
+}
 
-	const std::string prefix(mask, 0, at);
-	if (!InspIRCd::Match(user->nick + "!" + user->GetDisplayedUser(), prefix) &&
-		!InspIRCd::Match(user->nick + "!" + user->GetRealUser(), prefix))
-	{
-		// Neither the nick!user or nick!duser.
-		return false;
-	}
+bool Channel::CheckBan(User* user, const BanMask& mask)
+{
+	ModResult result;
+	FIRST_MOD_RESULT(OnCheckBan, result, (user, this, mask.GetMask()));
+	if (result != MOD_RES_PASSTHRU)
+		return (result == MOD_RES_DENY);
 
-	const std::string suffix(mask, at + 1);
-	return InspIRCd::Match(user->GetRealHost(), suffix) ||
-		InspIRCd::Match(user->GetDisplayedHost(), suffix) ||
-		InspIRCd::MatchCIDR(user->GetAddress(), suffix);
+	return mask.Matches(user);
+}
+
+void Channel::ResetBanCache()
+{
+	for (const auto& [_, memb] : userlist)
+		memb->banned.reset();
 }
 
 void Channel::PartUser(const MemberMap::iterator& membiter, const std::string& reason)
@@ -317,6 +342,7 @@ void Channel::PartUser(const MemberMap::iterator& membiter, const std::string& r
 
 	// Remove this channel from the user's chanlist
 	user->chans.erase(memb);
+	user->ResetBanCache();
 
 	// Remove the Membership from this channel's userlist and destroy it
 	this->DelUser(membiter);
@@ -332,6 +358,7 @@ void Channel::KickUser(User* src, const MemberMap::iterator& victimiter, const s
 	Write(ServerInstance->GetRFCEvents().kick, kickmsg, 0, except_list);
 
 	memb->user->chans.erase(memb);
+	memb->user->ResetBanCache();
 	this->DelUser(victimiter);
 }
 
@@ -458,10 +485,12 @@ ModeHandler::Rank Channel::GetPrefixValue(User* user) const
 
 bool Membership::SetPrefix(PrefixMode* delta_mh, bool adding)
 {
-	if (adding)
-		return modes.insert(delta_mh).second;
-	else
-		return modes.erase(delta_mh);
+	const bool changed = adding ? modes.insert(delta_mh).second : modes.erase(delta_mh);
+
+	// Extbans can match the prefix modes a user has in any of their channels.
+	if (changed)
+		user->ResetBanCache();
+	return changed;
 }
 
 void Membership::WriteNotice(const std::string& text) const
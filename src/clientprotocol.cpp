@@ -146,14 +146,29 @@ std::string ClientProtocol::Message::UnescapeTag(const std::string& value)
 const ClientProtocol::SerializedMessage& ClientProtocol::Message::GetSerialized(const SerializedInfo& serializeinfo) const
 {
 	// First check if the serialized line they're asking for is in the cache
+	std::shared_ptr<const std::string> body;
 	for (const auto& [info, msg] : serlist)
 	{
 		if (info == serializeinfo)
 			return msg;
+
+		// The body does not depend on the tags so it can be reused.
+		if (info.serializer == serializeinfo.serializer)
+			body = msg.body;
 	}
 
 	// Not cached, generate it and put it in the cache for later use
-	serlist.push_back(std::make_pair(serializeinfo, serializeinfo.serializer->Serialize(*this, serializeinfo.tagwl)));
+	SerializedMessage serialized;
+	if (body)
+		serialized.body = body;
+	else
+		serialized.body = std::make_shared<const std::string>(serializeinfo.serializer->SerializeBody(*this));
+
+	std::string serializedtags = serializeinfo.serializer->SerializeTags(*this, serializeinfo.tagwl);
+	if (!serializedtags.empty())
+		serialized.tags = std::make_shared<const std::string>(std::move(serializedtags));
+
+	serlist.emplace_back(serializeinfo, std::move(serialized));
 	return serlist.back().second;
 }
 
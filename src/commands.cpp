@@ -323,7 +323,11 @@ void CommandParser::ProcessCommand(LocalUser* user, std::string& command, Comman
 		/*
 		 * WARNING: be careful, the user may be deleted soon
 		 */
-		CmdResult result = handler->Handle(user, command_p);
+		CmdResult result;
+		{
+			ProfileManager::Stopwatch stopwatch(handler->use_time, ServerInstance->Profiler.IsEnabled());
+			result = handler->Handle(user, command_p);
+		}
 
 		FOREACH_MOD(OnPostCommand, (handler, command_p, user, result, false));
 	}
@@ -336,7 +340,7 @@ void CommandParser::RemoveCommand(Command* x)
 		cmdlist.erase(n);
 }
 
-void CommandParser::ProcessBuffer(LocalUser* user, const std::string& buffer)
+void CommandParser::ProcessBuffer(LocalUser* user, const std::string_view& buffer)
 {
 	ClientProtocol::ParseOutput parseoutput;
 	if (!user->serializer->Parse(user, buffer, parseoutput))
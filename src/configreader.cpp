@@ -303,6 +303,8 @@ void ServerConfig::CrossCheckConnectBlocks(ServerConfig* current)
 			i++;
 		}
 	}
+
+	ClassIndex.Build(Classes);
 }
 
 namespace
@@ -385,6 +387,8 @@ void ServerConfig::Fill()
 	NetBufferSize = performance->getNum<size_t>("netbuffersize", 10240, 1024, 65534);
 	SoftLimit = performance->getNum<size_t>("softlimit", (SocketEngine::GetMaxFds() > 0 ? SocketEngine::GetMaxFds() : SIZE_MAX), 10);
 	TimeSkipWarn = performance->getDuration("timeskipwarn", 2, 0, 30);
+	Profile = performance->getBool("profile", true);
+	ProfileHooks = Profile && performance->getBool("profilehooks");
 
 	// Read the <security> config.
 	const auto& security = ConfValue("security");
@@ -525,6 +529,9 @@ void ServerConfig::Apply(ServerConfig* old, const std::string& useruid)
 	errstr.clear();
 	errstr.str(std::string());
 
+	if (valid)
+		ServerInstance->Profiler.SetEnabled(Profile, ProfileHooks);
+
 	/* No old configuration -> initial boot, nothing more to do here */
 	if (!old)
 	{
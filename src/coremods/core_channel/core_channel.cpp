@@ -24,6 +24,7 @@
 #include "inspircd.h"
 #include "clientprotocolevent.h"
 #include "listmode.h"
+#include "modules/account.h"
 #include "modules/isupport.h"
 #include "utility/string.h"
 
@@ -102,6 +103,7 @@ public:
 
 class CoreModChannel final
 	: public Module
+	, public Account::EventListener
 	, public CheckExemption::EventListener
 	, public ISupport::EventListener
 {
@@ -129,6 +131,12 @@ class CoreModChannel final
 	insp::flat_map<std::string, char> exemptions;
 	ExtBanManager extbanmgr;
 
+	static void ResetBanCaches()
+	{
+		for (const auto& [_, chan] : ServerInstance->Channels.GetChans())
+			chan->ResetBanCache();
+	}
+
 	ModResult IsInvited(User* user, Channel* chan)
 	{
 		LocalUser* localuser = IS_LOCAL(user);
@@ -140,6 +148,7 @@ class CoreModChannel final
 public:
 	CoreModChannel()
 		: Module(VF_CORE | VF_VENDOR, "Provides the INVITE, JOIN, KICK, NAMES, and TOPIC commands")
+		, Account::EventListener(this)
 		, CheckExemption::EventListener(this, UINT_MAX)
 		, ISupport::EventListener(this)
 		, invapi(this)
@@ -217,6 +226,33 @@ public:
 
 		const auto& limitstag = ServerInstance->Config->ConfValue("limits");
 		keymode.maxkeylen = limitstag->getNum<size_t>("maxkey", 32, 1, ModeParser::MODE_PARAM_MAX);
+
+		// The extban format and the config of modules which check bans may have changed.
+		ResetBanCaches();
+	}
+
+	void OnAccountChange(User* user, const std::string& account) override
+	{
+		// Extbans can match the account of a user.
+		user->ResetBanCache();
+	}
+
+	void OnPostChangeConnectClass(LocalUser* user, bool force) override
+	{
+		// Extbans can match the connect class of a user.
+		user->ResetBanCache();
+	}
+
+	void OnLoadModule(Module* mod) override
+	{
+		// The module may check bans or provide extbans.
+		ResetBanCaches();
+	}
+
+	void OnUnloadModule(Module* mod) override
+	{
+		// The module may have checked bans or provided extbans.
+		ResetBanCaches();
 	}
 
 	void OnBuildISupport(ISupport::TokenMap& tokens) override
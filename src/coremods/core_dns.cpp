@@ -22,10 +22,12 @@
 
 #include "inspircd.h"
 #include "modules/dns.h"
+#include "modules/metrics.h"
 #include "modules/stats.h"
 #include "stringutils.h"
 
 #include <fstream>
+#include <list>
 
 #ifdef _WIN32
 #include <Iphlpapi.h>
@@ -201,6 +203,29 @@ private:
 
 				break;
 			}
+			case QUERY_SOA:
+			{
+				if (pos + rdlength > input_size)
+					throw Exception(creator, "Unable to unpack SOA resource record");
+
+				const unsigned short end = pos + rdlength;
+				const std::string mname = this->UnpackName(input, input_size, pos);
+				const std::string rname = this->UnpackName(input, input_size, pos);
+				if (pos + 20 > end)
+					throw Exception(creator, "Unable to unpack SOA resource record");
+
+				// We only care about the minimum field which is the last of the five
+				// 32-bit values (serial, refresh, retry, expire, minimum).
+				pos += 16;
+				const unsigned int minimum = (static_cast<uint32_t>(input[pos]) << 24) | (static_cast<uint32_t>(input[pos + 1]) << 16) | (static_cast<uint32_t>(input[pos + 2]) << 8) | input[pos + 3];
+				pos = end;
+
+				// RFC 2308 section 5: negative answers are cached for the smaller of
+				// the SOA record's TTL and its minimum field.
+				record.ttl = std::min(record.ttl, minimum);
+				record.rdata = INSP_FORMAT("{} {} {}", mname, rname, minimum);
+				break;
+			}
 			case QUERY_TXT:
 			{
 				if (pos + rdlength > input_size)
@@ -265,6 +290,9 @@ public:
 	/* Flags on the packet */
 	unsigned short flags = 0;
 
+	/* How long a negative answer can be cached for, from the authority section's SOA record */
+	unsigned int negative_ttl = 0;
+
 	Packet(const Module* mod)
 		: creator(mod)
 	{
@@ -304,6 +332,28 @@ public:
 
 		for (unsigned i = 0; i < ancount; ++i)
 			this->answers.push_back(this->UnpackResourceRecord(input, len, packet_pos));
+
+		if (!this->answers.empty() || !nscount)
+			return;
+
+		// The authority section is only used to find out how long a negative answer
+		// can be cached for so a malformed one should not fail the whole packet.
+		try
+		{
+			for (unsigned i = 0; i < nscount; ++i)
+			{
+				const ResourceRecord rr = this->UnpackResourceRecord(input, len, packet_pos);
+				if (rr.type == QUERY_SOA)
+				{
+					this->negative_ttl = rr.ttl;
+					break;
+				}
+			}
+		}
+		catch (const Exception& ex)
+		{
+			ServerInstance->Logs.Debug(MODNAME, "Unable to unpack authority section: {}", ex.GetReason());
+		}
 	}
 
 	unsigned short Pack(unsigned char* output, unsigned short output_size)
@@ -380,25 +430,254 @@ public:
 	}
 };
 
+class MyManager;
+
+/** A nameserver which queries can be sent to. */
+struct Nameserver final
+{
+	/** The address of the nameserver. */
+	irc::sockets::sockaddrs addr;
+
+	/** The number of queries to this nameserver that have timed out in a row. */
+	unsigned long failures = 0;
+
+	/** The time at which a query to this nameserver last timed out. */
+	time_t lastfailure = 0;
+
+	/** The number of queries which have been sent to this nameserver. */
+	size_t stats_sent = 0;
+
+	/** The number of queries to this nameserver which have timed out. */
+	size_t stats_timeouts = 0;
+
+	Nameserver(const irc::sockets::sockaddrs& sa)
+		: addr(sa)
+	{
+	}
+};
+
+/** A UDP socket which queries for nameservers of a single address family are sent from. */
+class UDPSocket final
+	: public EventHandler
+{
+private:
+	MyManager& manager;
+
+public:
+	UDPSocket(MyManager& mgr)
+		: manager(mgr)
+	{
+	}
+
+	~UDPSocket() override
+	{
+		Close();
+	}
+
+	bool Open(const irc::sockets::sockaddrs& bindto)
+	{
+		int s = socket(bindto.family(), SOCK_DGRAM, 0);
+		this->SetFd(s);
+
+		/* Have we got a socket? */
+		if (!this->HasFd())
+		{
+			ServerInstance->Logs.Critical(MODNAME, "Error creating DNS socket - hostnames will NOT resolve");
+			return false;
+		}
+
+		SocketEngine::SetOption<int>(s, SOL_SOCKET, SO_REUSEADDR, 1);
+		SocketEngine::NonBlocking(s);
+
+		if (SocketEngine::Bind(this, bindto) < 0)
+		{
+			/* Failed to bind */
+			ServerInstance->Logs.Critical(MODNAME, "Error binding dns socket - hostnames will NOT resolve");
+			SocketEngine::Close(this->GetFd());
+			this->SetFd(-1);
+			return false;
+		}
+
+		if (!SocketEngine::AddFd(this, FD_WANT_POLL_READ | FD_WANT_NO_WRITE))
+		{
+			ServerInstance->Logs.Critical(MODNAME, "Internal error starting DNS - hostnames will NOT resolve.");
+			SocketEngine::Close(this->GetFd());
+			this->SetFd(-1);
+			return false;
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+		// Shutdown the socket if it exists.
+		if (HasFd())
+		{
+			SocketEngine::Shutdown(this, 2);
+			SocketEngine::Close(this);
+		}
+	}
+
+	void OnEventHandlerError(int errcode) override
+	{
+		ServerInstance->Logs.Debug(MODNAME, "UDP socket got an error event");
+	}
+
+	void OnEventHandlerRead() override;
+};
+
+/** A TCP connection used to repeat a query whose UDP answer was truncated. */
+class TCPQuery final
+	: public EventHandler
+{
+private:
+	MyManager& manager;
+
+	/** The id of the pending query this connection is for. */
+	const RequestId id;
+
+	/** Data which is waiting to be sent to the nameserver. */
+	std::string sendq;
+
+	/** Data which has been received from the nameserver. */
+	std::string recvq;
+
+public:
+	TCPQuery(MyManager& mgr, RequestId rid, const irc::sockets::sockaddrs& server, const std::string& query)
+		: manager(mgr)
+		, id(rid)
+	{
+		// Messages sent over TCP are prefixed with a two byte length (RFC 1035 section 4.2.2).
+		sendq.push_back(static_cast<char>(query.length() >> 8));
+		sendq.push_back(static_cast<char>(query.length() & 0xFF));
+		sendq.append(query);
+
+		SetFd(socket(server.family(), SOCK_STREAM, 0));
+		if (!HasFd())
+			return;
+
+		SocketEngine::NonBlocking(GetFd());
+		if (SocketEngine::Connect(this, server) == -1 && errno != EINPROGRESS)
+		{
+			Close();
+			return;
+		}
+
+		if (!SocketEngine::AddFd(this, FD_WANT_NO_READ | FD_WANT_POLL_WRITE))
+			Close();
+	}
+
+	~TCPQuery() override
+	{
+		Close();
+	}
+
+	void Close()
+	{
+		if (HasFd())
+			SocketEngine::Close(this);
+	}
+
+	void OnEventHandlerError(int errcode) override;
+	void OnEventHandlerRead() override;
+	void OnEventHandlerWrite() override;
+};
+
 class MyManager final
 	: public Manager
 	, public Timer
-	, public EventHandler
 {
-	typedef std::unordered_map<Question, Query, Question::hash> cache_map;
+	/** An entry in the DNS cache. */
+	struct CacheEntry final
+	{
+		/** The cached query. If error is set this is a negative answer. */
+		Query query;
+
+		/** The time at which this entry expires. */
+		time_t expires;
+
+		CacheEntry(const Query& q, time_t exp)
+			: query(q)
+			, expires(exp)
+		{
+		}
+	};
+
+	/** Cache entries ordered from most to least recently used. */
+	typedef std::list<CacheEntry> cache_list;
+	cache_list cachelru;
+
+	/** Cache entries indexed by the question they answer. */
+	typedef std::unordered_map<Question, cache_list::iterator, Question::hash> cache_map;
 	cache_map cache;
 
-	irc::sockets::sockaddrs myserver;
+	/** A query which has been sent to a nameserver and is waiting for an answer. */
+	struct PendingQuery final
+	{
+		/** The question that was asked. */
+		Question question;
+
+		/** The requests which are waiting for the answer to this question. */
+		std::vector<DNS::Request*> requests;
+
+		/** The nameserver the question was sent to. */
+		std::shared_ptr<Nameserver> server;
+
+		/** The packed query, kept in case it needs to be repeated over TCP. */
+		std::string packet;
+
+		/** The TCP connection used if the UDP answer was truncated. */
+		std::unique_ptr<TCPQuery> tcp;
+
+		/** The time at which the question was sent. */
+		time_t sent;
+	};
+
+	/** Pending queries indexed by their request id. */
+	std::vector<std::unique_ptr<PendingQuery>> pending;
+
+	/** Pending query ids indexed by the question they are asking. */
+	std::unordered_map<Question, RequestId, Question::hash> inflight;
+
+	/** Request ids which are not currently in use. */
+	std::vector<RequestId> freeids;
+
+	/** The nameservers which queries can be sent to in order of preference. */
+	std::vector<std::shared_ptr<Nameserver>> nameservers;
+
+	/** The UDP sockets used for sending queries to IPv4 and IPv6 nameservers. */
+	UDPSocket socket4;
+	UDPSocket socket6;
+
 	bool unloading = false;
 
-	/** Maximum number of entries in cache
-	 */
-	static constexpr unsigned int MAX_CACHE_SIZE = 1000;
+	/** The number of seconds after which a failing nameserver will be tried again. */
+	static constexpr time_t NAMESERVER_RETRY = 60;
+
+	/** The maximum number of seconds an answer will be cached for. */
+	static constexpr unsigned int MAX_CACHE_TTL = 5*60;
+
+	static bool IsExpired(const CacheEntry& entry)
+	{
+		return entry.expires < ServerInstance->Time();
+	}
+
+	void EraseCache(cache_map::iterator it)
+	{
+		this->cachelru.erase(it->second);
+		this->cache.erase(it);
+	}
 
-	static bool IsExpired(const Query& record)
+	/** Evicts the least recently used entries until there are at most \p maxsize entries left. */
+	void TrimCache(size_t maxsize)
 	{
-		const ResourceRecord& req = record.answers[0];
-		return (req.created + static_cast<time_t>(req.ttl) < ServerInstance->Time());
+		while (this->cachelru.size() > maxsize)
+		{
+			this->cache.erase(this->cachelru.back().query.question);
+			this->cachelru.pop_back();
+			this->stats_cacheevicted++;
+		}
 	}
 
 	/** Check the DNS cache to see if request can be handled by a cached result
@@ -410,29 +689,61 @@ class MyManager final
 
 		cache_map::iterator it = this->cache.find(question);
 		if (it == this->cache.end())
+		{
+			this->stats_cachemisses++;
 			return false;
+		}
 
-		Query& record = it->second;
-		if (IsExpired(record))
+		if (IsExpired(*it->second))
 		{
-			this->cache.erase(it);
+			this->EraseCache(it);
+			this->stats_cachemisses++;
 			return false;
 		}
 
-		ServerInstance->Logs.Debug(MODNAME, "cache: Using cached result for " + question.name);
+		// Move the entry to the front of the list so it is evicted last.
+		this->cachelru.splice(this->cachelru.begin(), this->cachelru, it->second);
+		this->stats_cachehits++;
+
+		Query& record = it->second->query;
 		record.cached = true;
-		req->OnLookupComplete(&record);
+		if (record.error != ERROR_NONE)
+		{
+			ServerInstance->Logs.Debug(MODNAME, "cache: Using cached negative result for " + question.name);
+			req->OnError(&record);
+		}
+		else
+		{
+			ServerInstance->Logs.Debug(MODNAME, "cache: Using cached result for " + question.name);
+			req->OnLookupComplete(&record);
+		}
 		return true;
 	}
 
 	/** Add a record to the dns cache
 	 * @param r The record
+	 * @param ttl The number of seconds to cache the record for.
 	 */
-	void AddCache(Query& r)
+	void AddCache(const Query& r, unsigned int ttl)
 	{
-		if (cache.size() >= MAX_CACHE_SIZE)
-			cache.clear();
+		if (!this->cachesize || !ttl)
+			return;
+
+		cache_map::iterator it = this->cache.find(r.question);
+		if (it != this->cache.end())
+			this->EraseCache(it);
+		else
+			this->TrimCache(this->cachesize - 1);
 
+		this->cachelru.emplace_front(r, ServerInstance->Time() + std::min(ttl, MAX_CACHE_TTL));
+		this->cache[r.question] = this->cachelru.begin();
+	}
+
+	/** Add a successful answer to the dns cache
+	 * @param r The record
+	 */
+	void AddCache(Query& r)
+	{
 		// Determine the lowest TTL value and use that as the TTL of the cache entry
 		unsigned int cachettl = UINT_MAX;
 		for (const auto& rr : r.answers)
@@ -441,26 +752,139 @@ class MyManager final
 				cachettl = rr.ttl;
 		}
 
-		cachettl = std::min<unsigned int>(cachettl, 5*60);
+		cachettl = std::min<unsigned int>(cachettl, MAX_CACHE_TTL);
 		ResourceRecord& rr = r.answers.front();
 		// Set TTL to what we've determined to be the lowest
 		rr.ttl = cachettl;
 		ServerInstance->Logs.Debug(MODNAME, "cache: added cache for " + rr.name + " -> " + rr.rdata + " ttl: " + ConvToStr(rr.ttl));
-		this->cache[r.question] = r;
+		this->AddCache(r, cachettl);
+	}
+
+	/** Add a negative answer (NXDOMAIN or no records) to the dns cache
+	 * @param r The packet containing the negative answer.
+	 */
+	void AddNegativeCache(const Packet& r)
+	{
+		if (!r.negative_ttl)
+			return; // Without a SOA record we don't know how long we can cache for (RFC 2308 section 5).
+
+		ServerInstance->Logs.Debug(MODNAME, "cache: added negative cache for {} ttl: {}", r.question.name, r.negative_ttl);
+		this->AddCache(r, r.negative_ttl);
+	}
+
+	UDPSocket& GetSocket(int family)
+	{
+		return family == AF_INET6 ? socket6 : socket4;
+	}
+
+	/** Retrieves how many recent failures count against a nameserver. */
+	static unsigned long GetPenalty(const Nameserver& ns)
+	{
+		if (ns.lastfailure + NAMESERVER_RETRY < ServerInstance->Time())
+			return 0; // Give the nameserver another chance.
+		return ns.failures;
+	}
+
+	/** Selects the healthiest nameserver that queries can be sent to. Nameservers that are
+	 * equally healthy are selected in the order they were configured in.
+	 */
+	std::shared_ptr<Nameserver> SelectNameserver()
+	{
+		std::shared_ptr<Nameserver> best;
+		unsigned long bestpenalty = ULONG_MAX;
+		for (const auto& ns : this->nameservers)
+		{
+			if (!GetSocket(ns->addr.family()).HasFd())
+				continue;
+
+			unsigned long penalty = GetPenalty(*ns);
+			if (penalty < bestpenalty)
+			{
+				best = ns;
+				bestpenalty = penalty;
+			}
+		}
+		return best;
+	}
+
+	/** Allocates an unused request id. Ids are picked at random from the free list so that
+	 * answers are hard to forge.
+	 */
+	RequestId AllocateId()
+	{
+		if (this->freeids.empty())
+			throw Exception(creator, "DNS: All ids are in use");
+
+		size_t idx = ServerInstance->GenRandomInt(this->freeids.size());
+		RequestId id = this->freeids[idx];
+		this->freeids[idx] = this->freeids.back();
+		this->freeids.pop_back();
+		return id;
+	}
+
+	/** Closes the TCP connection of a pending query if it has one. The connection is culled
+	 * rather than deleted as the socket engine may still have events queued for it.
+	 */
+	static void CloseTCP(PendingQuery& query)
+	{
+		if (!query.tcp)
+			return;
+
+		query.tcp->Close();
+		ServerInstance->GlobalCulls.AddItem(query.tcp.release());
+	}
+
+	/** Removes a pending query and frees its request id. */
+	std::unique_ptr<PendingQuery> ReleaseQuery(RequestId id)
+	{
+		std::unique_ptr<PendingQuery> query = std::move(this->pending[id]);
+		CloseTCP(*query);
+		this->inflight.erase(query->question);
+		this->freeids.push_back(id);
+		return query;
+	}
+
+	/** Fails all of the requests waiting on a pending query.
+	 * @param id The id of the pending query.
+	 * @param error The error to give to the requests.
+	 */
+	void FailQuery(RequestId id, Error error)
+	{
+		std::unique_ptr<PendingQuery> query = ReleaseQuery(id);
+		this->stats_failure++;
+
+		Query rr(query->question);
+		rr.error = error;
+		for (auto* request : query->requests)
+		{
+			request->OnError(&rr);
+			delete request;
+		}
 	}
 
 public:
-	DNS::Request* requests[MAX_REQUEST_ID+1];
 	size_t stats_total = 0;
 	size_t stats_success = 0;
 	size_t stats_failure = 0;
+	size_t stats_cachehits = 0;
+	size_t stats_cachemisses = 0;
+	size_t stats_cacheevicted = 0;
+	size_t stats_coalesced = 0;
+	size_t stats_tcp = 0;
+
+	/** The maximum number of entries in the cache. */
+	size_t cachesize = 1000;
 
 	MyManager(Module* c)
 		: Manager(c)
 		, Timer(5*60, true)
+		, pending(MAX_REQUEST_ID + 1)
+		, socket4(*this)
+		, socket6(*this)
 	{
+		freeids.reserve(MAX_REQUEST_ID + 1);
 		for (unsigned int i = 0; i <= MAX_REQUEST_ID; ++i)
-			requests[i] = nullptr;
+			freeids.push_back(i);
 		ServerInstance->Timers.AddTimer(this);
 	}
 
@@ -472,29 +896,20 @@ public:
 
 		for (unsigned int i = 0; i <= MAX_REQUEST_ID; ++i)
 		{
-			DNS::Request* request = requests[i];
-			if (!request)
-				continue;
-
-			Query rr(request->question);
-			rr.error = ERROR_UNKNOWN;
-			request->OnError(&rr);
-
-			delete request;
+			if (pending[i])
+				FailQuery(i, ERROR_UNKNOWN);
 		}
 	}
 
 	void Close()
 	{
-		// Shutdown the socket if it exists.
-		if (HasFd())
-		{
-			SocketEngine::Shutdown(this, 2);
-			SocketEngine::Close(this);
-		}
+		// Shutdown the sockets if they exist.
+		socket4.Close();
+		socket6.Close();
 
 		// Remove all entries from the cache.
 		cache.clear();
+		cachelru.clear();
 	}
 
 	void Process(DNS::Request* req) override
@@ -502,7 +917,8 @@ public:
 		if ((unloading) || (req->creator->dying))
 			throw Exception(creator, "Module is being unloaded");
 
-		if (!HasFd())
+		std::shared_ptr<Nameserver> server = SelectNameserver();
+		if (!server)
 		{
 			Query rr(req->question);
 			rr.error = ERROR_DISABLED;
@@ -510,43 +926,8 @@ public:
 			return;
 		}
 
-		ServerInstance->Logs.Debug(MODNAME, "Processing request to lookup " + req->question.name + " of type " + ConvToStr(req->question.type) + " to " + this->myserver.addr());
-
-		/* Create an id */
-		unsigned int tries = 0;
-		long id;
-		do
-		{
-			id = ServerInstance->GenRandomInt(DNS::MAX_REQUEST_ID+1);
-
-			if (++tries == DNS::MAX_REQUEST_ID*5)
-			{
-				// If we couldn't find an empty slot this many times, do a sequential scan as a last
-				// resort. If an empty slot is found that way, go on, otherwise throw an exception
-				id = -1;
-				for (unsigned int i = 0; i <= DNS::MAX_REQUEST_ID; i++)
-				{
-					if (!this->requests[i])
-					{
-						id = i;
-						break;
-					}
-				}
-
-				if (id == -1)
-					throw Exception(creator, "DNS: All ids are in use");
-
-				break;
-			}
-		}
-		while (this->requests[id]);
-
-		req->id = id;
-		this->requests[req->id] = req;
-
 		Packet p(creator);
 		p.flags = QUERYFLAGS_RD;
-		p.id = req->id;
 		p.question = req->question;
 
 		unsigned char buffer[524];
@@ -566,8 +947,43 @@ public:
 		// domains so we need to update the original request so that question checking works.
 		req->question.name = p.question.name;
 
-		if (SocketEngine::SendTo(this, buffer, len, 0, this->myserver) != len)
+		// If we are already waiting on an answer to this question then wait on that instead
+		// of asking the nameserver again.
+		auto it = this->inflight.find(p.question);
+		if (it != this->inflight.end())
+		{
+			ServerInstance->Logs.Debug(MODNAME, "Waiting on in-flight request {} to lookup {}", it->second, p.question.name);
+			req->id = it->second;
+			this->pending[req->id]->requests.push_back(req);
+			this->stats_coalesced++;
+			ServerInstance->Timers.AddTimer(req);
+			return;
+		}
+
+		ServerInstance->Logs.Debug(MODNAME, "Processing request to lookup " + req->question.name + " of type " + ConvToStr(req->question.type) + " to " + server->addr.addr());
+
+		/* Create an id */
+		const RequestId id = AllocateId();
+		buffer[0] = id >> 8;
+		buffer[1] = id & 0xFF;
+
+		if (SocketEngine::SendTo(&GetSocket(server->addr.family()), buffer, len, 0, server->addr) != len)
+		{
+			this->freeids.push_back(id);
 			throw Exception(creator, "DNS: Unable to send query");
+		}
+
+		auto& query = this->pending[id];
+		query = std::make_unique<PendingQuery>();
+		query->question = p.question;
+		query->requests.push_back(req);
+		query->server = server;
+		query->packet.assign(reinterpret_cast<const char*>(buffer), len);
+		query->sent = ServerInstance->Time();
+		this->inflight.emplace(p.question, id);
+		server->stats_sent++;
+
+		req->id = id;
 
 		// Add timer for timeout
 		ServerInstance->Timers.AddTimer(req);
@@ -575,8 +991,42 @@ public:
 
 	void RemoveRequest(DNS::Request* req) override
 	{
-		if (requests[req->id] == req)
-			requests[req->id] = nullptr;
+		PendingQuery* query = this->pending[req->id].get();
+		if (!query || !stdalgo::vector::swaperase(query->requests, req) || !query->requests.empty())
+			return;
+
+		// Nothing is waiting on this query any more. If it was cancelled because it took too long
+		// then count that against the nameserver so another one is preferred for a while.
+		if (query->sent + static_cast<time_t>(req->GetInterval()) <= ServerInstance->Time())
+		{
+			query->server->failures++;
+			query->server->lastfailure = ServerInstance->Time();
+			query->server->stats_timeouts++;
+		}
+		ReleaseQuery(req->id);
+	}
+
+	/** Cancels all requests which were created by the specified module. */
+	void RemoveRequests(Module* mod)
+	{
+		std::vector<DNS::Request*> removed;
+		for (const auto& [_, id] : this->inflight)
+		{
+			for (auto* req : this->pending[id]->requests)
+			{
+				if (req->creator == mod)
+					removed.push_back(req);
+			}
+		}
+
+		for (auto* req : removed)
+		{
+			Query rr(req->question);
+			rr.error = ERROR_UNLOADED;
+			req->OnError(&rr);
+
+			delete req;
+		}
 	}
 
 	std::string GetErrorStr(Error e) override
@@ -619,6 +1069,8 @@ public:
 				return "AAAA";
 			case QUERY_CNAME:
 				return "CNAME";
+			case QUERY_SOA:
+				return "SOA";
 			case QUERY_PTR:
 				return "PTR";
 			case QUERY_TXT:
@@ -630,31 +1082,17 @@ public:
 		}
 	}
 
-	void OnEventHandlerError(int errcode) override
-	{
-		ServerInstance->Logs.Debug(MODNAME, "UDP socket got an error event");
-	}
-
-	void OnEventHandlerRead() override
+	/** Handles an answer received from a nameserver.
+	 * @param from The address of the nameserver the answer was received from.
+	 * @param buffer The answer packet.
+	 * @param length The length of the answer packet.
+	 * @param tcp Whether the answer was received over TCP.
+	 */
+	void HandleAnswer(const irc::sockets::sockaddrs& from, const unsigned char* buffer, unsigned short length, bool tcp)
 	{
-		unsigned char buffer[524];
-		irc::sockets::sockaddrs from(false);
-		socklen_t x = sizeof(from);
-
-		ssize_t length = SocketEngine::RecvFrom(this, buffer, sizeof(buffer), 0, &from.sa, &x);
-
 		if (length < Packet::HEADER_LENGTH)
 			return;
 
-		if (myserver != from)
-		{
-			std::string server1 = from.str();
-			std::string server2 = myserver.str();
-			ServerInstance->Logs.Debug(MODNAME, "Got a result from the wrong server! Bad NAT or DNS forging attempt? '{}' != '{}'",
-				server1, server2);
-			return;
-		}
-
 		Packet recv_packet(creator);
 		bool valid = false;
 
@@ -669,32 +1107,64 @@ public:
 		}
 
 		// recv_packet.id must be filled in here
-		DNS::Request* request = this->requests[recv_packet.id];
-		if (!request)
+		PendingQuery* pquery = this->pending[recv_packet.id].get();
+		if (!pquery)
 		{
 			ServerInstance->Logs.Debug(MODNAME, "Received an answer for something we didn't request");
 			return;
 		}
 
-		if (request->question != recv_packet.question)
+		if (pquery->server->addr != from)
+		{
+			std::string server1 = from.str();
+			std::string server2 = pquery->server->addr.str();
+			ServerInstance->Logs.Debug(MODNAME, "Got a result from the wrong server! Bad NAT or DNS forging attempt? '{}' != '{}'",
+				server1, server2);
+			return;
+		}
+
+		if (pquery->question != recv_packet.question)
 		{
 			// This can happen under high latency, drop it silently, do not fail the request
 			ServerInstance->Logs.Debug(MODNAME, "Received an answer that isn't for a question we asked");
 			return;
 		}
 
+		if (pquery->tcp && !tcp)
+		{
+			ServerInstance->Logs.Debug(MODNAME, "Ignoring UDP answer for a question being asked over TCP");
+			return;
+		}
+
+		if (valid && !tcp && (recv_packet.flags & QUERYFLAGS_TC))
+		{
+			// The answer did not fit in a UDP packet so ask again over TCP. If we can't connect
+			// then fall back to using the truncated answer.
+			ServerInstance->Logs.Debug(MODNAME, "Answer for {} was truncated, retrying over TCP", recv_packet.question.name);
+			pquery->tcp = std::make_unique<TCPQuery>(*this, recv_packet.id, pquery->server->addr, pquery->packet);
+			if (pquery->tcp->HasFd())
+			{
+				this->stats_tcp++;
+				return;
+			}
+			CloseTCP(*pquery);
+		}
+
+		// The TCP connection of the pending query is culled rather than deleted as we might be
+		// inside one of its event handlers.
+		std::unique_ptr<PendingQuery> query = ReleaseQuery(recv_packet.id);
+		query->server->failures = 0;
+
 		if (!valid)
 		{
 			this->stats_failure++;
 			recv_packet.error = ERROR_MALFORMED;
-			request->OnError(&recv_packet);
 		}
 		else if (recv_packet.flags & QUERYFLAGS_OPCODE)
 		{
 			ServerInstance->Logs.Debug(MODNAME, "Received a nonstandard query");
 			this->stats_failure++;
 			recv_packet.error = ERROR_NONSTANDARD_QUERY;
-			request->OnError(&recv_packet);
 		}
 		else if (!(recv_packet.flags & QUERYFLAGS_QR) || (recv_packet.flags & QUERYFLAGS_RCODE))
 		{
@@ -728,39 +1198,61 @@ public:
 
 			this->stats_failure++;
 			recv_packet.error = error;
-			request->OnError(&recv_packet);
 		}
 		else if (recv_packet.answers.empty())
 		{
 			ServerInstance->Logs.Debug(MODNAME, "No resource records returned");
 			this->stats_failure++;
 			recv_packet.error = ERROR_NO_RECORDS;
-			request->OnError(&recv_packet);
 		}
 		else
 		{
-			ServerInstance->Logs.Debug(MODNAME, "Lookup complete for " + request->question.name);
+			ServerInstance->Logs.Debug(MODNAME, "Lookup complete for " + recv_packet.question.name);
 			this->stats_success++;
-			request->OnLookupComplete(&recv_packet);
-			this->AddCache(recv_packet);
 		}
 
 		this->stats_total++;
 
-		/* Request's destructor removes it from the request map */
-		delete request;
+		for (auto* request : query->requests)
+		{
+			if (recv_packet.error == ERROR_NONE)
+				request->OnLookupComplete(&recv_packet);
+			else
+				request->OnError(&recv_packet);
+
+			/* Request's destructor tries to remove it from the pending query but it has already been released */
+			delete request;
+		}
+
+		if (recv_packet.error == ERROR_NONE)
+			this->AddCache(recv_packet);
+		else if (recv_packet.error == ERROR_DOMAIN_NOT_FOUND || recv_packet.error == ERROR_NO_RECORDS)
+			this->AddNegativeCache(recv_packet);
 	}
 
+	void OnTCPAnswer(RequestId id, const unsigned char* buffer, unsigned short length)
+	{
+		HandleAnswer(this->pending[id]->server->addr, buffer, length, true);
+	}
+
+	void OnTCPError(RequestId id)
+	{
+		ServerInstance->Logs.Debug(MODNAME, "TCP connection for request {} failed", id);
+		FailQuery(id, ERROR_SERVER_FAILURE);
+		this->stats_total++;
+	}
+
+
 	bool Tick() override
 	{
 		unsigned long expired = 0;
-		for (cache_map::iterator it = this->cache.begin(); it != this->cache.end(); )
+		for (cache_list::iterator it = this->cachelru.begin(); it != this->cachelru.end(); )
 		{
-			const Query& query = it->second;
-			if (IsExpired(query))
+			if (IsExpired(*it))
 			{
 				expired++;
-				this->cache.erase(it++);
+				this->cache.erase(it->query.question);
+				it = this->cachelru.erase(it);
 			}
 			else
 				++it;
@@ -772,59 +1264,136 @@ public:
 		return true;
 	}
 
-	void Rehash(const std::string& dnsserver, std::string sourceaddr, in_port_t sourceport)
+	void SetCacheSize(size_t newsize)
 	{
-		myserver.from_ip_port(dnsserver, DNS::PORT);
+		this->cachesize = newsize;
+		this->TrimCache(newsize);
+	}
+
+	size_t GetCacheCount() const
+	{
+		return this->cachelru.size();
+	}
 
-		/* Initialize mastersocket */
+	const std::vector<std::shared_ptr<Nameserver>>& GetNameservers() const
+	{
+		return this->nameservers;
+	}
+
+	void Rehash(const std::string& dnsservers, const std::string& sourceaddr, in_port_t sourceport)
+	{
+		/* Initialize mastersockets */
 		Close();
-		int s = socket(myserver.family(), SOCK_DGRAM, 0);
-		this->SetFd(s);
+		this->nameservers.clear();
 
-		/* Have we got a socket? */
-		if (this->HasFd())
-		{
-			SocketEngine::SetOption<int>(s, SOL_SOCKET, SO_REUSEADDR, 1);
-			SocketEngine::NonBlocking(s);
+		irc::sockets::sockaddrs bindto4;
+		bindto4.from_ip_port("0.0.0.0", sourceport);
 
-			if (sourceaddr.empty())
-			{
-				// set a sourceaddr based on the servers af type
-				if (myserver.family() == AF_INET)
-					sourceaddr = "0.0.0.0";
-				else if (myserver.family() == AF_INET6)
-					sourceaddr = "::";
-			}
+		irc::sockets::sockaddrs bindto6;
+		bindto6.from_ip_port("::", sourceport);
 
+		int sourcefamily = AF_UNSPEC;
+		if (!sourceaddr.empty())
+		{
 			irc::sockets::sockaddrs bindto;
 			bindto.from_ip_port(sourceaddr, sourceport);
+			sourcefamily = bindto.family();
+			if (sourcefamily == AF_INET6)
+				bindto6 = bindto;
+			else
+				bindto4 = bindto;
+		}
 
-			if (SocketEngine::Bind(this, bindto) < 0)
-			{
-				/* Failed to bind */
-				ServerInstance->Logs.Critical(MODNAME, "Error binding dns socket - hostnames will NOT resolve");
-				SocketEngine::Close(this->GetFd());
-				this->SetFd(-1);
-			}
-			else if (!SocketEngine::AddFd(this, FD_WANT_POLL_READ | FD_WANT_NO_WRITE))
+		irc::spacesepstream serverstream(dnsservers);
+		for (std::string dnsserver; serverstream.GetToken(dnsserver); )
+		{
+			irc::sockets::sockaddrs addr;
+			if (!addr.from_ip_port(dnsserver, DNS::PORT))
 			{
-				ServerInstance->Logs.Critical(MODNAME, "Internal error starting DNS - hostnames will NOT resolve.");
-				SocketEngine::Close(this->GetFd());
-				this->SetFd(-1);
+				ServerInstance->Logs.Warning(MODNAME, "Ignoring invalid nameserver address: {}", dnsserver);
+				continue;
 			}
 
-			if (bindto.family() != myserver.family())
+			if (sourcefamily != AF_UNSPEC && addr.family() != sourcefamily)
 				ServerInstance->Logs.Warning(MODNAME, "Nameserver address family differs from source address family - hostnames might not resolve");
-		}
-		else
-		{
-			ServerInstance->Logs.Critical(MODNAME, "Error creating DNS socket - hostnames will NOT resolve");
+
+			UDPSocket& sock = GetSocket(addr.family());
+			if (!sock.HasFd() && !sock.Open(addr.family() == AF_INET6 ? bindto6 : bindto4))
+				continue;
+
+			this->nameservers.push_back(std::make_shared<Nameserver>(addr));
 		}
 	}
 };
 
+void UDPSocket::OnEventHandlerRead()
+{
+	unsigned char buffer[524];
+	irc::sockets::sockaddrs from(false);
+	socklen_t x = sizeof(from);
+
+	ssize_t length = SocketEngine::RecvFrom(this, buffer, sizeof(buffer), 0, &from.sa, &x);
+	if (length > 0)
+		manager.HandleAnswer(from, buffer, length, false);
+}
+
+void TCPQuery::OnEventHandlerError(int errcode)
+{
+	// This will close this connection so return immediately.
+	manager.OnTCPError(id);
+}
+
+void TCPQuery::OnEventHandlerRead()
+{
+	char buffer[4096];
+	ssize_t length = SocketEngine::Recv(this, buffer, sizeof(buffer), 0);
+	if (length <= 0)
+	{
+		if (length < 0 && SocketEngine::IgnoreError())
+			return;
+
+		// This will close this connection so return immediately.
+		manager.OnTCPError(id);
+		return;
+	}
+
+	recvq.append(buffer, length);
+	if (recvq.length() < 2)
+		return;
+
+	const size_t answerlen = static_cast<unsigned char>(recvq[0]) << 8 | static_cast<unsigned char>(recvq[1]);
+	if (recvq.length() < answerlen + 2)
+		return;
+
+	// This will close this connection so return immediately.
+	const unsigned char* answer = reinterpret_cast<const unsigned char*>(recvq.data() + 2);
+	if (answerlen < 2 || (answer[0] << 8 | answer[1]) != id)
+		manager.OnTCPError(id);
+	else
+		manager.OnTCPAnswer(id, answer, answerlen);
+}
+
+void TCPQuery::OnEventHandlerWrite()
+{
+	ssize_t length = SocketEngine::Send(this, sendq.data(), sendq.length(), 0);
+	if (length < 0)
+	{
+		if (SocketEngine::IgnoreError())
+			return;
+
+		// This will close this connection so return immediately.
+		manager.OnTCPError(id);
+		return;
+	}
+
+	sendq.erase(0, length);
+	if (sendq.empty())
+		SocketEngine::ChangeEventMask(this, FD_WANT_POLL_READ | FD_WANT_NO_WRITE);
+}
+
 class ModuleDNS final
 	: public Module
+	, public Metrics::EventListener
 	, public Stats::EventListener
 {
 	MyManager manager;
@@ -853,14 +1422,21 @@ class ModuleDNS final
 			if (pFixedInfo)
 			{
 				if (GetNetworkParams(pFixedInfo, &dwBufferSize) == NO_ERROR)
-					DNSServer = pFixedInfo->DnsServerList.IpAddress.String;
+				{
+					for (PIP_ADDR_STRING addr = &pFixedInfo->DnsServerList; addr; addr = addr->Next)
+					{
+						if (!DNSServer.empty())
+							DNSServer.push_back(' ');
+						DNSServer.append(addr->IpAddress.String);
+					}
+				}
 
 				HeapFree(GetProcessHeap(), 0, pFixedInfo);
 			}
 
 			if (!DNSServer.empty())
 			{
-				ServerInstance->Logs.Normal(MODNAME, "<dns:server> set to '{}' as first active resolver in the system settings.", DNSServer);
+				ServerInstance->Logs.Normal(MODNAME, "<dns:server> set to '{}' from the active resolvers in the system settings.", DNSServer);
 				return;
 			}
 		}
@@ -872,19 +1448,27 @@ class ModuleDNS final
 
 		std::ifstream resolv("/etc/resolv.conf");
 
-		while (resolv >> DNSServer)
+		std::string token;
+		while (resolv >> token)
 		{
-			if (DNSServer == "nameserver")
+			if (token == "nameserver")
 			{
-				resolv >> DNSServer;
-				if (DNSServer.find_first_not_of("0123456789.") == std::string::npos || DNSServer.find_first_not_of("0123456789ABCDEFabcdef:") == std::string::npos)
+				resolv >> token;
+				if (token.find_first_not_of("0123456789.") == std::string::npos || token.find_first_not_of("0123456789ABCDEFabcdef:") == std::string::npos)
 				{
-					ServerInstance->Logs.Normal(MODNAME, "<dns:server> set to '{}' as first resolver in /etc/resolv.conf.", DNSServer);
-					return;
+					if (!DNSServer.empty())
+						DNSServer.push_back(' ');
+					DNSServer.append(token);
 				}
 			}
 		}
 
+		if (!DNSServer.empty())
+		{
+			ServerInstance->Logs.Normal(MODNAME, "<dns:server> set to '{}' from the resolvers in /etc/resolv.conf.", DNSServer);
+			return;
+		}
+
 		ServerInstance->Logs.Warning(MODNAME, "/etc/resolv.conf contains no viable nameserver entries! Defaulting to nameserver '127.0.0.1'!");
 #endif
 		DNSServer = "127.0.0.1";
@@ -893,6 +1477,7 @@ class ModuleDNS final
 public:
 	ModuleDNS()
 		: Module(VF_CORE | VF_VENDOR, "Provides support for DNS lookups")
+		, Metrics::EventListener(this)
 		, Stats::EventListener(this)
 		, manager(this)
 	{
@@ -912,6 +1497,8 @@ public:
 			return;
 		}
 
+		this->manager.SetCacheSize(tag->getNum<size_t>("cachesize", 1000));
+
 		const std::string oldserver = DNSServer;
 		DNSServer = tag->getString("server");
 
@@ -932,29 +1519,52 @@ public:
 	{
 		if (stats.GetSymbol() == 'T')
 		{
-			stats.AddGenericRow(INSP_FORMAT("DNS requests: {} ({} succeeded, {} failed)",
-				manager.stats_total, manager.stats_success, manager.stats_failure));
+			stats.AddGenericRow(INSP_FORMAT("DNS requests: {} ({} succeeded, {} failed, {} coalesced, {} retried over TCP)",
+				manager.stats_total, manager.stats_success, manager.stats_failure, manager.stats_coalesced, manager.stats_tcp));
+			for (const auto& ns : manager.GetNameservers())
+			{
+				stats.AddGenericRow(INSP_FORMAT("DNS server {}: {} queries, {} timed out ({} in a row)",
+					ns->addr.addr(), ns->stats_sent, ns->stats_timeouts, ns->failures));
+			}
+			stats.AddGenericRow(INSP_FORMAT("DNS cache: {}/{} entries ({} hits, {} misses, {} evicted)",
+				manager.GetCacheCount(), manager.cachesize, manager.stats_cachehits, manager.stats_cachemisses,
+				manager.stats_cacheevicted));
 		}
 		return MOD_RES_PASSTHRU;
 	}
 
-	void OnUnloadModule(Module* mod) override
+	void OnCollectMetrics(Metrics::Writer& writer) override
 	{
-		for (unsigned int i = 0; i <= MAX_REQUEST_ID; ++i)
-		{
-			DNS::Request* req = this->manager.requests[i];
-			if (!req)
-				continue;
+		writer.Family(Metrics::Type::COUNTER, "inspircd_dns_requests", "DNS requests by result.")
+			.Sample("result", "success", manager.stats_success)
+			.Sample("result", "failure", manager.stats_failure)
+			.Sample("result", "coalesced", manager.stats_coalesced);
 
-			if (req->creator == mod)
-			{
-				Query rr(req->question);
-				rr.error = ERROR_UNLOADED;
-				req->OnError(&rr);
+		writer.Family(Metrics::Type::COUNTER, "inspircd_dns_tcp_retries", "DNS requests retried over TCP.")
+			.Sample(manager.stats_tcp);
 
-				delete req;
-			}
-		}
+		writer.Family(Metrics::Type::COUNTER, "inspircd_dns_server_queries", "Queries sent to each DNS server.");
+		for (const auto& ns : manager.GetNameservers())
+			writer.Sample("server", ns->addr.addr(), ns->stats_sent);
+
+		writer.Family(Metrics::Type::COUNTER, "inspircd_dns_server_timeouts", "Queries to each DNS server which timed out.");
+		for (const auto& ns : manager.GetNameservers())
+			writer.Sample("server", ns->addr.addr(), ns->stats_timeouts);
+
+		writer.Family(Metrics::Type::GAUGE, "inspircd_dns_cache_entries", "Entries in the DNS cache.")
+			.Sample(manager.GetCacheCount());
+
+		writer.Family(Metrics::Type::COUNTER, "inspircd_dns_cache_lookups", "DNS cache lookups by result.")
+			.Sample("result", "hit", manager.stats_cachehits)
+			.Sample("result", "miss", manager.stats_cachemisses);
+
+		writer.Family(Metrics::Type::COUNTER, "inspircd_dns_cache_evictions", "DNS cache entries evicted to make room for new ones.")
+			.Sample(manager.stats_cacheevicted);
+	}
+
+	void OnUnloadModule(Module* mod) override
+	{
+		this->manager.RemoveRequests(mod);
 	}
 };
 
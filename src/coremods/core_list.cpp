@@ -25,8 +25,227 @@
 
 
 #include "inspircd.h"
+#include "extension.h"
 #include "modules/isupport.h"
 
+namespace
+{
+	/** Counts the elements in a range stopping once the limit is reached.
+	 * @param begin The start of the range.
+	 * @param end The end of the range.
+	 * @param limit The maximum number of elements to count.
+	 */
+	template <typename Iterator>
+	size_t CountRange(Iterator begin, Iterator end, size_t limit)
+	{
+		size_t count = 0;
+		for (; begin != end && count < limit; ++begin)
+			count++;
+		return count;
+	}
+
+	/** Retrieves the literal prefix of a glob pattern. */
+	std::string_view GetLiteralPrefix(const std::string& mask)
+	{
+		return std::string_view(mask).substr(0, mask.find_first_of("*?"));
+	}
+
+	/** Determines whether a string case insensitively starts with a prefix. */
+	bool HasPrefix(const std::string& str, const std::string_view& prefix)
+	{
+		return irc::equals(std::string_view(str).substr(0, prefix.size()), prefix);
+	}
+
+	/** Retrieves the channels from an index which have a value between two bounds.
+	 * @param set The index to search.
+	 * @param min If non-zero then the value which all channels must be greater than.
+	 * @param max If non-zero then the value which all channels must be less than.
+	 */
+	template <typename T>
+	auto GetRange(const ChannelIndex::ValueSet<T>& set, T min, T max)
+	{
+		if (min && max && min + 1 >= max)
+			return std::make_pair(set.end(), set.end());
+
+		auto begin = min ? set.lower_bound({ min + 1, nullptr }) : set.begin();
+		auto end = max ? set.lower_bound({ max, nullptr }) : set.end();
+		return std::make_pair(begin, end);
+	}
+
+	/** Retrieves the channels from a name or topic index which start with a prefix. */
+	template <typename Set, typename Field>
+	void GetPrefixed(const Set& set, const std::string_view& prefix, Field field, std::vector<Channel*>& candidates)
+	{
+		for (auto it = set.lower_bound(prefix); it != set.end() && HasPrefix((*it)->*field, prefix); ++it)
+			candidates.push_back(*it);
+	}
+}
+
+/** Holds the constraints a channel must match to be shown in a LIST response. */
+struct ListFilter final
+{
+	// C: Searching based on creation time, via the "C<val" and "C>val" modifiers
+	// to search for a channel creation time that is lower or higher than val
+	// respectively.
+	time_t mincreationtime = 0;
+	time_t maxcreationtime = 0;
+
+	// M: Searching based on mask.
+	std::string match;
+
+	// N: Searching based on !mask.
+	std::string notmatch;
+
+	// T: Searching based on topic time, via the "T<val" and "T>val" modifiers to
+	// search for a topic time that is lower or higher than val respectively.
+	time_t mintopictime = 0;
+	time_t maxtopictime = 0;
+
+	// U: Searching based on user count within the channel, via the "<val" and
+	// ">val" modifiers to search for a channel that has less than or more than
+	// val users respectively.
+	size_t minusers = 0;
+	size_t maxusers = 0;
+
+	/** Determines whether a channel matches this filter. */
+	bool Matches(const Channel* chan) const
+	{
+		// Check the user count if a search has been specified.
+		const size_t users = chan->GetUsers().size();
+		if ((minusers && users <= minusers) || (maxusers && users >= maxusers))
+			return false;
+
+		// Check the creation ts if a search has been specified.
+		const time_t creationtime = chan->age;
+		if ((mincreationtime && creationtime <= mincreationtime) || (maxcreationtime && creationtime >= maxcreationtime))
+			return false;
+
+		// Check the topic ts if a search has been specified.
+		const time_t topictime = chan->topicset;
+		if ((mintopictime && (!topictime || topictime <= mintopictime)) || (maxtopictime && (!topictime || topictime >= maxtopictime)))
+			return false;
+
+		// Attempt to match a glob pattern.
+		if (!match.empty() && !InspIRCd::Match(chan->name, match) && !InspIRCd::Match(chan->topic, match))
+			return false;
+
+		// Attempt to match an inverted glob pattern.
+		if (!notmatch.empty() && (InspIRCd::Match(chan->name, notmatch) || InspIRCd::Match(chan->topic, notmatch)))
+			return false;
+
+		return true;
+	}
+
+	/** Finds the channels which might match this filter using the smallest
+	 * applicable range from the channel index.
+	 * @param candidates The vector to store candidate channels in. All of
+	 *                   these still need to be checked with Matches().
+	 */
+	void FindCandidates(std::vector<Channel*>& candidates) const
+	{
+		ChannelIndex& index = ServerInstance->Channels.GetIndex();
+		const auto users = GetRange(index.GetUsers(), minusers, maxusers);
+		const auto ages = GetRange(index.GetAges(), mincreationtime, maxcreationtime);
+		const auto topictimes = GetRange(index.GetTopicTimes(), mintopictime, maxtopictime);
+
+		// Pick whichever index yields the fewest candidates. Counting stops
+		// as soon as an index is known to be no better than the current one.
+		std::function<void()> source;
+		size_t best = ServerInstance->Channels.GetChans().size();
+		auto consider = [&](size_t count, std::function<void()> newsource)
+		{
+			if (count < best)
+			{
+				best = count;
+				source = std::move(newsource);
+			}
+		};
+
+		const std::string_view prefix = GetLiteralPrefix(match);
+		if (!prefix.empty())
+		{
+			// A mask can match either the channel name or the channel topic.
+			size_t count = 0;
+			for (auto it = index.GetNames().lower_bound(prefix); it != index.GetNames().end() && count < best && HasPrefix((*it)->name, prefix); ++it)
+				count++;
+			for (auto it = index.GetTopics().lower_bound(prefix); it != index.GetTopics().end() && count < best && HasPrefix((*it)->topic, prefix); ++it)
+				count++;
+
+			consider(count, [&]()
+			{
+				GetPrefixed(index.GetNames(), prefix, &Channel::name, candidates);
+				GetPrefixed(index.GetTopics(), prefix, &Channel::topic, candidates);
+
+				// A channel can be in both the name and topic ranges.
+				std::sort(candidates.begin(), candidates.end());
+				candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+			});
+		}
+
+		auto consider_range = [&](bool active, const auto& range)
+		{
+			if (!active)
+				return;
+
+			consider(CountRange(range.first, range.second, best), [&candidates, range]()
+			{
+				for (auto it = range.first; it != range.second; ++it)
+					candidates.push_back(it->second);
+			});
+		};
+		consider_range(minusers || maxusers, users);
+		consider_range(mincreationtime || maxcreationtime, ages);
+		consider_range(mintopictime || maxtopictime, topictimes);
+
+		candidates.reserve(best);
+		if (source)
+		{
+			source();
+			return;
+		}
+
+		// No index is more selective than checking every channel.
+		for (const auto& [_, chan] : ServerInstance->Channels.GetChans())
+			candidates.push_back(chan);
+	}
+};
+
+class CommandList;
+
+/** Sends the remainder of a LIST response once the user's sendq has drained. */
+class ListStream final
+	: public Timer
+{
+private:
+	/** The command which created this stream. */
+	CommandList& cmd;
+
+	/** The user who requested the list. */
+	LocalUser* const user;
+
+public:
+	/** The constraints the listed channels must match. */
+	const ListFilter filter;
+
+	/** Whether the user can see secret and private channels. */
+	const bool has_privs;
+
+	/** The names of the channels which have not been checked yet. */
+	std::deque<std::string> channels;
+
+	ListStream(CommandList& c, LocalUser* u, const ListFilter& f, bool privs)
+		: Timer(1, true)
+		, cmd(c)
+		, user(u)
+		, filter(f)
+		, has_privs(privs)
+	{
+		ServerInstance->Timers.AddTimer(this);
+	}
+
+	bool Tick() override;
+};
+
 class CommandList final
 	: public Command
 {
@@ -46,7 +265,19 @@ private:
 		return ServerInstance->Time() - (minutes * 60);
 	}
 
+	/** Determines whether the sendq of a user is too full to send more list entries. */
+	static bool IsSendQFull(LocalUser* user)
+	{
+		return user->eh.GetSendQSize() >= user->GetClass()->hardsendqmax / 2;
+	}
+
+	/** Writes a single RPL_LIST numeric for a channel. */
+	void WriteChannel(User* user, Channel* chan, bool has_privs);
+
 public:
+	// The pending list responses of users who have a full sendq.
+	SimpleExtItem<ListStream> streamext;
+
 	// Whether to show modes in the LIST response.
 	bool showmodes;
 
@@ -54,38 +285,79 @@ public:
 		: Command(parent, "LIST")
 		, secretmode(creator, "secret")
 		, privatemode(creator, "private")
+		, streamext(parent, "list-stream", ExtensionType::USER)
 	{
 		penalty = 5000;
 	}
 
+	/** Sends pending list entries to a user until their sendq fills up.
+	 * @param user The user to send list entries to.
+	 * @param stream The pending list response.
+	 * @return True if the list response has been completed; otherwise, false.
+	 */
+	bool ContinueList(LocalUser* user, ListStream& stream);
+
 	CmdResult Handle(User* user, const Params& parameters) override;
 };
 
-CmdResult CommandList::Handle(User* user, const Params& parameters)
+bool ListStream::Tick()
 {
-	// C: Searching based on creation time, via the "C<val" and "C>val" modifiers
-	// to search for a channel creation time that is lower or higher than val
-	// respectively.
-	time_t mincreationtime = 0;
-	time_t maxcreationtime = 0;
+	if (!cmd.ContinueList(user, *this))
+		return true;
 
-	// M: Searching based on mask.
-	std::string match;
+	// This deletes the stream so we must not touch any members after it.
+	cmd.streamext.Unset(user);
+	return false;
+}
 
-	// N: Searching based on !mask.
-	std::string notmatch;
+void CommandList::WriteChannel(User* user, Channel* chan, bool has_privs)
+{
+	// if the channel is not private/secret, OR the user is on the channel anyway
+	bool n = (has_privs || chan->HasUser(user));
 
-	// T: Searching based on topic time, via the "T<val" and "T>val" modifiers to
-	// search for a topic time that is lower or higher than val respectively.
-	time_t mintopictime = 0;
-	time_t maxtopictime = 0;
+	// If we're not in the channel and +s is set on it, we want to ignore it
+	if ((n) || (!chan->IsModeSet(secretmode)))
+	{
+		const size_t users = chan->GetUsers().size();
+		if ((!n) && (chan->IsModeSet(privatemode)))
+		{
+			// Channel is private (+p) and user is outside/not privileged
+			user->WriteNumeric(RPL_LIST, '*', users, "");
+		}
+		else if (showmodes)
+		{
+			// Show the list response with the modes and topic.
+			user->WriteNumeric(RPL_LIST, chan->name, users, INSP_FORMAT("[+{}] {}", chan->ChanModes(n), chan->topic));
+		}
+		else
+		{
+			// Show the list response with just the modes.
+			user->WriteNumeric(RPL_LIST, chan->name, users, chan->topic);
+		}
+	}
+}
 
-	// U: Searching based on user count within the channel, via the "<val" and
-	// ">val" modifiers to search for a channel that has less than or more than
-	// val users respectively.
-	size_t minusers = 0;
-	size_t maxusers = 0;
+bool CommandList::ContinueList(LocalUser* user, ListStream& stream)
+{
+	while (!stream.channels.empty())
+	{
+		if (IsSendQFull(user))
+			return false;
+
+		// The channel may have been destroyed since the list was requested.
+		Channel* chan = ServerInstance->Channels.Find(stream.channels.front());
+		stream.channels.pop_front();
+		if (chan && stream.filter.Matches(chan))
+			WriteChannel(user, chan, stream.has_privs);
+	}
+
+	user->WriteNumeric(RPL_LISTEND, "End of channel list.");
+	return true;
+}
 
+CmdResult CommandList::Handle(User* user, const Params& parameters)
+{
+	ListFilter filter;
 	if (!parameters.empty())
 	{
 		irc::commasepstream constraints(parameters[0]);
@@ -93,92 +365,71 @@ CmdResult CommandList::Handle(User* user, const Params& parameters)
 		{
 			if (constraint[0] == '<')
 			{
-				maxusers = ConvToNum<size_t>(constraint.c_str() + 1);
+				filter.maxusers = ConvToNum<size_t>(constraint.c_str() + 1);
 			}
 			else if (constraint[0] == '>')
 			{
-				minusers = ConvToNum<size_t>(constraint.c_str() + 1);
+				filter.minusers = ConvToNum<size_t>(constraint.c_str() + 1);
 			}
 			else if (!constraint.compare(0, 2, "C<", 2) || !constraint.compare(0, 2, "c<", 2))
 			{
-				mincreationtime = ParseMinutes(constraint);
+				filter.mincreationtime = ParseMinutes(constraint);
 			}
 			else if (!constraint.compare(0, 2, "C>", 2) || !constraint.compare(0, 2, "c>", 2))
 			{
-				maxcreationtime = ParseMinutes(constraint);
+				filter.maxcreationtime = ParseMinutes(constraint);
 			}
 			else if (!constraint.compare(0, 2, "T<", 2) || !constraint.compare(0, 2, "t<", 2))
 			{
-				mintopictime = ParseMinutes(constraint);
+				filter.mintopictime = ParseMinutes(constraint);
 			}
 			else if (!constraint.compare(0, 2, "T>", 2) || !constraint.compare(0, 2, "t>", 2))
 			{
-				maxtopictime = ParseMinutes(constraint);
+				filter.maxtopictime = ParseMinutes(constraint);
 			}
 			else if (constraint[0] == '!')
 			{
 				// Ensure that the user didn't just run "LIST !".
 				if (constraint.length() > 2)
-					notmatch = constraint.substr(1);
+					filter.notmatch = constraint.substr(1);
 			}
 			else
 			{
-				match = constraint;
+				filter.match = constraint;
 			}
 		}
 	}
 
 	const bool has_privs = user->HasPrivPermission("channels/auspex");
 
-	user->WriteNumeric(RPL_LISTSTART, "Channel", "Users Name");
-
-	for (const auto& [_, chan] : ServerInstance->Channels.GetChans())
+	// A new list request replaces any which is still being sent.
+	LocalUser* luser = IS_LOCAL(user);
+	if (luser && streamext.Get(luser))
 	{
-		// Check the user count if a search has been specified.
-		const size_t users = chan->GetUsers().size();
-		if ((minusers && users <= minusers) || (maxusers && users >= maxusers))
-			continue;
-
-		// Check the creation ts if a search has been specified.
-		const time_t creationtime = chan->age;
-		if ((mincreationtime && creationtime <= mincreationtime) || (maxcreationtime && creationtime >= maxcreationtime))
-			continue;
-
-		// Check the topic ts if a search has been specified.
-		const time_t topictime = chan->topicset;
-		if ((mintopictime && (!topictime || topictime <= mintopictime)) || (maxtopictime && (!topictime || topictime >= maxtopictime)))
-			continue;
-
-		// Attempt to match a glob pattern.
-		if (!match.empty() && !InspIRCd::Match(chan->name, match) && !InspIRCd::Match(chan->topic, match))
-			continue;
-
-		// Attempt to match an inverted glob pattern.
-		if (!notmatch.empty() && (InspIRCd::Match(chan->name, notmatch) || InspIRCd::Match(chan->topic, notmatch)))
-			continue;
+		streamext.Unset(luser);
+		user->WriteNumeric(RPL_LISTEND, "End of channel list.");
+	}
 
-		// if the channel is not private/secret, OR the user is on the channel anyway
-		bool n = (has_privs || chan->HasUser(user));
+	user->WriteNumeric(RPL_LISTSTART, "Channel", "Users Name");
 
-		// If we're not in the channel and +s is set on it, we want to ignore it
-		if ((n) || (!chan->IsModeSet(secretmode)))
+	std::vector<Channel*> candidates;
+	filter.FindCandidates(candidates);
+	for (auto it = candidates.begin(); it != candidates.end(); ++it)
+	{
+		if (luser && IsSendQFull(luser))
 		{
-			if ((!n) && (chan->IsModeSet(privatemode)))
-			{
-				// Channel is private (+p) and user is outside/not privileged
-				user->WriteNumeric(RPL_LIST, '*', users, "");
-			}
-			else if (showmodes)
-			{
-				// Show the list response with the modes and topic.
-				user->WriteNumeric(RPL_LIST, chan->name, users, INSP_FORMAT("[+{}] {}", chan->ChanModes(n), chan->topic));
-			}
-			else
-			{
-				// Show the list response with just the modes.
-				user->WriteNumeric(RPL_LIST, chan->name, users, chan->topic);
-			}
+			// Send the rest of the list once the user has read what we have
+			// sent so far.
+			auto* stream = new ListStream(*this, luser, filter, has_privs);
+			for (; it != candidates.end(); ++it)
+				stream->channels.push_back((*it)->name);
+			streamext.Set(luser, stream);
+			return CmdResult::SUCCESS;
 		}
+
+		Channel* chan = *it;
+		if (filter.Matches(chan))
+			WriteChannel(user, chan, has_privs);
 	}
 	user->WriteNumeric(RPL_LISTEND, "End of channel list.");
 
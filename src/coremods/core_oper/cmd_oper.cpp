@@ -39,6 +39,8 @@ namespace
 
 CommandOper::CommandOper(Module* parent)
 	: SplitCommand(parent, "OPER", 2, 2)
+	, passwordchecker(parent, "password/async")
+	, pendingext(parent, "oper-pending", ExtensionType::USER)
 {
 	syntax = { "<username> <password>" };
 }
@@ -54,18 +56,64 @@ CmdResult CommandOper::HandleLocal(LocalUser* user, const Params& parameters)
 		return FailedOper(user, parameters[0]);
 	}
 
-	// Check whether the password is correct.
+	// Only allow one login attempt to be checked at a time.
+	if (pendingext.Get(user))
+	{
+		user->WriteNotice("*** Your previous attempt to log into an oper account is still being checked.");
+		return CmdResult::FAILURE;
+	}
+
+	// If the password is hashed with an expensive algorithm then check it without blocking the
+	// main thread and finish logging in once the result comes back.
 	auto account = it->second;
-	if (!account->CheckPassword(parameters[1]))
+	if (passwordchecker)
+	{
+		pendingext.Set(user);
+		const std::string uuid = user->uuid;
+		const bool async = passwordchecker->CheckPassword(account->GetPassword(), account->GetPasswordHash(), parameters[1], [this, uuid, account](bool validpass) {
+			auto* luser = ServerInstance->Users.FindUUID<LocalUser>(uuid);
+			if (!luser || luser->quitting || !pendingext.Get(luser))
+				return; // User quit whilst the password was being checked.
+
+			pendingext.Unset(luser);
+			CompleteLogin(luser, account, validpass);
+		});
+
+		if (async)
+			return CmdResult::SUCCESS;
+
+		pendingext.Unset(user);
+	}
+
+	return CompleteLogin(user, account, account->CheckPassword(parameters[1]));
+}
+
+CmdResult CommandOper::CompleteLogin(LocalUser* user, const std::shared_ptr<OperAccount>& account, bool validpass)
+{
+	// If the server was rehashed whilst the password was being checked then the account might
+	// have been removed or had its password changed.
+	auto it = ServerInstance->Config->OperAccounts.find(account->GetName());
+	if (it == ServerInstance->Config->OperAccounts.end())
+	{
+		ServerInstance->SNO.WriteGlobalSno('o', "{} ({}) [{}] failed to log into the \x02{}\x02 oper account because no account with that name exists.",
+			user->nick, user->GetRealUserHost(), user->GetAddress(), account->GetName());
+		return FailedOper(user, account->GetName());
+	}
+
+	if (it->second != account && (it->second->GetPassword() != account->GetPassword() || it->second->GetPasswordHash() != account->GetPasswordHash()))
+		validpass = false;
+
+	// Check whether the password is correct.
+	if (!validpass)
 	{
 		ServerInstance->SNO.WriteGlobalSno('o', "{} ({}) [{}] failed to log into the \x02{}\x02 oper account because they specified the wrong password.",
-			user->nick, user->GetRealUserHost(), user->GetAddress(), parameters[0]);
-		return FailedOper(user, parameters[0]);
+			user->nick, user->GetRealUserHost(), user->GetAddress(), account->GetName());
+		return FailedOper(user, account->GetName());
 	}
 
 	// Attempt to log the user into the account (modules will log if this fails).
-	if (!user->OperLogin(account))
-		return FailedOper(user, parameters[0]);
+	if (!user->OperLogin(it->second))
+		return FailedOper(user, account->GetName());
 
 	// If they have reached this point then the login succeeded,
 	return CmdResult::SUCCESS;
@@ -22,6 +22,8 @@
 #pragma once
 
 #include "inspircd.h"
+#include "extension.h"
+#include "modules/hash.h"
 
 enum
 {
@@ -69,6 +71,16 @@ public:
 class CommandOper final
 	: public SplitCommand
 {
+private:
+	/** Used to check hashed passwords without blocking the main thread. */
+	dynamic_reference_nocheck<AsyncPasswordChecker> passwordchecker;
+
+	/** Whether a user is waiting for their password to be checked. */
+	BoolExtItem pendingext;
+
+	/** Finishes logging a user into an oper account once their password has been checked. */
+	CmdResult CompleteLogin(LocalUser* user, const std::shared_ptr<OperAccount>& account, bool validpass);
+
 public:
 	CommandOper(Module* parent);
 	CmdResult HandleLocal(LocalUser* user, const Params& parameters) override;
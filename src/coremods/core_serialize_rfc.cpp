@@ -37,22 +37,21 @@ class RFCSerializer final
 	/** The maximum size of server-originated message tags in an outgoing message including the `@`. */
 	static constexpr std::string::size_type MAX_SERVER_MESSAGE_TAG_LENGTH = 4095;
 
-	static void SerializeTags(const ClientProtocol::TagMap& tags, const ClientProtocol::TagSelection& tagwl, std::string& line);
-
 public:
 	RFCSerializer(Module* mod)
 		: ClientProtocol::Serializer(mod, "rfc")
 	{
 	}
 
-	bool Parse(LocalUser* user, const std::string& line, ClientProtocol::ParseOutput& parseoutput) override;
-	ClientProtocol::SerializedMessage Serialize(const ClientProtocol::Message& msg, const ClientProtocol::TagSelection& tagwl) const override;
+	bool Parse(LocalUser* user, const std::string_view& line, ClientProtocol::ParseOutput& parseoutput) override;
+	std::string SerializeTags(const ClientProtocol::Message& msg, const ClientProtocol::TagSelection& tagwl) const override;
+	std::string SerializeBody(const ClientProtocol::Message& msg) const override;
 };
 
-bool RFCSerializer::Parse(LocalUser* user, const std::string& line, ClientProtocol::ParseOutput& parseoutput)
+bool RFCSerializer::Parse(LocalUser* user, const std::string_view& line, ClientProtocol::ParseOutput& parseoutput)
 {
 	size_t start = line.find_first_not_of(' ');
-	if (start == std::string::npos)
+	if (start == std::string_view::npos)
 	{
 		// Discourage the user from flooding the server.
 		user->CommandFloodPenalty += 2000;
@@ -154,8 +153,10 @@ namespace
 	}
 }
 
-void RFCSerializer::SerializeTags(const ClientProtocol::TagMap& tags, const ClientProtocol::TagSelection& tagwl, std::string& line)
+std::string RFCSerializer::SerializeTags(const ClientProtocol::Message& msg, const ClientProtocol::TagSelection& tagwl) const
 {
+	const ClientProtocol::TagMap& tags = msg.GetTags();
+	std::string line;
 	size_t client_tag_length = 0;
 	size_t server_tag_length = 0;
 	for (ClientProtocol::TagMap::const_iterator i = tags.begin(); i != tags.end(); ++i)
@@ -185,16 +186,12 @@ void RFCSerializer::SerializeTags(const ClientProtocol::TagMap& tags, const Clie
 
 	if (!line.empty())
 		line.push_back(' ');
+	return line;
 }
 
-ClientProtocol::SerializedMessage RFCSerializer::Serialize(const ClientProtocol::Message& msg, const ClientProtocol::TagSelection& tagwl) const
+std::string RFCSerializer::SerializeBody(const ClientProtocol::Message& msg) const
 {
 	std::string line;
-	SerializeTags(msg.GetTags(), tagwl, line);
-
-	// Save position for length calculation later
-	const std::string::size_type rfcmsg_begin = line.size();
-
 	if (msg.GetSource())
 	{
 		line.push_back(':');
@@ -218,8 +215,8 @@ ClientProtocol::SerializedMessage RFCSerializer::Serialize(const ClientProtocol:
 
 	// Truncate if too long
 	std::string::size_type maxline = ServerInstance->Config->Limits.MaxLine - 2;
-	if (line.length() - rfcmsg_begin > maxline)
-		line.erase(rfcmsg_begin + maxline);
+	if (line.length() > maxline)
+		line.erase(maxline);
 
 	line.append("\r\n", 2);
 	return line;
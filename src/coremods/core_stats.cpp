@@ -98,6 +98,87 @@ static void GenerateStatsLl(Stats::Context& stats)
 		stats.AddRow(211, u->nick+"["+u->GetDisplayedUser()+"@"+(stats.GetSymbol() == 'l' ? u->GetDisplayedHost() : u->GetAddress())+"] "+ConvToStr(u->eh.GetSendQSize())+" "+ConvToStr(u->cmds_out)+" "+ConvToStr(u->bytes_out)+" "+ConvToStr(u->cmds_in)+" "+ConvToStr(u->bytes_in)+" "+ConvToStr(ServerInstance->Time() - u->signon));
 }
 
+static std::string FormatProfile(const ProfileManager::Counter& counter)
+{
+	const double average = counter.calls ? static_cast<double>(counter.total) / counter.calls : 0;
+	return INSP_FORMAT("calls {} total {:.3f}ms avg {:.3f}us max {:.3f}us", counter.calls, counter.total / 1e6,
+		average / 1e3, counter.max / 1e3);
+}
+
+static void GenerateStatsProfile(Stats::Context& stats)
+{
+	const ProfileManager& profiler = ServerInstance->Profiler;
+	if (!profiler.IsEnabled())
+		stats.AddRow(249, "Profiling is disabled; the following statistics may be out of date.");
+
+	switch (stats.GetSymbol())
+	{
+		case 'r':
+		{
+			stats.AddRow(249, "Iterations: " + FormatProfile(profiler.GetIterations()));
+			const auto& phases = profiler.GetPhases();
+			for (size_t phase = 0; phase < phases.size(); ++phase)
+			{
+				const char* name = ProfileManager::GetPhaseName(static_cast<ProfileManager::Phase>(phase));
+				stats.AddRow(249, INSP_FORMAT("Phase {}: {}", name, FormatProfile(phases[phase])));
+			}
+
+			const auto& latency = profiler.GetLatency();
+			for (size_t bucket = 0; bucket < latency.size(); ++bucket)
+			{
+				if (!latency[bucket])
+					continue;
+
+				if (bucket + 1 == latency.size())
+					stats.AddRow(249, INSP_FORMAT("Latency {}us or more: {}", 1ULL << (bucket - 1), latency[bucket]));
+				else
+					stats.AddRow(249, INSP_FORMAT("Latency under {}us: {}", 1ULL << bucket, latency[bucket]));
+			}
+			break;
+		}
+
+		case 'M':
+		{
+			std::vector<const Command*> commands;
+			for (const auto& [_, command] : ServerInstance->Parser.GetCommands())
+			{
+				if (command->use_time.calls)
+					commands.push_back(command);
+			}
+
+			std::sort(commands.begin(), commands.end(), [](const Command* lhs, const Command* rhs) {
+				return lhs->use_time.total > rhs->use_time.total;
+			});
+			for (const auto* command : commands)
+				stats.AddRow(249, INSP_FORMAT("Command {}: {}", command->name, FormatProfile(command->use_time)));
+			break;
+		}
+
+		case 'h':
+		{
+			if (!profiler.IsProfilingHooks())
+				stats.AddRow(249, "Module event profiling is disabled; the following statistics may be out of date.");
+
+			std::vector<std::pair<const std::string*, const ProfileManager::HookCounter*>> hooks;
+			for (const auto& [modname, mod] : ServerInstance->Modules.GetModules())
+			{
+				for (const auto& hook : mod->hookstats)
+				{
+					if (hook.calls)
+						hooks.emplace_back(&modname, &hook);
+				}
+			}
+
+			std::sort(hooks.begin(), hooks.end(), [](const auto& lhs, const auto& rhs) {
+				return lhs.second->total > rhs.second->total;
+			});
+			for (const auto& [modname, hook] : hooks)
+				stats.AddRow(249, INSP_FORMAT("Module {} {}: {}", *modname, hook->name, FormatProfile(*hook)));
+			break;
+		}
+	}
+}
+
 void CommandStats::DoStats(Stats::Context& stats)
 {
 	User* const user = stats.GetSource();
@@ -334,6 +415,10 @@ void CommandStats::DoStats(Stats::Context& stats)
 			stats.AddRow(249, "connection count "+ConvToStr(ServerInstance->Stats.Connects));
 			stats.AddRow(249, INSP_FORMAT("bytes sent {:5.2}K recv {:5.2}K",
 				ServerInstance->Stats.Sent / 1024.0, ServerInstance->Stats.Recv / 1024.0));
+			stats.AddRow(249, INSP_FORMAT("sendq bytes shared {:5.2}K copied {:5.2}K",
+				ServerInstance->Stats.SendQShared / 1024.0, ServerInstance->Stats.SendQCopied / 1024.0));
+			stats.AddRow(249, INSP_FORMAT("queued bytes sendq {:5.2}K recvq {:5.2}K",
+				ServerInstance->Stats.SendQ / 1024.0, ServerInstance->Stats.RecvQ / 1024.0));
 		}
 		break;
 
@@ -344,6 +429,15 @@ void CommandStats::DoStats(Stats::Context& stats)
 			GenerateStatsLl(stats);
 		break;
 
+		/* stats r (show main loop profiling) */
+		case 'r':
+		/* stats M (show command profiling) */
+		case 'M':
+		/* stats h (show module event profiling) */
+		case 'h':
+			GenerateStatsProfile(stats);
+		break;
+
 		/* stats u (show server uptime) */
 		case 'u':
 		{
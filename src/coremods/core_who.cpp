@@ -45,6 +45,75 @@ enum
 static constexpr char whox_field_order[] = "tcuihsnfdlaor";
 static constexpr char who_field_order[] = "cuhsnf";
 
+// The flags which are handled by this module rather than by a Who::MatchEventListener.
+static constexpr char who_core_flags[] = "Aafhilmnoprstux";
+
+namespace
+{
+	/** Determines whether a string case insensitively ends with a suffix. */
+	bool HasSuffix(const std::string& str, const std::string_view& suffix)
+	{
+		if (str.size() < suffix.size())
+			return false;
+		return !UserIndex::CompareReversed(std::string_view(str).substr(str.size() - suffix.size()), suffix);
+	}
+
+	/** Retrieves the users from a host index which have a hostname ending with a suffix. */
+	template <typename Set>
+	void GetSuffixed(const Set& set, const std::string_view& suffix, std::vector<User*>& candidates)
+	{
+		for (auto it = set.lower_bound(suffix); it != set.end() && HasSuffix(Set::key_compare::GetHost(*it), suffix); ++it)
+			candidates.push_back(*it);
+	}
+}
+
+/** Keeps track of which users are logged into which accounts. */
+class AccountIndex final
+{
+private:
+	typedef std::multimap<std::string, User*, irc::insensitive_swo> AccountMap;
+
+	/** Logged in users ordered by their account name. */
+	AccountMap accounts;
+
+	/** The position of each logged in user within accounts. */
+	std::unordered_map<User*, AccountMap::iterator> positions;
+
+public:
+	/** Finds the users who are logged into an account starting with a prefix. */
+	void Find(const std::string& prefix, std::vector<User*>& candidates) const
+	{
+		for (auto it = accounts.lower_bound(prefix); it != accounts.end(); ++it)
+		{
+			if (!irc::equals(std::string_view(it->first).substr(0, prefix.size()), prefix))
+				break;
+			candidates.push_back(it->second);
+		}
+	}
+
+	/** Removes a user from the index. */
+	void Remove(User* user)
+	{
+		auto it = positions.find(user);
+		if (it == positions.end())
+			return;
+
+		accounts.erase(it->second);
+		positions.erase(it);
+	}
+
+	/** Updates the account of a user.
+	 * @param user The user whose account changed.
+	 * @param account The name of the account or an empty string if the user logged out.
+	 */
+	void Set(User* user, const std::string& account)
+	{
+		Remove(user);
+		if (!account.empty())
+			positions.emplace(user, accounts.emplace(account, user));
+	}
+};
+
 struct WhoData final
 	: public Who::Request
 {
@@ -203,7 +272,17 @@ private:
 	template<typename T>
 	void WhoUsers(LocalUser* source, const std::vector<std::string>& parameters, const T& users, WhoData& data);
 
+	/** Finds the users which might match a WHO request using the user indices.
+	 * @param source The user who sent the WHO request.
+	 * @param data The WHO request.
+	 * @param candidates The vector to store candidate users in. All of these
+	 *                   still need to be checked with MatchUser().
+	 * @return True if an index could be used; otherwise, false.
+	 */
+	bool FindCandidates(LocalUser* source, const WhoData& data, std::vector<User*>& candidates);
+
 public:
+	AccountIndex accounts;
 	insp::flat_map<char, std::string> oplevels;
 
 	CommandWho(Module* parent)
@@ -457,6 +536,101 @@ void CommandWho::WhoUsers(LocalUser* source, const std::vector<std::string>& par
 	}
 }
 
+bool CommandWho::FindCandidates(LocalUser* source, const WhoData& data, std::vector<User*>& candidates)
+{
+	// Modules can match users against their own flags in any way they want.
+	for (size_t flag = 0; flag < data.flags.size(); ++flag)
+	{
+		if (data.flags[flag] && (!flag || !strchr(who_core_flags, static_cast<char>(flag))))
+			return false;
+	}
+
+	// These checks must be kept in the same order as the ones in MatchUser.
+	const UserIndex& index = ServerInstance->Users.GetIndex();
+	const bool source_has_users_auspex = source->HasPrivPermission("users/auspex");
+	if (data.flags['A'])
+		return false; // Away messages are not indexed.
+
+	if (data.flags['a'])
+	{
+		const std::string prefix = data.matchtext.substr(0, data.matchtext.find_first_of("*?"));
+		if (prefix.empty())
+			return false;
+
+		accounts.Find(prefix, candidates);
+		return true;
+	}
+
+	if (data.flags['h'])
+	{
+		const size_t wildcard = data.matchtext.find_last_of("*?");
+		const std::string_view suffix = std::string_view(data.matchtext).substr(wildcard == std::string::npos ? 0 : wildcard + 1);
+		if (suffix.empty())
+			return false;
+
+		if (data.flags['x'] && source_has_users_auspex)
+		{
+			GetSuffixed(index.GetRealHosts(), suffix, candidates);
+			return true;
+		}
+
+		// The source can always match against their own real host.
+		GetSuffixed(index.GetDisplayedHosts(), suffix, candidates);
+		if (data.flags['x'] && !stdalgo::isin(candidates, static_cast<User*>(source)))
+			candidates.push_back(source);
+		return true;
+	}
+
+	if (data.flags['i'])
+	{
+		// Only users with the users/auspex privilege can match other users by IP address.
+		if (!source_has_users_auspex)
+		{
+			candidates.push_back(source);
+			return true;
+		}
+
+		if (data.matchtext.find_first_of("*?") != std::string::npos)
+			return false;
+
+		irc::sockets::sockaddrs sa(false);
+		if (!sa.from_ip(data.matchtext.substr(0, data.matchtext.rfind('/'))))
+			return false;
+
+		const irc::sockets::cidr_mask mask(data.matchtext);
+		const UserIndex::AddressSet& addresses = index.GetAddresses();
+		for (auto it = addresses.lower_bound(mask); it != addresses.end() && mask.match((*it)->client_sa); ++it)
+			candidates.push_back(*it);
+		return true;
+	}
+
+	if (data.flags['m'] || data.flags['n'] || data.flags['p'] || data.flags['r'])
+		return false; // Not indexed.
+
+	if (data.flags['s'])
+	{
+		bool show_real_server_name = ServerInstance->Config->HideServer.empty() || (source->HasPrivPermission("servers/auspex") && data.flags['x']);
+		if (!show_real_server_name)
+		{
+			// Every user appears to be on the same server so either all of them match or none do.
+			return !InspIRCd::Match(ServerInstance->Config->HideServer, data.matchtext, ascii_case_insensitive_map);
+		}
+
+		const UserIndex::ServerSet& servers = index.GetServers();
+		for (auto it = servers.begin(); it != servers.end(); )
+		{
+			const Server* server = (*it)->server;
+			auto end = servers.upper_bound(server);
+			if (InspIRCd::Match(server->GetName(), data.matchtext, ascii_case_insensitive_map))
+				candidates.insert(candidates.end(), it, end);
+			it = end;
+		}
+		return true;
+	}
+
+	return false;
+}
+
 void CommandWho::SendWhoLine(LocalUser* source, const std::vector<std::string>& parameters, Membership* memb, User* user, WhoData& data)
 {
 	if (!memb)
@@ -617,13 +791,25 @@ CmdResult CommandWho::HandleLocal(LocalUser* user, const Params& parameters)
 	if (data.matchchan)
 		WhoChannel(user, parameters, data);
 
-	// If we only want to match against opers we only have to iterate the oper list.
-	else if (data.flags['o'])
-		WhoUsers(user, parameters, ServerInstance->Users.all_opers, data);
-
-	// Otherwise we have to use the global user list.
 	else
-		WhoUsers(user, parameters, ServerInstance->Users.GetUsers(), data);
+	{
+		std::vector<User*> candidates;
+		if (FindCandidates(user, data, candidates))
+		{
+			// If we only want to match against opers we can skip everyone else.
+			if (data.flags['o'])
+				candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [](User* candidate) { return !candidate->IsOper(); }), candidates.end());
+			WhoUsers(user, parameters, candidates, data);
+		}
+
+		// If we only want to match against opers we only have to iterate the oper list.
+		else if (data.flags['o'])
+			WhoUsers(user, parameters, ServerInstance->Users.all_opers, data);
+
+		// Otherwise we have to use the global user list.
+		else
+			WhoUsers(user, parameters, ServerInstance->Users.GetUsers(), data);
+	}
 
 	// Send the results to the source.
 	for (const auto& numeric : data.results)
@@ -637,19 +823,52 @@ CmdResult CommandWho::HandleLocal(LocalUser* user, const Params& parameters)
 
 class CoreModWho final
 	: public Module
+	, public Account::EventListener
 	, public ISupport::EventListener
 {
 private:
+	Account::API accountapi;
 	CommandWho cmd;
 
 public:
 	CoreModWho()
 		: Module(VF_CORE | VF_VENDOR, "Provides the WHO command")
+		, Account::EventListener(this)
 		, ISupport::EventListener(this)
+		, accountapi(this)
 		, cmd(this)
 	{
 	}
 
+	void init() override
+	{
+		if (!accountapi)
+			return;
+
+		// Index the accounts of any users who logged in before we were loaded.
+		for (const auto& [_, user] : ServerInstance->Users.GetUsers())
+		{
+			const std::string* account = accountapi->GetAccountName(user);
+			if (account)
+				cmd.accounts.Set(user, *account);
+		}
+	}
+
+	void OnAccountChange(User* user, const std::string& account) override
+	{
+		cmd.accounts.Set(user, account);
+	}
+
+	void OnUserQuit(User* user, const std::string& message, const std::string& oper_message) override
+	{
+		cmd.accounts.Remove(user);
+	}
+
+	void OnUserDisconnect(LocalUser* user) override
+	{
+		cmd.accounts.Remove(user);
+	}
+
 	void OnBuildISupport(ISupport::TokenMap& tokens) override
 	{
 		tokens["WHOX"];
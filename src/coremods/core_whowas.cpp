@@ -42,32 +42,90 @@ enum
 
 namespace WhoWas
 {
+	/** Stores the strings used by entries. Each distinct string is only stored once no matter how
+	 * many entries use it as most entries share a server name and many share their hostnames,
+	 * usernames, and real names with other entries.
+	 */
+	class StringPool final
+	{
+	public:
+		/** Identifies a string in the pool. */
+		typedef uint32_t Id;
+
+		/** Adds a reference to a string, storing it if it is not already in the pool.
+		 * @param str The string to add.
+		 * @return The identifier of the string.
+		 */
+		Id Add(const std::string& str);
+
+		/** Retrieves a string from the pool.
+		 * @param id The identifier of the string.
+		 */
+		const std::string& Get(Id id) const { return slots[id].str; }
+
+		/** Retrieves the number of distinct strings in the pool. */
+		size_t GetCount() const { return index.size(); }
+
+		/** Retrieves the approximate amount of memory used by the pool in bytes. */
+		size_t GetMemory() const;
+
+		/** Removes a reference to a string, deleting it if it is no longer used.
+		 * @param id The identifier of the string.
+		 */
+		void Release(Id id);
+
+	private:
+		/** A string in the pool. */
+		struct Slot final
+		{
+			/** The value of the string. */
+			std::string str;
+
+			/** The number of references to the string. */
+			uint32_t refs = 0;
+		};
+
+		/** The strings in the pool. This is a deque so that the index can refer to the strings
+		 * without them moving when more are added.
+		 */
+		std::deque<Slot> slots;
+
+		/** Slots which are not in use. */
+		std::vector<Id> freeslots;
+
+		/** Maps a string to the slot it is stored in. */
+		std::unordered_map<std::string_view, Id> index;
+	};
+
 	/** One entry for a nick. There may be multiple entries for a nick. */
 	struct Entry final
 	{
 		/** Real hostname */
-		const std::string host;
+		StringPool::Id host;
 
 		/** Displayed hostname */
-		const std::string dhost;
+		StringPool::Id dhost;
 
 		/** Real username */
-		const std::string user;
+		StringPool::Id user;
 
 		/** Displayed username */
-		const std::string duser;
+		StringPool::Id duser;
 
 		/** Server name */
-		const std::string server;
+		StringPool::Id server;
 
 		/** Real name */
-		const std::string real;
+		StringPool::Id real;
 
 		/** Signon time */
-		const time_t signon;
+		time_t signon;
 
 		/** Initialize this Entry with a user */
-		Entry(User* user);
+		Entry(StringPool& pool, User* user);
+
+		/** Removes the references this entry holds to strings in the pool. */
+		void Release(StringPool& pool) const;
 	};
 
 	/** Everything known about one nick */
@@ -75,7 +133,7 @@ namespace WhoWas
 		: public insp::intrusive_list_node<Nick>
 	{
 		/** A group of users related by nickname */
-		typedef std::deque<Entry*> List;
+		typedef std::vector<Entry> List;
 
 		/** Container where each element has information about one occurrence of this nick */
 		List entries;
@@ -83,14 +141,11 @@ namespace WhoWas
 		/** Time this nick was added to the database */
 		const time_t addtime;
 
-		/** Nickname whose information is stored in this class */
-		const std::string nick;
+		/** Nickname whose information is stored in this class. This refers to the key of the map entry. */
+		const std::string& nick;
 
 		/** Constructor to initialize fields */
 		Nick(const std::string& nickname);
-
-		/** Destructor, deallocates all elements in the entries container */
-		~Nick();
 	};
 
 	class Manager final
@@ -100,6 +155,12 @@ namespace WhoWas
 		{
 			/** Number of currently existing WhoWas::Entry objects */
 			size_t entrycount;
+
+			/** Number of distinct strings used by the entries */
+			size_t stringcount;
+
+			/** Approximate amount of memory used by the database in bytes */
+			size_t memory;
 		};
 
 		/** Add a user to the whowas database. Called when a user quits.
@@ -107,6 +168,9 @@ namespace WhoWas
 		 */
 		void Add(User* user);
 
+		/** Retrieves the pool which holds the strings used by entries. */
+		const StringPool& GetPool() const { return pool; }
+
 		/** Retrieves statistics about the whowas database
 		 * @return Whowas statistics as a WhoWas::Manager::Stats struct
 		 */
@@ -151,6 +215,9 @@ namespace WhoWas
 		/** List of nicknames in the order they were inserted into the map */
 		FIFO whowas_fifo;
 
+		/** The strings used by the entries of every nick */
+		StringPool pool;
+
 		/** Max number of WhoWas entries per user. */
 		unsigned int GroupSize = 0;
 
@@ -165,6 +232,12 @@ namespace WhoWas
 		/** Shrink all data structures to honor the current settings */
 		void Prune();
 
+		/** Remove the oldest entries of a nick
+		 * @param list The entries of the nick
+		 * @param count The number of entries to remove
+		 */
+		void PurgeEntries(Nick::List& list, size_t count);
+
 		/** Remove a nick (and all entries belonging to it) from the database
 		 * @param it Iterator to the nick to purge
 		 */
@@ -226,16 +299,17 @@ CmdResult CommandWhowas::Handle(User* user, const Params& parameters)
 				last = nick->entries.rbegin() + count;
 		}
 
-		for (const auto* u : insp::iterator_range(nick->entries.rbegin(), last))
+		const WhoWas::StringPool& pool = manager.GetPool();
+		for (const auto& u : insp::iterator_range(nick->entries.rbegin(), last))
 		{
-			user->WriteNumeric(RPL_WHOWASUSER, parameters[0], u->duser, u->dhost, '*', u->real);
+			user->WriteNumeric(RPL_WHOWASUSER, parameters[0], pool.Get(u.duser), pool.Get(u.dhost), '*', pool.Get(u.real));
 
 			if (user->HasPrivPermission("users/auspex"))
-				user->WriteNumeric(RPL_WHOWASIP, parameters[0], INSP_FORMAT("was connecting from {}@{}", u->user, u->host));
+				user->WriteNumeric(RPL_WHOWASIP, parameters[0], INSP_FORMAT("was connecting from {}@{}", pool.Get(u.user), pool.Get(u.host)));
 
-			const std::string signon = Time::ToString(u->signon);
+			const std::string signon = Time::ToString(u.signon);
 			bool hide_server = (!ServerInstance->Config->HideServer.empty() && !user->HasPrivPermission("servers/auspex"));
-			user->WriteNumeric(RPL_WHOISSERVER, parameters[0], (hide_server ? ServerInstance->Config->HideServer : u->server), signon);
+			user->WriteNumeric(RPL_WHOISSERVER, parameters[0], (hide_server ? ServerInstance->Config->HideServer : pool.Get(u.server)), signon);
 		}
 	}
 
@@ -253,12 +327,22 @@ const WhoWas::Nick* WhoWas::Manager::FindNick(const std::string& nickname) const
 
 WhoWas::Manager::Stats WhoWas::Manager::GetStats() const
 {
+	// Each nick has a map node (key, value, next pointer, and cached hash) and a bucket.
+	const size_t nodesize = sizeof(std::string) + sizeof(Nick*) + sizeof(void*) + sizeof(size_t);
 	size_t entrycount = 0;
-	for (const auto& [_, nick] : whowas)
+	size_t memory = whowas.size() * (nodesize + sizeof(Nick)) + whowas.bucket_count() * sizeof(void*);
+	for (const auto& [nickname, nick] : whowas)
+	{
 		entrycount += nick->entries.size();
+		memory += nick->entries.capacity() * sizeof(Entry);
+		if (nickname.capacity() > std::string().capacity())
+			memory += nickname.capacity() + 1;
+	}
 
 	Stats stats;
 	stats.entrycount = entrycount;
+	stats.stringcount = pool.GetCount();
+	stats.memory = memory + pool.GetMemory();
 	return stats;
 }
 
@@ -275,7 +359,7 @@ void WhoWas::Manager::Add(User* user)
 	{
 		// This nick is new, create a list for it and add the first record to it
 		auto* nick = new WhoWas::Nick(ret.first->first);
-		nick->entries.push_back(new Entry(user));
+		nick->entries.emplace_back(pool, user);
 		ret.first->second = nick;
 
 		// Add this nick to the fifo too
@@ -291,14 +375,11 @@ void WhoWas::Manager::Add(User* user)
 	{
 		// We've met this nick before, add a new record to the list
 		WhoWas::Nick::List& list = ret.first->second->entries;
-		list.push_back(new Entry(user));
+		list.emplace_back(pool, user);
 
 		// If there are too many records for this nick, remove the oldest (front)
 		if (list.size() > this->GroupSize)
-		{
-			delete list.front();
-			list.pop_front();
-		}
+			PurgeEntries(list, list.size() - this->GroupSize);
 	}
 }
 
@@ -321,11 +402,8 @@ void WhoWas::Manager::Prune()
 	for (whowas_users::iterator i = whowas.begin(); i != whowas.end(); )
 	{
 		WhoWas::Nick::List& list = i->second->entries;
-		while (list.size() > this->GroupSize)
-		{
-			delete list.front();
-			list.pop_front();
-		}
+		if (list.size() > this->GroupSize)
+			PurgeEntries(list, list.size() - this->GroupSize);
 
 		if (list.empty())
 			PurgeNick(i++);
@@ -341,11 +419,10 @@ void WhoWas::Manager::Maintain()
 	for (whowas_users::iterator i = whowas.begin(); i != whowas.end(); )
 	{
 		WhoWas::Nick::List& list = i->second->entries;
-		while (!list.empty() && list.front()->signon < min)
-		{
-			delete list.front();
-			list.pop_front();
-		}
+		size_t expired = 0;
+		while (expired < list.size() && list[expired].signon < min)
+			expired++;
+		PurgeEntries(list, expired);
 
 		if (list.empty())
 			PurgeNick(i++);
@@ -376,9 +453,20 @@ void WhoWas::Manager::UpdateConfig(unsigned int NewGroupSize, unsigned int NewMa
 	Prune();
 }
 
+void WhoWas::Manager::PurgeEntries(Nick::List& list, size_t count)
+{
+	if (!count)
+		return;
+
+	for (size_t idx = 0; idx < count; ++idx)
+		list[idx].Release(pool);
+	list.erase(list.begin(), list.begin() + count);
+}
+
 void WhoWas::Manager::PurgeNick(whowas_users::iterator it)
 {
 	WhoWas::Nick* nick = it->second;
+	PurgeEntries(nick->entries, nick->entries.size());
 	whowas_fifo.erase(nick);
 	whowas.erase(it);
 	delete nick;
@@ -395,26 +483,88 @@ void WhoWas::Manager::PurgeNick(WhoWas::Nick* nick)
 	PurgeNick(it);
 }
 
-WhoWas::Entry::Entry(User* u)
-	: host(u->GetRealHost())
-	, dhost(u->GetDisplayedHost())
-	, user(u->GetRealUser())
-	, duser(u->GetDisplayedUser())
-	, server(u->server->GetPublicName())
-	, real(u->GetRealName())
+WhoWas::StringPool::Id WhoWas::StringPool::Add(const std::string& str)
+{
+	auto it = index.find(str);
+	if (it != index.end())
+	{
+		slots[it->second].refs++;
+		return it->second;
+	}
+
+	Id id;
+	if (freeslots.empty())
+	{
+		id = static_cast<Id>(slots.size());
+		slots.emplace_back();
+	}
+	else
+	{
+		id = freeslots.back();
+		freeslots.pop_back();
+	}
+
+	Slot& slot = slots[id];
+	slot.str = str;
+	slot.refs = 1;
+	index.emplace(slot.str, id);
+	return id;
+}
+
+size_t WhoWas::StringPool::GetMemory() const
+{
+	// Each string has a map node (key, value, next pointer, and cached hash) and a bucket.
+	const size_t nodesize = sizeof(std::string_view) + sizeof(Id) + sizeof(void*) + sizeof(size_t);
+	size_t memory = slots.size() * sizeof(Slot) + freeslots.capacity() * sizeof(Id)
+		+ index.size() * nodesize + index.bucket_count() * sizeof(void*);
+
+	// Short strings are stored inside of the std::string object.
+	const size_t inlinecapacity = std::string().capacity();
+	for (const auto& slot : slots)
+	{
+		if (slot.str.capacity() > inlinecapacity)
+			memory += slot.str.capacity() + 1;
+	}
+	return memory;
+}
+
+void WhoWas::StringPool::Release(Id id)
+{
+	Slot& slot = slots[id];
+	if (--slot.refs)
+		return;
+
+	index.erase(slot.str);
+	slot.str.clear();
+	slot.str.shrink_to_fit();
+	freeslots.push_back(id);
+}
+
+WhoWas::Entry::Entry(StringPool& pool, User* u)
+	: host(pool.Add(u->GetRealHost()))
+	, dhost(pool.Add(u->GetDisplayedHost()))
+	, user(pool.Add(u->GetRealUser()))
+	, duser(pool.Add(u->GetDisplayedUser()))
+	, server(pool.Add(u->server->GetPublicName()))
+	, real(pool.Add(u->GetRealName()))
 	, signon(u->signon)
 {
 }
 
-WhoWas::Nick::Nick(const std::string& nickname)
-	: addtime(ServerInstance->Time())
-	, nick(nickname)
+void WhoWas::Entry::Release(StringPool& pool) const
 {
+	pool.Release(host);
+	pool.Release(dhost);
+	pool.Release(user);
+	pool.Release(duser);
+	pool.Release(server);
+	pool.Release(real);
 }
 
-WhoWas::Nick::~Nick()
+WhoWas::Nick::Nick(const std::string& nickname)
+	: addtime(ServerInstance->Time())
+	, nick(nickname)
 {
-	stdalgo::delete_all(entries);
 }
 
 class ModuleWhoWas final
@@ -445,7 +595,11 @@ public:
 	ModResult OnStats(Stats::Context& stats) override
 	{
 		if (stats.GetSymbol() == 'z')
-			stats.AddRow(249, "Whowas entries: "+ConvToStr(cmd.manager.GetStats().entrycount));
+		{
+			const WhoWas::Manager::Stats whowasstats = cmd.manager.GetStats();
+			stats.AddRow(249, "Whowas entries: "+ConvToStr(whowasstats.entrycount));
+			stats.AddRow(249, INSP_FORMAT("Whowas memory: {} bytes ({} unique strings)", whowasstats.memory, whowasstats.stringcount));
+		}
 
 		return MOD_RES_PASSTHRU;
 	}
@@ -641,6 +641,8 @@ void InspIRCd::Run()
 
 	while (true)
 	{
+		Profiler.BeginIteration();
+
 		/* Check if there is a config thread which has finished executing but has not yet been freed */
 		if (this->ConfigThread && this->ConfigThread->IsDone())
 		{
@@ -685,11 +687,15 @@ void InspIRCd::Run()
 		 * This will cause any read or write events to be
 		 * dispatched to their handlers.
 		 */
+		Profiler.EnterPhase(ProfileManager::PHASE_EVENTS);
 		SocketEngine::DispatchTrialWrites();
 		SocketEngine::DispatchEvents();
 
 		/* if any users were quit, take them out */
+		Profiler.EnterPhase(ProfileManager::PHASE_CULLS);
 		GlobalCulls.Apply();
+
+		Profiler.EnterPhase(ProfileManager::PHASE_ACTIONS);
 		AtomicActions.Run();
 
 		if (s_signal)
@@ -30,6 +30,99 @@ enum
 	ERR_LISTMODENOTSET = 698,
 };
 
+BanMask::Pattern::Pattern(const std::string& pat)
+	: pattern(pat)
+{
+	if (pattern.find_first_not_of('*') == std::string::npos)
+		type = Type::ANY;
+	else if (pattern.find_first_of("*?") == std::string::npos)
+		type = Type::LITERAL;
+	else
+		type = Type::WILDCARD;
+}
+
+bool BanMask::Pattern::Matches(const std::string& str) const
+{
+	switch (type)
+	{
+		case Type::ANY:
+			return true;
+
+		case Type::LITERAL:
+			return irc::equals(str, pattern);
+
+		case Type::WILDCARD:
+			return InspIRCd::Match(str, pattern);
+	}
+	return false; // Should never happen.
+}
+
+BanMask::BanMask(const std::string& Mask)
+	: mask(Mask)
+{
+	const std::string::size_type at = mask.find('@');
+	if (at == std::string::npos)
+		return; // Not a nick!user@host mask.
+
+	hostmask = true;
+
+	// Nicknames and usernames can not contain a ! so if there is only one in the
+	// mask then the nickname and username can be matched separately.
+	const std::string prefix(mask, 0, at);
+	const std::string::size_type bang = prefix.find('!');
+	if (bang != std::string::npos && prefix.find('!', bang + 1) == std::string::npos)
+	{
+		split = true;
+		nick = Pattern(prefix.substr(0, bang));
+		user = Pattern(prefix.substr(bang + 1));
+	}
+	else
+		nick = Pattern(prefix);
+
+	const std::string suffix(mask, at + 1);
+	host = Pattern(suffix);
+
+	// This mirrors the parsing done by irc::sockets::MatchCIDR.
+	const std::string range(suffix, suffix.rfind('@') + 1);
+	const std::string::size_type slash = range.rfind('/');
+	if (slash != std::string::npos && (slash == range.length() - 1
+		|| range.find_first_not_of("0123456789", slash + 1) != std::string::npos
+		|| range.find_first_not_of("0123456789abcdefABCDEF.:") < slash))
+		return; // Not a valid CIDR range.
+
+	irc::sockets::sockaddrs sa(false);
+	if (sa.from_ip(range.substr(0, slash)))
+		cidr.emplace(range);
+}
+
+bool BanMask::Matches(User* u) const
+{
+	if (!hostmask)
+		return false;
+
+	if (split)
+	{
+		if (!nick.Matches(u->nick))
+			return false;
+
+		if (!user.Matches(u->GetDisplayedUser()) && (u->GetDisplayedUser() == u->GetRealUser() || !user.Matches(u->GetRealUser())))
+			return false; // Neither the nick!user or nick!duser.
+	}
+	else
+	{
+		if (!nick.Matches(u->nick + "!" + u->GetDisplayedUser()) && !nick.Matches(u->nick + "!" + u->GetRealUser()))
+			return false; // Neither the nick!user or nick!duser.
+	}
+
+	if (host.Matches(u->GetRealHost()) || host.Matches(u->GetDisplayedHost()))
+		return true;
+
+	if (cidr && u->client_sa.is_ip() && irc::sockets::cidr_mask(u->client_sa, cidr->length) == *cidr)
+		return true;
+
+	return host.Matches(u->GetAddress());
+}
+
 ListModeBase::ListModeBase(Module* Creator, const std::string& Name, char modechar, unsigned int lnum, unsigned int eolnum)
 	: ModeHandler(Creator, Name, modechar, PARAM_ALWAYS, MODETYPE_CHANNEL, MC_LIST)
 	, listnumeric(lnum)
@@ -204,6 +297,7 @@ bool ListModeBase::OnModeChange(User* source, User*, Channel* channel, Modes::Ch
 			change.set_by.value_or(ServerInstance->Config->MaskInList ? source->GetMask() : source->nick),
 			change.set_at.value_or(ServerInstance->Time())
 		);
+		channel->ResetBanCache();
 		return true;
 	}
 	else
@@ -218,6 +312,7 @@ bool ListModeBase::OnModeChange(User* source, User*, Channel* channel, Modes::Ch
 					continue; // Doesn't match the proposed removal.
 
 				stdalgo::vector::swaperase(cd->list, it);
+				channel->ResetBanCache();
 				return true;
 			}
 		}
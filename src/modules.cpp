@@ -454,8 +454,10 @@ void ModuleManager::DoSafeUnload(Module* mod)
 		DataProviderMap::iterator curr = i++;
 		if (curr->second->creator == mod)
 		{
+			// The iterator is invalidated by the erase so take the provider out of it first.
+			ServiceProvider* service = curr->second;
 			DataProviders.erase(curr);
-			FOREACH_MOD(OnServiceDel, (*curr->second));
+			FOREACH_MOD(OnServiceDel, (*service));
 		}
 	}
 
@@ -83,21 +83,34 @@ class HashArgon2 final
 {
 private:
 	const Argon2_type argon2Type;
+	HashWorkerPool& pool;
 
-public:
-	ProviderConfig config;
-
-	bool Compare(const std::string& input, const std::string& hash) override
+	static bool Verify(const std::string& input, const std::string& hash, Argon2_type type)
 	{
 		int result = argon2_verify(
 			hash.c_str(),
 			input.c_str(),
 			input.length(),
-			argon2Type);
+			type);
 
 		return result == ARGON2_OK;
 	}
 
+public:
+	ProviderConfig config;
+
+	bool Compare(const std::string& input, const std::string& hash) override
+	{
+		return Verify(input, hash, argon2Type);
+	}
+
+	void CompareAsync(const std::string& input, const std::string& hash, const HashCompareCallback& callback) override
+	{
+		pool.Submit([input, hash, type = argon2Type]() {
+			return Verify(input, hash, type);
+		}, callback);
+	}
+
 	std::string GenerateRaw(const std::string& data) override
 	{
 		const std::string salt = ServerInstance->GenRandomStr(config.saltlen, false);
@@ -144,10 +157,10 @@ public:
 		return raw;
 	}
 
-	HashArgon2(Module* parent, const std::string& hashName, Argon2_type type)
+	HashArgon2(Module* parent, const std::string& hashName, Argon2_type type, HashWorkerPool& workerpool)
 		: HashProvider(parent, hashName)
 		, argon2Type(type)
-
+		, pool(workerpool)
 	{
 	}
 };
@@ -156,6 +169,7 @@ class ModuleArgon2 final
 	: public Module
 {
 private:
+	HashWorkerPool pool;
 	HashArgon2 argon2i;
 	HashArgon2 argon2d;
 	HashArgon2 argon2id;
@@ -163,9 +177,9 @@ private:
 public:
 	ModuleArgon2()
 		: Module(VF_VENDOR, "Allows other modules to generate Argon2 hashes.")
-		, argon2i(this, "argon2i", Argon2_i)
-		, argon2d(this, "argon2d", Argon2_d)
-		, argon2id(this, "argon2id", Argon2_id)
+		, argon2i(this, "argon2i", Argon2_i, pool)
+		, argon2d(this, "argon2d", Argon2_d, pool)
+		, argon2id(this, "argon2id", Argon2_id, pool)
 	{
 	}
 
@@ -175,6 +189,9 @@ public:
 		argon2i.config = ProviderConfig("argon2i", &defaultConfig);
 		argon2d.config = ProviderConfig("argon2d", &defaultConfig);
 		argon2id.config = ProviderConfig("argon2id", &defaultConfig);
+
+		const auto& tag = ServerInstance->Config->ConfValue("argon2");
+		pool.SetWorkers(tag->getNum<size_t>("workers", 2, 0, 64));
 	}
 };
 
@@ -30,6 +30,15 @@
 #include "modules/regex.h"
 
 #include <re2/re2.h>
+#include <re2/set.h>
+
+static RE2::Options BuildOptions(uint8_t options)
+{
+	RE2::Options re2options;
+	re2options.set_case_sensitive(!(options & Regex::OPT_CASE_INSENSITIVE));
+	re2options.set_log_errors(false);
+	return re2options;
+}
 
 class RE2Pattern final
 	: public Regex::Pattern
@@ -37,14 +46,6 @@ class RE2Pattern final
 private:
 	RE2 regex;
 
-	static RE2::Options BuildOptions(uint8_t options)
-	{
-		RE2::Options re2options;
-		re2options.set_case_sensitive(!(options & Regex::OPT_CASE_INSENSITIVE));
-		re2options.set_log_errors(false);
-		return re2options;
-	}
-
 public:
 	RE2Pattern(const Module* mod, const std::string& pattern, uint8_t options)
 		: Regex::Pattern(pattern, options)
@@ -81,16 +82,92 @@ public:
 	}
 };
 
+class RE2PatternSet final
+	: public Regex::PatternSet
+{
+private:
+	RE2::Set regexset;
+
+	/** The indices of the patterns which matched the last text. */
+	std::vector<int> re2matches;
+
+public:
+	RE2PatternSet()
+		: regexset(BuildOptions(Regex::OPT_NONE), RE2::ANCHOR_BOTH)
+	{
+	}
+
+	bool Add(const Regex::PatternPtr& pattern)
+	{
+		// The options for a set apply to every pattern so case insensitivity
+		// has to be enabled inline for the patterns that need it.
+		std::string re2pattern;
+		if (pattern->GetOptions() & Regex::OPT_CASE_INSENSITIVE)
+			re2pattern.append("(?i)");
+		re2pattern.append(pattern->GetPattern());
+
+		return regexset.Add(re2pattern, nullptr) >= 0;
+	}
+
+	bool Compile()
+	{
+		return regexset.Compile();
+	}
+
+	bool Matches(const std::string& text, std::vector<size_t>& matches) override
+	{
+		matches.clear();
+		if (!regexset.Match(text, &re2matches))
+			return false;
+
+		std::sort(re2matches.begin(), re2matches.end());
+		matches.assign(re2matches.begin(), re2matches.end());
+		return true;
+	}
+};
+
+class RE2Engine final
+	: public Regex::Engine
+{
+public:
+	RE2Engine(Module* Creator)
+		: Regex::Engine(Creator, "re2")
+	{
+	}
+
+	Regex::PatternPtr Create(const std::string& pattern, uint8_t options) const override
+	{
+		return std::make_shared<RE2Pattern>(creator, pattern, options);
+	}
+
+	Regex::PatternSetPtr CreateSet(const std::vector<Regex::PatternPtr>& patterns) const override
+	{
+		auto regexset = std::make_shared<RE2PatternSet>();
+		for (const auto& pattern : patterns)
+		{
+			if (!regexset->Add(pattern))
+				return nullptr;
+		}
+
+		// This can fail if the set exceeds the memory budget of RE2. In that
+		// case the caller will fall back to matching the patterns one by one.
+		if (!regexset->Compile())
+			return nullptr;
+
+		return regexset;
+	}
+};
+
 class ModuleRegexRE2 final
 	: public Module
 {
 private:
-	Regex::SimpleEngine<RE2Pattern> regex;
+	RE2Engine regex;
 
 public:
 	ModuleRegexRE2()
 		: Module(VF_VENDOR, "Provides the re2 regular expression engine which uses the RE2 library.")
-		, regex(this, "re2")
+		, regex(this)
 	{
 	}
 };
@@ -41,10 +41,14 @@
 
 #include "inspircd.h"
 #include "modules/ssl.h"
+#include "modules/stats.h"
 #include "stringutils.h"
+#include "threadsocket.h"
 #include "timeutils.h"
 #include "utility/string.h"
 
+#include <chrono>
+
 #include <gnutls/gnutls.h>
 #include <gnutls/abstract.h>
 #include <gnutls/crypto.h>
@@ -425,6 +429,96 @@ namespace GnuTLS
 		}
 	};
 
+	/** Session resumption state which is kept when a profile is reloaded. */
+	class SessionState final
+	{
+	private:
+		/** The secret the ticket key was derived from. */
+		std::optional<std::string> ticketsecret;
+
+	public:
+		/** Sessions which clients connecting to us can resume. */
+		SSLSessionCache servercache;
+
+		/** Sessions which we can resume when connecting to a server. */
+		SSLSessionCache clientcache;
+
+		/** The master key used to encrypt stateless session tickets. GnuTLS rotates the keys
+		 * derived from this itself.
+		 */
+		gnutls_datum_t ticketkey = { nullptr, 0 };
+
+		/** Counters for the handshakes performed with this profile. */
+		SSLHandshakeStats stats;
+
+		/** Guards the caches which are also used by handshake worker threads. */
+		std::mutex mutex;
+
+		~SessionState()
+		{
+			gnutls_free(ticketkey.data);
+		}
+
+		/** Changes the secret the ticket key is derived from. If the secret is empty a random key
+		 * is generated which does not survive a restart.
+		 */
+		void SetTicketSecret(const std::string& secret)
+		{
+			if (ticketsecret && *ticketsecret == secret)
+				return;
+
+			gnutls_free(ticketkey.data);
+			ticketkey = { nullptr, 0 };
+			ticketsecret.reset();
+
+			if (secret.empty())
+			{
+				ThrowOnError(gnutls_session_ticket_key_generate(&ticketkey), "Unable to generate a session ticket key");
+			}
+			else
+			{
+				static const std::string label = "inspircd session ticket key";
+				const size_t keysize = gnutls_hmac_get_len(GNUTLS_MAC_SHA512);
+				ticketkey.data = static_cast<unsigned char*>(gnutls_malloc(keysize));
+				ticketkey.size = static_cast<unsigned int>(keysize);
+				ThrowOnError(gnutls_hmac_fast(GNUTLS_MAC_SHA512, secret.data(), secret.length(), label.data(), label.length(), ticketkey.data), "Unable to derive a session ticket key");
+			}
+			ticketsecret = secret;
+		}
+
+		static int Store(void* ptr, gnutls_datum_t key, gnutls_datum_t data)
+		{
+			auto* state = static_cast<SessionState*>(ptr);
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->servercache.Add(std::string(reinterpret_cast<const char*>(key.data), key.size), std::string(reinterpret_cast<const char*>(data.data), data.size));
+			return 0;
+		}
+
+		static gnutls_datum_t Retrieve(void* ptr, gnutls_datum_t key)
+		{
+			gnutls_datum_t data = { nullptr, 0 };
+			auto* state = static_cast<SessionState*>(ptr);
+			std::lock_guard<std::mutex> lock(state->mutex);
+			const std::string* session = state->servercache.Find(std::string(reinterpret_cast<const char*>(key.data), key.size));
+			if (session)
+			{
+				// GnuTLS takes ownership of the returned data.
+				data.data = static_cast<unsigned char*>(gnutls_malloc(session->length()));
+				data.size = static_cast<unsigned int>(session->length());
+				memcpy(data.data, session->data(), session->length());
+			}
+			return data;
+		}
+
+		static int Remove(void* ptr, gnutls_datum_t key)
+		{
+			auto* state = static_cast<SessionState*>(ptr);
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->servercache.Remove(std::string(reinterpret_cast<const char*>(key.data), key.size));
+			return 0;
+		}
+	};
+
 	class DataReader final
 	{
 		ssize_t retval;
@@ -485,6 +579,18 @@ namespace GnuTLS
 		/** Whether the fingerprint is a SPKI fingerprint or not. */
 		bool spkifp;
 
+		/** The maximum number of sessions to cache as a server. */
+		const size_t sessioncache;
+
+		/** The number of seconds a session can be resumed for. */
+		const unsigned long sessiontimeout;
+
+		/** Whether to issue stateless session tickets as a server. */
+		const bool tickets;
+
+		/** Session resumption state for this profile. */
+		std::shared_ptr<SessionState> state;
+
 		static std::string ReadFile(const std::string& filename)
 		{
 			auto file = ServerInstance->Config->ReadFile(filename, ServerInstance->Time());
@@ -540,6 +646,11 @@ namespace GnuTLS
 			bool requestclientcert;
 			bool spkifp;
 
+			size_t sessioncache;
+			unsigned long sessiontimeout;
+			bool tickets;
+			std::string ticketsecret;
+
 			Config(const std::string& profilename, const std::shared_ptr<ConfigTag>& tag)
 				: name(profilename)
 				, certstr(ReadFile(tag->getString("certfile", "cert.pem", 1)))
@@ -552,6 +663,10 @@ namespace GnuTLS
 				, hashstr(tag->getString("hash", "sha256", 1))
 				, requestclientcert(tag->getBool("requestclientcert", true))
 				, spkifp(tag->getBool("spkifp"))
+				, sessioncache(tag->getNum<size_t>("sessioncache", 0))
+				, sessiontimeout(tag->getDuration("sessiontimeout", 60*60, 1))
+				, tickets(tag->getBool("tickets"))
+				, ticketsecret(tag->getString("ticketsecret"))
 			{
 				// Load trusted CA and revocation list, if set
 				std::string filename = tag->getString("cafile");
@@ -568,7 +683,7 @@ namespace GnuTLS
 			}
 		};
 
-		Profile(Config& config)
+		Profile(Config& config, const std::shared_ptr<SessionState>& oldstate)
 			: name(config.name)
 			, x509cred(config.certstr, config.keystr)
 			, min_dh_bits(config.mindh)
@@ -577,16 +692,27 @@ namespace GnuTLS
 			, outrecsize(config.outrecsize)
 			, requestclientcert(config.requestclientcert)
 			, spkifp(config.spkifp)
+			, sessioncache(config.sessioncache)
+			, sessiontimeout(config.sessiontimeout)
+			, tickets(config.tickets)
+			, state(oldstate ? oldstate : std::make_shared<SessionState>())
 		{
 #ifndef GNUTLS_AUTO_DH
 			x509cred.SetDH(config.dh);
 #endif
 			x509cred.SetCA(config.ca, config.crl);
+
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->servercache.SetLimits(sessioncache, sessiontimeout);
+			state->clientcache.SetLimits(sessioncache ? sessioncache : 100, sessiontimeout);
+			if (tickets)
+				state->SetTicketSecret(config.ticketsecret);
 		}
 		/** Set up the given session with the settings in this profile
 		 */
 		void SetupSession(gnutls_session_t sess)
 		{
+			gnutls_session_set_ptr(sess, this);
 			priority.SetupSession(sess);
 			x509cred.SetupSession(sess);
 			gnutls_dh_set_prime_bits(sess, min_dh_bits);
@@ -596,11 +722,39 @@ namespace GnuTLS
 				gnutls_certificate_server_set_request(sess, GNUTLS_CERT_REQUEST);
 		}
 
+		/** Set up session resumption for the given session
+		 */
+		void SetupResumption(gnutls_session_t sess, bool server, const std::string& sessionkey)
+		{
+			if (server)
+			{
+				gnutls_db_set_cache_expiration(sess, static_cast<int>(std::min<unsigned long>(sessiontimeout, INT_MAX)));
+				if (sessioncache)
+				{
+					gnutls_db_set_ptr(sess, state.get());
+					gnutls_db_set_store_function(sess, SessionState::Store);
+					gnutls_db_set_retrieve_function(sess, SessionState::Retrieve);
+					gnutls_db_set_remove_function(sess, SessionState::Remove);
+				}
+				if (tickets)
+					gnutls_session_ticket_enable_server(sess, &state->ticketkey);
+			}
+			else if (!sessionkey.empty())
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				const std::string* data = state->clientcache.Find(sessionkey);
+				if (data)
+					gnutls_session_set_data(sess, data->data(), data->length());
+			}
+		}
+
 		const std::string& GetName() const { return name; }
 		X509Credentials& GetX509Credentials() { return x509cred; }
 		gnutls_digest_algorithm_t GetHash() const { return hash.get(); }
 		unsigned int GetOutgoingRecordSize() const { return outrecsize; }
 		bool UseSPKI() const { return spkifp; }
+		SessionState& GetSessionState() { return *state; }
+		const std::shared_ptr<SessionState>& GetSessionStatePtr() const { return state; }
 	};
 }
 
@@ -611,8 +765,350 @@ private:
 	gnutls_session_t sess = nullptr;
 	size_t gbuffersize = 0;
 
+	/** If non-empty then the key under which the session of this outgoing connection is cached. */
+	const std::string sessionkey;
+
+	/** The time spent processing the handshake so far in microseconds. */
+	unsigned long long handshaketime = 0;
+
+	/** The most data that can be buffered for an offloaded handshake before it is aborted. */
+	static constexpr size_t MaxOffloadBuffer = 128 * 1024;
+
+	/** The state of a handshake which is being run on handshake worker threads. */
+	struct Offload final
+	{
+		/** The pool that the steps of the handshake are run on. */
+		WorkerPool& pool;
+
+		/** The session which is handshaking. This belongs to the worker whilst a step is running. */
+		const gnutls_session_t sess;
+
+		/** The socket which the handshake is happening on. */
+		StreamSocket* const sock;
+
+		/** The hook which owns the handshake or nullptr if it was closed whilst a step was running. */
+		GnuTLSIOHook* hook;
+
+		/** Keeps the profile and its session state alive whilst a step is running. */
+		const std::shared_ptr<IOHookProvider> prov;
+
+		/** Data from the peer which has not been given to a worker yet. */
+		std::string input;
+
+		/** Data from the peer which has been given to a worker but not read by the session yet. */
+		std::string pending;
+
+		/** Data from a worker which has not been sent to the peer yet. */
+		std::string output;
+
+		/** Data written by the session during the current step. */
+		std::string written;
+
+		/** Whether a step is being run. */
+		bool running = false;
+
+		/** Whether a step is being submitted to the pool. */
+		bool submitting = false;
+
+		/** Whether the handshake has finished and is waiting for its output to be sent. */
+		bool finished = false;
+
+		/** The value returned by gnutls_handshake() during the last step. */
+		int result = 0;
+
+		/** The time spent processing the last step in microseconds. */
+		unsigned long long time = 0;
+
+		Offload(WorkerPool& workerpool, gnutls_session_t session, StreamSocket* socket, GnuTLSIOHook* iohook)
+			: pool(workerpool)
+			, sess(session)
+			, sock(socket)
+			, hook(iohook)
+			, prov(iohook->prov)
+		{
+		}
+	};
+
+	/** If non-null then the handshake is being run on handshake worker threads. */
+	std::shared_ptr<Offload> offload;
+
+	/** Data which was received before an offloaded handshake finished and has not been read yet. */
+	std::string handshakebuffer;
+
+	// Reads data for an offloaded handshake. This is called on a worker thread.
+	static ssize_t OffloadPull(gnutls_transport_ptr_t transportptr, void* buffer, size_t size)
+	{
+		Offload* job = static_cast<Offload*>(transportptr);
+		if (job->pending.empty())
+		{
+			gnutls_transport_set_errno(job->sess, EAGAIN);
+			return -1;
+		}
+
+		size = std::min(size, job->pending.length());
+		memcpy(buffer, job->pending.data(), size);
+		job->pending.erase(0, size);
+		return static_cast<ssize_t>(size);
+	}
+
+	// Writes data for an offloaded handshake. This is called on a worker thread.
+	static ssize_t OffloadPush(gnutls_transport_ptr_t transportptr, const giovec_t* iov, int iovcnt)
+	{
+		Offload* job = static_cast<Offload*>(transportptr);
+		ssize_t size = 0;
+		for (int i = 0; i < iovcnt; i++)
+		{
+			job->written.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+			size += iov[i].iov_len;
+		}
+		return size;
+	}
+
+	// Reads data which was received before an offloaded handshake finished.
+	static ssize_t HandshakeBufferPull(gnutls_transport_ptr_t transportptr, void* buffer, size_t size)
+	{
+		GnuTLSIOHook* hook = static_cast<GnuTLSIOHook*>(transportptr);
+		if (hook->handshakebuffer.empty())
+		{
+			gnutls_transport_set_errno(hook->sess, EAGAIN);
+			return -1;
+		}
+
+		size = std::min(size, hook->handshakebuffer.length());
+		memcpy(buffer, hook->handshakebuffer.data(), size);
+		hook->handshakebuffer.erase(0, size);
+		return static_cast<ssize_t>(size);
+	}
+
+	// Runs the next step of an offloaded handshake on a worker thread.
+	void SubmitHandshake()
+	{
+		std::shared_ptr<Offload> job = offload;
+		job->running = true;
+		job->submitting = true;
+
+		std::string data;
+		data.swap(job->input);
+		job->pool.Submit([job, data]() {
+			// This is called on a worker thread so only the session can be touched.
+			job->pending.append(data);
+
+			const auto start = std::chrono::steady_clock::now();
+			job->result = gnutls_handshake(job->sess);
+			job->time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		}, [job](bool ran) {
+			job->running = false;
+			if (job->hook)
+				job->hook->OnHandshakeStep(ran);
+			else
+				gnutls_deinit(job->sess);
+		});
+		job->submitting = false;
+	}
+
+	// Called on the main thread when a step of an offloaded handshake has been run.
+	void OnHandshakeStep(bool ran)
+	{
+		StreamSocket* sock = offload->sock;
+		const bool submitting = offload->submitting;
+		offload->output.append(offload->written);
+		offload->written.clear();
+		handshaketime += offload->time;
+
+		bool failed = !ran || offload->input.length() + offload->pending.length() > MaxOffloadBuffer;
+		if (!failed && offload->result == GNUTLS_E_SUCCESS)
+		{
+			offload->finished = true;
+			failed = !SendHandshakeData(sock);
+			if (!failed && offload->output.empty())
+				CompleteHandshake(sock);
+		}
+		else if (!failed)
+		{
+			if (offload->result != GNUTLS_E_AGAIN && offload->result != GNUTLS_E_INTERRUPTED)
+				sock->SetError("Handshake Failed - " + std::string(gnutls_strerror(offload->result)));
+			failed = !sock->GetError().empty() || !SendHandshakeData(sock);
+			if (!failed && !offload->input.empty())
+				SubmitHandshake();
+		}
+
+		if (failed)
+		{
+			// Try to send any alert before the session is closed.
+			SendHandshakeData(sock);
+			CloseSession();
+			sock->SetError("Handshake Failed");
+		}
+
+		// If the pool ran the step synchronously then the caller of SubmitHandshake() handles the result.
+		if (submitting)
+			return;
+
+		if (status == STATUS_NONE)
+			sock->OnError(I_ERR_OTHER);
+		else if (!handshakebuffer.empty())
+			sock->OnEventHandlerRead();
+	}
+
+	// Sends data from an offloaded handshake to the socket. Returns false on error.
+	bool SendHandshakeData(StreamSocket* user)
+	{
+		if (offload->output.empty() || (user->GetEventMask() & FD_WRITE_WILL_BLOCK))
+			return true;
+
+		ssize_t ret = SocketEngine::Send(user, offload->output.data(), offload->output.length(), 0);
+		if (ret > 0)
+			offload->output.erase(0, ret);
+		else if (!SocketEngine::IgnoreError())
+			return false;
+
+		if (!offload->output.empty())
+			SocketEngine::ChangeEventMask(user, FD_WRITE_WILL_BLOCK | FD_WANT_SINGLE_WRITE);
+		return true;
+	}
+
+	// Receives data for an offloaded handshake from the socket. Returns false on error.
+	bool ReceiveHandshakeData(StreamSocket* user)
+	{
+		if (user->GetEventMask() & FD_READ_WILL_BLOCK)
+			return true;
+
+		char* buffer = ServerInstance->GetReadBuffer();
+		ssize_t ret = SocketEngine::Recv(user, buffer, ServerInstance->Config->NetBufferSize, 0);
+		if (ret > 0)
+		{
+			offload->input.append(buffer, ret);
+			if (static_cast<size_t>(ret) == ServerInstance->Config->NetBufferSize)
+				SocketEngine::ChangeEventMask(user, FD_ADD_TRIAL_READ);
+			return offload->input.length() <= MaxOffloadBuffer;
+		}
+		else if (ret == 0)
+		{
+			user->SetError("Connection closed");
+			return false;
+		}
+		else if (SocketEngine::IgnoreError())
+		{
+			SocketEngine::ChangeEventMask(user, FD_READ_WILL_BLOCK);
+			return true;
+		}
+		else if (errno == EINTR)
+		{
+			SocketEngine::ChangeEventMask(user, FD_ADD_TRIAL_READ);
+			return true;
+		}
+
+		user->SetError(SocketEngine::LastError());
+		return false;
+	}
+
+	// Moves data between the socket and an offloaded handshake. Returns the same as Handshake().
+	int OffloadHandshake(StreamSocket* user)
+	{
+		if (!SendHandshakeData(user) || (!offload->finished && !ReceiveHandshakeData(user)))
+		{
+			CloseSession();
+			return -1;
+		}
+
+		if (offload->finished)
+		{
+			if (!offload->output.empty())
+				return 0;
+
+			CompleteHandshake(user);
+			return 1;
+		}
+
+		if (!offload->running && !offload->input.empty())
+		{
+			SubmitHandshake();
+
+			// If the pool has no workers then the step has already been run.
+			if (status != STATUS_HANDSHAKING)
+				return status == STATUS_OPEN ? 1 : -1;
+		}
+		return 0;
+	}
+
+	// Moves the session of a finished offloaded handshake back to doing I/O on the socket.
+	void CompleteHandshake(StreamSocket* user)
+	{
+		handshakebuffer = offload->pending + offload->input;
+		if (handshakebuffer.empty())
+		{
+			gnutls_transport_set_ptr(sess, reinterpret_cast<gnutls_transport_ptr_t>(user));
+			gnutls_transport_set_pull_function(sess, gnutls_pull_wrapper);
+		}
+		else
+		{
+			// The peer sent data after the handshake which has to be read before the socket.
+			gnutls_transport_set_ptr2(sess, this, reinterpret_cast<gnutls_transport_ptr_t>(user));
+			gnutls_transport_set_pull_function(sess, HandshakeBufferPull);
+		}
+		gnutls_transport_set_vec_push_function(sess, VectorPush);
+		offload.reset();
+
+		this->status = STATUS_OPEN;
+		this->resumed = gnutls_session_is_resumed(this->sess);
+		SSLHandshakeStats& stats = GetProfile().GetSessionState().stats;
+		stats.Add(resumed, handshaketime);
+		stats.offloaded++;
+		VerifyCertificate();
+
+		SocketEngine::ChangeEventMask(user, FD_WANT_POLL_READ | FD_WANT_NO_WRITE | FD_ADD_TRIAL_WRITE);
+	}
+
+	// Reads the data which was received before an offloaded handshake finished and then
+	// goes back to reading from the socket.
+	ssize_t ReadHandshakeBuffer(StreamSocket* user, std::string& recvq)
+	{
+		while (!handshakebuffer.empty() || gnutls_record_check_pending(sess) > 0)
+		{
+			GnuTLS::DataReader reader(sess);
+			ssize_t ret = reader.ret();
+			if (ret > 0)
+			{
+				reader.appendto(recvq);
+				continue;
+			}
+			else if (ret == 0)
+			{
+				user->SetError("Connection closed");
+				CloseSession();
+				return -1;
+			}
+			else if (ret != GNUTLS_E_AGAIN && ret != GNUTLS_E_INTERRUPTED)
+			{
+				user->SetError(gnutls_strerror(int(ret)));
+				CloseSession();
+				return -1;
+			}
+
+			// The rest of the record is still on the socket.
+			break;
+		}
+
+		handshakebuffer.clear();
+		gnutls_transport_set_ptr(sess, reinterpret_cast<gnutls_transport_ptr_t>(user));
+		gnutls_transport_set_pull_function(sess, gnutls_pull_wrapper);
+
+		SocketEngine::ChangeEventMask(user, FD_WANT_POLL_READ | FD_ADD_TRIAL_READ);
+		return 1;
+	}
+
 	void CloseSession()
 	{
+		if (offload)
+		{
+			// If a step is running then the session is freed once it has finished.
+			offload->hook = nullptr;
+			if (offload->running)
+				sess = nullptr;
+			offload.reset();
+		}
+
+		handshakebuffer.clear();
 		if (this->sess)
 		{
 			gnutls_bye(this->sess, GNUTLS_SHUT_WR);
@@ -626,7 +1122,12 @@ private:
 	// Returns 1 if handshake succeeded, 0 if it is still in progress, -1 if it failed
 	int Handshake(StreamSocket* user)
 	{
+		if (offload)
+			return OffloadHandshake(user);
+
+		const auto start = std::chrono::steady_clock::now();
 		int ret = gnutls_handshake(this->sess);
+		handshaketime += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
 
 		if (ret < 0)
 		{
@@ -659,9 +1160,15 @@ private:
 		{
 			// Change the session state
 			this->status = STATUS_OPEN;
+			this->resumed = gnutls_session_is_resumed(this->sess);
+			GetProfile().GetSessionState().stats.Add(resumed, handshaketime);
 
 			VerifyCertificate();
 
+			// TLSv1.3 sessions can only be cached once the server has sent a ticket.
+			if (!sessionkey.empty() && !IsTLS13())
+				CacheClientSession();
+
 			// Finish writing, if any left
 			SocketEngine::ChangeEventMask(user, FD_WANT_POLL_READ | FD_WANT_NO_WRITE | FD_ADD_TRIAL_WRITE);
 
@@ -803,6 +1310,36 @@ info_done_dealloc:
 		gnutls_x509_crt_deinit(cert);
 	}
 
+	bool IsTLS13() const
+	{
+#if INSPIRCD_GNUTLS_HAS_VERSION(3, 6, 3)
+		return gnutls_protocol_get_version(this->sess) == GNUTLS_TLS1_3;
+#else
+		return false;
+#endif
+	}
+
+	void CacheClientSession()
+	{
+		gnutls_datum_t data;
+		if (gnutls_session_get_data2(this->sess, &data) < 0)
+			return;
+
+		GnuTLS::SessionState& state = GetProfile().GetSessionState();
+		std::lock_guard<std::mutex> lock(state.mutex);
+		state.clientcache.Add(sessionkey, std::string(reinterpret_cast<const char*>(data.data), data.size));
+		gnutls_free(data.data);
+	}
+
+	static int OnNewSessionTicket(gnutls_session_t session, unsigned int htype, unsigned int when, unsigned int incoming, const gnutls_datum_t* msg)
+	{
+		StreamSocket* sock = reinterpret_cast<StreamSocket*>(gnutls_transport_get_ptr(session));
+		GnuTLSIOHook* hook = static_cast<GnuTLSIOHook*>(sock->GetModHook(thismod));
+		if (hook && hook->status == STATUS_OPEN && hook->IsTLS13())
+			hook->CacheClientSession();
+		return 0;
+	}
+
 	static void ProcessDNString(const char* buffer, size_t buffer_size, std::string& out)
 	{
 		out.assign(buffer, buffer_size);
@@ -934,15 +1471,33 @@ info_done_dealloc:
 	}
 
 public:
-	GnuTLSIOHook(const std::shared_ptr<IOHookProvider>& hookprov, StreamSocket* sock, unsigned int flags)
+	GnuTLSIOHook(const std::shared_ptr<IOHookProvider>& hookprov, StreamSocket* sock, unsigned int flags, const std::string& key = "", WorkerPool* pool = nullptr)
 		: SSLIOHook(hookprov)
+		, sessionkey(key)
 	{
 		gnutls_init(&sess, flags);
+		GetProfile().SetupSession(sess);
+		GetProfile().SetupResumption(sess, flags & GNUTLS_SERVER, sessionkey);
+		if (!sessionkey.empty())
+			gnutls_handshake_set_hook_function(sess, GNUTLS_HANDSHAKE_NEW_SESSION_TICKET, GNUTLS_HOOK_POST, OnNewSessionTicket);
+
+		if (pool)
+		{
+			// The handshake is run on a worker thread using memory buffers and only the main
+			// thread touches the socket until it has finished.
+			offload = std::make_shared<Offload>(*pool, sess, sock, this);
+			gnutls_transport_set_ptr(sess, offload.get());
+			gnutls_transport_set_vec_push_function(sess, OffloadPush);
+			gnutls_transport_set_pull_function(sess, OffloadPull);
+			sock->AddIOHook(this);
+			status = STATUS_HANDSHAKING;
+			SocketEngine::ChangeEventMask(sock, FD_WANT_POLL_READ | FD_WANT_NO_WRITE);
+			return;
+		}
+
 		gnutls_transport_set_ptr(sess, reinterpret_cast<gnutls_transport_ptr_t>(sock));
 		gnutls_transport_set_vec_push_function(sess, VectorPush);
 		gnutls_transport_set_pull_function(sess, gnutls_pull_wrapper);
-		GetProfile().SetupSession(sess);
-
 		sock->AddIOHook(this);
 		Handshake(sock);
 	}
@@ -959,6 +1514,10 @@ public:
 		if (prepret <= 0)
 			return prepret;
 
+		// Data which was received before an offloaded handshake finished has to be read first.
+		if (!handshakebuffer.empty())
+			return ReadHandshakeBuffer(user, recvq);
+
 		// If we resumed the handshake then this->status will be STATUS_OPEN.
 		{
 			GnuTLS::DataReader reader(sess);
@@ -1042,6 +1601,10 @@ public:
 
 	bool GetServerName(std::string& out) const override
 	{
+		// The session can not be touched whilst a worker is handshaking it.
+		if (offload && offload->running)
+			return false;
+
 		std::vector<char> nameBuffer(1);
 		size_t nameLength = 0;
 		unsigned int nameType = GNUTLS_NAME_DNS;
@@ -1067,8 +1630,8 @@ int GnuTLS::X509Credentials::cert_callback(gnutls_session_t sess, const gnutls_d
 	st->cert_type = GNUTLS_CRT_X509;
 	st->key_type = GNUTLS_PRIVKEY_X509;
 
-	StreamSocket* sock = reinterpret_cast<StreamSocket*>(gnutls_transport_get_ptr(sess));
-	GnuTLS::X509Credentials& cred = static_cast<GnuTLSIOHook*>(sock->GetModHook(thismod))->GetProfile().GetX509Credentials();
+	// This may be called on a handshake worker thread so the socket can not be used here.
+	GnuTLS::X509Credentials& cred = static_cast<GnuTLS::Profile*>(gnutls_session_get_ptr(sess))->GetX509Credentials();
 
 	st->ncerts = static_cast<unsigned int>(cred.certs.size());
 	st->cert.x509 = cred.certs.raw();
@@ -1083,10 +1646,14 @@ class GnuTLSIOHookProvider final
 {
 	GnuTLS::Profile profile;
 
+	/** The pool which handshakes with clients are run on. */
+	WorkerPool& pool;
+
 public:
-	GnuTLSIOHookProvider(Module* mod, GnuTLS::Profile::Config& config)
+	GnuTLSIOHookProvider(Module* mod, GnuTLS::Profile::Config& config, const std::shared_ptr<GnuTLS::SessionState>& state, WorkerPool& workerpool)
 		: SSLIOHookProvider(mod, config.name)
-		, profile(config)
+		, profile(config, state)
+		, pool(workerpool)
 	{
 		ServerInstance->Modules.AddService(*this);
 	}
@@ -1098,7 +1665,7 @@ public:
 
 	void OnAccept(StreamSocket* sock, const irc::sockets::sockaddrs& client, const irc::sockets::sockaddrs& server) override
 	{
-		new GnuTLSIOHook(shared_from_this(), sock, GNUTLS_SERVER);
+		new GnuTLSIOHook(shared_from_this(), sock, GNUTLS_SERVER, {}, pool.GetWorkers() ? &pool : nullptr);
 	}
 
 	void OnConnect(StreamSocket* sock) override
@@ -1106,6 +1673,11 @@ public:
 		new GnuTLSIOHook(shared_from_this(), sock, GNUTLS_CLIENT);
 	}
 
+	void OnConnect(StreamSocket* sock, const std::string& sessionkey) override
+	{
+		new GnuTLSIOHook(shared_from_this(), sock, GNUTLS_CLIENT, sessionkey);
+	}
+
 	GnuTLS::Profile& GetProfile() { return profile; }
 };
 
@@ -1116,6 +1688,7 @@ GnuTLS::Profile& GnuTLSIOHook::GetProfile()
 
 class ModuleSSLGnuTLS final
 	: public Module
+	, public Stats::EventListener
 {
 	typedef std::vector<std::shared_ptr<GnuTLSIOHookProvider>> ProfileList;
 
@@ -1124,6 +1697,9 @@ class ModuleSSLGnuTLS final
 	ProfileList profiles;
 	std::function<void(char*, size_t)> rememberer;
 
+	// This has to be destroyed before the profiles as unfinished handshakes keep them alive.
+	WorkerPool pool;
+
 	void ReadProfiles()
 	{
 		// First, store all profiles in a new, temporary container. If no problems occur, swap the two
@@ -1150,18 +1726,26 @@ class ModuleSSLGnuTLS final
 				continue;
 			}
 
-			std::shared_ptr<GnuTLSIOHookProvider> prov;
+			// Keep the session caches and ticket keys of profiles which are being reloaded.
+			std::shared_ptr<GnuTLS::SessionState> state;
+			for (const auto& profile : profiles)
+			{
+				if (profile->GetProfile().GetName() == name)
+					state = profile->GetProfile().GetSessionStatePtr();
+			}
+
+			std::shared_ptr<GnuTLSIOHookProvider> newprov;
 			try
 			{
 				GnuTLS::Profile::Config profileconfig(name, tag);
-				prov = std::make_shared<GnuTLSIOHookProvider>(this, profileconfig);
+				newprov = std::make_shared<GnuTLSIOHookProvider>(this, profileconfig, state, pool);
 			}
 			catch (const CoreException& ex)
 			{
 				throw ModuleException(this, "Error while initializing TLS profile \"" + name + "\" at " + tag->source.str() + " - " + ex.GetReason());
 			}
 
-			newprofiles.push_back(prov);
+			newprofiles.push_back(newprov);
 		}
 
 		// New profiles are ok, begin using them
@@ -1175,6 +1759,7 @@ class ModuleSSLGnuTLS final
 public:
 	ModuleSSLGnuTLS()
 		: Module(VF_VENDOR, "Allows TLS encrypted connections using the GnuTLS library.")
+		, Stats::EventListener(this)
 		, rememberer(ServerInstance->GenRandom)
 	{
 		thismod = this;
@@ -1190,6 +1775,7 @@ public:
 	void ReadConfig(ConfigStatus& status) override
 	{
 		const auto& tag = ServerInstance->Config->ConfValue("gnutls");
+		pool.SetWorkers(tag->getNum<size_t>("handshakethreads", 0, 0, 64));
 		if (status.initial || tag->getBool("onrehash", true))
 		{
 			// Try to help people who have outdated configs.
@@ -1238,6 +1824,32 @@ public:
 		}
 	}
 
+	ModResult OnStats(Stats::Context& stats) override
+	{
+		if (stats.GetSymbol() != 'T')
+			return MOD_RES_PASSTHRU;
+
+		for (const auto& profile : profiles)
+		{
+			GnuTLS::SessionState& state = profile->GetProfile().GetSessionState();
+			std::lock_guard<std::mutex> lock(state.mutex);
+			stats.AddGenericRow(INSP_FORMAT("TLS profile {} (GnuTLS): {}, {} cached sessions",
+				profile->GetProfile().GetName(), state.stats.ToString(), state.servercache.Size()));
+		}
+		return MOD_RES_PASSTHRU;
+	}
+
+	void OnPostConnect(User* user) override
+	{
+		LocalUser* const localuser = IS_LOCAL(user);
+		if (!localuser)
+			return;
+
+		GnuTLSIOHook* const iohook = static_cast<GnuTLSIOHook*>(localuser->eh.GetModHook(this));
+		if (iohook)
+			iohook->GetProfile().GetSessionState().stats.AddRegistration(iohook->GetAge());
+	}
+
 	ModResult OnCheckReady(LocalUser* user) override
 	{
 		const GnuTLSIOHook* const iohook = static_cast<GnuTLSIOHook*>(user->eh.GetModHook(this));
@@ -43,13 +43,19 @@
 #include "inspircd.h"
 #include "iohook.h"
 #include "modules/ssl.h"
+#include "modules/stats.h"
 #include "stringutils.h"
+#include "threadsocket.h"
 #include "timeutils.h"
 #include "utility/string.h"
 
+#include <chrono>
+
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/dh.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
 
 #ifdef _WIN32
 # define timegm _mkgmtime
@@ -64,9 +70,16 @@
 # define OPENSSL_VERSION_STRING OPENSSL_VERSION
 #else
 # define INSPIRCD_OPENSSL_AUTO_DH
+# define INSPIRCD_OPENSSL_EVP_TICKETS
+# include <openssl/core_names.h>
 #endif
 
-static bool SelfSigned = false;
+// OnVerify may be called on a handshake worker thread so this has to be thread local.
+static thread_local bool SelfSigned = false;
+
+// OnTicketKey may be called on a handshake worker thread so errors are passed back to
+// the main thread to be logged.
+static thread_local std::string TicketKeyError;
 static int exdataindex;
 static Module* thismod;
 
@@ -77,6 +90,14 @@ char* get_error()
 
 static int OnVerify(int preverify_ok, X509_STORE_CTX* ctx);
 static void StaticSSLInfoCallback(const SSL* ssl, int where, int rc);
+static int OnNewSession(SSL* ssl, SSL_SESSION* session);
+static SSL_SESSION* OnGetSession(SSL* ssl, const unsigned char* id, int idlen, int* copy);
+static void OnRemoveSession(SSL_CTX* ctx, SSL_SESSION* session);
+#ifdef INSPIRCD_OPENSSL_EVP_TICKETS
+static int OnTicketKey(SSL* ssl, unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cipherctx, EVP_MAC_CTX* macctx, int enc);
+#else
+static int OnTicketKey(SSL* ssl, unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cipherctx, HMAC_CTX* macctx, int enc);
+#endif
 
 namespace OpenSSL
 {
@@ -121,6 +142,131 @@ namespace OpenSSL
 	};
 #endif
 
+	/** Keys used to encrypt and decrypt stateless session tickets. */
+	class TicketKeys final
+	{
+	public:
+		struct Key final
+		{
+			/** The name which identifies this key in a ticket. */
+			unsigned char name[16];
+
+			/** The key used to encrypt tickets. */
+			unsigned char aeskey[32];
+
+			/** The key used to authenticate tickets. */
+			unsigned char hmackey[32];
+
+			/** The rotation period this key was created for. */
+			time_t epoch;
+		};
+
+	private:
+		/** The keys which are currently accepted, newest first. */
+		std::deque<Key> keys;
+
+		/** If non-empty then the secret keys are derived from. */
+		std::string secret;
+
+		/** The number of seconds between key rotations. */
+		unsigned long rotate = 1;
+
+		/** The number of seconds a ticket is valid for. */
+		unsigned long lifetime = 0;
+
+		void Derive(const std::string& label, time_t epoch, unsigned char* out, size_t outlen)
+		{
+			unsigned char md[EVP_MAX_MD_SIZE];
+			unsigned int mdlen = 0;
+			const std::string data = INSP_FORMAT("{}:{}", label, epoch);
+			HMAC(EVP_sha256(), secret.data(), static_cast<int>(secret.length()), reinterpret_cast<const unsigned char*>(data.data()), data.length(), md, &mdlen);
+			memcpy(out, md, std::min<size_t>(outlen, mdlen));
+		}
+
+		Key Generate(time_t epoch)
+		{
+			Key key;
+			key.epoch = epoch;
+			if (secret.empty())
+			{
+				// Keys which are not derived from a secret do not survive a restart.
+				if (RAND_bytes(key.name, sizeof(key.name)) <= 0 || RAND_bytes(key.aeskey, sizeof(key.aeskey)) <= 0 || RAND_bytes(key.hmackey, sizeof(key.hmackey)) <= 0)
+					throw Exception("Unable to generate a session ticket key: " + std::string(get_error()));
+			}
+			else
+			{
+				// Keys which are derived from a secret are the same after a restart and on
+				// every server which shares the secret.
+				Derive("name", epoch, key.name, sizeof(key.name));
+				Derive("aes", epoch, key.aeskey, sizeof(key.aeskey));
+				Derive("hmac", epoch, key.hmackey, sizeof(key.hmackey));
+			}
+			return key;
+		}
+
+	public:
+		/** Changes the settings used for generating keys. */
+		void Configure(const std::string& newsecret, unsigned long newrotate, unsigned long newlifetime)
+		{
+			if (newsecret != secret || newrotate != rotate)
+				keys.clear();
+
+			secret = newsecret;
+			rotate = newrotate;
+			lifetime = newlifetime;
+		}
+
+		/** Creates a new key if the current one is due to be rotated and forgets keys which can
+		 * only have encrypted expired tickets.
+		 */
+		void Rotate()
+		{
+			// This may be called on a handshake worker thread so ServerInstance->Time() can not be used.
+			const time_t epoch = time(nullptr) / rotate;
+			if (keys.empty() || keys.front().epoch != epoch)
+				keys.push_front(Generate(epoch));
+
+			const time_t oldest = epoch - static_cast<time_t>((lifetime + rotate - 1) / rotate);
+			while (keys.size() > 1 && keys.back().epoch < oldest)
+				keys.pop_back();
+		}
+
+		/** Retrieves the key which new tickets should be encrypted with. */
+		const Key& GetCurrent() const { return keys.front(); }
+
+		/** Finds the key with the specified name.
+		 * @return The key with the specified name or nullptr if it is not known.
+		 */
+		const Key* Find(const unsigned char* name) const
+		{
+			for (const auto& key : keys)
+			{
+				if (!memcmp(key.name, name, sizeof(key.name)))
+					return &key;
+			}
+			return nullptr;
+		}
+	};
+
+	/** Session resumption state which is kept when a profile is reloaded. */
+	struct SessionState final
+	{
+		/** Sessions which clients connecting to us can resume. */
+		SSLSessionCache servercache;
+
+		/** Sessions which we can resume when connecting to a server. */
+		SSLSessionCache clientcache;
+
+		/** Keys used to encrypt stateless session tickets. */
+		TicketKeys ticketkeys;
+
+		/** Counters for the handshakes performed with this profile. */
+		SSLHandshakeStats stats;
+
+		/** Guards the caches and ticket keys which are also used by handshake worker threads. */
+		std::mutex mutex;
+	};
+
 	class Context final
 	{
 		SSL_CTX* const ctx;
@@ -269,6 +415,48 @@ namespace OpenSSL
 			SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_CLIENT_ONCE, OnVerify);
 		}
 
+		void SetSessionState(SessionState* state, unsigned long timeout)
+		{
+			SSL_CTX_set_app_data(ctx, state);
+			SSL_CTX_set_timeout(ctx, static_cast<long>(timeout));
+		}
+
+		void EnableServerSessions(const std::string& sidctx, bool cache, bool tickets)
+		{
+			// Sessions can only be resumed within the profile they were created in.
+			ERR_clear_error();
+			if (!SSL_CTX_set_session_id_context(ctx, reinterpret_cast<const unsigned char*>(sidctx.data()), static_cast<unsigned int>(std::min<size_t>(sidctx.length(), SSL_MAX_SID_CTX_LENGTH))))
+				throw Exception("Couldn't set the session id context");
+
+			if (cache)
+			{
+				// We use our own cache so that it can be kept when the profile is reloaded.
+				SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+				SSL_CTX_sess_set_new_cb(ctx, OnNewSession);
+				SSL_CTX_sess_set_get_cb(ctx, OnGetSession);
+				SSL_CTX_sess_set_remove_cb(ctx, OnRemoveSession);
+			}
+
+			if (tickets)
+			{
+				ctx_options &= ~SSL_OP_NO_TICKET;
+				SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+#ifdef INSPIRCD_OPENSSL_EVP_TICKETS
+				SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, OnTicketKey);
+#else
+				SSL_CTX_set_tlsext_ticket_key_cb(ctx, OnTicketKey);
+#endif
+			}
+		}
+
+		void EnableClientSessions()
+		{
+			ctx_options &= ~SSL_OP_NO_TICKET;
+			SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+			SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL);
+			SSL_CTX_sess_set_new_cb(ctx, OnNewSession);
+		}
+
 		SSL* CreateServerSession()
 		{
 			SSL* sess = SSL_new(ctx);
@@ -317,6 +505,10 @@ namespace OpenSSL
 		 */
 		const unsigned int outrecsize;
 
+		/** Session resumption state for this profile
+		 */
+		std::shared_ptr<SessionState> state;
+
 		static int error_callback(const char* str, size_t len, void* u)
 		{
 			Profile* profile = reinterpret_cast<Profile*>(u);
@@ -367,7 +559,7 @@ namespace OpenSSL
 		}
 
 	public:
-		Profile(const std::string& profilename, const std::shared_ptr<ConfigTag>& tag)
+		Profile(const std::string& profilename, const std::shared_ptr<ConfigTag>& tag, const std::shared_ptr<SessionState>& oldstate)
 			: name(profilename)
 #ifndef INSPIRCD_OPENSSL_AUTO_DH
 			, dh(ServerInstance->Config->Paths.PrependConfig(tag->getString("dhfile", "dhparams.pem", 1)))
@@ -376,6 +568,7 @@ namespace OpenSSL
 			, clientctx(SSL_CTX_new(TLS_client_method()))
 			, allowrenego(tag->getBool("renegotiation")) // Disallow by default
 			, outrecsize(tag->getNum<unsigned int>("outrecsize", 2048, 512, 16384))
+			, state(oldstate ? oldstate : std::make_shared<SessionState>())
 		{
 #ifndef INSPIRCD_OPENSSL_AUTO_DH
 			if ((!ctx.SetDH(dh)) || (!clientctx.SetDH(dh)))
@@ -413,6 +606,23 @@ namespace OpenSSL
 				ctx.SetECDH(curvename);
 #endif
 
+			const size_t sessioncache = tag->getNum<size_t>("sessioncache", 0);
+			const unsigned long sessiontimeout = tag->getDuration("sessiontimeout", 60*60, 1);
+			const bool tickets = tag->getBool("tickets");
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->servercache.SetLimits(sessioncache, sessiontimeout);
+				state->clientcache.SetLimits(sessioncache ? sessioncache : 100, sessiontimeout);
+				if (tickets)
+					state->ticketkeys.Configure(tag->getString("ticketsecret"), tag->getDuration("ticketrotate", 60*60, 60), sessiontimeout);
+			}
+
+			ctx.SetSessionState(state.get(), sessiontimeout);
+			clientctx.SetSessionState(state.get(), sessiontimeout);
+			if (sessioncache || tickets)
+				ctx.EnableServerSessions(name, sessioncache, tickets);
+			clientctx.EnableClientSessions();
+
 			SetContextOptions("server", tag, ctx);
 			SetContextOptions("client", tag, clientctx);
 
@@ -454,7 +664,26 @@ namespace OpenSSL
 
 		const std::string& GetName() const { return name; }
 		SSL* CreateServerSession() { return ctx.CreateServerSession(); }
-		SSL* CreateClientSession() { return clientctx.CreateClientSession(); }
+		SessionState& GetSessionState() { return *state; }
+		const std::shared_ptr<SessionState>& GetSessionStatePtr() const { return state; }
+
+		SSL* CreateClientSession(const std::string& sessionkey)
+		{
+			SSL* sess = clientctx.CreateClientSession();
+			std::lock_guard<std::mutex> lock(state->mutex);
+			const std::string* data = sessionkey.empty() ? nullptr : state->clientcache.Find(sessionkey);
+			if (data)
+			{
+				const unsigned char* ptr = reinterpret_cast<const unsigned char*>(data->data());
+				SSL_SESSION* session = d2i_SSL_SESSION(nullptr, &ptr, static_cast<long>(data->length()));
+				if (session)
+				{
+					SSL_set_session(sess, session);
+					SSL_SESSION_free(session);
+				}
+			}
+			return sess;
+		}
 		const EVP_MD* GetDigest() { return digest; }
 		bool AllowRenegotiation() const { return allowrenego; }
 		unsigned int GetOutgoingRecordSize() const { return outrecsize; }
@@ -524,11 +753,341 @@ private:
 	SSL* sess;
 	bool data_to_write = false;
 
+	/** If non-empty then the key under which the session of this outgoing connection is cached. */
+	const std::string sessionkey;
+
+	/** The time spent processing the handshake so far in microseconds. */
+	unsigned long long handshaketime = 0;
+
+	/** The most data that can be buffered for an offloaded handshake before it is aborted. */
+	static constexpr size_t MaxOffloadBuffer = 128 * 1024;
+
+	/** The state of a handshake which is being run on handshake worker threads. */
+	struct Offload final
+	{
+		/** The pool that the steps of the handshake are run on. */
+		WorkerPool& pool;
+
+		/** The session which is handshaking. This belongs to the worker whilst a step is running. */
+		SSL* const sess;
+
+		/** The socket which the handshake is happening on. */
+		StreamSocket* const sock;
+
+		/** The hook which owns the handshake or nullptr if it was closed whilst a step was running. */
+		OpenSSLIOHook* hook;
+
+		/** Keeps the profile and its session state alive whilst a step is running. */
+		const std::shared_ptr<IOHookProvider> prov;
+
+		/** Data from the peer which has not been given to a worker yet. */
+		std::string input;
+
+		/** Data from a worker which has not been sent to the peer yet. */
+		std::string output;
+
+		/** Data written by the session during the current step. */
+		std::string written;
+
+		/** The amount of data which the session has not processed yet. */
+		size_t buffered = 0;
+
+		/** Whether a step is being run. */
+		bool running = false;
+
+		/** Whether a step is being submitted to the pool. */
+		bool submitting = false;
+
+		/** Whether the handshake has finished and is waiting for its output to be sent. */
+		bool finished = false;
+
+		/** The value returned by SSL_do_handshake() during the last step. */
+		int result = 0;
+
+		/** The error from SSL_get_error() during the last step. */
+		int error = SSL_ERROR_NONE;
+
+		/** Whether the peer certificate was self signed. */
+		bool selfsigned = false;
+
+		/** If non-empty then an error which occurred whilst handling a session ticket during the last step. */
+		std::string ticketerror;
+
+		/** The time spent processing the last step in microseconds. */
+		unsigned long long time = 0;
+
+		Offload(WorkerPool& workerpool, SSL* session, StreamSocket* socket, OpenSSLIOHook* iohook)
+			: pool(workerpool)
+			, sess(session)
+			, sock(socket)
+			, hook(iohook)
+			, prov(iohook->prov)
+		{
+		}
+	};
+
+	/** If non-null then the handshake is being run on handshake worker threads. */
+	std::shared_ptr<Offload> offload;
+
+	/** If non-null then a memory BIO containing data which was received before an offloaded handshake finished. */
+	BIO* handshakebio = nullptr;
+
+	// Runs the next step of an offloaded handshake on a worker thread.
+	void SubmitHandshake()
+	{
+		std::shared_ptr<Offload> job = offload;
+		job->running = true;
+		job->submitting = true;
+
+		std::string data;
+		data.swap(job->input);
+		job->pool.Submit([job, data]() {
+			// This is called on a worker thread so only the session can be touched.
+			BIO_write(SSL_get_rbio(job->sess), data.data(), static_cast<int>(data.length()));
+
+			ERR_clear_error();
+			const auto start = std::chrono::steady_clock::now();
+			job->result = SSL_do_handshake(job->sess);
+			job->time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+			job->error = job->result > 0 ? SSL_ERROR_NONE : SSL_get_error(job->sess, job->result);
+			job->selfsigned = SelfSigned;
+			job->ticketerror.swap(TicketKeyError);
+			TicketKeyError.clear();
+			ERR_clear_error();
+
+			char buffer[4096];
+			int ret;
+			BIO* wbio = SSL_get_wbio(job->sess);
+			while ((ret = BIO_read(wbio, buffer, sizeof(buffer))) > 0)
+				job->written.append(buffer, ret);
+			job->buffered = BIO_ctrl_pending(SSL_get_rbio(job->sess));
+		}, [job](bool ran) {
+			job->running = false;
+			if (job->hook)
+				job->hook->OnHandshakeStep(ran);
+			else
+				SSL_free(job->sess);
+		});
+		job->submitting = false;
+	}
+
+	// Called on the main thread when a step of an offloaded handshake has been run.
+	void OnHandshakeStep(bool ran)
+	{
+		StreamSocket* sock = offload->sock;
+		const bool submitting = offload->submitting;
+		offload->output.append(offload->written);
+		offload->written.clear();
+		handshaketime += offload->time;
+
+		if (!offload->ticketerror.empty())
+		{
+			ServerInstance->Logs.Warning(MODNAME, offload->ticketerror);
+			offload->ticketerror.clear();
+		}
+
+		bool failed = !ran || offload->input.length() + offload->buffered > MaxOffloadBuffer;
+		if (!failed && offload->result > 0)
+		{
+			offload->finished = true;
+			failed = !SendHandshakeData(sock);
+			if (!failed && offload->output.empty())
+				CompleteHandshake(sock);
+		}
+		else if (!failed)
+		{
+			failed = (offload->error != SSL_ERROR_WANT_READ && offload->error != SSL_ERROR_WANT_WRITE) || !SendHandshakeData(sock);
+			if (!failed && !offload->input.empty())
+				SubmitHandshake();
+		}
+
+		if (failed)
+		{
+			// Try to send any alert before the session is closed.
+			SendHandshakeData(sock);
+			CloseSession();
+			sock->SetError("Handshake failed");
+		}
+
+		// If the pool ran the step synchronously then the caller of SubmitHandshake() handles the result.
+		if (submitting)
+			return;
+
+		if (status == STATUS_NONE)
+			sock->OnError(I_ERR_OTHER);
+		else if (handshakebio)
+			sock->OnEventHandlerRead();
+	}
+
+	// Sends data from an offloaded handshake to the socket. Returns false on error.
+	bool SendHandshakeData(StreamSocket* user)
+	{
+		if (offload->output.empty() || (user->GetEventMask() & FD_WRITE_WILL_BLOCK))
+			return true;
+
+		ssize_t ret = SocketEngine::Send(user, offload->output.data(), offload->output.length(), 0);
+		if (ret > 0)
+			offload->output.erase(0, ret);
+		else if (!SocketEngine::IgnoreError())
+			return false;
+
+		if (!offload->output.empty())
+			SocketEngine::ChangeEventMask(user, FD_WRITE_WILL_BLOCK | FD_WANT_SINGLE_WRITE);
+		return true;
+	}
+
+	// Receives data for an offloaded handshake from the socket. Returns false on error.
+	bool ReceiveHandshakeData(StreamSocket* user)
+	{
+		if (user->GetEventMask() & FD_READ_WILL_BLOCK)
+			return true;
+
+		char* buffer = ServerInstance->GetReadBuffer();
+		ssize_t ret = SocketEngine::Recv(user, buffer, ServerInstance->Config->NetBufferSize, 0);
+		if (ret > 0)
+		{
+			offload->input.append(buffer, ret);
+			if (static_cast<size_t>(ret) == ServerInstance->Config->NetBufferSize)
+				SocketEngine::ChangeEventMask(user, FD_ADD_TRIAL_READ);
+			return offload->input.length() <= MaxOffloadBuffer;
+		}
+		else if (ret == 0)
+		{
+			user->SetError("Connection closed");
+			return false;
+		}
+		else if (SocketEngine::IgnoreError())
+		{
+			SocketEngine::ChangeEventMask(user, FD_READ_WILL_BLOCK);
+			return true;
+		}
+		else if (errno == EINTR)
+		{
+			SocketEngine::ChangeEventMask(user, FD_ADD_TRIAL_READ);
+			return true;
+		}
+
+		user->SetError(SocketEngine::LastError());
+		return false;
+	}
+
+	// Moves data between the socket and an offloaded handshake. Returns the same as Handshake().
+	int OffloadHandshake(StreamSocket* user)
+	{
+		if (!SendHandshakeData(user) || (!offload->finished && !ReceiveHandshakeData(user)))
+		{
+			CloseSession();
+			return -1;
+		}
+
+		if (offload->finished)
+		{
+			if (!offload->output.empty())
+				return 0;
+
+			CompleteHandshake(user);
+			return 1;
+		}
+
+		if (!offload->running && !offload->input.empty())
+		{
+			SubmitHandshake();
+
+			// If the pool has no workers then the step has already been run.
+			if (status != STATUS_HANDSHAKING)
+				return status == STATUS_OPEN ? 1 : -1;
+		}
+		return 0;
+	}
+
+	// Moves the session of a finished offloaded handshake back to doing I/O on the socket.
+	void CompleteHandshake(StreamSocket* user)
+	{
+		BIO* rbio = SSL_get_rbio(sess);
+		if (!offload->input.empty())
+			BIO_write(rbio, offload->input.data(), static_cast<int>(offload->input.length()));
+
+		BIO* bio = BIO_new(biomethods);
+		BIO_set_data(bio, user);
+		if (BIO_ctrl_pending(rbio))
+		{
+			// The peer sent data after the handshake which has to be read before the socket.
+			handshakebio = rbio;
+			SSL_set0_wbio(sess, bio);
+		}
+		else
+		{
+			SSL_set_bio(sess, bio, bio);
+		}
+
+		SSL_set_ex_data(sess, exdataindex, this);
+		SelfSigned = offload->selfsigned;
+		offload.reset();
+
+		resumed = SSL_session_reused(sess);
+		SSLHandshakeStats& stats = GetProfile().GetSessionState().stats;
+		stats.Add(resumed, handshaketime);
+		stats.offloaded++;
+		VerifyCertificate();
+
+		status = STATUS_OPEN;
+		SocketEngine::ChangeEventMask(user, FD_WANT_POLL_READ | FD_WANT_NO_WRITE | FD_ADD_TRIAL_WRITE);
+	}
+
+	// Reads the data which was received before an offloaded handshake finished and then
+	// goes back to reading from the socket.
+	ssize_t ReadHandshakeBuffer(StreamSocket* user, std::string& recvq)
+	{
+		char* buffer = ServerInstance->GetReadBuffer();
+		int bufsiz = static_cast<int>(std::min<size_t>(ServerInstance->Config->NetBufferSize, INT_MAX));
+		while (BIO_ctrl_pending(handshakebio) || SSL_pending(sess) > 0)
+		{
+			ERR_clear_error();
+			int ret = SSL_read(sess, buffer, bufsiz);
+
+			if (!CheckRenego(user))
+				return -1;
+
+			if (ret > 0)
+			{
+				recvq.append(buffer, ret);
+				continue;
+			}
+			else if (ret == 0)
+			{
+				CloseSession();
+				user->SetError("Connection closed");
+				return -1;
+			}
+			else if (SSL_get_error(sess, ret) != SSL_ERROR_WANT_READ)
+			{
+				CloseSession();
+				return -1;
+			}
+
+			// The rest of the record is still on the socket.
+			break;
+		}
+
+		BIO* bio = SSL_get_wbio(sess);
+		BIO_up_ref(bio);
+		SSL_set0_rbio(sess, bio);
+		handshakebio = nullptr;
+
+		SocketEngine::ChangeEventMask(user, FD_WANT_POLL_READ | FD_ADD_TRIAL_READ);
+		return 1;
+	}
+
 	// Returns 1 if handshake succeeded, 0 if it is still in progress, -1 if it failed
 	int Handshake(StreamSocket* user)
 	{
+		if (offload)
+			return OffloadHandshake(user);
+
 		ERR_clear_error();
+		const auto start = std::chrono::steady_clock::now();
 		int ret = SSL_do_handshake(sess);
+		handshaketime += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
 		if (ret < 0)
 		{
 			int err = SSL_get_error(sess, ret);
@@ -554,6 +1113,8 @@ private:
 		else if (ret > 0)
 		{
 			// Handshake complete.
+			resumed = SSL_session_reused(sess);
+			GetProfile().GetSessionState().stats.Add(resumed, handshaketime);
 			VerifyCertificate();
 
 			status = STATUS_OPEN;
@@ -571,6 +1132,16 @@ private:
 
 	void CloseSession()
 	{
+		if (offload)
+		{
+			// If a step is running then the session is freed once it has finished.
+			offload->hook = nullptr;
+			if (offload->running)
+				sess = nullptr;
+			offload.reset();
+		}
+
+		handshakebio = nullptr;
 		if (sess)
 		{
 			SSL_shutdown(sess);
@@ -599,6 +1170,10 @@ private:
 
 		certinfo->invalid = (SSL_get_verify_result(sess) != X509_V_OK);
 
+		// OnVerify is not called when a session is resumed.
+		if (resumed)
+			SelfSigned = (SSL_get_verify_result(sess) == X509_V_ERR_DEPTH_ZERO_SELF_SIGNED_CERT);
+
 		if (!SelfSigned)
 		{
 			certinfo->unknownsigner = false;
@@ -712,10 +1287,23 @@ private:
 	friend void StaticSSLInfoCallback(const SSL* ssl, int where, int rc);
 
 public:
-	OpenSSLIOHook(const std::shared_ptr<IOHookProvider>& hookprov, StreamSocket* sock, SSL* session)
+	OpenSSLIOHook(const std::shared_ptr<IOHookProvider>& hookprov, StreamSocket* sock, SSL* session, const std::string& key = "", WorkerPool* pool = nullptr)
 		: SSLIOHook(hookprov)
 		, sess(session)
+		, sessionkey(key)
 	{
+		if (pool)
+		{
+			// The handshake is run on a worker thread using memory BIOs and only the main
+			// thread touches the socket until it has finished.
+			offload = std::make_shared<Offload>(*pool, sess, sock, this);
+			SSL_set_bio(sess, BIO_new(BIO_s_mem()), BIO_new(BIO_s_mem()));
+			sock->AddIOHook(this);
+			status = STATUS_HANDSHAKING;
+			SocketEngine::ChangeEventMask(sock, FD_WANT_POLL_READ | FD_WANT_NO_WRITE);
+			return;
+		}
+
 		// Create BIO instance and store a pointer to the socket in it which will be used by the read and write functions
 		BIO* bio = BIO_new(biomethods);
 		BIO_set_data(bio, sock);
@@ -738,6 +1326,10 @@ public:
 		if (prepret <= 0)
 			return prepret;
 
+		// Data which was received before an offloaded handshake finished has to be read first.
+		if (handshakebio)
+			return ReadHandshakeBuffer(user, recvq);
+
 		// If we resumed the handshake then this->status will be STATUS_OPEN
 		{
 			ERR_clear_error();
@@ -864,6 +1456,10 @@ public:
 
 	bool GetServerName(std::string& out) const override
 	{
+		// The session can not be touched whilst a worker is handshaking it.
+		if (offload && offload->running)
+			return false;
+
 		const char* name = SSL_get_servername(sess, TLSEXT_NAMETYPE_host_name);
 		if (!name)
 			return false;
@@ -872,13 +1468,144 @@ public:
 		return true;
 	}
 
+	const std::string& GetSessionKey() const { return sessionkey; }
+
 	OpenSSL::Profile& GetProfile();
 };
 
 static void StaticSSLInfoCallback(const SSL* ssl, int where, int rc)
 {
+	// This is not set whilst the handshake is being run on a worker thread.
 	OpenSSLIOHook* hook = static_cast<OpenSSLIOHook*>(SSL_get_ex_data(ssl, exdataindex));
-	hook->SSLInfoCallback(where, rc);
+	if (hook)
+		hook->SSLInfoCallback(where, rc);
+}
+
+static OpenSSL::SessionState* GetSessionState(const SSL* ssl)
+{
+	return static_cast<OpenSSL::SessionState*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+}
+
+static int OnNewSession(SSL* ssl, SSL_SESSION* session)
+{
+	OpenSSLIOHook* hook = static_cast<OpenSSLIOHook*>(SSL_get_ex_data(ssl, exdataindex));
+	if (SSL_is_server(ssl))
+	{
+		// TLSv1.3 sessions which are resumed using a stateless ticket do not need to be cached.
+		if (SSL_version(ssl) >= TLS1_3_VERSION && !(SSL_get_options(ssl) & SSL_OP_NO_TICKET))
+			return 0;
+	}
+	else if (!hook || hook->GetSessionKey().empty())
+	{
+		// Only outgoing server connections have a key to cache their sessions under.
+		return 0;
+	}
+
+	std::string data(std::max(i2d_SSL_SESSION(session, nullptr), 0), '\0');
+	unsigned char* ptr = reinterpret_cast<unsigned char*>(data.data());
+	if (data.empty() || i2d_SSL_SESSION(session, &ptr) <= 0)
+		return 0;
+
+	OpenSSL::SessionState* state = GetSessionState(ssl);
+	std::lock_guard<std::mutex> lock(state->mutex);
+	if (SSL_is_server(ssl))
+	{
+		unsigned int idlen;
+		const unsigned char* id = SSL_SESSION_get_id(session, &idlen);
+		state->servercache.Add(std::string(reinterpret_cast<const char*>(id), idlen), data);
+	}
+	else
+	{
+		state->clientcache.Add(hook->GetSessionKey(), data);
+	}
+
+	// We have serialised the session so OpenSSL can keep ownership of it.
+	return 0;
+}
+
+static SSL_SESSION* OnGetSession(SSL* ssl, const unsigned char* id, int idlen, int* copy)
+{
+	*copy = 0;
+	OpenSSL::SessionState* state = GetSessionState(ssl);
+	std::lock_guard<std::mutex> lock(state->mutex);
+	const std::string* data = state->servercache.Find(std::string(reinterpret_cast<const char*>(id), idlen));
+	if (!data)
+		return nullptr;
+
+	const unsigned char* ptr = reinterpret_cast<const unsigned char*>(data->data());
+	return d2i_SSL_SESSION(nullptr, &ptr, static_cast<long>(data->length()));
+}
+
+static void OnRemoveSession(SSL_CTX* ctx, SSL_SESSION* session)
+{
+	unsigned int idlen;
+	const unsigned char* id = SSL_SESSION_get_id(session, &idlen);
+	auto* state = static_cast<OpenSSL::SessionState*>(SSL_CTX_get_app_data(ctx));
+	std::lock_guard<std::mutex> lock(state->mutex);
+	state->servercache.Remove(std::string(reinterpret_cast<const char*>(id), idlen));
+}
+
+#ifdef INSPIRCD_OPENSSL_EVP_TICKETS
+static bool InitTicketMAC(EVP_MAC_CTX* macctx, const OpenSSL::TicketKeys::Key& key)
+{
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char*>(key.hmackey), sizeof(key.hmackey)),
+		OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char*>("SHA256"), 0),
+		OSSL_PARAM_construct_end(),
+	};
+	return EVP_MAC_CTX_set_params(macctx, params);
+}
+
+static int OnTicketKey(SSL* ssl, unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cipherctx, EVP_MAC_CTX* macctx, int enc)
+#else
+static bool InitTicketMAC(HMAC_CTX* macctx, const OpenSSL::TicketKeys::Key& key)
+{
+	return HMAC_Init_ex(macctx, key.hmackey, sizeof(key.hmackey), EVP_sha256(), nullptr);
+}
+
+static int OnTicketKey(SSL* ssl, unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cipherctx, HMAC_CTX* macctx, int enc)
+#endif
+{
+	OpenSSL::SessionState* state = GetSessionState(ssl);
+	std::lock_guard<std::mutex> lock(state->mutex);
+	OpenSSL::TicketKeys& keys = state->ticketkeys;
+	try
+	{
+		keys.Rotate();
+	}
+	catch (const CoreException& ex)
+	{
+		// The hook is only set when we are not on a handshake worker thread.
+		if (SSL_get_ex_data(ssl, exdataindex))
+			ServerInstance->Logs.Warning(MODNAME, ex.GetReason());
+		else
+			TicketKeyError = ex.GetReason();
+		return -1;
+	}
+
+	if (enc)
+	{
+		// Encrypt a new ticket with the current key.
+		const OpenSSL::TicketKeys::Key& key = keys.GetCurrent();
+		if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) <= 0)
+			return -1;
+
+		memcpy(keyname, key.name, sizeof(key.name));
+		if (!EVP_EncryptInit_ex(cipherctx, EVP_aes_256_cbc(), nullptr, key.aeskey, iv) || !InitTicketMAC(macctx, key))
+			return -1;
+		return 1;
+	}
+
+	// If the key has been rotated out then the client has to do a full handshake.
+	const OpenSSL::TicketKeys::Key* key = keys.Find(keyname);
+	if (!key)
+		return 0;
+
+	if (!InitTicketMAC(macctx, *key) || !EVP_DecryptInit_ex(cipherctx, EVP_aes_256_cbc(), nullptr, key->aeskey, iv))
+		return -1;
+
+	// Tickets encrypted with an older key are renewed.
+	return key == &keys.GetCurrent() ? 1 : 2;
 }
 
 static int OpenSSL::BIOMethod::write(BIO* bio, const char* buffer, int size)
@@ -932,10 +1659,14 @@ class OpenSSLIOHookProvider final
 {
 	OpenSSL::Profile profile;
 
+	/** The pool which handshakes with clients are run on. */
+	WorkerPool& pool;
+
 public:
-	OpenSSLIOHookProvider(Module* mod, const std::string& profilename, const std::shared_ptr<ConfigTag>& tag)
+	OpenSSLIOHookProvider(Module* mod, const std::string& profilename, const std::shared_ptr<ConfigTag>& tag, const std::shared_ptr<OpenSSL::SessionState>& state, WorkerPool& workerpool)
 		: SSLIOHookProvider(mod, profilename)
-		, profile(profilename, tag)
+		, profile(profilename, tag, state)
+		, pool(workerpool)
 	{
 		ServerInstance->Modules.AddService(*this);
 	}
@@ -947,12 +1678,17 @@ public:
 
 	void OnAccept(StreamSocket* sock, const irc::sockets::sockaddrs& client, const irc::sockets::sockaddrs& server) override
 	{
-		new OpenSSLIOHook(shared_from_this(), sock, profile.CreateServerSession());
+		new OpenSSLIOHook(shared_from_this(), sock, profile.CreateServerSession(), {}, pool.GetWorkers() ? &pool : nullptr);
 	}
 
 	void OnConnect(StreamSocket* sock) override
 	{
-		new OpenSSLIOHook(shared_from_this(), sock, profile.CreateClientSession());
+		new OpenSSLIOHook(shared_from_this(), sock, profile.CreateClientSession({}));
+	}
+
+	void OnConnect(StreamSocket* sock, const std::string& sessionkey) override
+	{
+		new OpenSSLIOHook(shared_from_this(), sock, profile.CreateClientSession(sessionkey), sessionkey);
 	}
 
 	OpenSSL::Profile& GetProfile() { return profile; }
@@ -965,11 +1701,15 @@ OpenSSL::Profile& OpenSSLIOHook::GetProfile()
 
 class ModuleSSLOpenSSL final
 	: public Module
+	, public Stats::EventListener
 {
 	typedef std::vector<std::shared_ptr<OpenSSLIOHookProvider>> ProfileList;
 
 	ProfileList profiles;
 
+	// This has to be destroyed before the profiles as unfinished handshakes keep them alive.
+	WorkerPool pool;
+
 	void ReadProfiles()
 	{
 		ProfileList newprofiles;
@@ -992,17 +1732,25 @@ class ModuleSSLOpenSSL final
 				continue;
 			}
 
-			std::shared_ptr<OpenSSLIOHookProvider> prov;
+			// Keep the session caches and ticket keys of profiles which are being reloaded.
+			std::shared_ptr<OpenSSL::SessionState> state;
+			for (const auto& profile : profiles)
+			{
+				if (profile->GetProfile().GetName() == name)
+					state = profile->GetProfile().GetSessionStatePtr();
+			}
+
+			std::shared_ptr<OpenSSLIOHookProvider> newprov;
 			try
 			{
-				prov = std::make_shared<OpenSSLIOHookProvider>(this, name, tag);
+				newprov = std::make_shared<OpenSSLIOHookProvider>(this, name, tag, state, pool);
 			}
 			catch (const CoreException& ex)
 			{
 				throw ModuleException(this, "Error while initializing TLS profile \"" + name + "\" at " + tag->source.str() + " - " + ex.GetReason());
 			}
 
-			newprofiles.push_back(prov);
+			newprofiles.push_back(newprov);
 		}
 
 		for (const auto& profile : profiles)
@@ -1014,6 +1762,7 @@ class ModuleSSLOpenSSL final
 public:
 	ModuleSSLOpenSSL()
 		: Module(VF_VENDOR, "Allows TLS encrypted connections using the OpenSSL library.")
+		, Stats::EventListener(this)
 	{
 		// Initialize OpenSSL
 		OPENSSL_init_ssl(0, nullptr);
@@ -1042,6 +1791,7 @@ public:
 	void ReadConfig(ConfigStatus& status) override
 	{
 		const auto& tag = ServerInstance->Config->ConfValue("openssl");
+		pool.SetWorkers(tag->getNum<size_t>("handshakethreads", 0, 0, 64));
 		if (status.initial || tag->getBool("onrehash", true))
 		{
 			// Try to help people who have outdated configs.
@@ -1085,6 +1835,32 @@ public:
 		}
 	}
 
+	ModResult OnStats(Stats::Context& stats) override
+	{
+		if (stats.GetSymbol() != 'T')
+			return MOD_RES_PASSTHRU;
+
+		for (const auto& profile : profiles)
+		{
+			OpenSSL::SessionState& state = profile->GetProfile().GetSessionState();
+			std::lock_guard<std::mutex> lock(state.mutex);
+			stats.AddGenericRow(INSP_FORMAT("TLS profile {} (OpenSSL): {}, {} cached sessions",
+				profile->GetProfile().GetName(), state.stats.ToString(), state.servercache.Size()));
+		}
+		return MOD_RES_PASSTHRU;
+	}
+
+	void OnPostConnect(User* user) override
+	{
+		LocalUser* const localuser = IS_LOCAL(user);
+		if (!localuser)
+			return;
+
+		OpenSSLIOHook* const iohook = static_cast<OpenSSLIOHook*>(localuser->eh.GetModHook(this));
+		if (iohook)
+			iohook->GetProfile().GetSessionState().stats.AddRegistration(iohook->GetAge());
+	}
+
 	ModResult OnCheckReady(LocalUser* user) override
 	{
 		const OpenSSLIOHook* const iohook = static_cast<OpenSSLIOHook*>(user->eh.GetModHook(this));
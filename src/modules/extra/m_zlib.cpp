@@ -0,0 +1,664 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/// $CompilerFlags: find_compiler_flags("zlib" "")
+/// $LinkerFlags: find_linker_flags("zlib" "-lz")
+
+/// $PackageInfo: require_system("arch") pkgconf zlib
+/// $PackageInfo: require_system("centos") pkgconfig zlib-devel
+/// $PackageInfo: require_system("darwin") pkg-config zlib
+/// $PackageInfo: require_system("debian") pkg-config zlib1g-dev
+/// $PackageInfo: require_system("rocky") pkgconfig zlib-devel
+/// $PackageInfo: require_system("ubuntu") pkg-config zlib1g-dev
+
+
+#include "inspircd.h"
+#include "iohook.h"
+#include "modules/compress.h"
+#include "modules/stats.h"
+
+#include <zlib.h>
+
+namespace
+{
+	/** The name of the compression mechanism. This needs to change whenever the dictionary does. */
+	const std::string mechanism = "deflate/irc1";
+
+	/** Strings which are common in the server protocol. These are used to prime the compressor so
+	 * that even short messages compress well. The most common strings are at the end as they are
+	 * the cheapest to refer back to.
+	 */
+	constexpr std::string_view dictionary =
+		"SERVER SINFO version rawversion customversion desc BURST ENDBURST "
+		"SQUIT ADDLINE DELLINE SVSNICK SVSJOIN SVSPART SVSHOLD OPERTYPE "
+		"FHOST FIDENT FNAME FRHOST FTOPIC TOPIC INVITE KICK LMODE SAVE "
+		"SNONOTICE ENCAP * CHGHOST CHGIDENT CHGNAME AWAY NICK PART QUIT :Quit: "
+		"accountid accountname ctime mlock topiclock ssl_cert :vtrsE "
+		"PING PONG NOTICE METADATA IJOIN FJOIN FMODE MODE +nt :o,:v, "
+		"UID 1700000000 +iwx :@time=2024-01-01T00:00:00.000Z;msgid= "
+		"PRIVMSG #";
+
+	/** The size of the buffer used to hold data while it is being compressed and decompressed. */
+	constexpr size_t BUFFER_SIZE = 16384;
+
+	/** Converts a time since a specified time point to nanoseconds. */
+	uint64_t ElapsedSince(const std::chrono::steady_clock::time_point& start)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+/** Holds statistics about all of the streams which have been compressed. */
+struct CompressStats final
+{
+	/** The number of streams which are currently compressed in at least one direction. */
+	size_t streams = 0;
+
+	/** The number of bytes given to the compressor. */
+	uint64_t plainout = 0;
+
+	/** The number of bytes produced by the compressor. */
+	uint64_t compressedout = 0;
+
+	/** The number of bytes given to the decompressor. */
+	uint64_t compressedin = 0;
+
+	/** The number of bytes produced by the decompressor. */
+	uint64_t plainin = 0;
+
+	/** The time spent compressing data in nanoseconds. */
+	uint64_t deflatetime = 0;
+
+	/** The time spent decompressing data in nanoseconds. */
+	uint64_t inflatetime = 0;
+
+	/** The number of message compressors and decompressors which currently exist. */
+	size_t contexts = 0;
+};
+
+class ZlibHookProvider final
+	: public IOHookProvider
+{
+public:
+	/** The level to compress data at. */
+	int level = Z_DEFAULT_COMPRESSION;
+
+	/** The maximum amount of data that one read from a socket can be decompressed into. */
+	size_t maxinflate = 1024 * 1024;
+
+	/** The statistics for all of the streams using this provider. */
+	CompressStats stats;
+
+	ZlibHookProvider(Module* mod)
+		: IOHookProvider(mod, "zlib", IOHookProvider::IOH_COMPRESS, true)
+	{
+	}
+
+	void OnAccept(StreamSocket* sock, const irc::sockets::sockaddrs& client, const irc::sockets::sockaddrs& server) override;
+	void OnConnect(StreamSocket* sock) override;
+};
+
+class ZlibHook final
+	: public CompressIOHook
+{
+private:
+	/** The statistics to record the activity of this stream in. */
+	CompressStats& stats;
+
+	/** The state of the compressor. */
+	z_stream deflater;
+
+	/** The state of the decompressor. */
+	z_stream inflater;
+
+	/** Whether data written to the socket is being compressed. */
+	bool compressing = false;
+
+	/** Whether data read from the socket is being decompressed. */
+	bool decompressing = false;
+
+	/** Whether the compressor and decompressor were initialised successfully. */
+	bool initialised = false;
+
+	/** The maximum amount of data that one read from the socket can be decompressed into. */
+	const size_t maxinflate;
+
+	/** Whether the last read stopped decompressing because it reached maxinflate. */
+	bool pending = false;
+
+	/** The number of bytes written before compression started which still need to be passed through. */
+	size_t passthrough = 0;
+
+	/** Retrieves the send queue that this hook reads data to write from. */
+	const StreamSocket::SendQueue& GetUpperSendQ(StreamSocket* sock) const
+	{
+		for (IOHook* hook = sock->GetIOHook(); hook; )
+		{
+			const IOHookMiddle* const iohm = IOHookMiddle::ToMiddleHook(hook);
+			if (!iohm)
+				break;
+
+			if (iohm->GetNextHook() == this)
+				return iohm->GetSendQ();
+
+			hook = iohm->GetNextHook();
+		}
+		return sock->GetSendQ();
+	}
+
+	/** Compresses the pending input of the compressor.
+	 * @param out The buffer to append the compressed data to.
+	 * @param flush The zlib flush mode to compress with.
+	 * @return True if the data was compressed successfully; otherwise, false.
+	 */
+	bool Deflate(std::string& out, int flush)
+	{
+		char buffer[BUFFER_SIZE];
+		do
+		{
+			deflater.next_out = reinterpret_cast<Bytef*>(buffer);
+			deflater.avail_out = sizeof(buffer);
+
+			int ret = deflate(&deflater, flush);
+			if (ret != Z_OK && ret != Z_BUF_ERROR)
+				return false;
+
+			out.append(buffer, sizeof(buffer) - deflater.avail_out);
+		}
+		while (deflater.avail_out == 0);
+		return true;
+	}
+
+	/** Decompresses data read from the socket.
+	 * @param sock The socket the data was read from.
+	 * @param in The data to decompress. Any data which was decompressed is removed from this.
+	 * @param out The buffer to append the decompressed data to.
+	 * @return True if the data was decompressed successfully; otherwise, false.
+	 */
+	bool Inflate(StreamSocket* sock, std::string& in, std::string& out)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		const size_t prevsize = out.size();
+
+		inflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+		inflater.avail_in = static_cast<uInt>(in.size());
+
+		// Data from the peer can be read before it has authenticated so it must not be able to
+		// make us allocate an unbounded amount of memory. If the limit is reached the rest of the
+		// data is decompressed once what has been decompressed so far has been processed.
+		char buffer[BUFFER_SIZE];
+		size_t remaining = maxinflate;
+		int ret;
+		do
+		{
+			const size_t chunk = std::min(sizeof(buffer), remaining);
+			inflater.next_out = reinterpret_cast<Bytef*>(buffer);
+			inflater.avail_out = static_cast<uInt>(chunk);
+
+			ret = inflate(&inflater, Z_NO_FLUSH);
+			if (ret == Z_NEED_DICT)
+				ret = inflateSetDictionary(&inflater, reinterpret_cast<const Bytef*>(dictionary.data()), static_cast<uInt>(dictionary.size()));
+
+			if (ret != Z_OK && ret != Z_BUF_ERROR)
+				break;
+
+			const size_t length = chunk - inflater.avail_out;
+			out.append(buffer, length);
+			remaining -= length;
+		}
+		while (ret == Z_OK && remaining && (inflater.avail_in || inflater.avail_out == 0));
+
+		stats.compressedin += in.size() - inflater.avail_in;
+		stats.plainin += out.size() - prevsize;
+		stats.inflatetime += ElapsedSince(start);
+
+		if (ret != Z_OK && ret != Z_BUF_ERROR)
+		{
+			sock->SetError(INSP_FORMAT("Decompression error: {}", inflater.msg ? inflater.msg : zError(ret)));
+			return false;
+		}
+
+		const bool waspending = pending;
+		pending = !remaining;
+		if (pending)
+			in.erase(0, in.size() - inflater.avail_in);
+		else
+			in.clear();
+
+		// If there is more data to decompress or the next hook was not read from whilst there
+		// was then try to read again once the current data has been processed.
+		if (pending || waspending)
+			SocketEngine::ChangeEventMask(sock, FD_ADD_TRIAL_READ);
+		return true;
+	}
+
+public:
+	ZlibHook(const std::shared_ptr<IOHookProvider>& hookprov, StreamSocket* sock, int level, size_t maxlen, CompressStats& cstats)
+		: CompressIOHook(hookprov)
+		, stats(cstats)
+		, maxinflate(maxlen)
+	{
+		memset(&deflater, 0, sizeof(deflater));
+		memset(&inflater, 0, sizeof(inflater));
+		sock->AddIOHook(this);
+
+		if (deflateInit(&deflater, level) != Z_OK)
+		{
+			sock->SetError("Unable to initialise the zlib compressor");
+			return;
+		}
+
+		if (inflateInit(&inflater) != Z_OK)
+		{
+			deflateEnd(&deflater);
+			sock->SetError("Unable to initialise the zlib decompressor");
+			return;
+		}
+
+		initialised = true;
+		deflateSetDictionary(&deflater, reinterpret_cast<const Bytef*>(dictionary.data()), static_cast<uInt>(dictionary.size()));
+	}
+
+	~ZlibHook() override
+	{
+		if (compressing || decompressing)
+			stats.streams--;
+
+		if (initialised)
+		{
+			deflateEnd(&deflater);
+			inflateEnd(&inflater);
+		}
+	}
+
+	const std::string& GetMechanism() const override
+	{
+		return mechanism;
+	}
+
+	void StartCompressing(StreamSocket* sock) override
+	{
+		if (compressing || !initialised)
+			return;
+
+		if (!decompressing)
+			stats.streams++;
+
+		compressing = true;
+		passthrough = GetUpperSendQ(sock).bytes();
+	}
+
+	bool StartDecompressing(StreamSocket* sock, std::string& recvq) override
+	{
+		if (decompressing || !initialised)
+			return false;
+
+		if (!compressing)
+			stats.streams++;
+
+		decompressing = true;
+		std::string& myrecvq = GetRecvQ();
+		myrecvq.insert(0, recvq);
+		recvq.clear();
+		return Inflate(sock, myrecvq, recvq);
+	}
+
+	bool HasPendingRead() const override
+	{
+		return pending;
+	}
+
+	ssize_t OnStreamSocketWrite(StreamSocket* sock, StreamSocket::SendQueue& uppersendq) override
+	{
+		StreamSocket::SendQueue& mysendq = GetSendQ();
+
+		// Data which was written before compression started is sent as-is.
+		while (passthrough && !uppersendq.empty())
+		{
+			const StreamSocket::SendQueue::Element& elem = uppersendq.front();
+			if (elem.length() > passthrough)
+			{
+				mysendq.push_back(StreamSocket::SendQueue::Element(elem.data(), passthrough));
+				uppersendq.erase_front(passthrough);
+				passthrough = 0;
+				break;
+			}
+
+			passthrough -= elem.length();
+			mysendq.push_back(elem);
+			uppersendq.pop_front();
+		}
+
+		if (!compressing)
+		{
+			mysendq.moveall(uppersendq);
+			return 1;
+		}
+
+		if (uppersendq.empty())
+			return 1;
+
+		const auto start = std::chrono::steady_clock::now();
+		std::string compressed;
+		for (const auto& elem : uppersendq)
+		{
+			deflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(elem.data()));
+			deflater.avail_in = static_cast<uInt>(elem.length());
+			if (!Deflate(compressed, Z_NO_FLUSH))
+			{
+				sock->SetError("Compression error");
+				return -1;
+			}
+		}
+
+		// Flush at the end of every write so the remote end can act on everything we have sent.
+		if (!Deflate(compressed, Z_SYNC_FLUSH))
+		{
+			sock->SetError("Compression error");
+			return -1;
+		}
+
+		stats.plainout += uppersendq.bytes();
+		stats.compressedout += compressed.length();
+		stats.deflatetime += ElapsedSince(start);
+
+		uppersendq.clear();
+		mysendq.push_back(std::move(compressed));
+		return 1;
+	}
+
+	ssize_t OnStreamSocketRead(StreamSocket* sock, std::string& destrecvq) override
+	{
+		std::string& myrecvq = GetRecvQ();
+		if (!decompressing)
+		{
+			destrecvq.append(myrecvq);
+			myrecvq.clear();
+			return 1;
+		}
+
+		const size_t prevsize = destrecvq.size();
+		if (!Inflate(sock, myrecvq, destrecvq))
+			return -1;
+
+		return destrecvq.size() > prevsize ? 1 : 0;
+	}
+};
+
+/** Compresses messages for other modules into a raw deflate stream. */
+class ZlibDeflater final
+	: public Compress::Deflater
+{
+private:
+	/** The statistics to record the activity of this compressor in. */
+	CompressStats& stats;
+
+	/** The state of the compressor. */
+	z_stream deflater;
+
+	/** Whether the compressor was initialised successfully. */
+	bool initialised = false;
+
+	/** Runs the compressor until it has no more output.
+	 * @param out The buffer to append the compressed data to.
+	 * @param flush The zlib flush mode to compress with.
+	 */
+	bool Deflate(std::string& out, int flush)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		const size_t prevsize = out.size();
+
+		char buffer[BUFFER_SIZE];
+		do
+		{
+			deflater.next_out = reinterpret_cast<Bytef*>(buffer);
+			deflater.avail_out = sizeof(buffer);
+
+			int ret = deflate(&deflater, flush);
+			if (ret != Z_OK && ret != Z_BUF_ERROR)
+				return false;
+
+			out.append(buffer, sizeof(buffer) - deflater.avail_out);
+		}
+		while (deflater.avail_out == 0);
+
+		stats.compressedout += out.size() - prevsize;
+		stats.deflatetime += ElapsedSince(start);
+		return true;
+	}
+
+public:
+	ZlibDeflater(CompressStats& cstats, int level, unsigned int windowbits)
+		: stats(cstats)
+	{
+		memset(&deflater, 0, sizeof(deflater));
+
+		// A negative window size gives a raw stream without the zlib header and checksum.
+		const int bits = static_cast<int>(windowbits);
+		initialised = deflateInit2(&deflater, level, Z_DEFLATED, -bits, bits - 7, Z_DEFAULT_STRATEGY) == Z_OK;
+		stats.contexts++;
+	}
+
+	~ZlibDeflater() override
+	{
+		stats.contexts--;
+		if (initialised)
+			deflateEnd(&deflater);
+	}
+
+	bool Compress(const std::string_view& data, std::string& out) override
+	{
+		if (!initialised)
+			return false;
+
+		deflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+		deflater.avail_in = static_cast<uInt>(data.size());
+		stats.plainout += data.size();
+		return Deflate(out, Z_NO_FLUSH);
+	}
+
+	bool Flush(std::string& out) override
+	{
+		return initialised && Deflate(out, Z_SYNC_FLUSH);
+	}
+
+	void Reset() override
+	{
+		if (initialised)
+			deflateReset(&deflater);
+	}
+};
+
+/** Decompresses messages for other modules from a raw deflate stream. */
+class ZlibInflater final
+	: public Compress::Inflater
+{
+private:
+	/** The statistics to record the activity of this decompressor in. */
+	CompressStats& stats;
+
+	/** The state of the decompressor. */
+	z_stream inflater;
+
+	/** Whether the decompressor was initialised successfully. */
+	bool initialised = false;
+
+public:
+	ZlibInflater(CompressStats& cstats, unsigned int windowbits)
+		: stats(cstats)
+	{
+		memset(&inflater, 0, sizeof(inflater));
+		initialised = inflateInit2(&inflater, -static_cast<int>(windowbits)) == Z_OK;
+		stats.contexts++;
+	}
+
+	~ZlibInflater() override
+	{
+		stats.contexts--;
+		if (initialised)
+			inflateEnd(&inflater);
+	}
+
+	bool Decompress(const std::string_view& data, std::string& out, size_t maxlen) override
+	{
+		if (!initialised)
+			return false;
+
+		const auto start = std::chrono::steady_clock::now();
+		const size_t prevsize = out.size();
+
+		inflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+		inflater.avail_in = static_cast<uInt>(data.size());
+
+		char buffer[BUFFER_SIZE];
+		int ret;
+		do
+		{
+			inflater.next_out = reinterpret_cast<Bytef*>(buffer);
+			inflater.avail_out = sizeof(buffer);
+
+			ret = inflate(&inflater, Z_NO_FLUSH);
+			if (ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END)
+				break;
+
+			const size_t length = sizeof(buffer) - inflater.avail_out;
+			if (out.size() + length > maxlen)
+			{
+				ret = Z_MEM_ERROR;
+				break;
+			}
+			out.append(buffer, length);
+		}
+		while (ret == Z_OK && (inflater.avail_in || inflater.avail_out == 0));
+
+		stats.compressedin += data.size() - inflater.avail_in;
+		stats.plainin += out.size() - prevsize;
+		stats.inflatetime += ElapsedSince(start);
+
+		if (ret == Z_STREAM_END)
+		{
+			// A message is allowed to end with a final block (RFC 7692 section 7.2.3.3) after
+			// which zlib will not decompress any more data. Start a new stream for the next
+			// message but keep the window so that it can still refer to earlier messages.
+			Bytef window[1 << Compress::MessageProvider::MAX_WINDOW_BITS];
+			uInt windowlen = 0;
+			if (inflateGetDictionary(&inflater, window, &windowlen) != Z_OK || inflateReset(&inflater) != Z_OK)
+				return false;
+
+			if (windowlen && inflateSetDictionary(&inflater, window, windowlen) != Z_OK)
+				return false;
+		}
+		return ret == Z_OK || ret == Z_BUF_ERROR || ret == Z_STREAM_END;
+	}
+
+	void Reset() override
+	{
+		if (initialised)
+			inflateReset(&inflater);
+	}
+};
+
+class ZlibMessageProvider final
+	: public Compress::MessageProvider
+{
+private:
+	/** The provider to take the compression level and statistics from. */
+	ZlibHookProvider& hookprov;
+
+public:
+	ZlibMessageProvider(Module* mod, ZlibHookProvider& prov)
+		: Compress::MessageProvider(mod, "deflate")
+		, hookprov(prov)
+	{
+	}
+
+	std::unique_ptr<Compress::Deflater> CreateDeflater(unsigned int windowbits) override
+	{
+		return std::make_unique<ZlibDeflater>(hookprov.stats, hookprov.level, std::clamp(windowbits, MIN_WINDOW_BITS, MAX_WINDOW_BITS));
+	}
+
+	std::unique_ptr<Compress::Inflater> CreateInflater(unsigned int windowbits) override
+	{
+		return std::make_unique<ZlibInflater>(hookprov.stats, std::clamp(windowbits, MIN_WINDOW_BITS, MAX_WINDOW_BITS));
+	}
+
+	size_t GetDeflaterMemory(unsigned int windowbits) const override
+	{
+		// The memory level is always seven less than the window size which matches the zlib
+		// defaults. This is on top of about 6KiB of state.
+		return (size_t(1) << (windowbits + 2)) + (size_t(1) << (windowbits + 2)) + 6144;
+	}
+
+	size_t GetInflaterMemory(unsigned int windowbits) const override
+	{
+		// The window is on top of about 7KiB of state.
+		return (size_t(1) << windowbits) + 7168;
+	}
+};
+
+void ZlibHookProvider::OnAccept(StreamSocket* sock, const irc::sockets::sockaddrs& client, const irc::sockets::sockaddrs& server)
+{
+	new ZlibHook(shared_from_this(), sock, level, maxinflate, stats);
+}
+
+void ZlibHookProvider::OnConnect(StreamSocket* sock)
+{
+	new ZlibHook(shared_from_this(), sock, level, maxinflate, stats);
+}
+
+class ModuleZlib final
+	: public Module
+	, public Stats::EventListener
+{
+private:
+	std::shared_ptr<ZlibHookProvider> hookprov;
+	ZlibMessageProvider messageprov;
+
+public:
+	ModuleZlib()
+		: Module(VF_VENDOR, "Allows server links and WebSocket messages to be compressed using zlib.")
+		, Stats::EventListener(this)
+		, hookprov(std::make_shared<ZlibHookProvider>(this))
+		, messageprov(this, *hookprov)
+	{
+	}
+
+	void ReadConfig(ConfigStatus& status) override
+	{
+		const auto& tag = ServerInstance->Config->ConfValue("zlib");
+		hookprov->level = tag->getNum<int>("level", 6, 1, 9);
+		hookprov->maxinflate = tag->getNum<size_t>("maxinflate", 1024 * 1024, 64 * 1024);
+	}
+
+	ModResult OnStats(Stats::Context& stats) override
+	{
+		if (stats.GetSymbol() != 'x')
+			return MOD_RES_PASSTHRU;
+
+		const CompressStats& cstats = hookprov->stats;
+		stats.AddGenericRow(INSP_FORMAT("Compressed streams: {} using {}", cstats.streams, mechanism));
+		stats.AddGenericRow(INSP_FORMAT("Message compression contexts: {}", cstats.contexts));
+		stats.AddGenericRow(INSP_FORMAT("Sent: {} bytes compressed to {} bytes ({:.1f}%) in {:.3f}ms",
+			cstats.plainout, cstats.compressedout, cstats.plainout ? 100.0 * cstats.compressedout / cstats.plainout : 100.0,
+			cstats.deflatetime / 1000000.0));
+		stats.AddGenericRow(INSP_FORMAT("Received: {} bytes decompressed to {} bytes ({:.1f}%) in {:.3f}ms",
+			cstats.compressedin, cstats.plainin, cstats.plainin ? 100.0 * cstats.compressedin / cstats.plainin : 100.0,
+			cstats.inflatetime / 1000000.0));
+		return MOD_RES_DENY;
+	}
+};
+
+MODULE_INIT(ModuleZlib)
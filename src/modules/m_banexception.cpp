@@ -134,7 +134,7 @@ public:
 
 		for (const auto& entry : *list)
 		{
-			if (chan->CheckBan(user, entry.mask))
+			if (chan->CheckBan(user, entry.GetBanMask()))
 			{
 				// They match an entry on the list, so let them in.
 				return MOD_RES_ALLOW;
@@ -42,6 +42,7 @@ private:
 
 public:
 	unsigned long rounds = 10;
+	HashWorkerPool pool;
 
 	static std::string Generate(const std::string& data, const std::string& salt)
 	{
@@ -60,6 +61,13 @@ public:
 		return InspIRCd::TimingSafeCompare(Generate(input, hash), hash);
 	}
 
+	void CompareAsync(const std::string& input, const std::string& hash, const HashCompareCallback& callback) override
+	{
+		pool.Submit([input, hash]() {
+			return InspIRCd::TimingSafeCompare(Generate(input, hash), hash);
+		}, callback);
+	}
+
 	std::string ToPrintable(const std::string& raw) override
 	{
 		return raw;
@@ -88,6 +96,7 @@ public:
 	{
 		const auto& conf = ServerInstance->Config->ConfValue("bcrypt");
 		bcrypt.rounds = conf->getNum<unsigned long>("rounds", 10, 1);
+		bcrypt.pool.SetWorkers(conf->getNum<size_t>("workers", 2, 0, 64));
 	}
 };
 
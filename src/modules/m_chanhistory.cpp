@@ -22,57 +22,564 @@
  */
 
 
+#ifndef _WIN32
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+#include <filesystem>
+
 #include "inspircd.h"
 #include "clientprotocolmsg.h"
+#include "modules/cap.h"
 #include "modules/ircv3_batch.h"
+#include "modules/ircv3_replies.h"
 #include "modules/ircv3_servertime.h"
+#include "modules/isupport.h"
 #include "modules/server.h"
 #include "numerichelper.h"
 
-typedef insp::flat_map<std::string, std::string> HistoryTagMap;
+#ifdef _WIN32
+# define timegm _mkgmtime
+#endif
+
+/** The bytes at the start of a history segment file. */
+static constexpr char SEGMENT_MAGIC[8] = { 'I', 'N', 'S', 'P', 'H', 'I', 'S', '2' };
+
+/** The granularity that history segments are grown in. */
+static constexpr size_t SEGMENT_GROWTH = 4096;
+
+/** The header at the start of a history segment. */
+struct SegmentHeader final
+{
+	/** Always set to SEGMENT_MAGIC. */
+	char magic[8];
+
+	/** The position of the segment within the history of its channel. */
+	uint64_t sequence;
+
+	/** The number of bytes at the start of the segment which contain valid records. */
+	uint64_t used;
+
+	/** The creation time of the channel which the segment belongs to. */
+	int64_t created;
+};
+
+/** The header at the start of a message record within a history segment. */
+struct RecordHeader final
+{
+	/** The size of the record including this header and any padding. */
+	uint32_t size;
+
+	/** The length of the source mask. */
+	uint16_t sourcelen;
+
+	/** The length of the message identifier. */
+	uint16_t msgidlen;
+
+	/** The length of the encoded message tags. */
+	uint32_t tagslen;
+
+	/** The length of the message text. */
+	uint32_t textlen;
+
+	/** The time at which the message was sent in milliseconds since the UNIX epoch. */
+	int64_t time;
+
+	/** The type of the message. */
+	MessageType type;
+
+	/** Pads the header to a multiple of eight bytes. */
+	uint8_t padding[7];
+};
+
+static_assert(sizeof(SegmentHeader) % 8 == 0 && sizeof(RecordHeader) % 8 == 0);
 
+/** A message which has been read from a history segment. The views are only valid until the segment changes. */
 struct HistoryItem final
 {
-	time_t ts;
-	std::string text;
+	/** The time at which the message was sent in milliseconds since the UNIX epoch. */
+	int64_t time;
+
+	/** The type of the message. */
 	MessageType type;
-	HistoryTagMap tags;
-	std::string sourcemask;
 
-	HistoryItem(User* source, const MessageDetails& details)
-		: ts(ServerInstance->Time())
-		, text(details.text)
-		, type(details.type)
-		, sourcemask(source->GetMask())
+	/** The mask of the user who sent the message. */
+	std::string_view sourcemask;
+
+	/** The identifier of the message or empty if it has none. */
+	std::string_view msgid;
+
+	/** The tags of the message encoded as a series of (uint16 keylen, uint16 valuelen, key, value). */
+	std::string_view tags;
+
+	/** The text of the message. */
+	std::string_view text;
+};
+
+/** An append-only block of message records which is either backed by a memory-mapped file or by the heap. */
+class HistorySegment final
+{
+private:
+	/** The start of the segment. */
+	char* data = nullptr;
+
+	/** The number of bytes which are available at data. */
+	size_t capacity = 0;
+
+	/** The path to the backing file or empty if the segment is not persisted. */
+	std::string path;
+
+	/** Whether a failure to grow the segment has already been logged. */
+	bool growfailed = false;
+
+	/** The memory which backs the segment if it is not persisted. */
+	std::vector<char> memory;
+
+	/** The offsets of the records within the segment. */
+	std::vector<uint32_t> offsets;
+
+	static constexpr size_t AlignRecord(size_t size)
+	{
+		return (size + 7) & ~static_cast<size_t>(7);
+	}
+
+	SegmentHeader* GetHeader() const
 	{
-		tags.reserve(details.tags_out.size());
-		for (const auto& [tagname, tagvalue] : details.tags_out)
-			tags[tagname] = tagvalue.value;
+		return reinterpret_cast<SegmentHeader*>(data);
 	}
+
+	bool Map(size_t size)
+	{
+		size = (size + SEGMENT_GROWTH - 1) / SEGMENT_GROWTH * SEGMENT_GROWTH;
+#ifndef _WIN32
+		if (!path.empty())
+		{
+			// The backing file is only kept open whilst it is being mapped so that
+			// persisted channels do not use up file descriptors.
+			int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+			if (fd < 0)
+				return false;
+
+			// Reserve the space on disk up front as writing to a mapped page which
+			// the file system is unable to store raises SIGBUS.
+#if defined __linux__ || defined __FreeBSD__
+			int error = posix_fallocate(fd, 0, size);
+#else
+			int error = ftruncate(fd, size) < 0 ? errno : 0;
+#endif
+			void* mapping = MAP_FAILED;
+			if (!error)
+			{
+				mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				if (mapping == MAP_FAILED)
+					error = errno;
+			}
+
+			close(fd);
+			if (mapping == MAP_FAILED)
+			{
+				errno = error;
+				return false;
+			}
+
+			if (data)
+				munmap(data, capacity);
+			data = static_cast<char*>(mapping);
+			capacity = size;
+			return true;
+		}
+#endif
+		memory.resize(size);
+		data = memory.data();
+		capacity = size;
+		return true;
+	}
+
+public:
+	HistorySegment() = default;
+	HistorySegment(const HistorySegment&) = delete;
+	HistorySegment& operator=(const HistorySegment&) = delete;
+
+	~HistorySegment()
+	{
+		Close();
+	}
+
+	/** Closes the segment without removing its backing file. */
+	void Close()
+	{
+#ifndef _WIN32
+		if (!path.empty() && data)
+			munmap(data, capacity);
+#endif
+		data = nullptr;
+		capacity = 0;
+		path.clear();
+		growfailed = false;
+		std::vector<char>().swap(memory);
+		std::vector<uint32_t>().swap(offsets);
+	}
+
+	/** Creates an empty segment.
+	 * @param newpath The path to the backing file or empty to keep the segment on the heap.
+	 * @param sequence The position of the segment within the history of its channel.
+	 * @param created The creation time of the channel which the segment belongs to.
+	 * @return True if the segment was created; otherwise, false.
+	 */
+	bool Create(const std::string& newpath, uint64_t sequence, time_t created)
+	{
+#ifndef _WIN32
+		if (!newpath.empty())
+		{
+			int fd = open(newpath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+			if (fd < 0)
+				return false;
+
+			close(fd);
+			path = newpath;
+		}
+#endif
+
+		if (!Map(sizeof(SegmentHeader)))
+		{
+			Destroy();
+			return false;
+		}
+
+		SegmentHeader* header = GetHeader();
+		memcpy(header->magic, SEGMENT_MAGIC, sizeof(header->magic));
+		header->sequence = sequence;
+		header->used = sizeof(SegmentHeader);
+		header->created = created;
+		return true;
+	}
+
+	/** Opens an existing segment and discards any records after the last intact one.
+	 * @param newpath The path to the backing file.
+	 * @return True if the segment was opened; otherwise, false.
+	 */
+	bool Open(const std::string& newpath)
+	{
+#ifndef _WIN32
+		struct stat sb;
+		if (stat(newpath.c_str(), &sb) < 0)
+			return false;
+
+		path = newpath;
+		if (static_cast<size_t>(sb.st_size) < sizeof(SegmentHeader) || !Map(sb.st_size))
+		{
+			Close();
+			return false;
+		}
+
+		SegmentHeader* header = GetHeader();
+		if (memcmp(header->magic, SEGMENT_MAGIC, sizeof(header->magic)) != 0)
+		{
+			Close();
+			return false;
+		}
+
+		const size_t used = std::min<uint64_t>(header->used, std::min<size_t>(capacity, UINT32_MAX));
+		size_t offset = sizeof(SegmentHeader);
+		while (offset + sizeof(RecordHeader) <= used)
+		{
+			const RecordHeader* record = reinterpret_cast<const RecordHeader*>(data + offset);
+			const size_t length = sizeof(RecordHeader) + record->sourcelen + record->msgidlen + record->tagslen + record->textlen;
+			if (record->size != AlignRecord(length) || offset + record->size > used || record->type > MessageType::NOTICE)
+				break;
+
+			offsets.push_back(static_cast<uint32_t>(offset));
+			offset += record->size;
+		}
+		header->used = offset;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	/** Closes the segment and removes its backing file. */
+	void Destroy()
+	{
+		const std::string oldpath = path;
+		Close();
+
+		std::error_code ec;
+		if (!oldpath.empty())
+			std::filesystem::remove(oldpath, ec);
+	}
+
+	/** Appends a message record to the segment.
+	 * @return True if the record was appended; otherwise, false.
+	 */
+	bool Append(int64_t time, MessageType type, const std::string& sourcemask, const std::string& msgid, const std::string& tags, const std::string& text)
+	{
+		const size_t size = AlignRecord(sizeof(RecordHeader) + sourcemask.length() + msgid.length() + tags.length() + text.length());
+		const size_t offset = GetHeader()->used;
+		if (offset + size > UINT32_MAX)
+			return false;
+
+		if (offset + size > capacity && !Map(std::max(capacity * 2, offset + size)))
+		{
+			if (!growfailed)
+			{
+				ServerInstance->Logs.Warning(MODNAME, "Unable to grow the history segment {}; messages will not be recorded: {} ({})",
+					path, strerror(errno), errno);
+				growfailed = true;
+			}
+			return false;
+		}
+
+		RecordHeader* record = reinterpret_cast<RecordHeader*>(data + offset);
+		memset(record, 0, size);
+		record->size = static_cast<uint32_t>(size);
+		record->sourcelen = static_cast<uint16_t>(sourcemask.length());
+		record->msgidlen = static_cast<uint16_t>(msgid.length());
+		record->tagslen = static_cast<uint32_t>(tags.length());
+		record->textlen = static_cast<uint32_t>(text.length());
+		record->time = time;
+		record->type = type;
+
+		char* ptr = data + offset + sizeof(RecordHeader);
+		for (const auto* field : { &sourcemask, &msgid, &tags, &text })
+		{
+			memcpy(ptr, field->data(), field->length());
+			ptr += field->length();
+		}
+
+		// The record only becomes visible once it has been completely written.
+		offsets.push_back(static_cast<uint32_t>(offset));
+		GetHeader()->used = offset + size;
+		return true;
+	}
+
+	/** Retrieves the message record at the specified index. */
+	HistoryItem Get(size_t idx) const
+	{
+		const char* ptr = data + offsets[idx];
+		const RecordHeader* record = reinterpret_cast<const RecordHeader*>(ptr);
+		ptr += sizeof(RecordHeader);
+
+		HistoryItem item;
+		item.time = record->time;
+		item.type = record->type;
+		item.sourcemask = std::string_view(ptr, record->sourcelen);
+		ptr += record->sourcelen;
+		item.msgid = std::string_view(ptr, record->msgidlen);
+		ptr += record->msgidlen;
+		item.tags = std::string_view(ptr, record->tagslen);
+		ptr += record->tagslen;
+		item.text = std::string_view(ptr, record->textlen);
+		return item;
+	}
+
+	/** Retrieves the time of the message record at the specified index. */
+	int64_t GetTime(size_t idx) const
+	{
+		return reinterpret_cast<const RecordHeader*>(data + offsets[idx])->time;
+	}
+
+	/** Retrieves the position of the segment within the history of its channel. */
+	uint64_t GetSequence() const { return GetHeader()->sequence; }
+
+	/** Retrieves the creation time of the channel which the segment belongs to. */
+	time_t GetCreated() const { return static_cast<time_t>(GetHeader()->created); }
+
+	/** Retrieves the number of message records in the segment. */
+	size_t size() const { return offsets.size(); }
 };
 
-struct HistoryList final
+/** The history of a channel. This is stored in two segments of up to maxlen messages each. When the current
+ * segment is full the previous one is discarded and the current one takes its place which bounds the size
+ * of the history without ever having to move messages around.
+ */
+class HistoryList final
 {
-	std::deque<HistoryItem> lines;
+private:
+	/** The path that the names of the backing files start with or empty if the history is not persisted. */
+	const std::string basepath;
+
+	/** The creation time of the channel which this history belongs to. */
+	const time_t created;
+
+	/** The segment which was written to before the current one. */
+	std::unique_ptr<HistorySegment> previous;
+
+	/** The segment which new messages are appended to. */
+	std::unique_ptr<HistorySegment> current;
+
+	std::unique_ptr<HistorySegment> CreateSegment(uint64_t sequence)
+	{
+		auto segment = std::make_unique<HistorySegment>();
+		const std::string path = basepath.empty() ? basepath : INSP_FORMAT("{}.{}", basepath, sequence % 2);
+		if (segment->Create(path, sequence, created))
+			return segment;
+
+		ServerInstance->Logs.Warning(MODNAME, "Unable to create the history segment {}; history will not be persisted: {} ({})",
+			path, strerror(errno), errno);
+		segment->Create({}, sequence, created);
+		return segment;
+	}
+
+	void EncodeTags(const ClientProtocol::TagMap& tags, std::string& out)
+	{
+		for (const auto& [tagname, tagvalue] : tags)
+		{
+			// The message identifier is stored separately so it can be searched for.
+			if (tagname == "msgid" || tagname.length() > UINT16_MAX || tagvalue.value.length() > UINT16_MAX)
+				continue;
+
+			const uint16_t lengths[2] = { static_cast<uint16_t>(tagname.length()), static_cast<uint16_t>(tagvalue.value.length()) };
+			out.append(reinterpret_cast<const char*>(lengths), sizeof(lengths));
+			out.append(tagname);
+			out.append(tagvalue.value);
+		}
+	}
+
+public:
 	unsigned long maxlen;
 	unsigned long maxtime;
 
-	HistoryList(unsigned long len, unsigned long time)
-		: maxlen(len)
+	HistoryList(unsigned long len, unsigned long time, const std::string& path, time_t age)
+		: basepath(path)
+		, created(age)
+		, maxlen(len)
 		, maxtime(time)
 	{
+		if (basepath.empty())
+			return;
+
+		// Load any history which was persisted by a previous instance.
+		for (const auto* suffix : { ".0", ".1" })
+		{
+			auto segment = std::make_unique<HistorySegment>();
+			if (!segment->Open(basepath + suffix))
+				continue;
+
+			// Segments which were left behind by an earlier channel with the same name must not be
+			// shown to the members of this one.
+			if (segment->GetCreated() != created)
+			{
+				ServerInstance->Logs.Debug(MODNAME, "Removing stale history segment {}{}", basepath, suffix);
+				segment->Destroy();
+				continue;
+			}
+
+			if (!current)
+				current = std::move(segment);
+			else if (segment->GetSequence() > current->GetSequence())
+			{
+				previous = std::move(current);
+				current = std::move(segment);
+			}
+			else
+				previous = std::move(segment);
+		}
+	}
+
+	/** Adds a message to the history. */
+	void Add(User* source, const MessageDetails& details)
+	{
+		const std::string sourcemask = source->GetMask();
+		const auto msgid = details.tags_out.find("msgid");
+		const std::string& msgidstr = msgid == details.tags_out.end() ? "" : msgid->second.value;
+		if (sourcemask.length() > UINT16_MAX || msgidstr.length() > UINT16_MAX)
+			return;
+
+		if (!current)
+			current = CreateSegment(0);
+		else if (current->size() >= maxlen)
+		{
+			if (previous)
+				previous->Destroy();
+
+			const uint64_t sequence = current->GetSequence() + 1;
+			previous = std::move(current);
+			current = CreateSegment(sequence);
+		}
+
+		std::string tags;
+		EncodeTags(details.tags_out, tags);
+
+		const int64_t now = static_cast<int64_t>(ServerInstance->Time()) * 1000 + ServerInstance->Time_ns() / 1'000'000;
+		current->Append(now, details.type, sourcemask, msgidstr, tags, details.text);
+	}
+
+	/** Removes the history from memory and disk. */
+	void Destroy()
+	{
+		for (auto* segment : { &previous, &current })
+		{
+			if (*segment)
+				(*segment)->Destroy();
+			segment->reset();
+		}
 	}
 
+	/** Retrieves the message at the specified index. */
+	HistoryItem Get(size_t idx) const
+	{
+		const size_t prevsize = previous ? previous->size() : 0;
+		return idx < prevsize ? previous->Get(idx) : current->Get(idx - prevsize);
+	}
+
+	/** Retrieves the path that the names of the backing files start with. */
+	const std::string& GetBasePath() const { return basepath; }
+
+	/** Retrieves the index of the oldest message which is within the configured limits. */
+	size_t GetFirst() const
+	{
+		const size_t count = size();
+		const size_t first = count > maxlen ? count - maxlen : 0;
+		if (!maxtime)
+			return first;
+
+		const int64_t mintime = static_cast<int64_t>(ServerInstance->Time() - maxtime) * 1000;
+		return PartitionPoint(first, count, [mintime](int64_t time) { return time < mintime; });
+	}
+
+	/** Finds the first index in [first, last) for which the predicate is false when given the time of the
+	 * message at that index. The predicate must be true for all messages before that index.
+	 */
+	template <typename Predicate>
+	size_t PartitionPoint(size_t first, size_t last, Predicate pred) const
+	{
+		const size_t prevsize = previous ? previous->size() : 0;
+		while (first < last)
+		{
+			const size_t middle = first + (last - first) / 2;
+			const int64_t time = middle < prevsize ? previous->GetTime(middle) : current->GetTime(middle - prevsize);
+			if (pred(time))
+				first = middle + 1;
+			else
+				last = middle;
+		}
+		return first;
+	}
+
+	/** Frees segments which only contain expired messages.
+	 * @return The number of messages which are within the configured limits.
+	 */
 	size_t Prune()
 	{
-		// Prune expired entries from the list.
-		if (maxtime)
+		const size_t first = GetFirst();
+		if (first && first == size())
+			Destroy();
+		else if (previous && first >= previous->size())
 		{
-			time_t mintime = ServerInstance->Time() - maxtime;
-			while (!lines.empty() && lines.front().ts < mintime)
-				lines.pop_front();
+			previous->Destroy();
+			previous.reset();
 		}
-		return lines.size();
+		return size() - GetFirst();
+	}
+
+	/** Retrieves the number of messages which are stored including any outside of the configured limits. */
+	size_t size() const
+	{
+		return (previous ? previous->size() : 0) + (current ? current->size() : 0);
 	}
 };
 
@@ -111,7 +618,19 @@ private:
 		return true;
 	}
 
+	std::string GetPath(const Channel* channel) const
+	{
+		if (directory.empty())
+			return {};
+
+		std::string foldedname(channel->name);
+		for (auto& chr : foldedname)
+			chr = static_cast<char>(national_case_insensitive_map[static_cast<unsigned char>(chr)]);
+		return INSP_FORMAT("{}/{}", directory, Hex::Encode(foldedname));
+	}
+
 public:
+	std::string directory;
 	unsigned long maxduration;
 	unsigned long maxlines;
 
@@ -136,21 +655,25 @@ public:
 		HistoryList* history = ext.Get(channel);
 		if (history)
 		{
-			// Shrink the list if the new line number limit is lower than the old one
-			if (lines < history->lines.size())
-				history->lines.erase(history->lines.begin(), history->lines.begin() + (history->lines.size() - lines));
-
 			history->maxlen = lines;
 			history->maxtime = duration;
 			history->Prune();
 		}
 		else
 		{
-			ext.SetFwd(channel, lines, duration);
+			ext.SetFwd(channel, lines, duration, GetPath(channel), channel->age);
 		}
 		return true;
 	}
 
+	void OnUnset(User* source, Channel* channel) override
+	{
+		// Keep the history on disk if the module is only being reloaded.
+		HistoryList* history = ext.Get(channel);
+		if (history && !creator->dying)
+			history->Destroy();
+	}
+
 	void SerializeParam(Channel* chan, const HistoryList* history, std::string& out)
 	{
 		out.append(ConvToStr(history->maxlen));
@@ -159,19 +682,10 @@ public:
 	}
 };
 
-class ModuleChanHistory final
-	: public Module
-	, public ServerProtocol::BroadcastEventListener
+class HistorySender final
 {
 private:
-	HistoryMode historymode;
-	SimpleUserMode nohistorymode;
-	bool prefixmsg;
-	UserModeReference botmode;
-	bool dobots;
-	IRCv3::Batch::CapReference batchcap;
 	IRCv3::Batch::API batchmanager;
-	IRCv3::Batch::Batch batch;
 	IRCv3::ServerTime::API servertimemanager;
 	ClientProtocol::MessageTagEvent tagevent;
 
@@ -188,41 +702,380 @@ private:
 		}
 	}
 
-	void SendHistory(LocalUser* user, Channel* channel, HistoryList* list)
+	void AddTags(ClientProtocol::Message& msg, const HistoryItem& item)
+	{
+		std::string_view tags = item.tags;
+		uint16_t lengths[2];
+		while (tags.length() >= sizeof(lengths))
+		{
+			memcpy(lengths, tags.data(), sizeof(lengths));
+			tags.remove_prefix(sizeof(lengths));
+			if (tags.length() < static_cast<size_t>(lengths[0]) + lengths[1])
+				break;
+
+			const std::string tagkey(tags.substr(0, lengths[0]));
+			std::string tagval(tags.substr(lengths[0], lengths[1]));
+			tags.remove_prefix(tagkey.length() + tagval.length());
+			AddTag(msg, tagkey, tagval);
+		}
+
+		if (!item.msgid.empty())
+		{
+			std::string msgid(item.msgid);
+			AddTag(msg, "msgid", msgid);
+		}
+	}
+
+public:
+	IRCv3::Batch::CapReference batchcap;
+	IRCv3::Batch::Batch batch;
+	ClientProtocol::EventProvider protoevprov;
+
+	HistorySender(Module* mod)
+		: batchmanager(mod)
+		, servertimemanager(mod)
+		, tagevent(mod)
+		, batchcap(mod)
+		, batch("chathistory")
+		, protoevprov(mod, "CHATHISTORY")
+	{
+	}
+
+	/** Starts a batch. */
+	bool StartBatch(IRCv3::Batch::Batch& b)
 	{
 		if (batchmanager)
+			batchmanager->Start(b);
+		return b.IsRunning();
+	}
+
+	/** Ends a batch. If nothing was sent in it then the user is sent an empty batch. */
+	void EndBatch(LocalUser* user, IRCv3::Batch::Batch& b, bool empty)
+	{
+		if (!b.IsRunning())
+			return;
+
+		if (empty && batchcap.IsEnabled(user))
 		{
-			batchmanager->Start(batch);
-			batch.GetBatchStartMessage().PushParamRef(channel->name);
+			user->Send(protoevprov, b.GetBatchStartMessage());
+			user->Send(protoevprov, b.GetBatchEndMessage());
 		}
+		batchmanager->End(b);
+	}
 
-		for (auto& item : list->lines)
+	/** Sends the messages in [first, last) from the history of a channel to a user. */
+	void Send(LocalUser* user, Channel* channel, const HistoryList* list, size_t first, size_t last)
+	{
+		if (StartBatch(batch))
+			batch.GetBatchStartMessage().PushParamRef(channel->name);
+
+		for (size_t idx = first; idx < last; ++idx)
 		{
-			ClientProtocol::Messages::Privmsg msg(ClientProtocol::Messages::Privmsg::nocopy, item.sourcemask, channel, item.text, item.type);
-			for (auto& [tagname, tagvalue] : item.tags)
-				AddTag(msg, tagname, tagvalue);
+			const HistoryItem item = list->Get(idx);
+			const std::string sourcemask(item.sourcemask);
+			ClientProtocol::Messages::Privmsg msg(sourcemask, channel, std::string(item.text), item.type);
+			AddTags(msg, item);
 			if (servertimemanager)
-				servertimemanager->Set(msg, item.ts);
+				servertimemanager->Set(msg, item.time / 1000, item.time % 1000);
 			batch.AddToBatch(msg);
 			user->Send(ServerInstance->GetRFCEvents().privmsg, msg);
 		}
 
-		if (batchmanager)
-			batchmanager->End(batch);
+		EndBatch(user, batch, first >= last);
+	}
+};
+
+class CommandChatHistory final
+	: public SplitCommand
+{
+private:
+	/** A reference to a point in the history of a channel. */
+	struct Reference final
+	{
+		/** If non-empty then the identifier of the referenced message. */
+		std::string msgid;
+
+		/** If msgid is empty then the referenced time in milliseconds since the UNIX epoch. */
+		int64_t time = 0;
+	};
+
+	IRCv3::Replies::Fail fail;
+	HistoryMode& historymode;
+	HistorySender& sender;
+	IRCv3::Batch::Batch targetsbatch;
+
+	static bool ParseTimestamp(const std::string& str, int64_t& out)
+	{
+		tm ts = { };
+		unsigned int millisecs = 0;
+		char zone = 0;
+		if (sscanf(str.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d.%3u%c", &ts.tm_year, &ts.tm_mon, &ts.tm_mday, &ts.tm_hour, &ts.tm_min, &ts.tm_sec, &millisecs, &zone) != 8
+			&& sscanf(str.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d%c", &ts.tm_year, &ts.tm_mon, &ts.tm_mday, &ts.tm_hour, &ts.tm_min, &ts.tm_sec, &zone) != 7)
+			return false;
+
+		if (zone != 'Z' || millisecs > 999)
+			return false;
+
+		ts.tm_year -= 1900;
+		ts.tm_mon -= 1;
+		const time_t secs = timegm(&ts);
+		if (secs == -1)
+			return false;
+
+		out = static_cast<int64_t>(secs) * 1000 + millisecs;
+		return true;
 	}
 
+	static bool ParseReference(const std::string& str, Reference& ref)
+	{
+		if (str.compare(0, 6, "msgid=") == 0)
+		{
+			ref.msgid = str.substr(6);
+			return !ref.msgid.empty();
+		}
+
+		if (str.compare(0, 10, "timestamp=") == 0)
+			return ParseTimestamp(str.substr(10), ref.time);
+
+		return false;
+	}
+
+	/** Finds the messages which are at a reference.
+	 * @param lower Set to the index of the first message at or after the reference.
+	 * @param upper Set to the index of the first message after the reference.
+	 * @return True if the reference was found; otherwise, false.
+	 */
+	static bool FindReference(const HistoryList* list, size_t first, size_t last, const Reference& ref, size_t& lower, size_t& upper)
+	{
+		if (!ref.msgid.empty())
+		{
+			for (size_t idx = last; idx-- > first; )
+			{
+				if (list->Get(idx).msgid == ref.msgid)
+				{
+					lower = idx;
+					upper = idx + 1;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		lower = list->PartitionPoint(first, last, [&ref](int64_t time) { return time < ref.time; });
+		upper = list->PartitionPoint(lower, last, [&ref](int64_t time) { return time <= ref.time; });
+		return true;
+	}
+
+	CmdResult HandleTargets(LocalUser* user, const Params& parameters)
+	{
+		Reference from;
+		Reference to;
+		if (!ParseReference(parameters[1], from) || !from.msgid.empty() || !ParseReference(parameters[2], to) || !to.msgid.empty())
+		{
+			fail.SendIfCap(user, &cap, this, "INVALID_PARAMS", parameters[0], "Invalid timestamp");
+			return CmdResult::FAILURE;
+		}
+
+		const size_t limit = ParseLimit(user, parameters[0], parameters[3]);
+		if (!limit)
+			return CmdResult::FAILURE;
+
+		const int64_t lowertime = std::min(from.time, to.time);
+		const int64_t uppertime = std::max(from.time, to.time);
+
+		std::vector<std::pair<int64_t, Channel*>> targets;
+		for (const auto* memb : user->chans)
+		{
+			HistoryList* list = historymode.ext.Get(memb->chan);
+			if (!list || !list->Prune())
+				continue;
+
+			const size_t first = list->GetFirst();
+			const size_t idx = list->PartitionPoint(first, list->size(), [uppertime](int64_t time) { return time < uppertime; });
+			if (idx > first && list->Get(idx - 1).time > lowertime)
+				targets.emplace_back(list->Get(idx - 1).time, memb->chan);
+		}
+
+		std::sort(targets.begin(), targets.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+		if (targets.size() > limit)
+			targets.resize(limit);
+
+		sender.StartBatch(targetsbatch);
+		for (const auto& [time, chan] : targets)
+		{
+			ClientProtocol::Message msg("CHATHISTORY", ServerInstance->Config->GetServerName());
+			msg.PushParam("TARGETS");
+			msg.PushParamRef(chan->name);
+			msg.PushParam("timestamp=" + IRCv3::ServerTime::FormatTime(time / 1000, time % 1000));
+			targetsbatch.AddToBatch(msg);
+			user->Send(sender.protoevprov, msg);
+		}
+		sender.EndBatch(user, targetsbatch, targets.empty());
+		return CmdResult::SUCCESS;
+	}
+
+	size_t ParseLimit(LocalUser* user, const std::string& subcommand, const std::string& limitstr)
+	{
+		const size_t limit = ConvToNum<size_t>(limitstr);
+		if (!limit)
+			fail.SendIfCap(user, &cap, this, "INVALID_PARAMS", subcommand, limitstr, "Invalid message limit");
+		return std::min<size_t>(limit, maxlimit);
+	}
+
+public:
+	Cap::Capability cap;
+	size_t maxlimit;
+
+	CommandChatHistory(Module* Creator, HistoryMode& hm, HistorySender& hs)
+		: SplitCommand(Creator, "CHATHISTORY", 4, 5)
+		, fail(Creator)
+		, historymode(hm)
+		, sender(hs)
+		, targetsbatch("draft/chathistory-targets")
+		, cap(Creator, "draft/chathistory")
+	{
+		syntax = {
+			"LATEST <channel> {*|<reference>} <limit>",
+			"{BEFORE|AFTER|AROUND} <channel> <reference> <limit>",
+			"BETWEEN <channel> <reference> <reference> <limit>",
+			"TARGETS <reference> <reference> <limit>",
+		};
+	}
+
+	CmdResult HandleLocal(LocalUser* user, const Params& parameters) override
+	{
+		const std::string& subcommand = parameters[0];
+		if (irc::equals(subcommand, "TARGETS"))
+			return HandleTargets(user, parameters);
+
+		const bool between = irc::equals(subcommand, "BETWEEN");
+		if (!between && !irc::equals(subcommand, "LATEST") && !irc::equals(subcommand, "BEFORE")
+			&& !irc::equals(subcommand, "AFTER") && !irc::equals(subcommand, "AROUND"))
+		{
+			fail.SendIfCap(user, &cap, this, "UNKNOWN_COMMAND", subcommand, "Unknown subcommand");
+			return CmdResult::FAILURE;
+		}
+
+		if (between && parameters.size() < 5)
+		{
+			fail.SendIfCap(user, &cap, this, "NEED_MORE_PARAMS", subcommand, "Not enough parameters");
+			return CmdResult::FAILURE;
+		}
+
+		Reference ref;
+		Reference endref;
+		const bool latest = irc::equals(subcommand, "LATEST") && parameters[2] == "*";
+		if ((!latest && !ParseReference(parameters[2], ref)) || (between && !ParseReference(parameters[3], endref)))
+		{
+			fail.SendIfCap(user, &cap, this, "INVALID_PARAMS", subcommand, "Invalid message reference");
+			return CmdResult::FAILURE;
+		}
+
+		const size_t limit = ParseLimit(user, subcommand, parameters[between ? 4 : 3]);
+		if (!limit)
+			return CmdResult::FAILURE;
+
+		Channel* chan = ServerInstance->Channels.Find(parameters[1]);
+		if (!chan || (!chan->HasUser(user) && !user->HasPrivPermission("channels/auspex")))
+		{
+			fail.SendIfCap(user, &cap, this, "INVALID_TARGET", subcommand, parameters[1], "You can not view the history of this target");
+			return CmdResult::FAILURE;
+		}
+
+		HistoryList* list = historymode.ext.Get(chan);
+		if (!list || !list->Prune())
+		{
+			sender.Send(user, chan, list, 0, 0);
+			return CmdResult::SUCCESS;
+		}
+
+		// Work out which messages to send. References are exclusive except for the centre of AROUND.
+		const size_t first = list->GetFirst();
+		const size_t last = list->size();
+		size_t lower;
+		size_t upper;
+		size_t begin = 0;
+		size_t end = 0;
+		if (latest)
+		{
+			begin = std::max(first, last > limit ? last - limit : 0);
+			end = last;
+		}
+		else if (FindReference(list, first, last, ref, lower, upper))
+		{
+			if (irc::equals(subcommand, "LATEST"))
+			{
+				begin = std::max(upper, last > limit ? last - limit : 0);
+				end = last;
+			}
+			else if (irc::equals(subcommand, "BEFORE"))
+			{
+				begin = std::max(first, lower > limit ? lower - limit : 0);
+				end = lower;
+			}
+			else if (irc::equals(subcommand, "AFTER"))
+			{
+				begin = upper;
+				end = std::min(last, upper + limit);
+			}
+			else if (irc::equals(subcommand, "AROUND"))
+			{
+				begin = std::max(first, lower > limit / 2 ? lower - limit / 2 : 0);
+				end = std::min(last, begin + limit);
+				begin = std::max(first, end > limit ? end - limit : 0);
+			}
+			else
+			{
+				size_t endlower;
+				size_t endupper;
+				if (FindReference(list, first, last, endref, endlower, endupper))
+				{
+					if (lower <= endlower)
+					{
+						// Forwards from the first reference.
+						begin = upper;
+						end = std::min(endlower, upper + limit);
+					}
+					else
+					{
+						// Backwards from the first reference.
+						begin = std::max(endupper, lower > limit ? lower - limit : 0);
+						end = lower;
+					}
+				}
+			}
+		}
+
+		sender.Send(user, chan, list, begin, std::max(begin, end));
+		return CmdResult::SUCCESS;
+	}
+};
+
+class ModuleChanHistory final
+	: public Module
+	, public ServerProtocol::BroadcastEventListener
+	, public ISupport::EventListener
+{
+private:
+	HistoryMode historymode;
+	SimpleUserMode nohistorymode;
+	bool prefixmsg;
+	UserModeReference botmode;
+	bool dobots;
+	HistorySender sender;
+	CommandChatHistory cmd;
+	bool shuttingdown = false;
+
 public:
 	ModuleChanHistory()
-		: Module(VF_VENDOR, "Adds channel mode H (history) which allows message history to be viewed on joining the channel.")
+		: Module(VF_VENDOR, "Adds channel mode H (history) which allows message history to be viewed on joining the channel and with the IRCv3 CHATHISTORY command.")
 		, ServerProtocol::BroadcastEventListener(this)
+		, ISupport::EventListener(this)
 		, historymode(this)
 		, nohistorymode(this, "nohistory", 'N')
 		, botmode(this, "bot")
-		, batchcap(this)
-		, batchmanager(this)
-		, batch("chathistory")
-		, servertimemanager(this)
-		, tagevent(this)
+		, sender(this)
+		, cmd(this, historymode, sender)
 	{
 	}
 
@@ -233,6 +1086,31 @@ public:
 		historymode.maxlines = tag->getNum<unsigned long>("maxlines", 50);
 		prefixmsg = tag->getBool("prefixmsg", true);
 		dobots = tag->getBool("bots", true);
+		cmd.maxlimit = tag->getNum<size_t>("chathistorylimit", 100, 1);
+
+		std::string directory;
+#ifndef _WIN32
+		if (tag->getBool("persist", true))
+		{
+			directory = ServerInstance->Config->Paths.PrependData(tag->getString("directory", "history", 1));
+
+			std::error_code ec;
+			std::filesystem::create_directories(directory, ec);
+			if (ec)
+			{
+				ServerInstance->Logs.Warning(MODNAME, "Unable to create the history directory {}; history will not be persisted: {}",
+					directory, ec.message());
+				directory.clear();
+			}
+		}
+#endif
+		historymode.directory = directory;
+	}
+
+	void OnBuildISupport(ISupport::TokenMap& tokens) override
+	{
+		tokens["CHATHISTORY"] = ConvToStr(cmd.maxlimit);
+		tokens["MSGREFTYPES"] = "timestamp,msgid";
 	}
 
 	ModResult OnBroadcastMessage(const Channel* channel, const Server* server) override
@@ -253,9 +1131,7 @@ public:
 		if (!list)
 			return;
 
-		list->lines.emplace_back(user, details);
-		if (list->lines.size() > list->maxlen)
-			list->lines.pop_front();
+		list->Add(user, details);
 	}
 
 	void OnPostJoin(Membership* memb) override
@@ -270,11 +1146,15 @@ public:
 		if (memb->user->IsModeSet(nohistorymode))
 			return;
 
+		// Clients which support CHATHISTORY request the history they want themselves.
+		if (cmd.cap.IsEnabled(localuser))
+			return;
+
 		HistoryList* list = historymode.ext.Get(memb->chan);
 		if (!list || !list->Prune())
 			return;
 
-		if ((prefixmsg) && (!batchcap.IsEnabled(localuser)))
+		if ((prefixmsg) && (!sender.batchcap.IsEnabled(localuser)))
 		{
 			std::string message("Replaying up to " + ConvToStr(list->maxlen) + " lines of pre-join history");
 			if (list->maxtime > 0)
@@ -282,7 +1162,55 @@ public:
 			memb->WriteNotice(message);
 		}
 
-		SendHistory(localuser, memb->chan, list);
+		sender.Send(localuser, memb->chan, list, list->GetFirst(), list->size());
+	}
+
+	void OnChannelDelete(Channel* chan) override
+	{
+		// The history of channels which are destroyed when the server shuts down is kept so it can be
+		// restored when the channel is recreated.
+		HistoryList* list = historymode.ext.Get(chan);
+		if (list && !shuttingdown)
+			list->Destroy();
+	}
+
+	void OnGarbageCollect() override
+	{
+		insp::flat_set<std::string> active;
+		for (const auto& [_, chan] : ServerInstance->Channels.GetChans())
+		{
+			HistoryList* list = historymode.ext.Get(chan);
+			if (!list)
+				continue;
+
+			list->Prune();
+			if (!list->GetBasePath().empty())
+				active.insert(std::filesystem::path(list->GetBasePath()).filename().string());
+		}
+
+		if (historymode.directory.empty() || !historymode.maxduration)
+			return;
+
+		// Remove the history of channels which have not been recreated once it has expired.
+		std::error_code ec;
+		const auto mintime = std::filesystem::file_time_type::clock::now() - std::chrono::seconds(historymode.maxduration);
+		for (const auto& entry : std::filesystem::directory_iterator(historymode.directory, ec))
+		{
+			const std::filesystem::path& path = entry.path();
+			if (path.extension() != ".0" && path.extension() != ".1")
+				continue;
+
+			if (active.count(path.stem().string()) || entry.last_write_time(ec) > mintime || ec)
+				continue;
+
+			ServerInstance->Logs.Debug(MODNAME, "Removing expired history segment {}", path.string());
+			std::filesystem::remove(path, ec);
+		}
+	}
+
+	void OnShutdown(const std::string& reason) override
+	{
+		shuttingdown = true;
 	}
 };
 
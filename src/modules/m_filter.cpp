@@ -172,6 +172,68 @@ public:
 	FilterResult() = default;
 };
 
+/** A group of filters which have been compiled into a single regex pattern set. */
+class FilterSet final
+{
+private:
+	/** The indices of the patterns which matched the last text. */
+	std::vector<size_t> matches;
+
+	/** The compiled pattern set or nullptr if there are no patterns. */
+	Regex::PatternSetPtr patternset;
+
+	/** The position in the filter list of each pattern in the set. */
+	std::vector<size_t> positions;
+
+public:
+	/** Compiles the specified filters into a pattern set.
+	 * @param engine The regex engine which created the filters.
+	 * @param filters The list of all filters.
+	 * @param stripped Whether to compile the filters which match against text with formatting removed.
+	 * @return True if the set was compiled or false if the regex engine does not support pattern sets.
+	 */
+	bool Build(const Regex::Engine* engine, const std::vector<FilterResult>& filters, bool stripped)
+	{
+		std::vector<Regex::PatternPtr> patterns;
+		positions.clear();
+		for (size_t idx = 0; idx < filters.size(); ++idx)
+		{
+			const FilterResult& filter = filters[idx];
+			if (filter.flag_strip_color == stripped)
+			{
+				patterns.push_back(filter.regex);
+				positions.push_back(idx);
+			}
+		}
+
+		patternset = patterns.empty() ? nullptr : engine->CreateSet(patterns);
+		return patterns.empty() || patternset;
+	}
+
+	/** Removes all filters from the set. */
+	void Clear()
+	{
+		patternset = nullptr;
+		positions.clear();
+	}
+
+	/** Determines whether the set contains no filters. */
+	bool Empty() const { return positions.empty(); }
+
+	/** Finds the filters in this set which match the specified text.
+	 * @param text The text to match against.
+	 * @param matched The vector to append the positions in the filter list of the matching filters to.
+	 */
+	void Match(const std::string& text, std::vector<size_t>& matched)
+	{
+		if (!patternset || !patternset->Matches(text, matches))
+			return;
+
+		for (const auto match : matches)
+			matched.push_back(positions[match]);
+	}
+};
+
 class CommandFilter final
 	: public Command
 {
@@ -210,6 +272,20 @@ private:
 	unsigned long saveperiod;
 	unsigned long maxbackoff;
 	unsigned char backoff;
+
+	// Whether the filter sets need to be rebuilt before they are next used.
+	bool rebuildsets = false;
+
+	// Whether the filters are matched using the filter sets instead of one at a time.
+	bool usesets = false;
+
+	// The filters which match against the original text.
+	FilterSet textset;
+
+	// The filters which match against the text with formatting removed.
+	FilterSet strippedset;
+
+	void BuildFilterSets();
 	void FreeFilters();
 
 public:
@@ -380,10 +456,30 @@ Cullable::Result ModuleFilter::Cull()
 	return Module::Cull();
 }
 
+void ModuleFilter::BuildFilterSets()
+{
+	// Regex engines can only compile a pattern set in one go so rather than
+	// updating the sets every time a filter is added or removed they are
+	// rebuilt once when they are next needed.
+	rebuildsets = false;
+	usesets = RegexEngine && textset.Build(*RegexEngine, filters, false) && strippedset.Build(*RegexEngine, filters, true);
+	if (!usesets)
+	{
+		textset.Clear();
+		strippedset.Clear();
+	}
+}
+
 void ModuleFilter::FreeFilters()
 {
 	filters.clear();
 	dirty = true;
+
+	// The pattern sets belong to the regex engine which may be going away.
+	textset.Clear();
+	strippedset.Clear();
+	usesets = false;
+	rebuildsets = true;
 }
 
 ModResult ModuleFilter::OnUserPreMessage(User* user, const MessageTarget& msgtarget, MessageDetails& details)
@@ -770,6 +866,34 @@ const FilterResult* ModuleFilter::FilterMatch(User* user, const std::string& tex
 	static std::string stripped_text;
 	stripped_text.clear();
 
+	if (rebuildsets)
+		BuildFilterSets();
+
+	if (usesets)
+	{
+		// Find every matching filter in a single pass and then check them in
+		// list order so that the same filter wins as when matching one by one.
+		static std::vector<size_t> matched;
+		matched.clear();
+
+		textset.Match(text, matched);
+		if (!strippedset.Empty())
+		{
+			stripped_text = text;
+			InspIRCd::StripColor(stripped_text);
+			strippedset.Match(stripped_text, matched);
+		}
+
+		std::sort(matched.begin(), matched.end());
+		for (const auto idx : matched)
+		{
+			const FilterResult& filter = filters[idx];
+			if (AppliesToMe(user, filter, flgs))
+				return &filter;
+		}
+		return nullptr;
+	}
+
 	for (const auto& filter : filters)
 	{
 		/* Skip ones that dont apply to us */
@@ -797,6 +921,7 @@ bool ModuleFilter::DeleteFilter(const std::string& freeform, std::string& reason
 			reason.assign(i->reason);
 			filters.erase(i);
 			dirty = true;
+			rebuildsets = true;
 			return true;
 		}
 	}
@@ -817,6 +942,7 @@ std::pair<bool, std::string> ModuleFilter::AddFilter(const std::string& freeform
 	{
 		filters.emplace_back(RegexEngine, freeform, reason, type, duration, flgs, config);
 		dirty = true;
+		rebuildsets = true;
 	}
 	catch (const ModuleException& e)
 	{
@@ -875,6 +1001,7 @@ void ModuleFilter::ReadFilters()
 		{
 			removedfilters.insert(filter->freeform);
 			filter = filters.erase(filter);
+			rebuildsets = true;
 			continue;
 		}
 
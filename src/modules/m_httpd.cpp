@@ -54,6 +54,10 @@ static Events::ModuleEventProvider* aclevprov;
 static Events::ModuleEventProvider* reqevprov;
 static http_parser_settings parser_settings;
 
+// Once the send queue of a socket holds this many bytes no more of a streamed document is
+// produced until the client has received some of it.
+static constexpr size_t STREAM_SENDQ_LIMIT = 65536;
+
 /** A socket used for HTTP transport
  */
 class HttpServerSocket final
@@ -78,6 +82,15 @@ private:
 	bool waitingcull = false;
 	bool messagecomplete = false;
 
+	/** The stream which is producing the body of the response or nullptr if not streaming. */
+	std::unique_ptr<HTTPDocumentStream> stream;
+
+	/** The module which created the stream. */
+	Module* streammod = nullptr;
+
+	/** Whether the body of the streamed response uses chunked transfer encoding. */
+	bool chunked = false;
+
 	bool Tick() override
 	{
 		if (!messagecomplete)
@@ -268,10 +281,6 @@ public:
 
 	void SendHeaders(unsigned long size, unsigned int response, HTTPHeaders& rheaders)
 	{
-		WriteData(INSP_FORMAT("HTTP/{}.{} {} {}\r\n", parser.http_major ? parser.http_major : 1, parser.http_major ? parser.http_minor : 1, response, http_status_str((http_status)response)));
-
-		rheaders.CreateHeader("Date", Time::ToString(ServerInstance->Time(), "%a, %d %b %Y %H:%M:%S GMT", true));
-		rheaders.CreateHeader("Server", INSPIRCD_BRANCH);
 		rheaders.SetHeader("Content-Length", ConvToStr(size));
 
 		if (size)
@@ -279,6 +288,16 @@ public:
 		else
 			rheaders.RemoveHeader("Content-Type");
 
+		SendHeaders(response, rheaders);
+	}
+
+	void SendHeaders(unsigned int response, HTTPHeaders& rheaders)
+	{
+		WriteData(INSP_FORMAT("HTTP/{}.{} {} {}\r\n", parser.http_major ? parser.http_major : 1, parser.http_major ? parser.http_minor : 1, response, http_status_str((http_status)response)));
+
+		rheaders.CreateHeader("Date", Time::ToString(ServerInstance->Time(), "%a, %d %b %Y %H:%M:%S GMT", true));
+		rheaders.CreateHeader("Server", INSPIRCD_BRANCH);
+
 		/* Supporting Connection: keep-alive causes a whole world of hurt synchronizing timeouts,
 		 * so remove it, its not essential for what we need.
 		 */
@@ -329,6 +348,61 @@ public:
 		Page(n->str(), response, hheaders);
 	}
 
+	void Stream(std::unique_ptr<HTTPDocumentStream>&& newstream, Module* mod, unsigned int response, HTTPHeaders* hheaders)
+	{
+		// Chunked transfer encoding is only available in HTTP/1.1 and newer. Older
+		// clients read the body until the connection is closed instead.
+		chunked = parser.http_major > 1 || (parser.http_major == 1 && parser.http_minor >= 1);
+		if (chunked)
+			hheaders->SetHeader("Transfer-Encoding", "chunked");
+
+		hheaders->RemoveHeader("Content-Length");
+		hheaders->CreateHeader("Content-Type", "text/html");
+		SendHeaders(response, *hheaders);
+
+		stream = std::move(newstream);
+		streammod = mod;
+		ContinueStream();
+	}
+
+	void ContinueStream()
+	{
+		// If the client is not keeping up then the rest of the document is produced when the
+		// socket becomes writable again. Otherwise, queueing data requests a trial write so we
+		// get called again on the next iteration of the main loop.
+		while (stream && HasFd() && !waitingcull && GetSendQSize() < STREAM_SENDQ_LIMIT)
+		{
+			std::string data;
+			const bool more = stream->Produce(data);
+			if (!data.empty())
+			{
+				if (chunked)
+				{
+					WriteData(INSP_FORMAT("{:x}\r\n", data.length()));
+					WriteData(data);
+					WriteData("\r\n");
+				}
+				else
+					WriteData(data);
+			}
+
+			if (!more)
+			{
+				stream.reset();
+				streammod = nullptr;
+				if (chunked)
+					WriteData("0\r\n\r\n");
+				BufferedSocket::Close(true);
+			}
+		}
+	}
+
+	void OnEventHandlerWrite() override
+	{
+		BufferedSocket::OnEventHandlerWrite();
+		ContinueStream();
+	}
+
 	bool ParseURI(const std::string& uristr, HTTPRequestURI& out)
 	{
 		http_parser_url_init(&url);
@@ -400,7 +474,10 @@ public:
 
 	void SendResponse(HTTPDocumentResponse& resp) override
 	{
-		resp.src.sock->Page(resp.document, resp.responsecode, &resp.headers);
+		if (resp.stream)
+			resp.src.sock->Stream(std::move(resp.stream), resp.module, resp.responsecode, &resp.headers);
+		else
+			resp.src.sock->Page(resp.document, resp.responsecode, &resp.headers);
 	}
 };
 
@@ -456,6 +533,13 @@ public:
 				sock->Cull();
 				delete sock;
 			}
+			else if (sock->streammod == mod)
+			{
+				// The stream can not outlive the module which produces it.
+				sock->stream.reset();
+				sock->streammod = nullptr;
+				sock->Close();
+			}
 		}
 	}
 
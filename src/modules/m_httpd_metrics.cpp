@@ -0,0 +1,196 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+#include "modules/httpd.h"
+#include "modules/metrics.h"
+#include "xline.h"
+
+namespace
+{
+	/** Converts a time in nanoseconds to seconds. */
+	double ToSeconds(uint64_t nanoseconds)
+	{
+		return nanoseconds / 1000000000.0;
+	}
+
+	void ServerMetrics(Metrics::Writer& writer)
+	{
+		writer.Family(Metrics::Type::GAUGE, "inspircd_info", "Information about the server.")
+			.Sample("version", INSPIRCD_VERSION, 1);
+
+		writer.Family(Metrics::Type::GAUGE, "inspircd_start_time_seconds", "The UNIX time at which the server started.")
+			.Sample(ServerInstance->startup_time);
+	}
+
+	void UserMetrics(Metrics::Writer& writer)
+	{
+		const UserManager& users = ServerInstance->Users;
+
+		writer.Family(Metrics::Type::GAUGE, "inspircd_users", "Fully connected users on the network.")
+			.Sample("scope", "local", users.LocalUserCount())
+			.Sample("scope", "global", users.GlobalUserCount());
+
+		writer.Family(Metrics::Type::GAUGE, "inspircd_unregistered_users", "Local connections which have not finished registering.")
+			.Sample(users.UnknownUserCount());
+
+		writer.Family(Metrics::Type::GAUGE, "inspircd_services", "Services pseudoclients on the network.")
+			.Sample(users.ServiceCount());
+
+		writer.Family(Metrics::Type::GAUGE, "inspircd_opers", "Server operators on the network.")
+			.Sample(users.all_opers.size());
+
+		writer.Family(Metrics::Type::GAUGE, "inspircd_channels", "Channels on the network.")
+			.Sample(ServerInstance->Channels.GetChans().size());
+
+		writer.Family(Metrics::Type::COUNTER, "inspircd_user_connections", "Users which have finished registering on this server.")
+			.Sample(ServerInstance->Stats.Connects);
+
+		writer.Family(Metrics::Type::COUNTER, "inspircd_nick_collisions", "Nickname collisions which have been handled.")
+			.Sample(ServerInstance->Stats.Collisions);
+	}
+
+	void SocketMetrics(Metrics::Writer& writer)
+	{
+		const ServerStats& stats = ServerInstance->Stats;
+
+		writer.Family(Metrics::Type::GAUGE, "inspircd_sockets", "File descriptors in the socket engine.")
+			.Sample(SocketEngine::GetUsedFds());
+
+		writer.Family(Metrics::Type::GAUGE, "inspircd_sockets_max", "The maximum number of file descriptors in the socket engine.")
+			.Sample(SocketEngine::GetMaxFds());
+
+		writer.Family(Metrics::Type::COUNTER, "inspircd_accepts", "Incoming connections by result.")
+			.Sample("result", "accepted", stats.Accept)
+			.Sample("result", "refused", stats.Refused);
+
+		writer.Family(Metrics::Type::GAUGE, "inspircd_sendq_bytes", "Bytes waiting in send queues.")
+			.Sample(stats.SendQ);
+
+		writer.Family(Metrics::Type::GAUGE, "inspircd_recvq_bytes", "Bytes waiting in receive queues.")
+			.Sample(stats.RecvQ);
+
+		writer.Family(Metrics::Type::COUNTER, "inspircd_sendq_queued_bytes", "Bytes added to send queues by whether the buffer was shared or copied.")
+			.Sample("buffer", "shared", stats.SendQShared)
+			.Sample("buffer", "copied", stats.SendQCopied);
+
+		writer.Family(Metrics::Type::COUNTER, "inspircd_user_bytes", "Bytes of IRC traffic to and from local users.")
+			.Sample("direction", "sent", stats.Sent)
+			.Sample("direction", "received", stats.Recv);
+
+		const SocketEngine::Statistics& sestats = SocketEngine::GetStats();
+		writer.Family(Metrics::Type::COUNTER, "inspircd_socketengine_events", "Events dispatched by the socket engine.")
+			.Sample("type", "read", sestats.ReadEvents)
+			.Sample("type", "write", sestats.WriteEvents)
+			.Sample("type", "error", sestats.ErrorEvents);
+	}
+
+	void CommandMetrics(Metrics::Writer& writer)
+	{
+		const CommandParser::CommandMap& commands = ServerInstance->Parser.GetCommands();
+
+		writer.Family(Metrics::Type::COUNTER, "inspircd_commands", "Commands executed by name.");
+		for (const auto& [cmdname, cmd] : commands)
+		{
+			if (cmd->use_count)
+				writer.Sample("command", cmdname, cmd->use_count);
+		}
+
+		writer.Family(Metrics::Type::COUNTER, "inspircd_command_seconds", "Time spent executing commands by name. Only measured when profiling is enabled.");
+		for (const auto& [cmdname, cmd] : commands)
+		{
+			if (cmd->use_time.calls)
+				writer.Sample("command", cmdname, ToSeconds(cmd->use_time.total));
+		}
+
+		writer.Family(Metrics::Type::COUNTER, "inspircd_unknown_commands", "Commands which did not exist.")
+			.Sample(ServerInstance->Stats.Unknown);
+	}
+
+	void XLineMetrics(Metrics::Writer& writer)
+	{
+		writer.Family(Metrics::Type::COUNTER, "inspircd_xline_hits", "X-line matches by X-line type.");
+		for (const auto& [type, hits] : ServerInstance->XLines->GetHits())
+			writer.Sample("type", type, hits);
+	}
+
+	void ProfileMetrics(Metrics::Writer& writer)
+	{
+		const ProfileManager& profiler = ServerInstance->Profiler;
+		if (!profiler.IsEnabled())
+			return;
+
+		writer.Family(Metrics::Type::COUNTER, "inspircd_mainloop_iterations", "Iterations of the main loop.")
+			.Sample(profiler.GetIterations().calls);
+
+		writer.Family(Metrics::Type::COUNTER, "inspircd_mainloop_busy_seconds", "Time the main loop spent doing work.")
+			.Sample(ToSeconds(profiler.GetIterations().total));
+
+		writer.Family(Metrics::Type::COUNTER, "inspircd_mainloop_phase_seconds", "Time the main loop spent in each phase.");
+		const auto& phases = profiler.GetPhases();
+		for (size_t phase = 0; phase < phases.size(); ++phase)
+			writer.Sample("phase", ProfileManager::GetPhaseName(static_cast<ProfileManager::Phase>(phase)), ToSeconds(phases[phase].total));
+	}
+}
+
+class ModuleHttpMetrics final
+	: public Module
+	, public HTTPRequestEventListener
+{
+private:
+	HTTPdAPI API;
+	Metrics::EventProvider metricsevprov;
+
+public:
+	ModuleHttpMetrics()
+		: Module(VF_VENDOR, "Provides server metrics in the OpenMetrics text format over HTTP via the /metrics path.")
+		, HTTPRequestEventListener(this)
+		, API(this)
+		, metricsevprov(this)
+	{
+	}
+
+	ModResult OnHTTPRequest(HTTPRequest& request) override
+	{
+		if (request.GetPath() != "/metrics")
+			return MOD_RES_PASSTHRU;
+
+		ServerInstance->Logs.Debug(MODNAME, "Handling HTTP request for {}", request.GetPath());
+
+		// Everything here is kept up to date as the server runs so a scrape only
+		// costs as much as the number of metrics and not the number of users.
+		std::string data;
+		Metrics::Writer writer(data);
+		ServerMetrics(writer);
+		UserMetrics(writer);
+		SocketMetrics(writer);
+		CommandMetrics(writer);
+		XLineMetrics(writer);
+		ProfileMetrics(writer);
+		metricsevprov.Call(&Metrics::EventListener::OnCollectMetrics, writer);
+		writer.End();
+
+		std::stringstream buffer(data);
+		HTTPDocumentResponse response(this, request, &buffer, 200);
+		response.headers.SetHeader("X-Powered-By", MODNAME);
+		response.headers.SetHeader("Content-Type", "application/openmetrics-text; version=1.0.0; charset=utf-8");
+		API->SendResponse(response);
+		return MOD_RES_DENY;
+	}
+};
+
+MODULE_INIT(ModuleHttpMetrics)
@@ -35,6 +35,8 @@
 #include "modules/httpd.h"
 #include "xline.h"
 
+#include <deque>
+#include <functional>
 #include <stack>
 
 static ISupport::EventProvider* isevprov;
@@ -83,49 +85,288 @@ namespace Stats
 		return ret;
 	}
 
-	class XMLSerializer final
+	/** Base class for the formats which statistics can be serialised as. The serialised data is
+	 * buffered until it is taken by the HTTP server so a document can be produced in parts.
+	 */
+	class Serializer
 	{
-	private:
-		std::stack<const char*> blocks;
-		std::stringstream data;
+	protected:
+		/** The serialised data which has not been sent yet. */
+		std::string data;
+
+		/** Writes an attribute.
+		 * @param name The name of the attribute.
+		 * @param value The value of the attribute.
+		 * @param numeric Whether the value is a number.
+		 */
+		virtual void WriteAttribute(const char* name, const std::string& value, bool numeric) = 0;
 
 	public:
-		XMLSerializer& Attribute(const char* name, const std::string& value)
+		virtual ~Serializer() = default;
+
+		/** Retrieves the MIME type of the serialised data. */
+		virtual const char* GetContentType() const = 0;
+
+		/** Retrieves the serialised data which has not been sent yet. */
+		std::string& GetData() { return data; }
+
+		Serializer& Attribute(const char* name, const std::string& value)
 		{
-			if (value.empty())
-				data << '<' << name << "/>";
-			else
-				data << '<' << name << '>' << Sanitize(value) << "</" << name << '>';
+			WriteAttribute(name, value, false);
 			return *this;
 		}
 
 		template<typename Numeric>
-		std::enable_if_t<std::is_arithmetic_v<Numeric>, XMLSerializer&> Attribute(const char* name, const Numeric& value)
+		std::enable_if_t<std::is_arithmetic_v<Numeric>, Serializer&> Attribute(const char* name, const Numeric& value)
 		{
-			return Attribute(name, ConvToStr(value));
+			WriteAttribute(name, ConvToStr(value), true);
+			return *this;
 		}
 
-		std::stringstream* GetData() { return &data; }
+		/** Begins a block of attributes.
+		 * @param name The name of the block. This is not used by JSON if the block is in a list.
+		 */
+		virtual Serializer& BeginBlock(const char* name) = 0;
 
-		XMLSerializer& BeginBlock(const char* name)
+		/** Ends the current block. */
+		virtual Serializer& EndBlock() = 0;
+
+		/** Begins a list of blocks.
+		 * @param name The name of the list.
+		 * @param element Whether the list has its own element in XML. This is only false for lists
+		 *                which existed before JSON support was added to keep the XML compatible.
+		 */
+		virtual Serializer& BeginList(const char* name, bool element = true) = 0;
+
+		/** Ends the current list. */
+		virtual Serializer& EndList() = 0;
+	};
+
+	class XMLSerializer final
+		: public Serializer
+	{
+	private:
+		std::stack<const char*> blocks;
+
+	protected:
+		void WriteAttribute(const char* name, const std::string& value, bool numeric) override
+		{
+			if (value.empty())
+				data.append("<").append(name).append("/>");
+			else
+				data.append("<").append(name).append(">").append(Sanitize(value)).append("</").append(name).append(">");
+		}
+
+	public:
+		const char* GetContentType() const override { return "text/xml"; }
+
+		Serializer& BeginBlock(const char* name) override
 		{
 			blocks.push(name);
-			data << '<' << name << '>';
+			data.append("<").append(name).append(">");
 			return *this;
 		}
 
-		XMLSerializer& EndBlock()
+		Serializer& EndBlock() override
 		{
 			const char* name = blocks.top();
-			data << "</" << name << '>';
+			data.append("</").append(name).append(">");
+			blocks.pop();
+			return *this;
+		}
+
+		Serializer& BeginList(const char* name, bool element) override
+		{
+			if (element)
+				return BeginBlock(name);
+
+			blocks.push(nullptr);
+			return *this;
+		}
+
+		Serializer& EndList() override
+		{
+			if (blocks.top())
+				return EndBlock();
+
 			blocks.pop();
 			return *this;
 		}
 	};
 
-	void DumpMeta(XMLSerializer& serializer, Extensible* ext)
+	class JSONSerializer final
+		: public Serializer
+	{
+	private:
+		struct Frame final
+		{
+			/** Whether this is a list rather than a block. */
+			bool list;
+
+			/** Whether nothing has been written to this frame yet. */
+			bool empty = true;
+
+			Frame(bool isList)
+				: list(isList)
+			{
+			}
+		};
+
+		/** The blocks and lists which are currently open. */
+		std::vector<Frame> frames;
+
+		void AppendString(const std::string& str)
+		{
+			// JSON must be valid UTF-8 but IRC text is not always. If it isn't then we treat
+			// it as ISO 8859-1 which allows any byte to be represented.
+			const bool utf8 = UTF8::IsValid(str);
+
+			data.push_back('"');
+			for (const auto chr : str)
+			{
+				const unsigned char uchr = chr;
+				if (chr == '"' || chr == '\\')
+					data.append("\\").push_back(chr);
+				else if (uchr < 0x20 || (uchr >= 0x80 && !utf8))
+					data.append(INSP_FORMAT("\\u{:04x}", uchr));
+				else
+					data.push_back(chr);
+			}
+			data.push_back('"');
+		}
+
+		void BeginValue(const char* name)
+		{
+			// The document itself is an anonymous value.
+			if (frames.empty())
+				return;
+
+			Frame& frame = frames.back();
+			if (!frame.empty)
+				data.push_back(',');
+			frame.empty = false;
+
+			if (!frame.list)
+			{
+				AppendString(name);
+				data.push_back(':');
+			}
+		}
+
+	protected:
+		void WriteAttribute(const char* name, const std::string& value, bool numeric) override
+		{
+			BeginValue(name);
+			if (numeric)
+				data.append(value);
+			else
+				AppendString(value);
+		}
+
+	public:
+		const char* GetContentType() const override { return "application/json"; }
+
+		Serializer& BeginBlock(const char* name) override
+		{
+			BeginValue(name);
+			data.push_back('{');
+			frames.emplace_back(false);
+			return *this;
+		}
+
+		Serializer& EndBlock() override
+		{
+			data.push_back('}');
+			frames.pop_back();
+			return *this;
+		}
+
+		Serializer& BeginList(const char* name, bool element) override
+		{
+			BeginValue(name);
+			data.push_back('[');
+			frames.emplace_back(true);
+			return *this;
+		}
+
+		Serializer& EndList() override
+		{
+			data.push_back(']');
+			frames.pop_back();
+			return *this;
+		}
+	};
+
+	/** Produces a statistics document in chunks so that large documents do not have to be
+	 * held in memory or generated in one go.
+	 */
+	class Document final
+		: public HTTPDocumentStream
+	{
+	public:
+		/** A step in producing the document. Returns true once it has finished. */
+		typedef std::function<bool(Serializer&)> Step;
+
+	private:
+		/** The serializer which the document is written with. */
+		std::unique_ptr<Serializer> serializer;
+
+		/** The steps which are left to produce the document. */
+		std::deque<Step> steps;
+
+	public:
+		Document(std::unique_ptr<Serializer>&& s)
+			: serializer(std::move(s))
+		{
+		}
+
+		/** Retrieves the serializer which the document is written with. */
+		Serializer& GetSerializer() { return *serializer; }
+
+		/** Adds a step which writes a section of the document in one go.
+		 * @param section The function which writes the section.
+		 */
+		void Add(void (*section)(Serializer&))
+		{
+			steps.push_back([section](Serializer& s) { section(s); return true; });
+		}
+
+		/** Adds a step which writes a section of the document in multiple parts.
+		 * @param step The function which writes the next part of the section.
+		 */
+		void Add(Step&& step)
+		{
+			steps.push_back(std::move(step));
+		}
+
+		/** Adds a list which is written in multiple parts.
+		 * @param name The name of the list.
+		 * @param items The function which writes the next item of the list.
+		 */
+		void AddList(const char* name, Step&& items)
+		{
+			steps.push_back([name](Serializer& s) { s.BeginList(name); return true; });
+			steps.push_back(std::move(items));
+			steps.push_back([](Serializer& s) { s.EndList(); return true; });
+		}
+
+		bool Produce(std::string& buffer) override
+		{
+			std::string& data = serializer->GetData();
+			while (!steps.empty() && data.length() < 16384)
+			{
+				if (steps.front()(*serializer))
+					steps.pop_front();
+			}
+
+			buffer.swap(data);
+			return !steps.empty();
+		}
+	};
+
+	void DumpMeta(Serializer& serializer, Extensible* ext)
 	{
-		serializer.BeginBlock("metadata");
+		serializer.BeginList("metadata");
 		for (const auto& [item, obj] : ext->GetExtList())
 		{
 			serializer.BeginBlock("meta")
@@ -135,10 +376,10 @@ namespace Stats
 			serializer.Attribute("value", value)
 				.EndBlock();
 		}
-		serializer.EndBlock();
+		serializer.EndList();
 	}
 
-	void ServerInfo(XMLSerializer& serializer)
+	void ServerInfo(Serializer& serializer)
 	{
 		serializer.BeginBlock("server")
 			.Attribute("id", ServerInstance->Config->ServerId)
@@ -149,12 +390,12 @@ namespace Stats
 			.EndBlock();
 	}
 
-	void ISupport(XMLSerializer& serializer)
+	void ISupport(Serializer& serializer)
 	{
 		ISupport::TokenMap tokens;
 		isevprov->Call(&ISupport::EventListener::OnBuildISupport, tokens);
 
-		serializer.BeginBlock("isupport");
+		serializer.BeginList("isupport");
 		for (const auto& [key, value] : tokens)
 		{
 			serializer.BeginBlock("token")
@@ -162,10 +403,10 @@ namespace Stats
 				.Attribute("value", value)
 				.EndBlock();
 		}
-		serializer.EndBlock();
+		serializer.EndList();
 	}
 
-	void General(XMLSerializer& serializer)
+	void General(Serializer& serializer)
 	{
 		serializer.BeginBlock("general")
 			.Attribute("usercount", ServerInstance->Users.GetUsers().size())
@@ -181,9 +422,9 @@ namespace Stats
 		serializer.EndBlock();
 	}
 
-	void XLines(XMLSerializer& serializer)
+	void XLines(Serializer& serializer)
 	{
-		serializer.BeginBlock("xlines");
+		serializer.BeginList("xlines");
 		for (const auto& xltype : ServerInstance->XLines->GetAllTypes())
 		{
 			XLineLookup* lookup = ServerInstance->XLines->GetAll(xltype);
@@ -201,12 +442,12 @@ namespace Stats
 					.EndBlock();
 			}
 		}
-		serializer.EndBlock();
+		serializer.EndList();
 	}
 
-	void Modules(XMLSerializer& serializer)
+	void Modules(Serializer& serializer)
 	{
-		serializer.BeginBlock("modulelist");
+		serializer.BeginList("modulelist");
 		for (const auto& [modname, mod] : ServerInstance->Modules.GetModules())
 		{
 			serializer.BeginBlock("module")
@@ -214,46 +455,43 @@ namespace Stats
 				.Attribute("description", mod->description)
 				.EndBlock();
 		}
-		serializer.EndBlock();
+		serializer.EndList();
 	}
 
-	void Channels(XMLSerializer& serializer)
+	void DumpChannel(Serializer& serializer, Channel* c)
 	{
-		serializer.BeginBlock("channellist");
-		for (const auto& [_, c] : ServerInstance->Channels.GetChans())
-		{
-			serializer.BeginBlock("channel")
-				.Attribute("channelname", c->name)
-				.Attribute("usercount", c->GetUsers().size())
-				.Attribute("channelmodes", c->ChanModes(true));
-
-			if (!c->topic.empty())
-			{
-				serializer.BeginBlock("channeltopic")
-					.Attribute("topictext", c->topic)
-					.Attribute("setby", c->setby)
-					.Attribute("settime", c->topicset)
-					.EndBlock();
-			}
+		serializer.BeginBlock("channel")
+			.Attribute("channelname", c->name)
+			.Attribute("usercount", c->GetUsers().size())
+			.Attribute("channelmodes", c->ChanModes(true));
 
-			for (const auto& [__, memb] : c->GetUsers())
-			{
-				serializer.BeginBlock("channelmember")
-					.Attribute("uid", memb->user->uuid)
-					.Attribute("privs", memb->GetAllPrefixChars())
-					.Attribute("modes", memb->GetAllPrefixModes());
+		if (!c->topic.empty())
+		{
+			serializer.BeginBlock("channeltopic")
+				.Attribute("topictext", c->topic)
+				.Attribute("setby", c->setby)
+				.Attribute("settime", c->topicset)
+				.EndBlock();
+		}
 
-				DumpMeta(serializer, memb);
-				serializer.EndBlock();
-			}
+		serializer.BeginList("channelmembers", false);
+		for (const auto& [_, memb] : c->GetUsers())
+		{
+			serializer.BeginBlock("channelmember")
+				.Attribute("uid", memb->user->uuid)
+				.Attribute("privs", memb->GetAllPrefixChars())
+				.Attribute("modes", memb->GetAllPrefixModes());
 
-			DumpMeta(serializer, c);
+			DumpMeta(serializer, memb);
 			serializer.EndBlock();
 		}
+		serializer.EndList();
+
+		DumpMeta(serializer, c);
 		serializer.EndBlock();
 	}
 
-	void DumpUser(XMLSerializer& serializer, User* u)
+	void DumpUser(Serializer& serializer, User* u)
 	{
 		serializer.BeginBlock("user")
 			.Attribute("nickname", u->nick)
@@ -291,25 +529,12 @@ namespace Stats
 		serializer.EndBlock();
 	}
 
-	void Users(XMLSerializer& serializer)
-	{
-		serializer.BeginBlock("userlist");
-		for (const auto& [_, u] : ServerInstance->Users.GetUsers())
-		{
-			if (!u->IsFullyConnected())
-				continue;
-
-			DumpUser(serializer, u);
-		}
-		serializer.EndBlock();
-	}
-
-	void Servers(XMLSerializer& serializer)
+	void Servers(Serializer& serializer)
 	{
 		ProtocolInterface::ServerList sl;
 		ServerInstance->PI->GetServerList(sl);
 
-		serializer.BeginBlock("serverlist");
+		serializer.BeginList("serverlist");
 		for (const auto& server : sl)
 		{
 			serializer.BeginBlock("server")
@@ -321,26 +546,159 @@ namespace Stats
 				.Attribute("lagmillisecs", server.latencyms)
 				.EndBlock();
 		}
-		serializer.EndBlock();
+		serializer.EndList();
 	}
 
-	void Commands(XMLSerializer& serializer)
+	void Commands(Serializer& serializer)
 	{
-		serializer.BeginBlock("commandlist");
+		serializer.BeginList("commandlist");
 		for (const auto& [cmdname, cmd] : ServerInstance->Parser.GetCommands())
 		{
 			serializer.BeginBlock("command")
 				.Attribute("name", cmdname)
 				.Attribute("usecount", cmd->use_count)
+				.Attribute("usetime", cmd->use_time.total / 1000)
+				.Attribute("maxtime", cmd->use_time.max / 1000)
 				.EndBlock();
 		}
-		serializer.EndBlock();
+		serializer.EndList();
+	}
+
+	void ProfileCounter(Serializer& serializer, const char* name, const ProfileManager::Counter& counter)
+	{
+		// Times are in microseconds.
+		serializer.BeginBlock(name)
+			.Attribute("calls", counter.calls)
+			.Attribute("total", counter.total / 1000)
+			.Attribute("max", counter.max / 1000);
+	}
+
+	void Profiling(Serializer& serializer)
+	{
+		const ProfileManager& profiler = ServerInstance->Profiler;
+		serializer.BeginBlock("profiling")
+			.Attribute("enabled", profiler.IsEnabled())
+			.Attribute("hooks", profiler.IsProfilingHooks());
+
+		ProfileCounter(serializer, "iterations", profiler.GetIterations());
+		const auto& latency = profiler.GetLatency();
+		serializer.BeginList("latencylist", false);
+		for (size_t bucket = 0; bucket < latency.size(); ++bucket)
+		{
+			serializer.BeginBlock("latency")
+				.Attribute("under", bucket + 1 == latency.size() ? 0 : 1ULL << bucket)
+				.Attribute("count", latency[bucket])
+				.EndBlock();
+		}
+		serializer.EndList()
+			.EndBlock();
+
+		const auto& phases = profiler.GetPhases();
+		serializer.BeginList("phaselist", false);
+		for (size_t phase = 0; phase < phases.size(); ++phase)
+		{
+			ProfileCounter(serializer, "phase", phases[phase]);
+			serializer.Attribute("name", ProfileManager::GetPhaseName(static_cast<ProfileManager::Phase>(phase)))
+				.EndBlock();
+		}
+		serializer.EndList();
+
+		serializer.BeginList("hooklist", false);
+		for (const auto& [modname, mod] : ServerInstance->Modules.GetModules())
+		{
+			for (const auto& hook : mod->hookstats)
+			{
+				if (!hook.calls)
+					continue;
+
+				ProfileCounter(serializer, "hook", hook);
+				serializer.Attribute("module", modname)
+					.Attribute("event", hook.name)
+					.EndBlock();
+			}
+		}
+		serializer.EndList()
+			.EndBlock();
+	}
+
+	/** Creates a step which writes the specified channels one at a time. Channels which are
+	 * deleted before they are reached are skipped.
+	 * @param names The names of the channels to write.
+	 */
+	Document::Step ChannelList(std::vector<std::string>&& names)
+	{
+		return [names = std::move(names), position = size_t(0)](Serializer& serializer) mutable {
+			if (position < names.size())
+			{
+				Channel* chan = ServerInstance->Channels.Find(names[position++]);
+				if (chan)
+					DumpChannel(serializer, chan);
+			}
+			return position >= names.size();
+		};
+	}
+
+	/** Creates a step which writes the specified users one at a time. Users who quit before
+	 * they are reached are skipped.
+	 * @param uuids The UUIDs of the users to write.
+	 */
+	Document::Step UserList(std::vector<std::string>&& uuids)
+	{
+		return [uuids = std::move(uuids), position = size_t(0)](Serializer& serializer) mutable {
+			if (position < uuids.size())
+			{
+				User* user = ServerInstance->Users.FindUUID(uuids[position++]);
+				if (user)
+					DumpUser(serializer, user);
+			}
+			return position >= uuids.size();
+		};
+	}
+
+	/** Removes the entries outside of the page requested with the offset and limit parameters.
+	 * @param entries The entries to paginate.
+	 * @param params The parameters of the request.
+	 */
+	template<typename T>
+	void Paginate(std::vector<T>& entries, const HTTPQueryParameters& params)
+	{
+		const size_t offset = std::min(params.getNum<size_t>("offset"), entries.size());
+		entries.erase(entries.begin(), entries.begin() + offset);
+
+		const size_t limit = params.getNum<size_t>("limit");
+		if (limit && limit < entries.size())
+			entries.resize(limit);
+	}
+
+	std::vector<std::string> FindChannels(const HTTPQueryParameters& params)
+	{
+		std::vector<Channel*> chan_list;
+		chan_list.reserve(ServerInstance->Channels.GetChans().size());
+		for (const auto& [_, chan] : ServerInstance->Channels.GetChans())
+			chan_list.push_back(chan);
+
+		// Sort the channels so that pages are consistent between requests.
+		const bool paginate = params.find("offset") != params.end() || params.find("limit") != params.end();
+		if (paginate)
+		{
+			std::sort(chan_list.begin(), chan_list.end(), [](const Channel* lhs, const Channel* rhs) {
+				return lhs->name < rhs->name;
+			});
+			Paginate(chan_list, params);
+		}
+
+		std::vector<std::string> names;
+		names.reserve(chan_list.size());
+		for (const auto* chan : chan_list)
+			names.push_back(chan->name);
+		return names;
 	}
 
 	enum OrderBy
 	{
 		OB_NICK,
 		OB_LASTMSG,
+		OB_UUID,
 
 		OB_NONE
 	};
@@ -370,24 +728,17 @@ namespace Stats
 					return Compare(IS_LOCAL(u1)->idle_lastmsg, IS_LOCAL(u2)->idle_lastmsg);
 				case OB_NICK:
 					return Compare(u1->nick, u2->nick);
+				case OB_UUID:
+					return Compare(u1->uuid, u2->uuid);
 				default:
 					return false;
 			}
 		}
 	};
 
-	void ListUsers(XMLSerializer& serializer, const HTTPQueryParameters& params)
+	std::vector<std::string> FindUsers(const HTTPQueryParameters& params)
 	{
-		if (params.empty())
-		{
-			Users(serializer);
-			return;
-		}
-
-		serializer.BeginBlock("userlist");
-
 		// Filters
-		size_t limit = params.getNum<size_t>("limit");
 		bool showunreg = params.getBool("showunreg");
 		bool localonly = params.getBool("localonly");
 
@@ -412,11 +763,15 @@ namespace Stats
 			// We can only check idle times on local users
 			localonly = true;
 		}
+		else if (params.find("offset") != params.end() || params.find("limit") != params.end())
+		{
+			// Sort the users so that pages are consistent between requests.
+			orderby = OB_UUID;
+		}
 		else
 			orderby = OB_NONE;
 
-		typedef std::list<User*> NewUserList;
-		NewUserList user_list;
+		std::vector<User*> user_list;
 		for (const auto& [_, u] : ServerInstance->Users.GetUsers())
 		{
 			if (!showunreg && !u->IsFullyConnected())
@@ -432,15 +787,16 @@ namespace Stats
 			user_list.push_back(u);
 		}
 
-		UserSorter sorter(orderby, desc);
-		if (sorter.order != OB_NONE && !(!localonly && sorter.order == OB_LASTMSG))
-			user_list.sort(sorter);
+		if (orderby != OB_NONE)
+			std::sort(user_list.begin(), user_list.end(), UserSorter(orderby, desc));
 
-		size_t count = 0;
-		for (NewUserList::const_iterator i = user_list.begin(); i != user_list.end() && (!limit || count < limit); ++i, ++count)
-			DumpUser(serializer, *i);
+		Paginate(user_list, params);
 
-		serializer.EndBlock();
+		std::vector<std::string> uuids;
+		uuids.reserve(user_list.size());
+		for (const auto* u : user_list)
+			uuids.push_back(u->uuid);
+		return uuids;
 	}
 }
 
@@ -454,7 +810,7 @@ private:
 
 public:
 	ModuleHttpStats()
-		: Module(VF_VENDOR, "Provides XML-serialised statistics about the server, channels, and users over HTTP via the /stats path.")
+		: Module(VF_VENDOR, "Provides XML or JSON serialised statistics about the server, channels, and users over HTTP via the /stats path.")
 		, HTTPRequestEventListener(this)
 		, API(this)
 		, isupportevprov(this)
@@ -469,37 +825,57 @@ public:
 
 		ServerInstance->Logs.Debug(MODNAME, "Handling HTTP request for {}", request.GetPath());
 
-		Stats::XMLSerializer serializer;
-		serializer.BeginBlock("inspircdstats");
+		const HTTPQueryParameters& params = request.GetParsedURI().query_params;
+		std::unique_ptr<Stats::Serializer> serializer;
+		if (insp::equalsci(params.getString("format"), "json"))
+			serializer = std::make_unique<Stats::JSONSerializer>();
+		else
+			serializer = std::make_unique<Stats::XMLSerializer>();
+
+		const std::string contenttype = serializer->GetContentType();
+		auto document = std::make_unique<Stats::Document>(std::move(serializer));
+		document->GetSerializer().BeginBlock("inspircdstats");
+
+		// The lists of channels and users can be huge so these are written a few entries at
+		// a time as the client receives the document.
 		if (request.GetPath() == "/stats")
 		{
-			Stats::ServerInfo(serializer);
-			Stats::General(serializer);
-			Stats::XLines(serializer);
-			Stats::Modules(serializer);
-			Stats::Channels(serializer);
-			Stats::Users(serializer);
-			Stats::Servers(serializer);
-			Stats::Commands(serializer);
+			document->Add(Stats::ServerInfo);
+			document->Add(Stats::General);
+			document->Add(Stats::XLines);
+			document->Add(Stats::Modules);
+			document->AddList("channellist", Stats::ChannelList(Stats::FindChannels(HTTPQueryParameters())));
+			document->AddList("userlist", Stats::UserList(Stats::FindUsers(HTTPQueryParameters())));
+			document->Add(Stats::Servers);
+			document->Add(Stats::Commands);
+			document->Add(Stats::Profiling);
 		}
 		else if (request.GetPath() == "/stats/general")
 		{
-			Stats::General(serializer);
+			document->Add(Stats::General);
+		}
+		else if (request.GetPath() == "/stats/profiling")
+		{
+			document->Add(Stats::Profiling);
+		}
+		else if (request.GetPath() == "/stats/channels")
+		{
+			document->AddList("channellist", Stats::ChannelList(Stats::FindChannels(params)));
 		}
 		else if (request.GetPath() == "/stats/users")
 		{
-			Stats::ListUsers(serializer, request.GetParsedURI().query_params);
+			document->AddList("userlist", Stats::UserList(Stats::FindUsers(params)));
 		}
 		else
 		{
 			return MOD_RES_PASSTHRU;
 		}
-		serializer.EndBlock();
+		document->Add([](Stats::Serializer& s) { s.EndBlock(); return true; });
 
-		/* Send the document back to m_httpd */
-		HTTPDocumentResponse response(this, request, serializer.GetData(), 200);
+		/* Stream the document back via m_httpd */
+		HTTPDocumentResponse response(this, request, std::move(document), 200);
 		response.headers.SetHeader("X-Powered-By", MODNAME);
-		response.headers.SetHeader("Content-Type", "text/xml");
+		response.headers.SetHeader("Content-Type", contenttype);
 		API->SendResponse(response);
 		return MOD_RES_DENY; // Handled
 	}
@@ -85,16 +85,42 @@ public:
 	}
 };
 
+class PasswordChecker final
+	: public AsyncPasswordChecker
+{
+public:
+	PasswordChecker(Module* mod)
+		: AsyncPasswordChecker(mod)
+	{
+	}
+
+	bool CheckPassword(const std::string& password, const std::string& passwordhash, const std::string& value, const HashCompareCallback& callback) override
+	{
+		// HMAC passwords are cheap enough to check synchronously.
+		if (!passwordhash.compare(0, 5, "hmac-", 5))
+			return false;
+
+		HashProvider* hp = ServerInstance->Modules.FindDataService<HashProvider>("hash/" + passwordhash);
+		if (!hp)
+			return false;
+
+		hp->CompareAsync(value, password, callback);
+		return true;
+	}
+};
+
 class ModulePasswordHash final
 	: public Module
 {
 private:
 	CommandMkpasswd cmd;
+	PasswordChecker checker;
 
 public:
 	ModulePasswordHash()
 		: Module(VF_VENDOR, "Allows passwords to be hashed and adds the /MKPASSWD command which allows the generation of hashed passwords for use in the server configuration.")
 		, cmd(this)
+		, checker(this)
 	{
 	}
 
@@ -80,12 +80,13 @@ class PBKDF2Provider final
 {
 public:
 	HashProvider* provider;
+	HashWorkerPool& pool;
 	unsigned long iterations;
 	size_t dkey_length;
 
-	std::string PBKDF2(const std::string& pass, const std::string& salt, unsigned long itr = 0, size_t dkl = 0) const
+	static std::string PBKDF2(HashProvider* hp, const std::string& pass, const std::string& salt, unsigned long itr, size_t dkl)
 	{
-		size_t blocks = std::ceil((double)dkl / provider->out_size);
+		size_t blocks = std::ceil((double)dkl / hp->out_size);
 
 		std::string output;
 		std::string tmphash;
@@ -99,12 +100,12 @@ public:
 			salt_block.erase(salt.length());
 			salt_block.append(salt_data, sizeof(salt_data));
 
-			std::string blockdata = provider->hmac(pass, salt_block);
+			std::string blockdata = hp->hmac(pass, salt_block);
 			std::string lasthash = blockdata;
 			for (size_t iter = 1; iter < itr; iter++)
 			{
-				tmphash = provider->hmac(pass, lasthash);
-				for (size_t i = 0; i < provider->out_size; i++)
+				tmphash = hp->hmac(pass, lasthash);
+				for (size_t i = 0; i < hp->out_size; i++)
 					blockdata[i] ^= tmphash[i];
 
 				lasthash.swap(tmphash);
@@ -119,28 +120,44 @@ public:
 	std::string GenerateRaw(const std::string& data) override
 	{
 		PBKDF2Hash hs(this->iterations, this->dkey_length, ServerInstance->GenRandomStr(dkey_length, false));
-		hs.hash = PBKDF2(data, hs.salt, this->iterations, this->dkey_length);
+		hs.hash = PBKDF2(this->provider, data, hs.salt, this->iterations, this->dkey_length);
 		return hs.ToString();
 	}
 
-	bool Compare(const std::string& input, const std::string& hash) override
+	static bool Compare(HashProvider* hp, const std::string& input, const std::string& hash)
 	{
 		PBKDF2Hash hs(hash);
 		if (!hs.IsValid())
 			return false;
 
-		std::string cmp = PBKDF2(input, hs.salt, hs.iterations, hs.length);
+		std::string cmp = PBKDF2(hp, input, hs.salt, hs.iterations, hs.length);
 		return InspIRCd::TimingSafeCompare(cmp, hs.hash);
 	}
 
+	bool Compare(const std::string& input, const std::string& hash) override
+	{
+		return Compare(this->provider, input, hash);
+	}
+
+	void CompareAsync(const std::string& input, const std::string& hash, const HashCompareCallback& callback) override
+	{
+		// The job runs on a worker thread so it must not read any members which can be
+		// changed by a rehash. The pool is flushed before the underlying provider is deleted
+		// so it is safe to use it here.
+		pool.Submit([hp = this->provider, input, hash]() {
+			return Compare(hp, input, hash);
+		}, callback);
+	}
+
 	std::string ToPrintable(const std::string& raw) override
 	{
 		return raw;
 	}
 
-	PBKDF2Provider(Module* mod, HashProvider* hp)
+	PBKDF2Provider(Module* mod, HashProvider* hp, HashWorkerPool& workerpool)
 		: HashProvider(mod, "pbkdf2-hmac-" + hp->name.substr(hp->name.find('/') + 1))
 		, provider(hp)
+		, pool(workerpool)
 	{
 		DisableAutoRegister();
 	}
@@ -157,6 +174,7 @@ typedef std::map<std::string, ProviderConfig> ProviderConfigMap;
 class ModulePBKDF2 final
 	: public Module
 {
+	HashWorkerPool pool;
 	std::vector<PBKDF2Provider*> providers;
 	ProviderConfig globalconfig;
 	ProviderConfigMap providerconfigs;
@@ -187,6 +205,7 @@ class ModulePBKDF2 final
 		ProviderConfig newglobal;
 		newglobal.iterations = tag->getNum<unsigned long>("iterations", 12288, 1);
 		newglobal.dkey_length = tag->getNum<size_t>("length", 32, 1, 1024);
+		pool.SetWorkers(tag->getNum<size_t>("workers", 2, 0, 64));
 
 		// Then the specific values
 		ProviderConfigMap newconfigs;
@@ -213,6 +232,8 @@ public:
 
 	~ModulePBKDF2() override
 	{
+		// Finish any comparisons which are using the providers before deleting them.
+		pool.SetWorkers(0);
 		stdalgo::delete_all(providers);
 	}
 
@@ -233,7 +254,7 @@ public:
 		if (hp->IsKDF())
 			return;
 
-		auto* prov = new PBKDF2Provider(this, hp);
+		auto* prov = new PBKDF2Provider(this, hp, pool);
 		providers.push_back(prov);
 		ServerInstance->Modules.AddService(*prov);
 
@@ -248,6 +269,8 @@ public:
 			if (item->provider != &prov)
 				continue;
 
+			// Finish any comparisons which are using the provider before deleting it.
+			pool.Flush();
 			ServerInstance->Modules.DelService(*item);
 			delete item;
 			providers.erase(i);
@@ -27,6 +27,7 @@
 
 #include "inspircd.h"
 #include "dynamic.h"
+#include "modules/compress.h"
 #include "modules/extban.h"
 #include "utility/map.h"
 
@@ -394,6 +395,11 @@ void TreeSocket::SendCapabilities(int phase)
 		capabilities["CHALLENGE"] = GetOurChallenge();
 	}
 
+	// If this link can be compressed then advertise the mechanism we use.
+	CompressIOHook* compress = CompressIOHook::Find(this);
+	if (compress)
+		capabilities["COMPRESSION"] = compress->GetMechanism();
+
 	std::stringstream capabilitystr;
 	char separator = ':';
 	for (const auto& [capkey, capvalue] : capabilities)
@@ -566,6 +572,15 @@ bool TreeSocket::Capab(const CommandBase::Params& params)
 			}
 		}
 
+		// If both servers can compress this link then everything we send after this point is compressed.
+		CompressIOHook* compress = CompressIOHook::Find(this);
+		std::map<std::string, std::string>::const_iterator mechanism = capab->CapKeys.find("COMPRESSION");
+		if (compress && mechanism != capab->CapKeys.end() && mechanism->second == compress->GetMechanism())
+		{
+			WriteLine("CAPAB COMPRESS " + compress->GetMechanism());
+			compress->StartCompressing(this);
+		}
+
 		/* Challenge response, store their challenge for our password */
 		std::map<std::string, std::string>::iterator n = this->capab->CapKeys.find("CHALLENGE");
 		if ((n != this->capab->CapKeys.end()) && (ServerInstance->Modules.FindService(SERVICE_DATA, "hash/sha256")))
@@ -620,6 +635,16 @@ bool TreeSocket::Capab(const CommandBase::Params& params)
 	{
 		capab->ExtBans = params[1];
 	}
+	else if (irc::equals(params[0], "COMPRESS") && (params.size() == 2))
+	{
+		// Everything the remote server sends after this is compressed.
+		CompressIOHook* compress = CompressIOHook::Find(this);
+		if (!compress || params[1] != compress->GetMechanism() || !compress->StartDecompressing(this, recvq))
+		{
+			SendError("CAPAB negotiation failed: Unable to decompress data using " + params[1]);
+			return false;
+		}
+	}
 	else if (irc::equals(params[0], "CAPABILITIES") && (params.size() == 2))
 	{
 		irc::spacesepstream capabs(params[1]);
@@ -284,7 +284,7 @@ void CommandFJoin::LowerTS(Channel* chan, time_t TS, const std::string& newname)
 
 	// While the name is equal in case-insensitive compare, it might differ in case; use the remote version
 	chan->name = newname;
-	chan->age = TS;
+	ServerInstance->Channels.GetIndex().ChangeAge(chan, TS);
 
 	// Clear all modes
 	CommandFJoin::RemoveStatus(chan);
@@ -39,6 +39,8 @@ public:
 	std::vector<std::string> AllowMasks;
 	bool HiddenFromStats;
 	std::string Hook;
+	std::string Compress;
+	bool ResumeSession;
 	unsigned long Timeout;
 	std::string Bind;
 	bool Hidden;
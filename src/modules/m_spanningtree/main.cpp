@@ -541,7 +541,10 @@ void ModuleSpanningTree::OnUserJoin(Membership* memb, bool sync, bool created_by
 {
 	// Only do this for local users
 	if (!IS_LOCAL(memb->user))
+	{
+		Utils->AddChannelRoute(memb);
 		return;
+	}
 
 	// Assign the current membership id to the new Membership and increase it
 	memb->id = currmembid++;
@@ -610,6 +613,10 @@ void ModuleSpanningTree::OnUserPart(Membership* memb, std::string& partmessage,
 			params.push_last(partmessage);
 		params.Broadcast();
 	}
+	else
+	{
+		Utils->DelChannelRoute(memb);
+	}
 }
 
 void ModuleSpanningTree::OnUserQuit(User* user, const std::string& reason, const std::string& oper_message)
@@ -633,6 +640,9 @@ void ModuleSpanningTree::OnUserQuit(User* user, const std::string& reason, const
 			ServerInstance->SNO.WriteToSnoMask('Q', "Client exiting on server {}: {} ({}) [{}]", user->server->GetName(),
 				user->GetRealMask(), user->GetAddress(), oper_message);
 		}
+
+		for (const auto* memb : user->chans)
+			Utils->DelChannelRoute(memb);
 	}
 
 	// Regardless, update the UserCount
@@ -657,6 +667,9 @@ void ModuleSpanningTree::OnUserPostNick(User* user, const std::string& oldnick)
 
 void ModuleSpanningTree::OnUserKick(User* source, Membership* memb, const std::string& reason, CUList& excepts)
 {
+	if (!IS_LOCAL(memb->user))
+		Utils->DelChannelRoute(memb);
+
 	if ((!IS_LOCAL(source)) && (source != ServerInstance->FakeClient))
 		return;
 
@@ -670,6 +683,11 @@ void ModuleSpanningTree::OnUserKick(User* source, Membership* memb, const std::s
 	params.Broadcast();
 }
 
+void ModuleSpanningTree::OnChannelDelete(Channel* chan)
+{
+	Utils->ChannelRoutes.erase(chan);
+}
+
 void ModuleSpanningTree::OnPreRehash(User* user, const std::string& parameter)
 {
 	ServerInstance->Logs.Debug(MODNAME, "OnPreRehash called with param {}", parameter);
@@ -778,7 +796,7 @@ restart:
 		TreeSocket* sock = child->GetSocket();
 		if (sock->GetModHook(mod))
 		{
-			sock->SendError("TLS module unloaded");
+			sock->SendError("I/O hook module unloaded");
 			sock->Close();
 			// XXX: The list we're iterating is modified by TreeServer::SQuit() which is called by Close()
 			goto restart;
@@ -191,6 +191,7 @@ public:
 	void OnUserQuit(User* user, const std::string& reason, const std::string& oper_message) override;
 	void OnUserPostNick(User* user, const std::string& oldnick) override;
 	void OnUserKick(User* source, Membership* memb, const std::string& reason, CUList& excepts) override;
+	void OnChannelDelete(Channel* chan) override;
 	void OnPreRehash(User* user, const std::string& parameter) override;
 	void ReadConfig(ConfigStatus& status) override;
 	void OnOperLogin(User* user, const std::shared_ptr<OperAccount>& oper, bool automatic) override;
@@ -85,6 +85,21 @@ public:
 	}
 };
 
+namespace
+{
+	/** The number of bytes of burst data which are serialized into a single sendq element. */
+	constexpr size_t BURST_CHUNK_SIZE = 64 * 1024;
+
+	/** The number of bytes of burst data which are generated before yielding to the event loop. */
+	constexpr size_t BURST_SLICE_SIZE = 4 * BURST_CHUNK_SIZE;
+
+	/** Retrieves the current time in milliseconds. */
+	uint64_t GetTimeMS()
+	{
+		return ServerInstance->Time() * 1000 + (ServerInstance->Time_ns() / 1000000);
+	}
+}
+
 struct TreeSocket::BurstState final
 {
 	SpanningTreeProtocolInterface::Server server;
@@ -94,6 +109,63 @@ struct TreeSocket::BurstState final
 	}
 };
 
+/** Holds the state of a netburst which is being sent to a server over
+ * several iterations of the event loop.
+ */
+class TreeSocket::Burst final
+{
+public:
+	BurstState bs;
+
+	/** Burst lines which have been serialized but not added to the sendq yet. */
+	std::string buffer;
+
+	/** Lines which were written to the socket from outside of the burst while it
+	 * was being sent. These are sent after the burst to keep them in order.
+	 */
+	std::string held;
+
+	/** Whether lines written to the socket are currently part of the burst. */
+	bool generating = false;
+
+	/** The UUIDs of the users to introduce. */
+	std::vector<std::string> users;
+
+	/** The index of the next user to introduce. */
+	size_t nextuser = 0;
+
+	/** The names of the channels to synchronise. */
+	std::vector<std::string> channels;
+
+	/** The index of the next channel to synchronise. */
+	size_t nextchannel = 0;
+
+	Burst(TreeSocket* sock)
+		: bs(sock)
+	{
+		buffer.reserve(BURST_CHUNK_SIZE);
+
+		// Users and channels are looked up again when they are sent as they may
+		// have gone away by then. Anything that is created after this point will
+		// be sent to the server in the held lines instead.
+		users.reserve(ServerInstance->Users.GetUsers().size());
+		for (const auto& [_, user] : ServerInstance->Users.GetUsers())
+		{
+			if (user->IsFullyConnected())
+				users.push_back(user->uuid);
+		}
+
+		channels.reserve(ServerInstance->Channels.GetChans().size());
+		for (const auto& [_, chan] : ServerInstance->Channels.GetChans())
+			channels.push_back(chan->name);
+	}
+};
+
+TreeSocket::~TreeSocket()
+{
+	delete burst;
+}
+
 /** This function is called when we want to send a netburst to a local
  * server. There is a set order we must do this, because for example
  * users require their servers to exist, and channels require their
@@ -106,23 +178,110 @@ void TreeSocket::DoBurst(TreeServer* s)
 		capab->auth_fingerprint ? "TLS certificate fingerprint and " : "",
 		capab->auth_challenge ? "challenge-response" : "plaintext password");
 	this->CleanNegotiationInfo();
+
+	burststats = BurstStats();
+	burststats.start = GetTimeMS();
+	delete burst;
+	burst = new Burst(this);
+	burst->generating = true;
+
 	this->WriteLine(CmdBuilder("BURST").push_int(ServerInstance->Time()));
 	// Introduce all servers behind us
 	this->SendServers(Utils->TreeRoot, s);
 
-	BurstState bs(this);
-	// Introduce all users
-	this->SendUsers(bs);
+	burst->generating = false;
+	ContinueBurst();
+}
 
-	// Sync all channels
-	for (const auto& [_, chan] : ServerInstance->Channels.GetChans())
-		SyncChannel(chan, bs);
+void TreeSocket::ContinueBurst()
+{
+	// Only generate as much data as can be written out before the next event
+	// loop iteration so that clients are still served during large bursts.
+	const uint64_t slicebytes = burststats.bytes + BURST_SLICE_SIZE;
+	burst->generating = true;
+	while (burststats.bytes < slicebytes)
+	{
+		if (burst->nextuser < burst->users.size())
+		{
+			// Introduce all users
+			auto* user = ServerInstance->Users.FindUUID(burst->users[burst->nextuser++]);
+			if (user && !user->quitting)
+				SendUser(user, burst->bs);
+		}
+		else if (burst->nextchannel < burst->channels.size())
+		{
+			// Sync all channels
+			auto* chan = ServerInstance->Channels.Find(burst->channels[burst->nextchannel++]);
+			if (chan)
+				SyncChannel(chan, burst->bs);
+		}
+		else
+		{
+			FinishBurst();
+			return;
+		}
+	}
+	burst->generating = false;
+
+	if (!burst->buffer.empty())
+	{
+		WriteData(burst->buffer);
+		burst->buffer.clear();
+	}
 
+	// Writing to the sendq queues a trial write which continues the burst in
+	// the next iteration of the event loop.
+}
+
+void TreeSocket::FinishBurst()
+{
 	// Send all xlines
 	this->SendXLines();
-	Utils->Creator->synceventprov.Call(&ServerProtocol::SyncEventListener::OnSyncNetwork, bs.server);
+	Utils->Creator->synceventprov.Call(&ServerProtocol::SyncEventListener::OnSyncNetwork, burst->bs.server);
 	this->WriteLine(CmdBuilder("ENDBURST"));
-	ServerInstance->SNO.WriteToSnoMask('l', "Finished bursting to \002"+ s->GetName()+"\002.");
+
+	// Any lines which were written while bursting can now be sent.
+	burst->buffer.append(burst->held);
+	std::string pending;
+	pending.swap(burst->buffer);
+	AbortBurst();
+	if (!pending.empty())
+		WriteData(pending);
+
+	burststats.end = GetTimeMS();
+	const uint64_t duration = burststats.end - burststats.start;
+	ServerInstance->SNO.WriteToSnoMask('l', "Finished bursting to \002{}\002 ({} bytes in {} ms).",
+		MyRoot->GetName(), burststats.bytes, duration);
+}
+
+void TreeSocket::AbortBurst()
+{
+	delete burst;
+	burst = nullptr;
+}
+
+void TreeSocket::WriteBurstLine(const std::string& line)
+{
+	if (!burst->generating)
+	{
+		burst->held.append(line).push_back('\n');
+		return;
+	}
+
+	burststats.bytes += line.length() + 1;
+	burst->buffer.append(line).push_back('\n');
+	if (burst->buffer.length() >= BURST_CHUNK_SIZE)
+	{
+		WriteData(burst->buffer);
+		burst->buffer.clear();
+	}
+}
+
+void TreeSocket::OnEventHandlerWrite()
+{
+	BufferedSocket::OnEventHandlerWrite();
+	if (burst && GetError().empty() && GetSendQSize() < BURST_SLICE_SIZE)
+		ContinueBurst();
 }
 
 void TreeSocket::SendServerInfo(TreeServer* from)
@@ -275,32 +434,26 @@ void TreeSocket::SyncChannel(Channel* chan)
 	SyncChannel(chan, bs);
 }
 
-/** Send all users and their state, including oper and away status and global metadata */
-void TreeSocket::SendUsers(BurstState& bs)
+/** Send a user and their state, including oper and away status and global metadata */
+void TreeSocket::SendUser(User* user, BurstState& bs)
 {
-	for (const auto& [_, user] : ServerInstance->Users.GetUsers())
-	{
-		if (!user->IsFullyConnected())
-			continue;
+	this->WriteLine(CommandUID::Builder(user, this->proto_version != PROTO_INSPIRCD_3));
 
-		this->WriteLine(CommandUID::Builder(user, this->proto_version != PROTO_INSPIRCD_3));
+	if (user->IsOper())
+		this->WriteLine(CommandOpertype::Builder(user, user->oper));
 
-		if (user->IsOper())
-			this->WriteLine(CommandOpertype::Builder(user, user->oper));
+	if (user->IsAway())
+		this->WriteLine(CommandAway::Builder(user));
 
-		if (user->IsAway())
-			this->WriteLine(CommandAway::Builder(user));
+	if (user->uniqueusername) // TODO: convert this to BooleanExtItem in v4.
+		this->WriteLine(CommandMetadata::Builder(user, "uniqueusername", "1"));
 
-		if (user->uniqueusername) // TODO: convert this to BooleanExtItem in v4.
-			this->WriteLine(CommandMetadata::Builder(user, "uniqueusername", "1"));
-
-		for (const auto& [item, obj] : user->GetExtList())
-		{
-			const std::string value = item->ToNetwork(user, obj);
-			if (!value.empty())
-				this->WriteLine(CommandMetadata::Builder(user, item->name, value));
-		}
-
-		Utils->Creator->synceventprov.Call(&ServerProtocol::SyncEventListener::OnSyncUser, user, bs.server);
+	for (const auto& [item, obj] : user->GetExtList())
+	{
+		const std::string value = item->ToNetwork(user, obj);
+		if (!value.empty())
+			this->WriteLine(CommandMetadata::Builder(user, item->name, value));
 	}
+
+	Utils->Creator->synceventprov.Call(&ServerProtocol::SyncEventListener::OnSyncUser, user, bs.server);
 }
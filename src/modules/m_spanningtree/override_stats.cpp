@@ -25,6 +25,8 @@
 #include "main.h"
 #include "utils.h"
 #include "link.h"
+#include "treeserver.h"
+#include "treesocket.h"
 
 ModResult ModuleSpanningTree::OnStats(Stats::Context& stats)
 {
@@ -55,5 +57,26 @@ ModResult ModuleSpanningTree::OnStats(Stats::Context& stats)
 		}
 		return MOD_RES_DENY;
 	}
+	else if (stats.GetSymbol() == 'T')
+	{
+		for (const auto* server : Utils->TreeRoot->GetChildren())
+		{
+			const auto* sock = server->GetSocket();
+			if (!sock || !sock->GetBurstStats().start)
+				continue;
+
+			const BurstStats& bstats = sock->GetBurstStats();
+			if (!bstats.end)
+			{
+				stats.AddGenericRow(INSP_FORMAT("Netburst to {}: in progress ({} bytes sent)",
+					server->GetName(), bstats.bytes));
+				continue;
+			}
+
+			const uint64_t duration = std::max<uint64_t>(bstats.end - bstats.start, 1);
+			stats.AddGenericRow(INSP_FORMAT("Netburst to {}: {} bytes in {} ms ({} bytes/sec)",
+				server->GetName(), bstats.bytes, duration, bstats.bytes * 1000 / duration));
+		}
+	}
 	return MOD_RES_PASSTHRU;
 }
@@ -136,7 +136,8 @@ std::shared_ptr<Link> TreeSocket::AuthRemote(const CommandBase::Params& params)
 		{
 			std::string ciphersuite;
 			ssliohook->GetCiphersuite(ciphersuite);
-			ServerInstance->SNO.WriteToSnoMask('l', "Negotiated ciphersuite {} on link {}", ciphersuite, x->Name);
+			ServerInstance->SNO.WriteToSnoMask('l', "Negotiated ciphersuite {} on link {}{}", ciphersuite, x->Name,
+				ssliohook->IsResumed() ? " (resumed session)" : "");
 		}
 		else if (!capab->remotesa.is_local())
 		{
@@ -102,6 +102,19 @@ struct CapabData final
 	}
 };
 
+/** Statistics about a netburst sent to a server. */
+struct BurstStats final
+{
+	/** The number of bytes of burst data which have been queued. */
+	uint64_t bytes = 0;
+
+	/** The time in milliseconds at which the burst started. */
+	uint64_t start = 0;
+
+	/** The time in milliseconds at which the burst finished or 0 if it is still in progress. */
+	uint64_t end = 0;
+};
+
 /** Every SERVER connection inbound or outbound is represented by an object of
  * type TreeSocket. During setup, the object can be found in Utils->timeoutlist;
  * after setup, MyRoot will have been created as a child of Utils->TreeRoot
@@ -110,6 +123,7 @@ class TreeSocket final
 	: public BufferedSocket
 {
 	struct BurstState;
+	class Burst;
 
 	std::string linkID;			/* Description for this link */
 	ServerState LinkState;			/* Link state */
@@ -118,6 +132,12 @@ class TreeSocket final
 	/* The server we are talking to */
 	TreeServer* MyRoot = nullptr;
 
+	/** The netburst which is being sent to the server or nullptr if it has been sent. */
+	Burst* burst = nullptr;
+
+	/** Statistics about the netburst sent to the server. */
+	BurstStats burststats;
+
 	/** Checks if the given servername and sid are both free
 	 */
 	bool CheckDuplicate(const std::string& servername, const std::string& sid);
@@ -130,8 +150,22 @@ class TreeSocket final
 	/** Send all known information about a channel */
 	void SyncChannel(Channel* chan, BurstState& bs);
 
-	/** Send all users and their oper state, away state and metadata */
-	void SendUsers(BurstState& bs);
+	/** Send a user and their oper state, away state and metadata */
+	void SendUser(User* user, BurstState& bs);
+
+	/** Sends the next part of the netburst to the server. */
+	void ContinueBurst();
+
+	/** Finishes sending the netburst to the server. */
+	void FinishBurst();
+
+	/** Stops sending the netburst to the server without finishing it. */
+	void AbortBurst();
+
+	/** Adds a line to the netburst which is being sent to the server.
+	 * @param line The line to add.
+	 */
+	void WriteBurstLine(const std::string& line);
 
 	/** Send all additional info about the given server to this server */
 	void SendServerInfo(TreeServer* from);
@@ -198,10 +232,15 @@ public:
 	 */
 	TreeSocket(int newfd, ListenSocket* via, const irc::sockets::sockaddrs& client, const irc::sockets::sockaddrs& server);
 
+	~TreeSocket() override;
+
 	/** Get link state
 	 */
 	ServerState GetLinkState() const { return LinkState; }
 
+	/** Retrieves statistics about the netburst sent to the server. */
+	const BurstStats& GetBurstStats() const { return burststats; }
+
 	/** Get challenge set in our CAPAB for challenge/response
 	 */
 	const std::string& GetOurChallenge();
@@ -333,6 +372,9 @@ public:
 	/** Handle socket timeout from connect()
 	 */
 	void OnTimeout() override;
+
+	/** Sends more of the netburst when the socket becomes writable. */
+	void OnEventHandlerWrite() override;
 	/** Handle server quit on close
 	 */
 	void Close() override;
@@ -25,6 +25,7 @@
 
 #include "inspircd.h"
 #include "iohook.h"
+#include "modules/ssl.h"
 
 #include "main.h"
 #include "utils.h"
@@ -125,6 +126,18 @@ void TreeSocket::OnConnected()
 {
 	if (this->LinkState == CONNECTING)
 	{
+		// The compression hook has to be added before the TLS hook as it sits above it.
+		if (!capab->link->Compress.empty())
+		{
+			ServiceProvider* prov = ServerInstance->Modules.FindService(SERVICE_IOHOOK, capab->link->Compress);
+			if (!prov || static_cast<IOHookProvider*>(prov)->type != IOHookProvider::IOH_COMPRESS)
+			{
+				SetError("Could not find compression hook '" + capab->link->Compress + "' for connection to " + linkID);
+				return;
+			}
+			static_cast<IOHookProvider*>(prov)->OnConnect(this);
+		}
+
 		if (!capab->link->Hook.empty())
 		{
 			ServiceProvider* prov = ServerInstance->Modules.FindService(SERVICE_IOHOOK, "ssl/" + capab->link->Hook);
@@ -133,7 +146,12 @@ void TreeSocket::OnConnected()
 				SetError("Could not find hook '" + capab->link->Hook + "' for connection to " + linkID);
 				return;
 			}
-			static_cast<IOHookProvider*>(prov)->OnConnect(this);
+
+			auto* sslprov = static_cast<SSLIOHookProvider*>(prov);
+			if (capab->link->ResumeSession)
+				sslprov->OnConnect(this, INSP_FORMAT("{}/{}/{}", capab->link->Name, capab->link->IPAddr, capab->link->Port));
+			else
+				sslprov->OnConnect(this);
 		}
 
 		ServerInstance->SNO.WriteGlobalSno('l', "Connection to \002{}\002[{}] started.", linkID,
@@ -152,6 +170,7 @@ void TreeSocket::OnError(BufferedSocketError e)
 
 void TreeSocket::SendError(const std::string& errormessage)
 {
+	AbortBurst();
 	WriteLine("ERROR :"+errormessage);
 	DoWrite();
 	LinkState = DYING;
@@ -237,6 +256,12 @@ static std::string newline("\n");
 void TreeSocket::WriteLineInternal(const std::string& line)
 {
 	ServerInstance->Logs.RawIO(MODNAME, "S[{}] O {}", GetFd(), line);
+	if (burst)
+	{
+		WriteBurstLine(line);
+		return;
+	}
+
 	this->WriteData(line);
 	this->WriteData(newline);
 }
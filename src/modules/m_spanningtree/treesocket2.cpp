@@ -415,6 +415,7 @@ void TreeSocket::Close()
 	if (!HasFd())
 		return;
 
+	AbortBurst();
 	ServerInstance->GlobalCulls.AddItem(this);
 	this->BufferedSocket::Close();
 	SetError("Remote host closed connection");
@@ -90,6 +90,7 @@ CmdResult CommandUID::HandleServer(TreeServer* remoteserver, CommandBase::Params
 	_new->ChangeRemoteAddress(sa);
 	_new->ChangeRealName(params.back());
 	_new->connected = User::CONN_FULL;
+	ServerInstance->Users.GetIndex().Add(_new);
 	_new->signon = signon;
 	_new->nickchanged = nickchanged;
 
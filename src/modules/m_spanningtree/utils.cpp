@@ -145,36 +145,76 @@ void SpanningTreeUtilities::GetListOfServersForChannel(const Channel* c, TreeSoc
 			minrank = mh->GetPrefixRank();
 	}
 
-	TreeServer::ChildServers children = TreeRoot->GetChildren();
-	for (const auto& [user, memb] : c->GetUsers())
+	if (minrank)
 	{
-		if (IS_LOCAL(user))
-			continue;
-
-		if (minrank && memb->GetRank() < minrank)
-			continue;
+		// The route counts do not know about member ranks so we have to look at every member.
+		for (const auto& [user, memb] : c->GetUsers())
+		{
+			if (IS_LOCAL(user) || memb->GetRank() < minrank)
+				continue;
 
-		if (exempt_list.find(user) == exempt_list.end())
+			if (exempt_list.find(user) == exempt_list.end())
+				list.insert(TreeServer::Get(user)->GetSocket());
+		}
+	}
+	else
+	{
+		ChannelRouteMap::const_iterator routes = ChannelRoutes.find(c);
+		if (routes != ChannelRoutes.end())
 		{
-			TreeServer* best = TreeServer::Get(user);
-			list.insert(best->GetSocket());
+			// Work out how many of the members behind each route are exempt from receiving this.
+			RouteCounts exempt;
+			for (auto* user : exempt_list)
+			{
+				if (!IS_LOCAL(user) && c->HasUser(user))
+					exempt[TreeServer::Get(user)->GetRoute()]++;
+			}
 
-			TreeServer::ChildServers::iterator citer = std::find(children.begin(), children.end(), best);
-			if (citer != children.end())
-				children.erase(citer);
+			for (const auto& [route, count] : routes->second)
+			{
+				RouteCounts::const_iterator exemptiter = exempt.find(route);
+				if (exemptiter == exempt.end() || exemptiter->second < count)
+					list.insert(route->GetSocket());
+			}
 		}
 	}
 
 	// Check whether the servers which do not have users in the channel might need this message. This
 	// is used to keep the chanhistory module synchronised between servers.
-	for (const auto* child : children)
+	for (const auto* child : TreeRoot->GetChildren())
 	{
+		if (list.find(child->GetSocket()) != list.end())
+			continue;
+
 		ModResult result = Creator->broadcasteventprov.FirstResult(&ServerProtocol::BroadcastEventListener::OnBroadcastMessage, c, child);
 		if (result == MOD_RES_ALLOW)
 			list.insert(child->GetSocket());
 	}
 }
 
+void SpanningTreeUtilities::AddChannelRoute(const Membership* memb)
+{
+	ChannelRoutes[memb->chan][TreeServer::Get(memb->user)->GetRoute()]++;
+}
+
+void SpanningTreeUtilities::DelChannelRoute(const Membership* memb)
+{
+	ChannelRouteMap::iterator routes = ChannelRoutes.find(memb->chan);
+	if (routes == ChannelRoutes.end())
+		return;
+
+	RouteCounts::iterator route = routes->second.find(TreeServer::Get(memb->user)->GetRoute());
+	if (route == routes->second.end())
+		return;
+
+	if (--route->second)
+		return;
+
+	routes->second.erase(route);
+	if (routes->second.empty())
+		ChannelRoutes.erase(routes);
+}
+
 void SpanningTreeUtilities::DoOneToAllButSender(const CmdBuilder& params, const TreeServer* omitroute) const
 {
 	const std::string& FullLine = params.str();
@@ -288,6 +328,8 @@ void SpanningTreeUtilities::ReadConfiguration()
 		L->HiddenFromStats = tag->getBool("statshidden");
 		L->Timeout = tag->getDuration("timeout", 30);
 		L->Hook = tag->getString("sslprofile");
+		L->ResumeSession = tag->getBool("resumesession");
+		L->Compress = tag->getString("compress");
 		L->Bind = tag->getString("bind");
 		L->Hidden = tag->getBool("hidden");
 
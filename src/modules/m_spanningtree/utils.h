@@ -54,6 +54,10 @@ public:
 	typedef std::set<TreeSocket*> TreeSocketSet;
 	typedef std::map<TreeSocket*, std::pair<std::string, unsigned int>> TimeoutList;
 
+	/** Maps a directly connected server to the number of channel members which are behind it. */
+	typedef insp::flat_map<TreeServer*, size_t> RouteCounts;
+	typedef std::unordered_map<const Channel*, RouteCounts> ChannelRouteMap;
+
 	/** Creator module
 	 */
 	ModuleSpanningTree* Creator;
@@ -100,6 +104,11 @@ public:
 	/** List of all outgoing sockets and their timeouts
 	 */
 	TimeoutList timeoutlist;
+	/** The number of remote members of each channel by the route they are behind. This is kept up
+	 * to date as remote users join and leave channels so routing a channel message only needs to
+	 * look at the servers we are directly connected to instead of every member of the channel.
+	 */
+	ChannelRouteMap ChannelRoutes;
 	/** Holds the data from the <link> tags in the conf
 	 */
 	std::vector<std::shared_ptr<Link>> LinkBlocks;
@@ -141,6 +150,16 @@ public:
 	 */
 	static bool DoCollision(User* u, TreeServer* server, time_t remotets, const std::string& remoteuser, const std::string& remoteip, const std::string& remoteuid, const char* collidecmd);
 
+	/** Records that a remote user has joined a channel.
+	 * @param memb The membership of the remote user.
+	 */
+	void AddChannelRoute(const Membership* memb);
+
+	/** Records that a remote user is leaving a channel.
+	 * @param memb The membership of the remote user.
+	 */
+	void DelChannelRoute(const Membership* memb);
+
 	/** Compile a list of servers which contain members of channel c
 	 */
 	void GetListOfServersForChannel(const Channel* c, TreeSocketSet& list, char status, const CUList& exempt_list) const;
@@ -56,6 +56,9 @@ public:
 		if (old && old->refcount_dec())
 			delete old;
 
+		// Extbans can match the client certificate of a user.
+		user->ResetBanCache();
+
 		if (sync)
 			Sync(user, value);
 	}
@@ -63,6 +66,9 @@ public:
 	void Unset(User* user)
 	{
 		Delete(user, UnsetRaw(user));
+
+		// Extbans can match the client certificate of a user.
+		user->ResetBanCache();
 	}
 
 	std::string ToInternal(const Extensible* container, void* item) const noexcept override
@@ -21,6 +21,8 @@
 
 #include "inspircd.h"
 #include "iohook.h"
+#include "stringutils.h"
+#include "modules/compress.h"
 #include "modules/hash.h"
 #include "utility/string.h"
 
@@ -31,6 +33,7 @@ static constexpr char MagicGUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 static constexpr char newline[] = "\r\n";
 static constexpr char whitespace[] = " \t";
 static dynamic_reference_nocheck<HashProvider>* sha1;
+static dynamic_reference_nocheck<Compress::MessageProvider>* compressor;
 
 struct WebSocketConfig final
 {
@@ -60,6 +63,24 @@ struct WebSocketConfig final
 
 	// Whether to send WebSocket ping messages instead of IRC ping messages.
 	bool nativeping;
+
+	// Whether to compress messages using the permessage-deflate extension.
+	bool compress;
+
+	// Whether connections can keep their compression contexts between messages.
+	bool contexttakeover;
+
+	// The largest window size to compress messages sent to clients with.
+	unsigned int windowbits;
+
+	// The largest window size to ask clients to compress messages with.
+	unsigned int clientwindowbits;
+
+	// The maximum amount of memory the compression contexts of a connection can use.
+	size_t maxcompressmemory;
+
+	// The maximum number of compression contexts which can be kept between messages.
+	size_t maxcompresscontexts;
 };
 
 class WebSocketHookProvider final
@@ -67,11 +88,43 @@ class WebSocketHookProvider final
 {
 public:
 	WebSocketConfig config;
+
+	// The number of compression contexts which are being kept between messages.
+	size_t contexts = 0;
+
+	// The compressors shared by connections which do not keep context between messages indexed by window size.
+	std::array<std::unique_ptr<Compress::Deflater>, Compress::MessageProvider::MAX_WINDOW_BITS + 1> shareddeflaters;
+
+	// The decompressor shared by connections which do not keep context between messages.
+	std::unique_ptr<Compress::Inflater> sharedinflater;
+
 	WebSocketHookProvider(Module* mod)
 		: IOHookProvider(mod, "websocket", IOHookProvider::IOH_UNKNOWN, true)
 	{
 	}
 
+	Compress::Deflater* GetSharedDeflater(unsigned int windowbits)
+	{
+		auto& deflater = shareddeflaters[windowbits];
+		if (!deflater)
+			deflater = (*compressor)->CreateDeflater(windowbits);
+		return deflater.get();
+	}
+
+	Compress::Inflater* GetSharedInflater()
+	{
+		if (!sharedinflater)
+			sharedinflater = (*compressor)->CreateInflater(Compress::MessageProvider::MAX_WINDOW_BITS);
+		return sharedinflater.get();
+	}
+
+	void ResetCompression()
+	{
+		for (auto& deflater : shareddeflaters)
+			deflater.reset();
+		sharedinflater.reset();
+	}
+
 	void OnAccept(StreamSocket* sock, const irc::sockets::sockaddrs& client, const irc::sockets::sockaddrs& server) override;
 
 	void OnConnect(StreamSocket* sock) override
@@ -149,6 +202,7 @@ class WebSocketHook final
 
 	static constexpr unsigned char WS_MASKBIT = (1 << 7);
 	static constexpr unsigned char WS_FINBIT = (1 << 7);
+	static constexpr unsigned char WS_RSV1BIT = (1 << 6);
 	static constexpr unsigned char WS_PAYLOAD_LENGTH_MAGIC_LARGE = 126;
 	static constexpr unsigned char WS_PAYLOAD_LENGTH_MAGIC_HUGE = 127;
 	static constexpr size_t WS_MAX_PAYLOAD_LENGTH_SMALL = 125;
@@ -163,10 +217,28 @@ class WebSocketHook final
 	WebSocketConfig& config;
 	bool sendastext;
 
-	static size_t FillHeader(unsigned char* outbuf, size_t sendlength, OpCode opcode)
+	// The compressor for messages sent to the client or nullptr if permessage-deflate is not in use.
+	Compress::Deflater* deflater = nullptr;
+
+	// The decompressor for messages sent by the client or nullptr if permessage-deflate is not in use.
+	Compress::Inflater* inflater = nullptr;
+
+	// The compressor owned by this connection if it keeps context between messages.
+	std::unique_ptr<Compress::Deflater> owndeflater;
+
+	// The decompressor owned by this connection if it keeps context between messages.
+	std::unique_ptr<Compress::Inflater> owninflater;
+
+	// Whether the message currently being received is compressed.
+	bool inflating = false;
+
+	// The compressed payload of the message currently being received.
+	std::string compressedmsg;
+
+	static size_t FillHeader(unsigned char* outbuf, size_t sendlength, OpCode opcode, bool compressed)
 	{
 		size_t pos = 0;
-		outbuf[pos++] = WS_FINBIT | opcode;
+		outbuf[pos++] = WS_FINBIT | (compressed ? WS_RSV1BIT : 0) | opcode;
 
 		if (sendlength <= WS_MAX_PAYLOAD_LENGTH_SMALL)
 		{
@@ -189,15 +261,48 @@ class WebSocketHook final
 		return pos;
 	}
 
-	static StreamSocket::SendQueue::Element PrepareSendQElem(size_t size, OpCode opcode)
+	static StreamSocket::SendQueue::Element PrepareSendQElem(size_t size, OpCode opcode, bool compressed = false)
 	{
 		unsigned char header[MAXHEADERSIZE];
-		const size_t n = FillHeader(header, size, opcode);
+		const size_t n = FillHeader(header, size, opcode, compressed);
 
 		return StreamSocket::SendQueue::Element(reinterpret_cast<const char*>(header), n);
 	}
 
-	int HandleAppData(StreamSocket* sock, std::string& appdataout, bool allowlarge)
+	/** Unmasks the payload of a client frame in place.
+	 * @param data The payload to unmask.
+	 * @param length The length of the payload.
+	 * @param maskkey The four byte masking key of the frame.
+	 */
+	static void Unmask(char* data, size_t length, const unsigned char* maskkey)
+	{
+		// The mask repeats every four bytes so we can XOR a whole word at a time (which the
+		// compiler is free to vectorise further) and then finish off any trailing bytes.
+		uint32_t mask32;
+		memcpy(&mask32, maskkey, sizeof(mask32));
+		const uint64_t mask64 = (static_cast<uint64_t>(mask32) << 32) | mask32;
+
+		size_t pos = 0;
+		for (uint64_t word; length - pos >= sizeof(word); pos += sizeof(word))
+		{
+			memcpy(&word, data + pos, sizeof(word));
+			word ^= mask64;
+			memcpy(data + pos, &word, sizeof(word));
+		}
+
+		for (; pos < length; ++pos)
+			data[pos] ^= maskkey[pos % 4];
+	}
+
+	/** Reads the payload of a frame from the receive queue.
+	 * @param sock The socket the frame was received on.
+	 * @param appdata If a whole frame was available then a view of its unmasked payload in the receive queue.
+	 * @param framelength If a whole frame was available then its length. The caller must remove the frame
+	 *                    from the receive queue once it has finished with the payload.
+	 * @param allowlarge Whether the frame is allowed to have a payload longer than 125 bytes.
+	 * @return 1 if a whole frame was available, 0 if more data is needed, or -1 on error.
+	 */
+	int HandleAppData(StreamSocket* sock, std::string_view& appdata, size_t& framelength, bool allowlarge)
 	{
 		std::string& myrecvq = GetRecvQ();
 		// Need 1 byte opcode, minimum 1 byte len, 4 bytes masking key
@@ -255,16 +360,11 @@ class WebSocketHook final
 		if (myrecvq.length() < payloadstartoffset + len)
 			return 0;
 
-		unsigned int maskkeypos = 0;
-		const std::string::iterator endit = myrecvq.begin() + payloadstartoffset + len;
-		for (std::string::const_iterator i = myrecvq.begin() + payloadstartoffset; i != endit; ++i)
-		{
-			const unsigned char c = (unsigned char)*i;
-			appdataout.push_back(c ^ maskkey[maskkeypos++]);
-			maskkeypos %= 4;
-		}
+		char* payload = &myrecvq[payloadstartoffset];
+		Unmask(payload, len, maskkey);
 
-		myrecvq.erase(myrecvq.begin(), endit);
+		appdata = std::string_view(payload, len);
+		framelength = payloadstartoffset + len;
 		return 1;
 	}
 
@@ -278,16 +378,16 @@ class WebSocketHook final
 
 		lastpingpong = ServerInstance->Time();
 
-		std::string appdata;
-		const int result = HandleAppData(sock, appdata, false);
+		std::string_view appdata;
+		size_t framelength;
+		const int result = HandleAppData(sock, appdata, framelength, false);
 		if (result <= 0)
 			return result;
 
 		if (isping)
 		{
-			StreamSocket::SendQueue::Element elem = PrepareSendQElem(appdata.length(), OP_PONG);
-			elem.append(appdata);
-			GetSendQ().push_back(elem);
+			GetSendQ().push_back(PrepareSendQElem(appdata.length(), OP_PONG));
+			GetSendQ().push_back(StreamSocket::SendQueue::Element(appdata.data(), appdata.length()));
 
 			SocketEngine::ChangeEventMask(sock, FD_ADD_TRIAL_WRITE);
 		}
@@ -297,6 +397,8 @@ class WebSocketHook final
 			UserIOHandler* ioh = static_cast<UserIOHandler*>(sock);
 			ioh->user->lastping = 1;
 		}
+
+		GetRecvQ().erase(0, framelength);
 		return 1;
 	}
 
@@ -306,23 +408,83 @@ class WebSocketHook final
 			return 0;
 
 		unsigned char opcode = (unsigned char)GetRecvQ()[0];
+		if (opcode & WS_RSV1BIT)
+		{
+			// The RSV1 bit is only valid on the first frame of a compressed message.
+			const unsigned char type = opcode & ~(WS_FINBIT | WS_RSV1BIT);
+			if (!inflater || (type != OP_TEXT && type != OP_BINARY))
+			{
+				CloseConnection(sock, CLOSE_PROTOCOL_ERROR, "WebSocket protocol violation: unexpected compressed frame");
+				return -1;
+			}
+			opcode &= ~WS_RSV1BIT;
+		}
+
 		switch (opcode & ~WS_FINBIT)
 		{
 			case OP_CONTINUATION:
 			case OP_TEXT:
 			case OP_BINARY:
 			{
-				std::string appdata;
-				const int result = HandleAppData(sock, appdata, true);
+				std::string_view appdata;
+				size_t framelength;
+				const int result = HandleAppData(sock, appdata, framelength, true);
 				if (result != 1)
 					return result;
 
+				if ((opcode & ~WS_FINBIT) != OP_CONTINUATION)
+				{
+					inflating = GetRecvQ()[0] & WS_RSV1BIT;
+					compressedmsg.clear();
+				}
+
+				std::string decompressed;
+				if (inflating)
+				{
+					// Compressed messages have to be buffered until they are complete so that a
+					// decompressor can be shared by connections which do not need it to keep context.
+					if (compressedmsg.length() + appdata.length() > WS_MAX_PAYLOAD_LENGTH_LARGE)
+					{
+						CloseConnection(sock, CLOSE_TOO_LARGE, "WebSocket: Compressed message too large");
+						return -1;
+					}
+
+					compressedmsg.append(appdata);
+					GetRecvQ().erase(0, framelength);
+					if (!(opcode & WS_FINBIT))
+						return 1;
+
+					// The empty stored block at the end of the message is implied by the extension.
+					compressedmsg.append("\x00\x00\xff\xff", 4);
+					const bool success = inflater->Decompress(compressedmsg, decompressed, WS_MAX_PAYLOAD_LENGTH_LARGE);
+					if (!owninflater)
+						inflater->Reset();
+					compressedmsg.clear();
+
+					if (!success)
+					{
+						CloseConnection(sock, CLOSE_PROTOCOL_ERROR, "WebSocket: Unable to decompress message");
+						return -1;
+					}
+
+					appdata = decompressed;
+					framelength = 0;
+				}
+
 				// Strip out any CR+LF which may have been erroneously sent.
-				for (const auto chr : appdata)
+				if (!memchr(appdata.data(), '\r', appdata.length()) && !memchr(appdata.data(), '\n', appdata.length()))
 				{
-					if (chr != '\r' && chr != '\n')
-						destrecvq.push_back(chr);
+					destrecvq.append(appdata);
 				}
+				else
+				{
+					for (const auto chr : appdata)
+					{
+						if (chr != '\r' && chr != '\n')
+							destrecvq.push_back(chr);
+					}
+				}
+				GetRecvQ().erase(0, framelength);
 
 				// If we are on the final message of this block append a line terminator.
 				if (opcode & WS_FINBIT)
@@ -379,6 +541,134 @@ class WebSocketHook final
 		sock->SetError(sockerror);
 	}
 
+	WebSocketHookProvider* GetProvider() const
+	{
+		return static_cast<WebSocketHookProvider*>(prov.get());
+	}
+
+	/** Negotiates the permessage-deflate extension from RFC 7692.
+	 * @param offers The extensions which were offered by the client.
+	 * @return The extension to send back to the client or an empty string if no offer was accepted.
+	 */
+	std::string NegotiateCompression(const std::string& offers)
+	{
+		if (!config.compress || !*compressor)
+			return {};
+
+		irc::commasepstream offerstream(offers);
+		for (std::string offer; offerstream.GetToken(offer); )
+		{
+			offer.erase(std::remove_if(offer.begin(), offer.end(), ::isspace), offer.end());
+
+			irc::sepstream paramstream(offer, ';');
+			std::string param;
+			if (!paramstream.GetToken(param) || !insp::equalsci(param, "permessage-deflate"))
+				continue;
+
+			bool acceptable = true;
+			bool servertakeover = config.contexttakeover;
+			bool clienttakeover = config.contexttakeover;
+			bool clientbitsrequested = false;
+			unsigned int serverbits = config.windowbits;
+			unsigned int clientbits = Compress::MessageProvider::MAX_WINDOW_BITS;
+			while (acceptable && paramstream.GetToken(param))
+			{
+				std::string value;
+				const size_t eqpos = param.find('=');
+				if (eqpos != std::string::npos)
+				{
+					value.assign(param, eqpos + 1);
+					param.erase(eqpos);
+					if (value.length() >= 2 && value.front() == '"' && value.back() == '"')
+						value = value.substr(1, value.length() - 2);
+				}
+
+				// Window sizes of 2^8 are valid but zlib can not compress with them.
+				const unsigned int bits = ConvToNum<unsigned int>(value);
+				const bool validbits = bits >= 8 && bits <= Compress::MessageProvider::MAX_WINDOW_BITS;
+				if (insp::equalsci(param, "server_no_context_takeover") && value.empty())
+					servertakeover = false;
+				else if (insp::equalsci(param, "client_no_context_takeover") && value.empty())
+					clienttakeover = false;
+				else if (insp::equalsci(param, "server_max_window_bits") && validbits && bits >= Compress::MessageProvider::MIN_WINDOW_BITS)
+					serverbits = std::min(serverbits, bits);
+				else if (insp::equalsci(param, "client_max_window_bits") && (value.empty() || validbits))
+				{
+					clientbitsrequested = true;
+					clientbits = std::min(config.clientwindowbits, value.empty() ? clientbits : bits);
+				}
+				else
+					acceptable = false;
+			}
+
+			if (!acceptable)
+				continue;
+
+			// Keeping context between messages needs a compression context per connection. If we
+			// can not afford one then messages are compressed independently with a shared context.
+			WebSocketHookProvider* wsprov = GetProvider();
+			if (servertakeover && wsprov->contexts >= config.maxcompresscontexts)
+				servertakeover = false;
+			if (clienttakeover && wsprov->contexts + (servertakeover ? 1 : 0) >= config.maxcompresscontexts)
+				clienttakeover = false;
+
+			// Shrink the contexts until they fit within the per-connection memory limit. Messages
+			// from clients tend to be short so their context is the first to go.
+			auto getmemory = [&]() {
+				size_t memory = 0;
+				if (servertakeover)
+					memory += (*compressor)->GetDeflaterMemory(serverbits);
+				if (clienttakeover)
+					memory += (*compressor)->GetInflaterMemory(std::max(clientbits, Compress::MessageProvider::MIN_WINDOW_BITS));
+				return memory;
+			};
+			while (getmemory() > config.maxcompressmemory)
+			{
+				if (clienttakeover && clientbitsrequested && clientbits > Compress::MessageProvider::MIN_WINDOW_BITS)
+					clientbits--;
+				else if (clienttakeover)
+					clienttakeover = false;
+				else if (serverbits > Compress::MessageProvider::MIN_WINDOW_BITS)
+					serverbits--;
+				else
+					servertakeover = false;
+			}
+
+			std::string response = "permessage-deflate";
+			if (servertakeover)
+			{
+				owndeflater = (*compressor)->CreateDeflater(serverbits);
+				deflater = owndeflater.get();
+				wsprov->contexts++;
+			}
+			else
+			{
+				deflater = wsprov->GetSharedDeflater(serverbits);
+				response.append("; server_no_context_takeover");
+			}
+
+			if (clienttakeover)
+			{
+				owninflater = (*compressor)->CreateInflater(std::max(clientbits, Compress::MessageProvider::MIN_WINDOW_BITS));
+				inflater = owninflater.get();
+				wsprov->contexts++;
+			}
+			else
+			{
+				inflater = wsprov->GetSharedInflater();
+				response.append("; client_no_context_takeover");
+			}
+
+			if (serverbits < Compress::MessageProvider::MAX_WINDOW_BITS)
+				response.append("; server_max_window_bits=").append(ConvToStr(serverbits));
+			if (clientbitsrequested)
+				response.append("; client_max_window_bits=").append(ConvToStr(clientbits));
+			return response;
+		}
+
+		return {};
+	}
+
 	int HandleHTTPReq(StreamSocket* sock)
 	{
 		std::string& recvq = GetRecvQ();
@@ -490,6 +780,11 @@ class WebSocketHook final
 			return -1;
 		}
 
+		std::string extensions;
+		HTTPHeaderFinder extensionsheader;
+		if (extensionsheader.Find(recvq, "Sec-WebSocket-Extensions:", 25, reqend))
+			extensions = NegotiateCompression(extensionsheader.ExtractValue(recvq));
+
 		state = STATE_ESTABLISHED;
 
 		std::string key = keyheader.ExtractValue(recvq);
@@ -499,6 +794,8 @@ class WebSocketHook final
 		reply.append(Base64::Encode((*sha1)->GenerateRaw(key), nullptr, '=')).append(newline);
 		if (!selectedproto.empty())
 			reply.append("Sec-WebSocket-Protocol: ").append(selectedproto).append(newline);
+		if (!extensions.empty())
+			reply.append("Sec-WebSocket-Extensions: ").append(extensions).append(newline);
 		reply.append(newline);
 		GetSendQ().push_back(StreamSocket::SendQueue::Element(reply));
 
@@ -518,11 +815,116 @@ public:
 		sock->AddIOHook(this);
 	}
 
+	~WebSocketHook() override
+	{
+		StopCompression();
+	}
+
+	/** Determines whether messages on this connection are being compressed. */
+	bool IsCompressing() const
+	{
+		return deflater || inflater;
+	}
+
+	/** Stops compressing messages on this connection and frees its compression contexts. */
+	void StopCompression()
+	{
+		WebSocketHookProvider* wsprov = GetProvider();
+		if (owndeflater)
+		{
+			owndeflater.reset();
+			wsprov->contexts--;
+		}
+		if (owninflater)
+		{
+			owninflater.reset();
+			wsprov->contexts--;
+		}
+		deflater = nullptr;
+		inflater = nullptr;
+	}
+
 	bool IsHookReady() const override
 	{
 		return state == STATE_ESTABLISHED;
 	}
 
+	/** Writes a message to the send queue as a single frame.
+	 * @param message The pieces of the message without the line terminator.
+	 * @return True if the message was written successfully; otherwise, false.
+	 */
+	bool WriteFrame(std::vector<StreamSocket::SendQueue::Element>& message)
+	{
+		// The line terminator is CR LF so the CR will be at the end of the last piece.
+		while (!message.empty())
+		{
+			StreamSocket::SendQueue::Element& last = message.back();
+			if (!last.empty() && *(last.end() - 1) == '\r')
+				last.erase_back(1);
+			if (!last.empty())
+				break;
+			message.pop_back();
+		}
+
+		size_t length = 0;
+		bool valid = true;
+		for (const auto& piece : message)
+		{
+			length += piece.length();
+			if (sendastext && valid)
+				valid = UTF8::Validate(piece.data(), piece.length()) == piece.length();
+		}
+
+		if (sendastext && (!valid || message.size() > 1))
+		{
+			// If we send messages as text then we need to ensure they are valid UTF-8. A multi-byte
+			// sequence might be split across pieces so those are joined before checking them.
+			std::string joined;
+			joined.reserve(length);
+			for (const auto& piece : message)
+				joined.append(piece.data(), piece.length());
+
+			if (!valid && !UTF8::IsValid(joined))
+			{
+				std::string encoded;
+				utf8::unchecked::replace_invalid(joined.begin(), joined.end(), std::back_inserter(encoded));
+				joined.swap(encoded);
+			}
+
+			length = joined.length();
+			message.clear();
+			message.emplace_back(std::move(joined));
+		}
+
+		StreamSocket::SendQueue& mysendq = GetSendQ();
+		const OpCode opcode = sendastext ? OP_TEXT : OP_BINARY;
+		if (deflater)
+		{
+			std::string compressed;
+			bool success = true;
+			for (const auto& piece : message)
+				success = success && deflater->Compress(piece, compressed);
+			success = success && deflater->Flush(compressed);
+			if (!owndeflater)
+				deflater->Reset();
+
+			if (!success || compressed.length() < 4)
+				return false;
+
+			// The empty stored block at the end of the message is implied by the extension.
+			compressed.erase(compressed.length() - 4);
+			mysendq.push_back(PrepareSendQElem(compressed.length(), opcode, true));
+			mysendq.push_back(std::move(compressed));
+			return true;
+		}
+
+		// Otherwise, send the payload directly from the buffers it is already in.
+		mysendq.push_back(PrepareSendQElem(length, opcode));
+		for (auto& piece : message)
+			mysendq.push_back(std::move(piece));
+		return true;
+	}
+
 	ssize_t OnStreamSocketWrite(StreamSocket* sock, StreamSocket::SendQueue& uppersendq) override
 	{
 		StreamSocket::SendQueue& mysendq = GetSendQ();
@@ -531,35 +933,35 @@ public:
 		if (state != STATE_ESTABLISHED)
 			return (mysendq.empty() ? 0 : 1);
 
-		std::string message;
+		// The pieces of the message which have been found so far. These share the buffers of the
+		// upper send queue so the payload of a frame is never copied unless it needs re-encoding.
+		std::vector<StreamSocket::SendQueue::Element> message;
 		for (const auto& elem : uppersendq)
 		{
-			for (const auto chr : elem)
+			StreamSocket::SendQueue::Element rest(elem);
+			while (!rest.empty())
 			{
-				if (chr == '\n')
+				const char* eol = static_cast<const char*>(memchr(rest.data(), '\n', rest.length()));
+				if (!eol)
 				{
-					// We have found an entire message. Send it in its own frame.
-					if (sendastext)
-					{
-						// If we send messages as text then we need to ensure they are valid UTF-8.
-						std::string encoded;
-						utf8::unchecked::replace_invalid(message.begin(), message.end(), std::back_inserter(encoded));
-
-						mysendq.push_back(PrepareSendQElem(encoded.length(), OP_TEXT));
-						mysendq.push_back(encoded);
-					}
-					else
-					{
-						// Otherwise, send the raw message as a binary frame.
-						mysendq.push_back(PrepareSendQElem(message.length(), OP_BINARY));
-						mysendq.push_back(message);
-					}
-					message.clear();
+					message.push_back(rest);
+					break;
 				}
-				else if (chr != '\r')
+
+				// We have found an entire message. Send it in its own frame.
+				const size_t piecelen = eol - rest.data();
+				StreamSocket::SendQueue::Element piece(rest);
+				piece.erase_back(piece.length() - piecelen);
+				if (!piece.empty())
+					message.push_back(piece);
+				rest.erase_front(piecelen + 1);
+
+				if (!WriteFrame(message))
 				{
-					message.push_back(chr);
+					sock->SetError("WebSocket: Compression error");
+					return -1;
 				}
+				message.clear();
 			}
 		}
 
@@ -567,7 +969,8 @@ public:
 		uppersendq.clear();
 		if (!message.empty())
 		{
-			uppersendq.push_back(message);
+			for (auto& piece : message)
+				uppersendq.push_back(std::move(piece));
 			return 0;
 		}
 
@@ -618,15 +1021,18 @@ class ModuleWebSocket final
 {
 private:
 	dynamic_reference_nocheck<HashProvider> hash;
+	dynamic_reference_nocheck<Compress::MessageProvider> deflate;
 	std::shared_ptr<WebSocketHookProvider> hookprov;
 
 public:
 	ModuleWebSocket()
 		: Module(VF_VENDOR, "Allows WebSocket clients to connect to the IRC server.")
 		, hash(this, "hash/sha1")
+		, deflate(this, "compress/deflate")
 		, hookprov(std::make_shared<WebSocketHookProvider>(this))
 	{
 		sha1 = &hash;
+		compressor = &deflate;
 	}
 
 	void ReadConfig(ConfigStatus& status) override
@@ -663,11 +1069,38 @@ public:
 			config.proxyranges.push_back(proxyrange);
 
 		config.nativeping = tag->getBool("nativeping", true);
+		config.compress = tag->getBool("compress", true);
+		config.contexttakeover = tag->getBool("contexttakeover", true);
+		config.windowbits = tag->getNum<unsigned int>("windowbits", 13, Compress::MessageProvider::MIN_WINDOW_BITS, Compress::MessageProvider::MAX_WINDOW_BITS);
+		config.clientwindowbits = tag->getNum<unsigned int>("clientwindowbits", 15, Compress::MessageProvider::MIN_WINDOW_BITS, Compress::MessageProvider::MAX_WINDOW_BITS);
+		config.maxcompressmemory = tag->getNum<size_t>("maxcompressmemory", 128 * 1024);
+		config.maxcompresscontexts = tag->getNum<size_t>("maxcompresscontexts", 10000);
 
 		// Everything is okay; apply the new config.
 		hookprov->config = config;
 	}
 
+	void OnServiceDel(ServiceProvider& service) override
+	{
+		if (service.name != "compress/deflate")
+			return;
+
+		// The compression contexts belong to the module being unloaded so they have to be freed
+		// now. Connections which are using them can not carry on without them.
+		hookprov->ResetCompression();
+		const UserManager::LocalList& users = ServerInstance->Users.GetLocalUsers();
+		for (UserManager::LocalList::const_iterator it = users.begin(); it != users.end(); )
+		{
+			LocalUser* user = *it++;
+			auto* hook = static_cast<WebSocketHook*>(user->eh.GetModHook(this));
+			if (hook && hook->IsCompressing())
+			{
+				hook->StopCompression();
+				ServerInstance->Users.QuitUser(user, "WebSocket compression provider unloading");
+			}
+		}
+	}
+
 	void OnCleanup(ExtensionType type, Extensible* item) override
 	{
 		if (type != ExtensionType::USER)
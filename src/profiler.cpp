@@ -0,0 +1,85 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+
+void ProfileManager::SetEnabled(bool profile, bool profilehooks)
+{
+	// Start measuring from the beginning of the next iteration.
+	if (profile && !enabled)
+		restart = true;
+
+	enabled = profile;
+	hooks = profilehooks;
+}
+
+void ProfileManager::SwitchPhase(Phase newphase)
+{
+	const Clock::time_point now = Clock::now();
+	const uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - phasestart).count();
+
+	phases[phase].Add(elapsed);
+	if (phase != PHASE_IDLE)
+		busy += elapsed;
+
+	phase = newphase;
+	phasestart = now;
+}
+
+void ProfileManager::BeginIteration()
+{
+	if (!enabled)
+		return;
+
+	if (restart)
+	{
+		phase = PHASE_TIMERS;
+		phasestart = Clock::now();
+		busy = 0;
+		restart = false;
+		return;
+	}
+
+	SwitchPhase(PHASE_TIMERS);
+	iterations.Add(busy);
+
+	size_t bucket = 0;
+	for (uint64_t micros = busy / 1000; micros && bucket < LATENCY_BUCKETS - 1; micros >>= 1)
+		bucket++;
+	latency[bucket]++;
+
+	busy = 0;
+}
+
+const char* ProfileManager::GetPhaseName(Phase p)
+{
+	switch (p)
+	{
+		case PHASE_TIMERS:
+			return "timers";
+		case PHASE_EVENTS:
+			return "events";
+		case PHASE_IDLE:
+			return "idle";
+		case PHASE_CULLS:
+			return "culls";
+		case PHASE_ACTIONS:
+			return "actions";
+		default:
+			return "unknown";
+	}
+}
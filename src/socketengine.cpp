@@ -171,10 +171,12 @@ EventHandler* SocketEngine::GetRef(int fd)
 	return ref[fd];
 }
 
+#ifndef HAS_SOCKETENGINE_IO
 int SocketEngine::Accept(EventHandler* eh, sockaddr* addr, socklen_t* addrlen)
 {
 	return accept(eh->GetFd(), addr, addrlen);
 }
+#endif
 
 int SocketEngine::Close(EventHandler* eh)
 {
@@ -222,6 +224,7 @@ ssize_t SocketEngine::RecvFrom(EventHandler* eh, void* buf, size_t len, int flag
 	return nbRecvd;
 }
 
+#ifndef HAS_SOCKETENGINE_IO
 ssize_t SocketEngine::Send(EventHandler* eh, const void* buf, size_t len, int flags)
 {
 	ssize_t nbSent = send(eh->GetFd(), static_cast<const char*>(buf), len, flags);
@@ -235,6 +238,7 @@ ssize_t SocketEngine::Recv(EventHandler* eh, void* buf, size_t len, int flags)
 	stats.UpdateReadCounters(nbRecvd);
 	return nbRecvd;
 }
+#endif
 
 ssize_t SocketEngine::SendTo(EventHandler* eh, const void* buf, size_t len, int flags, const irc::sockets::sockaddrs& address)
 {
@@ -243,12 +247,14 @@ ssize_t SocketEngine::SendTo(EventHandler* eh, const void* buf, size_t len, int
 	return nbSent;
 }
 
+#ifndef HAS_SOCKETENGINE_IO
 ssize_t SocketEngine::WriteV(EventHandler* eh, const IOVector* iovec, int count)
 {
 	ssize_t sent = writev(eh->GetFd(), iovec, count);
 	stats.UpdateWriteCounters(sent);
 	return sent;
 }
+#endif
 
 #ifdef _WIN32
 int SocketEngine::WriteV(EventHandler* eh, const iovec* iovec, int count)
@@ -279,10 +285,12 @@ int SocketEngine::Connect(EventHandler* eh, const irc::sockets::sockaddrs& addre
 	return ret;
 }
 
+#ifndef HAS_SOCKETENGINE_IO
 int SocketEngine::Shutdown(EventHandler* eh, int how)
 {
 	return shutdown(eh->GetFd(), how);
 }
+#endif
 
 int SocketEngine::Bind(EventHandler* eh, const irc::sockets::sockaddrs& addr)
 {
@@ -161,8 +161,11 @@ void SocketEngine::DelFd(EventHandler* eh)
 
 int SocketEngine::DispatchEvents()
 {
-	int i = epoll_wait(EngineHandle, events.data(), static_cast<int>(events.size()), 1000);
+	ServerInstance->Profiler.EnterPhase(ProfileManager::PHASE_IDLE);
+	// Don't block if a handler queued a trial read or write while the last events were dispatched.
+	int i = epoll_wait(EngineHandle, events.data(), static_cast<int>(events.size()), trials.empty() ? 1000 : 0);
 	ServerInstance->UpdateTime();
+	ServerInstance->Profiler.EnterPhase(ProfileManager::PHASE_EVENTS);
 
 	stats.TotalEvents += i;
 
@@ -0,0 +1,1224 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+
+#include <csignal>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/** A specialisation of the SocketEngine class, designed to use Linux 5.19+ io_uring.
+ *
+ * Readiness is tracked with one-shot poll requests which are rearmed after every event
+ * so that the level-triggered semantics of the other engines are kept. Changes to these
+ * requests are queued and submitted together with the wait for completions so a loop
+ * iteration needs a single system call no matter how many sockets changed.
+ *
+ * Once a listener or stream socket is read from through the socket engine it is moved
+ * to a multishot accept or a multishot receive into a ring of provided buffers and the
+ * socket engine serves Accept() and Recv() calls from what the kernel completed. Once a
+ * stream socket is written to through the socket engine its writes are buffered and
+ * submitted as a batch at the end of the loop iteration.
+ */
+namespace
+{
+	/** The type of operation a submission was for. Stored in the top byte of the user data. */
+	enum Operation
+		: uint8_t
+	{
+		OP_POLL = 1,
+		OP_ACCEPT,
+		OP_RECV,
+		OP_SEND,
+		OP_IGNORE,
+	};
+
+	/** The number of submission queue entries to request. */
+	const unsigned int QueueDepth = 1024;
+
+	/** The number of buffers in the provided buffer ring. Must be a power of two. */
+	const unsigned int BufferCount = 512;
+
+	/** The size of each buffer in the provided buffer ring. */
+	const unsigned int BufferSize = 16384;
+
+	/** The identifier of the provided buffer group. */
+	const uint16_t BufferGroup = 0;
+
+	/** The amount of received data to hold for a socket before pausing its receive. */
+	const size_t MaxRecvBuffer = 64 * 1024;
+
+	/** The amount of unsent data to hold for a socket before writes report EAGAIN. */
+	const size_t MaxSendBuffer = 128 * 1024;
+
+	/** Per-descriptor state which is kept on top of the reference table. */
+	struct Descriptor final
+	{
+		/** The kind of socket this descriptor refers to. */
+		enum Kind
+			: uint8_t
+		{
+			KIND_UNKNOWN,
+			KIND_STREAM,
+			KIND_OTHER,
+		};
+
+		/** Incremented for every new submission so stale completions can be recognised. */
+		uint32_t serial = 0;
+
+		/** The serial of the event handler currently registered on this descriptor. */
+		uint32_t generation = 0;
+
+		/** The serial of the currently armed poll request. */
+		uint32_t pollserial = 0;
+
+		/** The poll events currently armed in the kernel or 0 if none are. */
+		unsigned int polling = 0;
+
+		/** The poll events which fired and have not been dispatched yet. */
+		unsigned int ready = 0;
+
+		/** Whether this descriptor is in the list of descriptors to rearm. */
+		bool dirty = false;
+
+		/** Whether this descriptor is in the list of descriptors to dispatch. */
+		bool pending = false;
+
+		/** Whether this descriptor is in the list of descriptors to send. */
+		bool flushing = false;
+
+		/** The kind of socket this descriptor refers to. */
+		Kind kind = KIND_UNKNOWN;
+
+		/** Whether Accept() has been called on this descriptor. */
+		bool listening = false;
+
+		/** Whether a multishot accept is armed in the kernel. */
+		bool accepting = false;
+
+		/** Sockets accepted by the kernel which have not been collected yet. */
+		std::deque<int> accepted;
+
+		/** The error which stopped the multishot accept or 0 if there was none. */
+		int accepterror = 0;
+
+		/** Whether Recv() has been called on this descriptor. */
+		bool streaming = false;
+
+		/** Whether a multishot receive is armed in the kernel. */
+		bool receiving = false;
+
+		/** Whether the multishot receive has been asked to stop. */
+		bool cancelling = false;
+
+		/** Whether the peer has closed their side of the connection. */
+		bool eof = false;
+
+		/** The error which stopped the multishot receive or 0 if there was none. */
+		int recverror = 0;
+
+		/** Data received by the kernel which has not been collected yet. */
+		std::string recvq;
+
+		/** The position of the first uncollected byte in recvq. */
+		size_t recvpos = 0;
+
+		/** Whether Send() or WriteV() has been called on this descriptor. */
+		bool buffering = false;
+
+		/** Data written by the event handler which has not been submitted yet. */
+		std::vector<char> sendq;
+
+		/** Data which has been submitted to the kernel. Must not be touched until it completes. */
+		std::vector<char> sending;
+
+		/** The number of bytes of sending which the kernel has already sent. */
+		size_t sendpos = 0;
+
+		/** The error which stopped sending or 0 if there was none. */
+		int senderror = 0;
+
+		/** Retrieves the amount of received data which has not been collected yet. */
+		size_t GetRecvQSize() const { return recvq.length() - recvpos; }
+
+		/** Retrieves the amount of data which has not been sent yet. */
+		size_t GetSendQSize() const { return sendq.size() + sending.size() - sendpos; }
+	};
+
+	/** The file descriptor of the ring. */
+	int EngineHandle = -1;
+
+	/** The memory which the submission and completion queue rings are mapped to. */
+	void* RingMemory = MAP_FAILED;
+	size_t RingMemorySize = 0;
+
+	/** The memory which the submission queue entries are mapped to. */
+	io_uring_sqe* SubmissionEntries = static_cast<io_uring_sqe*>(MAP_FAILED);
+	size_t SubmissionEntriesSize = 0;
+
+	/** Pointers into the submission queue ring. */
+	unsigned* SubmissionHead;
+	unsigned* SubmissionTail;
+	unsigned* SubmissionArray;
+	unsigned SubmissionMask;
+	unsigned SubmissionEntryCount;
+
+	/** The tail of the submission queue which has not been published to the kernel yet. */
+	unsigned SubmissionLocalTail;
+
+	/** Pointers into the completion queue ring. */
+	unsigned* CompletionHead;
+	unsigned* CompletionTail;
+	unsigned CompletionMask;
+	io_uring_cqe* CompletionEntries;
+
+	/** The provided buffer ring and the buffers which it refers to. */
+	io_uring_buf_ring* BufferRing = static_cast<io_uring_buf_ring*>(MAP_FAILED);
+	char* Buffers = static_cast<char*>(MAP_FAILED);
+
+	/** Whether the kernel takes buffers from BufferRing. If not they are provided with submissions. */
+	bool UseBufferRing;
+
+	/** The tail of the provided buffer ring which has not been published to the kernel yet. */
+	uint16_t BufferLocalTail;
+
+	/** Per-descriptor state, indexed by file descriptor. */
+	std::vector<Descriptor> descriptors;
+
+	/** Descriptors which need their poll request rearmed. */
+	std::vector<int> dirty;
+
+	/** Descriptors which have an event that needs dispatching. */
+	std::vector<int> pending;
+
+	/** Descriptors which have data that needs sending. */
+	std::vector<int> flushes;
+
+	/** Buffers belonging to sends which were still in progress when their descriptor was removed. */
+	std::unordered_map<uint64_t, std::vector<char>> orphans;
+
+	inline uint64_t ToUserData(Operation op, int fd, uint32_t serial)
+	{
+		return (uint64_t(op) << 56) | (uint64_t(serial & 0xFFFFFF) << 32) | uint32_t(fd);
+	}
+
+	inline Descriptor* GetDescriptor(int fd)
+	{
+		if (fd < 0 || static_cast<size_t>(fd) >= descriptors.size())
+			return nullptr;
+		return &descriptors[fd];
+	}
+
+	/** Retrieves the state of the descriptor which belongs to the specified event handler. */
+	inline Descriptor* GetDescriptor(EventHandler* eh)
+	{
+		if (SocketEngine::GetRef(eh->GetFd()) != eh)
+			return nullptr;
+		return GetDescriptor(eh->GetFd());
+	}
+
+	/** Checks whether the specified descriptor is a stream socket which can use the ring for I/O. */
+	bool IsStream(int fd, Descriptor& d)
+	{
+		if (d.kind == Descriptor::KIND_UNKNOWN)
+		{
+			int type;
+			socklen_t typelen = sizeof(type);
+			if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &typelen) == 0 && type == SOCK_STREAM)
+				d.kind = Descriptor::KIND_STREAM;
+			else
+				d.kind = Descriptor::KIND_OTHER;
+		}
+		return d.kind == Descriptor::KIND_STREAM;
+	}
+
+	int Enter(unsigned int submit, unsigned int wait, unsigned int flags, void* arg, size_t argsize)
+	{
+		return static_cast<int>(syscall(__NR_io_uring_enter, EngineHandle, submit, wait, flags, arg, argsize));
+	}
+
+	/** Publishes queued submissions to the kernel and optionally waits for a completion.
+	 * @param timeout The number of milliseconds to wait for a completion or 0 to not wait.
+	 */
+	int Submit(long timeout)
+	{
+		__atomic_store_n(SubmissionTail, SubmissionLocalTail, __ATOMIC_RELEASE);
+		const unsigned int submit = SubmissionLocalTail - __atomic_load_n(SubmissionHead, __ATOMIC_ACQUIRE);
+
+		__kernel_timespec ts;
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
+
+		io_uring_getevents_arg arg;
+		memset(&arg, 0, sizeof(arg));
+		arg.sigmask_sz = _NSIG / 8;
+		arg.ts = reinterpret_cast<uintptr_t>(&ts);
+
+		return Enter(submit, timeout ? 1 : 0, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	}
+
+	void Reap();
+
+	/** Retrieves an empty submission queue entry, submitting the queue if it is full. */
+	io_uring_sqe* GetSubmission()
+	{
+		while (SubmissionLocalTail - __atomic_load_n(SubmissionHead, __ATOMIC_ACQUIRE) >= SubmissionEntryCount)
+		{
+			// The kernel refuses new submissions while completions are backed up.
+			if (Submit(0) < 0 && errno == EBUSY)
+				Reap();
+		}
+
+		const unsigned int index = SubmissionLocalTail++ & SubmissionMask;
+		SubmissionArray[index] = index;
+
+		io_uring_sqe* sqe = &SubmissionEntries[index];
+		memset(sqe, 0, sizeof(*sqe));
+		return sqe;
+	}
+
+	/** Gives a buffer back to the kernel after its contents have been copied out. */
+	void ProvideBuffer(uint16_t bid)
+	{
+		if (!UseBufferRing)
+		{
+			io_uring_sqe* sqe = GetSubmission();
+			sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+			sqe->fd = 1;
+			sqe->addr = reinterpret_cast<uintptr_t>(Buffers + size_t(bid) * BufferSize);
+			sqe->len = BufferSize;
+			sqe->off = bid;
+			sqe->buf_group = BufferGroup;
+			sqe->user_data = ToUserData(OP_IGNORE, 0, 0);
+			return;
+		}
+
+		io_uring_buf* buf = &BufferRing->bufs[BufferLocalTail++ & (BufferCount - 1)];
+		buf->addr = reinterpret_cast<uintptr_t>(Buffers + size_t(bid) * BufferSize);
+		buf->len = BufferSize;
+		buf->bid = bid;
+	}
+
+	void MarkDirty(int fd, Descriptor& d)
+	{
+		if (d.dirty)
+			return;
+
+		d.dirty = true;
+		dirty.push_back(fd);
+	}
+
+	void MarkPending(int fd, Descriptor& d)
+	{
+		if (d.pending)
+			return;
+
+		d.pending = true;
+		pending.push_back(fd);
+	}
+
+	void MarkFlush(int fd, Descriptor& d)
+	{
+		if (d.flushing)
+			return;
+
+		d.flushing = true;
+		flushes.push_back(fd);
+	}
+
+	/** Determines which poll events a descriptor needs to have armed for the specified event mask. */
+	unsigned int GetPollEvents(const Descriptor& d, int event_mask)
+	{
+		unsigned int events = 0;
+
+		// Descriptors which are fed by a multishot request do not need to be polled for reads.
+		if ((event_mask & FD_WANT_READ_MASK) && !(event_mask & FD_WANT_NO_READ) && !d.streaming && !d.accepting)
+			events |= POLLIN;
+
+		// Write readiness of buffered descriptors is based on the size of their buffer. For the others
+		// edge-triggered writes are only polled for when the last write returned EAGAIN.
+		if (!d.buffering)
+		{
+			if (event_mask & (FD_WANT_POLL_WRITE | FD_WANT_SINGLE_WRITE))
+				events |= POLLOUT;
+			else if ((event_mask & (FD_WANT_FAST_WRITE | FD_WANT_EDGE_WRITE)) && (event_mask & FD_WRITE_WILL_BLOCK))
+				events |= POLLOUT;
+		}
+		return events;
+	}
+
+	/** Checks whether a buffered descriptor should receive a write event for the specified event mask. */
+	bool WantsBufferedWrite(const Descriptor& d, int event_mask)
+	{
+		if (!d.buffering || d.GetSendQSize() > MaxSendBuffer / 2)
+			return false;
+
+		if (event_mask & (FD_WANT_POLL_WRITE | FD_WANT_SINGLE_WRITE))
+			return true;
+
+		return (event_mask & (FD_WANT_FAST_WRITE | FD_WANT_EDGE_WRITE)) && (event_mask & FD_WRITE_WILL_BLOCK);
+	}
+
+	/** Checks whether a multishot descriptor has something to give to the next read. */
+	bool HasBufferedRead(const Descriptor& d)
+	{
+		if (d.streaming && (d.GetRecvQSize() || d.eof || d.recverror))
+			return true;
+
+		if (d.listening && (!d.accepted.empty() || d.accepterror))
+			return true;
+
+		return false;
+	}
+
+	void ArmAccept(int fd, Descriptor& d)
+	{
+		io_uring_sqe* sqe = GetSubmission();
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = fd;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->user_data = ToUserData(OP_ACCEPT, fd, d.generation);
+		d.accepting = true;
+	}
+
+	void ArmRecv(int fd, Descriptor& d)
+	{
+		io_uring_sqe* sqe = GetSubmission();
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = fd;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = BufferGroup;
+		sqe->user_data = ToUserData(OP_RECV, fd, d.generation);
+		d.receiving = true;
+	}
+
+	void ArmSend(int fd, Descriptor& d)
+	{
+		io_uring_sqe* sqe = GetSubmission();
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = fd;
+		sqe->addr = reinterpret_cast<uintptr_t>(d.sending.data() + d.sendpos);
+		sqe->len = static_cast<uint32_t>(d.sending.size() - d.sendpos);
+		sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+		sqe->user_data = ToUserData(OP_SEND, fd, d.generation);
+	}
+
+	void Cancel(uint64_t user_data)
+	{
+		io_uring_sqe* sqe = GetSubmission();
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = user_data;
+		sqe->user_data = ToUserData(OP_IGNORE, 0, 0);
+	}
+
+	/** Moves the write buffer of a descriptor into the kernel if it is not already sending. */
+	void SendBuffered(int fd, Descriptor& d)
+	{
+		if (!d.sending.empty() || d.sendq.empty() || d.senderror)
+			return;
+
+		std::swap(d.sending, d.sendq);
+		d.sendpos = 0;
+		ArmSend(fd, d);
+	}
+
+	/** Updates the armed poll request of a descriptor to match its event mask. */
+	void Rearm(int fd, Descriptor& d)
+	{
+		EventHandler* eh = SocketEngine::GetRef(fd);
+		const unsigned int events = eh ? GetPollEvents(d, eh->GetEventMask()) : 0;
+		if (events == d.polling)
+			return;
+
+		if (d.polling)
+		{
+			io_uring_sqe* sqe = GetSubmission();
+			sqe->opcode = IORING_OP_POLL_REMOVE;
+			sqe->fd = -1;
+			sqe->addr = ToUserData(OP_POLL, fd, d.pollserial);
+			sqe->user_data = ToUserData(OP_IGNORE, 0, 0);
+		}
+
+		d.polling = events;
+		if (!events)
+			return;
+
+		d.pollserial = ++d.serial;
+		io_uring_sqe* sqe = GetSubmission();
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fd;
+		sqe->poll32_events = events;
+		sqe->user_data = ToUserData(OP_POLL, fd, d.pollserial);
+	}
+
+	/** Queues everything which was changed during this loop iteration. */
+	void PrepareSubmissions()
+	{
+		for (int fd : flushes)
+		{
+			Descriptor& d = descriptors[fd];
+			d.flushing = false;
+			SendBuffered(fd, d);
+		}
+		flushes.clear();
+
+		for (int fd : dirty)
+		{
+			Descriptor& d = descriptors[fd];
+			d.dirty = false;
+			Rearm(fd, d);
+		}
+		dirty.clear();
+	}
+
+	void OnAcceptComplete(int fd, const io_uring_cqe& cqe)
+	{
+		Descriptor& d = descriptors[fd];
+		if (!(cqe.flags & IORING_CQE_F_MORE))
+			d.accepting = false;
+
+		if (cqe.res >= 0)
+		{
+			d.accepted.push_back(cqe.res);
+		}
+		else if (cqe.res != -ECANCELED)
+		{
+			// The multishot accept has terminated so fall back to polling until the next
+			// call to Accept() arms it again.
+			d.accepterror = -cqe.res;
+			MarkDirty(fd, d);
+		}
+		MarkPending(fd, d);
+	}
+
+	void OnRecvComplete(int fd, const io_uring_cqe& cqe)
+	{
+		Descriptor& d = descriptors[fd];
+		const bool more = cqe.flags & IORING_CQE_F_MORE;
+		if (!more)
+			d.receiving = false;
+
+		if (cqe.res > 0)
+		{
+			if (d.recvpos && d.recvpos >= d.recvq.length() / 2)
+			{
+				d.recvq.erase(0, d.recvpos);
+				d.recvpos = 0;
+			}
+
+			const uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+			d.recvq.append(Buffers + size_t(bid) * BufferSize, static_cast<size_t>(cqe.res));
+			ProvideBuffer(bid);
+
+			if (more && !d.cancelling && d.GetRecvQSize() >= MaxRecvBuffer)
+			{
+				// The event handler is not keeping up so stop reading until it catches up. This
+				// leaves the data in the socket receive buffer which applies TCP backpressure.
+				d.cancelling = true;
+				Cancel(ToUserData(OP_RECV, fd, d.generation));
+			}
+		}
+		else if (cqe.res == 0)
+		{
+			d.eof = true;
+		}
+		else if (cqe.res != -ECANCELED && cqe.res != -ENOBUFS)
+		{
+			d.recverror = -cqe.res;
+		}
+
+		if (!d.receiving)
+		{
+			d.cancelling = false;
+
+			// The kernel stops a multishot receive when it runs out of buffers. These were given back
+			// above so it can be resumed straight away if the event handler is keeping up.
+			if (!d.eof && !d.recverror && d.GetRecvQSize() < MaxRecvBuffer)
+				ArmRecv(fd, d);
+		}
+		MarkPending(fd, d);
+	}
+
+	void OnSendComplete(int fd, const io_uring_cqe& cqe)
+	{
+		Descriptor& d = descriptors[fd];
+		if (cqe.res < 0)
+		{
+			d.senderror = -cqe.res;
+			d.sending.clear();
+			d.sendq.clear();
+			d.sendpos = 0;
+		}
+		else
+		{
+			d.sendpos += static_cast<size_t>(cqe.res);
+			if (d.sendpos < d.sending.size())
+			{
+				// The send was interrupted so resubmit the rest of it.
+				ArmSend(fd, d);
+				return;
+			}
+
+			d.sending.clear();
+			d.sendpos = 0;
+			if (!d.sendq.empty())
+				MarkFlush(fd, d);
+		}
+		MarkPending(fd, d);
+	}
+
+	void OnPollComplete(int fd, const io_uring_cqe& cqe)
+	{
+		Descriptor& d = descriptors[fd];
+		d.polling = 0;
+		if (cqe.res > 0)
+		{
+			d.ready |= static_cast<unsigned int>(cqe.res);
+			MarkPending(fd, d);
+		}
+		MarkDirty(fd, d);
+	}
+
+	/** Processes the completions which the kernel has posted. This only updates the engine state
+	 * and never calls into an event handler so it is safe to call from anywhere.
+	 */
+	void Reap()
+	{
+		const uint16_t buftail = BufferLocalTail;
+		for (;;)
+		{
+			// The head is advanced before processing as queueing a submission can reap again.
+			const unsigned int head = *CompletionHead;
+			if (head == __atomic_load_n(CompletionTail, __ATOMIC_ACQUIRE))
+				break;
+
+			const io_uring_cqe cqe = CompletionEntries[head & CompletionMask];
+			__atomic_store_n(CompletionHead, head + 1, __ATOMIC_RELEASE);
+			const Operation op = static_cast<Operation>(cqe.user_data >> 56);
+			const uint32_t serial = (cqe.user_data >> 32) & 0xFFFFFF;
+			const int fd = static_cast<int>(cqe.user_data & 0xFFFFFFFF);
+
+			Descriptor* d = GetDescriptor(fd);
+			bool current = d && SocketEngine::GetRef(fd);
+			if (current)
+				current = serial == ((op == OP_POLL ? d->pollserial : d->generation) & 0xFFFFFF);
+
+			switch (op)
+			{
+				case OP_POLL:
+					if (current)
+						OnPollComplete(fd, cqe);
+					break;
+
+				case OP_ACCEPT:
+					if (current)
+						OnAcceptComplete(fd, cqe);
+					else if (cqe.res >= 0)
+						SocketEngine::Close(cqe.res);
+					break;
+
+				case OP_RECV:
+					if (current)
+						OnRecvComplete(fd, cqe);
+					else if (cqe.flags & IORING_CQE_F_BUFFER)
+						ProvideBuffer(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+					break;
+
+				case OP_SEND:
+					if (current)
+						OnSendComplete(fd, cqe);
+					else
+						orphans.erase(cqe.user_data);
+					break;
+
+				case OP_IGNORE:
+					break;
+			}
+		}
+		if (UseBufferRing && buftail != BufferLocalTail)
+			__atomic_store_n(&BufferRing->tail, BufferLocalTail, __ATOMIC_RELEASE);
+	}
+
+	/** Gives buffered writes a last chance to be sent before a descriptor is shut down. */
+	void FlushNow(int fd, Descriptor& d)
+	{
+		if (!d.buffering || !d.GetSendQSize() || d.senderror)
+			return;
+
+		// Sends which can complete without blocking do so during submission.
+		SendBuffered(fd, d);
+		PrepareSubmissions();
+		Submit(0);
+		Reap();
+
+		// Anything which is still left over gets a best-effort write like the other engines do.
+		if (d.sending.empty() && !d.sendq.empty() && !d.senderror)
+		{
+			ssize_t sent = send(fd, d.sendq.data(), d.sendq.size(), MSG_NOSIGNAL);
+			if (sent > 0)
+				d.sendq.erase(d.sendq.begin(), d.sendq.begin() + sent);
+		}
+	}
+
+	/** Checks whether the kernel hands out buffers from the provided buffer ring. Some kernels accept
+	 * the registration of a ring but then never take buffers from it.
+	 */
+	bool CheckBufferRing()
+	{
+		int sv[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+			return false;
+
+		bool usable = false;
+		if (write(sv[1], "", 1) == 1)
+		{
+			io_uring_sqe* sqe = GetSubmission();
+			sqe->opcode = IORING_OP_RECV;
+			sqe->fd = sv[0];
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = BufferGroup;
+			sqe->user_data = ToUserData(OP_IGNORE, 0, 0);
+			Submit(1000);
+
+			const unsigned int head = *CompletionHead;
+			if (head != __atomic_load_n(CompletionTail, __ATOMIC_ACQUIRE))
+			{
+				const io_uring_cqe cqe = CompletionEntries[head & CompletionMask];
+				__atomic_store_n(CompletionHead, head + 1, __ATOMIC_RELEASE);
+				if (cqe.res == 1 && (cqe.flags & IORING_CQE_F_BUFFER))
+				{
+					usable = true;
+					ProvideBuffer(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+					__atomic_store_n(&BufferRing->tail, BufferLocalTail, __ATOMIC_RELEASE);
+				}
+			}
+		}
+
+		SocketEngine::Close(sv[0]);
+		SocketEngine::Close(sv[1]);
+		return usable;
+	}
+
+	void Teardown()
+	{
+		if (BufferRing != MAP_FAILED)
+			munmap(BufferRing, BufferCount * sizeof(io_uring_buf));
+		if (Buffers != MAP_FAILED)
+			munmap(Buffers, size_t(BufferCount) * BufferSize);
+		if (SubmissionEntries != MAP_FAILED)
+			munmap(SubmissionEntries, SubmissionEntriesSize);
+		if (RingMemory != MAP_FAILED)
+			munmap(RingMemory, RingMemorySize);
+		if (EngineHandle >= 0)
+			SocketEngine::Close(EngineHandle);
+
+		BufferRing = static_cast<io_uring_buf_ring*>(MAP_FAILED);
+		Buffers = static_cast<char*>(MAP_FAILED);
+		SubmissionEntries = static_cast<io_uring_sqe*>(MAP_FAILED);
+		RingMemory = MAP_FAILED;
+		EngineHandle = -1;
+	}
+
+	bool Setup()
+	{
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+		params.cq_entries = QueueDepth * 4;
+		EngineHandle = static_cast<int>(syscall(__NR_io_uring_setup, QueueDepth, &params));
+		if (EngineHandle < 0 && errno == EINVAL)
+		{
+			// Deferred task running needs Linux 6.1 but is only an optimisation.
+			params.flags &= ~(IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN);
+			EngineHandle = static_cast<int>(syscall(__NR_io_uring_setup, QueueDepth, &params));
+		}
+		if (EngineHandle < 0)
+			return false;
+
+		const unsigned int required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+		if ((params.features & required) != required)
+		{
+			errno = ENOSYS;
+			return false;
+		}
+
+		RingMemorySize = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+			params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+		RingMemory = mmap(nullptr, RingMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, EngineHandle, IORING_OFF_SQ_RING);
+		if (RingMemory == MAP_FAILED)
+			return false;
+
+		SubmissionEntriesSize = params.sq_entries * sizeof(io_uring_sqe);
+		SubmissionEntries = static_cast<io_uring_sqe*>(mmap(nullptr, SubmissionEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, EngineHandle, IORING_OFF_SQES));
+		if (SubmissionEntries == MAP_FAILED)
+			return false;
+
+		char* ring = static_cast<char*>(RingMemory);
+		SubmissionHead = reinterpret_cast<unsigned*>(ring + params.sq_off.head);
+		SubmissionTail = reinterpret_cast<unsigned*>(ring + params.sq_off.tail);
+		SubmissionArray = reinterpret_cast<unsigned*>(ring + params.sq_off.array);
+		SubmissionMask = *reinterpret_cast<unsigned*>(ring + params.sq_off.ring_mask);
+		SubmissionEntryCount = params.sq_entries;
+		SubmissionLocalTail = *SubmissionTail;
+
+		CompletionHead = reinterpret_cast<unsigned*>(ring + params.cq_off.head);
+		CompletionTail = reinterpret_cast<unsigned*>(ring + params.cq_off.tail);
+		CompletionMask = *reinterpret_cast<unsigned*>(ring + params.cq_off.ring_mask);
+		CompletionEntries = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+
+		BufferRing = static_cast<io_uring_buf_ring*>(mmap(nullptr, BufferCount * sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		Buffers = static_cast<char*>(mmap(nullptr, size_t(BufferCount) * BufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		if (BufferRing == MAP_FAILED || Buffers == MAP_FAILED)
+			return false;
+
+		io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = reinterpret_cast<uintptr_t>(BufferRing);
+		reg.ring_entries = BufferCount;
+		reg.bgid = BufferGroup;
+		UseBufferRing = syscall(__NR_io_uring_register, EngineHandle, IORING_REGISTER_PBUF_RING, &reg, 1) == 0;
+		if (UseBufferRing)
+		{
+			BufferLocalTail = 0;
+			for (unsigned int bid = 0; bid < BufferCount; ++bid)
+				ProvideBuffer(static_cast<uint16_t>(bid));
+			__atomic_store_n(&BufferRing->tail, BufferLocalTail, __ATOMIC_RELEASE);
+
+			UseBufferRing = CheckBufferRing();
+			if (!UseBufferRing)
+				syscall(__NR_io_uring_register, EngineHandle, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+		}
+
+		if (!UseBufferRing)
+		{
+			// Fall back to giving the buffers to the kernel with a submission.
+			io_uring_sqe* sqe = GetSubmission();
+			sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+			sqe->fd = BufferCount;
+			sqe->addr = reinterpret_cast<uintptr_t>(Buffers);
+			sqe->len = BufferSize;
+			sqe->buf_group = BufferGroup;
+			sqe->user_data = ToUserData(OP_IGNORE, 0, 0);
+		}
+
+		ServerInstance->Logs.Debug("SOCKET", "Receive buffers are provided using {}", UseBufferRing ? "a buffer ring" : "submissions");
+		return true;
+	}
+}
+
+void SocketEngine::Init()
+{
+	LookupMaxFds();
+
+	if (!Setup())
+		InitError();
+}
+
+void SocketEngine::RecoverFromFork()
+{
+	// A ring which only accepts submissions from a single task can not be used after forking so
+	// create a new one and rearm the poll requests of everything which was added before the fork.
+	Teardown();
+	if (!Setup())
+		InitError();
+
+	for (size_t fd = 0; fd < descriptors.size(); ++fd)
+	{
+		Descriptor& d = descriptors[fd];
+		d.polling = 0;
+		d.accepting = d.receiving = d.cancelling = false;
+		if (GetRef(static_cast<int>(fd)))
+			MarkDirty(static_cast<int>(fd), d);
+	}
+}
+
+void SocketEngine::Deinit()
+{
+	for (Descriptor& d : descriptors)
+	{
+		for (int fd : d.accepted)
+			Close(fd);
+		d.accepted.clear();
+	}
+	Teardown();
+}
+
+bool SocketEngine::AddFd(EventHandler* eh, int event_mask)
+{
+	int fd = eh->GetFd();
+	if (!eh->HasFd())
+	{
+		ServerInstance->Logs.Debug("SOCKET", "AddFd out of range: (fd: {})", fd);
+		return false;
+	}
+
+	if (!SocketEngine::AddFdRef(eh))
+	{
+		ServerInstance->Logs.Debug("SOCKET", "Attempt to add duplicate fd: {}", fd);
+		return false;
+	}
+
+	if (static_cast<size_t>(fd) >= descriptors.size())
+		descriptors.resize(std::max<size_t>(fd + 1, descriptors.size() * 2));
+
+	Descriptor& d = descriptors[fd];
+	d.generation = ++d.serial;
+
+	ServerInstance->Logs.Debug("SOCKET", "New file descriptor: {}", fd);
+
+	eh->SetEventMask(event_mask);
+	MarkDirty(fd, d);
+	return true;
+}
+
+void SocketEngine::OnSetEvent(EventHandler* eh, int old_mask, int new_mask)
+{
+	Descriptor* d = GetDescriptor(eh);
+	if (!d)
+		return;
+
+	if (GetPollEvents(*d, old_mask) != GetPollEvents(*d, new_mask))
+		MarkDirty(eh->GetFd(), *d);
+
+	// Events for buffered descriptors are synthesised so the new mask may need one straight away.
+	if (WantsBufferedWrite(*d, new_mask) || (!(new_mask & FD_WANT_NO_READ) && HasBufferedRead(*d)))
+		MarkPending(eh->GetFd(), *d);
+}
+
+void SocketEngine::DelFd(EventHandler* eh)
+{
+	int fd = eh->GetFd();
+	if (!eh->HasFd())
+	{
+		ServerInstance->Logs.Debug("SOCKET", "DelFd out of range: (fd: {})", fd);
+		return;
+	}
+
+	Descriptor* d = GetDescriptor(eh);
+	if (d)
+	{
+		FlushNow(fd, *d);
+
+		// The kernel holds a reference to the socket until everything which uses it has been
+		// cancelled. These are keyed on the user data rather than the descriptor so they can
+		// be batched without affecting a socket which reuses the descriptor.
+		if (d->polling)
+			Cancel(ToUserData(OP_POLL, fd, d->pollserial));
+		if (d->receiving)
+			Cancel(ToUserData(OP_RECV, fd, d->generation));
+		if (!d->sending.empty())
+		{
+			const uint64_t user_data = ToUserData(OP_SEND, fd, d->generation);
+			Cancel(user_data);
+			orphans[user_data] = std::move(d->sending);
+		}
+		if (d->accepting)
+		{
+			// Listeners are often rebound straight away so this can not wait for the next loop.
+			Cancel(ToUserData(OP_ACCEPT, fd, d->generation));
+			Submit(0);
+		}
+
+		for (int afd : d->accepted)
+			Close(afd);
+
+		const uint32_t serial = d->serial;
+		const bool isdirty = d->dirty;
+		const bool ispending = d->pending;
+		const bool isflushing = d->flushing;
+		*d = Descriptor();
+		d->serial = serial;
+		d->dirty = isdirty;
+		d->pending = ispending;
+		d->flushing = isflushing;
+	}
+
+	SocketEngine::DelFdRef(eh);
+
+	ServerInstance->Logs.Debug("SOCKET", "Remove file descriptor: {}", fd);
+}
+
+int SocketEngine::DispatchEvents()
+{
+	PrepareSubmissions();
+
+	ServerInstance->Profiler.EnterPhase(ProfileManager::PHASE_IDLE);
+	// If something is already waiting to be dispatched then just collect whatever has completed.
+	int ret = Submit(pending.empty() && trials.empty() ? 1000 : 0);
+	ServerInstance->UpdateTime();
+	ServerInstance->Profiler.EnterPhase(ProfileManager::PHASE_EVENTS);
+	if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY)
+		ServerInstance->Logs.Debug("SOCKET", "io_uring_enter failed: {}", strerror(errno));
+
+	Reap();
+
+	std::vector<int> working_list;
+	working_list.swap(pending);
+
+	int i = 0;
+	for (int fd : working_list)
+	{
+		Descriptor& d = descriptors[fd];
+		d.pending = false;
+
+		EventHandler* const eh = GetRef(fd);
+		if (!eh)
+		{
+			d.ready = 0;
+			continue;
+		}
+
+		const unsigned int ready = d.ready;
+		d.ready = 0;
+
+		if (ready & POLLHUP)
+		{
+			i++;
+			stats.ErrorEvents++;
+			eh->OnEventHandlerError(0);
+			continue;
+		}
+
+		if ((ready & POLLERR) || d.senderror)
+		{
+			i++;
+			stats.ErrorEvents++;
+			/* Get error number */
+			int errcode = d.senderror;
+			socklen_t codesize = sizeof(int);
+			if (!errcode && getsockopt(fd, SOL_SOCKET, SO_ERROR, &errcode, &codesize) < 0)
+				errcode = errno;
+			eh->OnEventHandlerError(errcode);
+			continue;
+		}
+
+		// The event handlers below may add descriptors which invalidates d.
+		int mask = eh->GetEventMask();
+		const bool readable = !(mask & FD_WANT_NO_READ) && ((ready & POLLIN) || HasBufferedRead(d));
+		const bool writable = (ready & POLLOUT) || WantsBufferedWrite(d, mask);
+		if (!readable && !writable)
+			continue;
+
+		i++;
+		if (readable)
+			mask &= ~FD_READ_WILL_BLOCK;
+		if (writable)
+		{
+			mask &= ~FD_WRITE_WILL_BLOCK;
+			if (mask & FD_WANT_SINGLE_WRITE)
+			{
+				int nm = mask & ~FD_WANT_SINGLE_WRITE;
+				OnSetEvent(eh, mask, nm);
+				mask = nm;
+			}
+		}
+		eh->SetEventMask(mask);
+		if (readable)
+		{
+			eh->OnEventHandlerRead();
+			if (eh != GetRef(fd))
+				// whoa! we got deleted, better not give out the write event
+				continue;
+		}
+		if (writable)
+		{
+			eh->OnEventHandlerWrite();
+			if (eh != GetRef(fd))
+				continue;
+		}
+
+		// Keep level-triggered semantics for data which the event handler did not collect. The
+		// event handler may have added descriptors so this needs to be looked up again.
+		Descriptor& nd = descriptors[fd];
+		if (!(eh->GetEventMask() & FD_WANT_NO_READ) && HasBufferedRead(nd))
+			MarkPending(fd, nd);
+	}
+
+	stats.TotalEvents += i;
+	return i;
+}
+
+int SocketEngine::Accept(EventHandler* eh, sockaddr* addr, socklen_t* addrlen)
+{
+	Descriptor* d = GetDescriptor(eh);
+	if (!d)
+		return accept(eh->GetFd(), addr, addrlen);
+
+	if (!d->accepting && d->accepted.empty())
+	{
+		// Switch this listener to a multishot accept. Anything which is already waiting is
+		// accepted directly as the multishot accept will not be submitted until the end of
+		// the loop iteration.
+		d->listening = true;
+		d->accepterror = 0;
+		ArmAccept(eh->GetFd(), *d);
+		MarkDirty(eh->GetFd(), *d);
+		return accept(eh->GetFd(), addr, addrlen);
+	}
+
+	if (d->accepted.empty())
+	{
+		errno = d->accepterror ? d->accepterror : EAGAIN;
+		d->accepterror = 0;
+		return -1;
+	}
+
+	const int fd = d->accepted.front();
+	d->accepted.pop_front();
+
+	// A multishot accept can not write the peer address anywhere so look it up instead.
+	if (getpeername(fd, addr, addrlen) < 0)
+	{
+		const int error = errno;
+		Close(fd);
+		errno = error;
+		return -1;
+	}
+	return fd;
+}
+
+ssize_t SocketEngine::Send(EventHandler* eh, const void* buf, size_t len, int flags)
+{
+	if (flags)
+	{
+		ssize_t nbSent = send(eh->GetFd(), static_cast<const char*>(buf), len, flags);
+		stats.UpdateWriteCounters(nbSent);
+		return nbSent;
+	}
+
+	IOVector iov;
+	iov.iov_base = const_cast<void*>(buf);
+	iov.iov_len = len;
+	return WriteV(eh, &iov, 1);
+}
+
+ssize_t SocketEngine::Recv(EventHandler* eh, void* buf, size_t len, int flags)
+{
+	Descriptor* d = GetDescriptor(eh);
+	if (!d || flags || !IsStream(eh->GetFd(), *d))
+	{
+		ssize_t nbRecvd = recv(eh->GetFd(), static_cast<char*>(buf), len, flags);
+		stats.UpdateReadCounters(nbRecvd);
+		return nbRecvd;
+	}
+
+	if (!d->streaming)
+	{
+		// Switch this socket to a multishot receive. Anything which is already waiting is
+		// read directly as the multishot receive will not be submitted until the end of the
+		// loop iteration.
+		d->streaming = true;
+		ArmRecv(eh->GetFd(), *d);
+		MarkDirty(eh->GetFd(), *d);
+
+		ssize_t nbRecvd = recv(eh->GetFd(), static_cast<char*>(buf), len, flags);
+		stats.UpdateReadCounters(nbRecvd);
+		return nbRecvd;
+	}
+
+	ssize_t nbRecvd;
+	if (d->GetRecvQSize())
+	{
+		const size_t length = std::min(len, d->GetRecvQSize());
+		memcpy(buf, d->recvq.data() + d->recvpos, length);
+		d->recvpos += length;
+		if (d->recvpos == d->recvq.length())
+		{
+			d->recvq.clear();
+			d->recvpos = 0;
+		}
+		nbRecvd = static_cast<ssize_t>(length);
+	}
+	else if (d->recverror)
+	{
+		errno = d->recverror;
+		nbRecvd = -1;
+	}
+	else if (d->eof)
+	{
+		nbRecvd = 0;
+	}
+	else
+	{
+		errno = EAGAIN;
+		nbRecvd = -1;
+	}
+
+	// Resume receiving if it was paused because the event handler was not keeping up.
+	if (!d->receiving && !d->eof && !d->recverror && !d->GetRecvQSize())
+		ArmRecv(eh->GetFd(), *d);
+
+	stats.UpdateReadCounters(nbRecvd);
+	return nbRecvd;
+}
+
+ssize_t SocketEngine::WriteV(EventHandler* eh, const IOVector* iovec, int count)
+{
+	Descriptor* d = GetDescriptor(eh);
+	if (!d || !IsStream(eh->GetFd(), *d))
+	{
+		ssize_t sent = writev(eh->GetFd(), iovec, count);
+		stats.UpdateWriteCounters(sent);
+		return sent;
+	}
+
+	ssize_t sent;
+	if (d->senderror)
+	{
+		errno = d->senderror;
+		sent = -1;
+	}
+	else if (d->GetSendQSize() >= MaxSendBuffer)
+	{
+		errno = EAGAIN;
+		sent = -1;
+	}
+	else
+	{
+		// Copy as much as fits into the write buffer. This is sent at the end of the loop
+		// iteration together with every other pending submission.
+		d->buffering = true;
+		size_t space = MaxSendBuffer - d->GetSendQSize();
+		size_t copied = 0;
+		for (int j = 0; j < count && space; ++j)
+		{
+			const size_t length = std::min(space, iovec[j].iov_len);
+			const char* data = static_cast<const char*>(iovec[j].iov_base);
+			d->sendq.insert(d->sendq.end(), data, data + length);
+			copied += length;
+			space -= length;
+		}
+		MarkFlush(eh->GetFd(), *d);
+		sent = static_cast<ssize_t>(copied);
+	}
+
+	stats.UpdateWriteCounters(sent);
+	return sent;
+}
+
+int SocketEngine::Shutdown(EventHandler* eh, int how)
+{
+	Descriptor* d = GetDescriptor(eh);
+	if (d)
+		FlushNow(eh->GetFd(), *d);
+	return shutdown(eh->GetFd(), how);
+}
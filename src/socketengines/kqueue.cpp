@@ -164,11 +164,14 @@ int SocketEngine::DispatchEvents()
 {
 	struct timespec ts;
 	ts.tv_nsec = 0;
-	ts.tv_sec = 1;
+	// Don't block if a handler queued a trial read or write while the last events were dispatched.
+	ts.tv_sec = trials.empty() ? 1 : 0;
 
+	ServerInstance->Profiler.EnterPhase(ProfileManager::PHASE_IDLE);
 	int i = kevent(EngineHandle, &changelist.front(), ChangePos, &ke_list.front(), static_cast<int>(ke_list.size()), &ts);
 	ChangePos = 0;
 	ServerInstance->UpdateTime();
+	ServerInstance->Profiler.EnterPhase(ProfileManager::PHASE_EVENTS);
 
 	if (i < 0)
 		return i;
@@ -156,9 +156,12 @@ void SocketEngine::DelFd(EventHandler* eh)
 
 int SocketEngine::DispatchEvents()
 {
-	int i = poll(&events[0], static_cast<unsigned int>(CurrentSetSize), 1000);
+	ServerInstance->Profiler.EnterPhase(ProfileManager::PHASE_IDLE);
+	// Don't block if a handler queued a trial read or write while the last events were dispatched.
+	int i = poll(&events[0], static_cast<unsigned int>(CurrentSetSize), trials.empty() ? 1000 : 0);
 	int processed = 0;
 	ServerInstance->UpdateTime();
+	ServerInstance->Profiler.EnterPhase(ProfileManager::PHASE_EVENTS);
 
 	for (size_t index = 0; index < CurrentSetSize && processed < i; index++)
 	{
@@ -127,13 +127,16 @@ void SocketEngine::OnSetEvent(EventHandler* eh, int old_mask, int new_mask)
 int SocketEngine::DispatchEvents()
 {
 	timeval tval;
-	tval.tv_sec = 1;
+	// Don't block if a handler queued a trial read or write while the last events were dispatched.
+	tval.tv_sec = trials.empty() ? 1 : 0;
 	tval.tv_usec = 0;
 
 	fd_set rfdset = ReadSet, wfdset = WriteSet, errfdset = ErrSet;
 
+	ServerInstance->Profiler.EnterPhase(ProfileManager::PHASE_IDLE);
 	int sresult = select(MaxFD + 1, &rfdset, &wfdset, &errfdset, &tval);
 	ServerInstance->UpdateTime();
+	ServerInstance->Profiler.EnterPhase(ProfileManager::PHASE_EVENTS);
 
 	for (int i = 0, j = sresult; i <= MaxFD && j > 0; i++)
 	{
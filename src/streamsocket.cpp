@@ -121,6 +121,7 @@ void StreamSocket::Close()
 		SocketEngine::Shutdown(this, 2);
 		SocketEngine::Close(this);
 	}
+	UpdateQueueStats();
 }
 
 void StreamSocket::Close(bool writeblock)
@@ -143,7 +144,7 @@ ssize_t StreamSocket::HookChainRead(IOHook* hook, std::string& rq)
 		return ReadToRecvQ(rq);
 
 	IOHookMiddle* const iohm = IOHookMiddle::ToMiddleHook(hook);
-	if (iohm)
+	if (iohm && !iohm->HasPendingRead())
 	{
 		// Call the next hook to put data into the recvq of the current hook
 		const ssize_t ret = HookChainRead(iohm->GetNextHook(), iohm->GetRecvQ());
@@ -220,6 +221,8 @@ void StreamSocket::DoWrite()
 	{
 		if (closeonempty)
 			Close();
+		else
+			UpdateQueueStats();
 
 		return;
 	}
@@ -261,6 +264,8 @@ void StreamSocket::DoWrite()
 
 	if (GetSendQSize() == 0 && closeonempty)
 		Close();
+	else
+		UpdateQueueStats();
 }
 
 void StreamSocket::FlushSendQ(SendQueue& sq)
@@ -351,18 +356,46 @@ void StreamSocket::FlushSendQ(SendQueue& sq)
 }
 
 void StreamSocket::WriteData(const std::string& data)
+{
+	if (QueueData(data))
+		ServerInstance->Stats.SendQCopied += data.length();
+}
+
+void StreamSocket::WriteData(const SendQueue::Element& data)
+{
+	if (QueueData(data))
+		ServerInstance->Stats.SendQShared += data.length();
+}
+
+void StreamSocket::UpdateQueueStats()
+{
+	// A closed socket will never send or process its queues so they no longer count.
+	const size_t newsendq = closing ? 0 : GetSendQSize();
+	const size_t newrecvq = closing ? 0 : recvq.length();
+
+	// These are unsigned so this works even if the queues have shrunk.
+	ServerInstance->Stats.SendQ += newsendq - statsendq;
+	ServerInstance->Stats.RecvQ += newrecvq - statrecvq;
+	statsendq = newsendq;
+	statrecvq = newrecvq;
+}
+
+bool StreamSocket::QueueData(const SendQueue::Element& data)
 {
 	if (!HasFd())
 	{
 		ServerInstance->Logs.Debug("SOCKET", "Attempt to write data to dead socket: {}",
-			data);
-		return;
+			std::string_view(data));
+		return false;
 	}
 
 	/* Append the data to the back of the queue ready for writing */
 	sendq.push_back(data);
+	statsendq += data.length();
+	ServerInstance->Stats.SendQ += data.length();
 
 	SocketEngine::ChangeEventMask(this, FD_ADD_TRIAL_WRITE);
+	return true;
 }
 
 bool SocketTimeout::Tick()
@@ -402,7 +435,10 @@ void BufferedSocket::OnEventHandlerWrite()
 	{
 		state = I_CONNECTED;
 		this->OnConnected();
-		if (!GetIOHook())
+
+		// Hooks which talk to the socket directly (e.g. TLS) manage the event mask themselves.
+		IOHook* const lasthook = GetLastHook();
+		if (!lasthook || IOHookMiddle::ToMiddleHook(lasthook))
 			SocketEngine::ChangeEventMask(this, FD_WANT_FAST_READ | FD_WANT_EDGE_WRITE);
 	}
 	this->StreamSocket::OnEventHandlerWrite();
@@ -463,6 +499,7 @@ void StreamSocket::OnEventHandlerRead()
 			GetFd(), ex.GetReason());
 		SetError(ex.GetReason());
 	}
+	UpdateQueueStats();
 	CheckError(I_ERR_OTHER);
 }
 
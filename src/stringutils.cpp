@@ -189,6 +189,70 @@ std::string Base64::Decode(const void* data, size_t length, const char* table)
 	return buffer;
 }
 
+size_t UTF8::Validate(const void* data, size_t length)
+{
+	const auto* str = static_cast<const unsigned char*>(data);
+	size_t pos = 0;
+	while (pos < length)
+	{
+		// Skip over ASCII 16 bytes at a time as it is by far the most common.
+		for (uint64_t first, second; length - pos >= 16; pos += 16)
+		{
+			memcpy(&first, str + pos, sizeof(first));
+			memcpy(&second, str + pos + sizeof(first), sizeof(second));
+			if ((first | second) & UINT64_C(0x8080808080808080))
+				break;
+		}
+
+		if (pos >= length)
+			break;
+
+		const unsigned char chr = str[pos];
+		if (chr < 0x80)
+		{
+			pos++;
+			continue;
+		}
+
+		// The range of the second byte is narrower for some lead bytes to reject overlong
+		// encodings, UTF-16 surrogates, and code points above U+10FFFF.
+		size_t seqlen;
+		unsigned char min = 0x80;
+		unsigned char max = 0xBF;
+		if (chr >= 0xC2 && chr <= 0xDF)
+			seqlen = 2;
+		else if (chr >= 0xE0 && chr <= 0xEF)
+		{
+			seqlen = 3;
+			if (chr == 0xE0)
+				min = 0xA0;
+			else if (chr == 0xED)
+				max = 0x9F;
+		}
+		else if (chr >= 0xF0 && chr <= 0xF4)
+		{
+			seqlen = 4;
+			if (chr == 0xF0)
+				min = 0x90;
+			else if (chr == 0xF4)
+				max = 0x8F;
+		}
+		else
+			return pos;
+
+		if (length - pos < seqlen || str[pos + 1] < min || str[pos + 1] > max)
+			return pos;
+
+		for (size_t idx = 2; idx < seqlen; ++idx)
+		{
+			if ((str[pos + idx] & 0xC0) != 0x80)
+				return pos;
+		}
+		pos += seqlen;
+	}
+	return length;
+}
+
 std::string Template::Replace(const std::string& str, const VariableMap& vars)
 {
 	std::string out;
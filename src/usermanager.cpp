@@ -120,6 +120,46 @@ namespace
 	}
 }
 
+int UserIndex::CompareReversed(const std::string_view& lhs, const std::string_view& rhs)
+{
+	auto lit = lhs.rbegin();
+	auto rit = rhs.rbegin();
+	for (; lit != lhs.rend() && rit != rhs.rend(); ++lit, ++rit)
+	{
+		const unsigned char lchr = ascii_case_insensitive_map[static_cast<unsigned char>(*lit)];
+		const unsigned char rchr = ascii_case_insensitive_map[static_cast<unsigned char>(*rit)];
+		if (lchr != rchr)
+			return lchr < rchr ? -1 : 1;
+	}
+	return lhs.size() == rhs.size() ? 0 : (lhs.size() < rhs.size() ? -1 : 1);
+}
+
+int UserIndex::CompareAddress(const irc::sockets::cidr_mask& lhs, const irc::sockets::cidr_mask& rhs)
+{
+	if (lhs.type != rhs.type)
+		return lhs.type < rhs.type ? -1 : 1;
+	return memcmp(lhs.bits, rhs.bits, sizeof(lhs.bits));
+}
+
+void UserIndex::Add(User* user)
+{
+	if (IS_SERVER(user) || !user->IsFullyConnected() || user->quitting)
+		return;
+
+	displayedhosts.insert(user);
+	realhosts.insert(user);
+	addresses.insert(user);
+	servers.insert(user);
+}
+
+void UserIndex::Remove(User* user)
+{
+	displayedhosts.erase(user);
+	realhosts.erase(user);
+	addresses.erase(user);
+	servers.erase(user);
+}
+
 UserManager::UserManager()
 {
 	// We need to define a constructor here to work around a Clang bug.
@@ -203,6 +243,7 @@ void UserManager::AddUser(int socket, ListenSocket* via, const irc::sockets::soc
 		{
 			/* user banned */
 			ServerInstance->Logs.Debug("BANCACHE", "Positive hit for " + New->GetAddress());
+			ServerInstance->XLines->AddHit(b->Type);
 
 			if (!ServerInstance->Config->XLineMessage.empty())
 				New->WriteNumeric(ERR_YOUREBANNEDCREEP, ServerInstance->Config->XLineMessage);
@@ -313,6 +354,7 @@ void UserManager::QuitUser(User* user, const std::string& quitmessage, const std
 		ServerInstance->Logs.Debug("USERS", "BUG: Nick not found in clientlist, cannot remove: " + user->nick);
 
 	uuidlist.erase(user->uuid);
+	index.Remove(user);
 	user->PurgeEmptyChannels();
 	user->OperLogout();
 }
@@ -382,6 +424,7 @@ void UserManager::DoBackgroundUserStuff()
 			else
 				curr->CommandFloodPenalty = 0;
 			curr->eh.OnDataReady();
+			curr->eh.UpdateQueueStats();
 		}
 
 		switch (curr->connected)
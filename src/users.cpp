@@ -240,28 +240,24 @@ void UserIOHandler::OnDataReady()
 	if (!user->HasPrivPermission("users/flood/no-fakelag"))
 		penaltymax = user->GetClass()->penaltythreshold * 1000;
 
-	// The cleaned message sent by the user or empty if not found yet.
-	std::string line;
-
-	// The position of the most \n character or npos if not found yet.
-	std::string::size_type eolpos;
-
-	// The position within the recvq of the current character.
-	std::string::size_type qpos;
+	// The position within the recvq of the start of the current line.
+	std::string::size_type linestart = 0;
 
 	while (user->CommandFloodPenalty < penaltymax && GetSendQSize() < sendqmax)
 	{
 		// Check the newly received data for an EOL.
-		eolpos = recvq.find('\n', checked_until);
+		const std::string::size_type eolpos = recvq.find('\n', std::max(linestart, checked_until));
 		if (eolpos == std::string::npos)
 		{
 			checked_until = recvq.length();
-			return;
+			break;
 		}
 
-		// We've found a line! Clean it up and move it to the line buffer.
-		line.reserve(eolpos);
-		for (qpos = 0; qpos < eolpos; ++qpos)
+		// We've found a line! Clean it up in place. This never makes the line
+		// longer so we can overwrite the part of the recvq we have consumed.
+		char* line = &recvq[linestart];
+		size_t linelen = 0;
+		for (std::string::size_type qpos = linestart; qpos < eolpos; ++qpos)
 		{
 			char c = recvq[qpos];
 			switch (c)
@@ -273,48 +269,76 @@ void UserIOHandler::OnDataReady()
 					continue;
 			}
 
-			line.push_back(c);
+			line[linelen++] = c;
 		}
 
-		// just found a newline. Terminate the string, and pull it out of recvq
-		recvq.erase(0, eolpos + 1);
-		checked_until = 0;
-
 		// TODO should this be moved to when it was inserted in recvq?
-		ServerInstance->Stats.Recv += qpos;
-		user->bytes_in += qpos;
+		ServerInstance->Stats.Recv += eolpos - linestart;
+		user->bytes_in += eolpos - linestart;
 		user->cmds_in++;
 
-		ServerInstance->Parser.ProcessBuffer(user, line);
+		// Skip past the line but leave it in the recvq until we are done with
+		// the read event so we don't have to move the rest of the buffer for
+		// every line that a pipelining client sends.
+		linestart = eolpos + 1;
+
+		ServerInstance->Parser.ProcessBuffer(user, std::string_view(line, linelen));
 		if (user->quitting)
 			return;
+	}
 
-		// clear() does not reclaim memory associated with the string, so our .reserve() call is safe
-		line.clear();
+	// Remove all of the lines we processed at once.
+	if (linestart)
+	{
+		recvq.erase(0, linestart);
+		checked_until = checked_until > linestart ? checked_until - linestart : 0;
 	}
 
 	if (user->CommandFloodPenalty >= penaltymax && !user->GetClass()->fakelag)
 		ServerInstance->Users.QuitUser(user, "Excess Flood");
 }
 
-void UserIOHandler::AddWriteBuf(const std::string& data)
+bool UserIOHandler::CanAddWriteBuf(size_t length)
 {
 	if (user->quitting_sendq)
-		return;
+		return false;
 
 	if (!user->quitting
-		&& (user->GetClass() && GetSendQSize() + data.length() > user->GetClass()->hardsendqmax)
+		&& (user->GetClass() && GetSendQSize() + length > user->GetClass()->hardsendqmax)
 		&& !user->HasPrivPermission("users/flood/increased-buffers"))
 	{
 		user->quitting_sendq = true;
 		ServerInstance->GlobalCulls.AddSQItem(user);
-		return;
+		return false;
 	}
 
 	// We still want to append data to the sendq of a quitting user,
 	// e.g. their ERROR message that says 'closing link'
+	return true;
+}
 
-	WriteData(data);
+void UserIOHandler::AddWriteBuf(const std::string& data)
+{
+	if (CanAddWriteBuf(data.length()))
+		WriteData(data);
+}
+
+void UserIOHandler::AddWriteBuf(const StreamSocket::SendQueue::Element& data)
+{
+	if (CanAddWriteBuf(data.length()))
+		WriteData(data);
+}
+
+void UserIOHandler::AddWriteBuf(const ClientProtocol::SerializedMessage& data)
+{
+	if (!CanAddWriteBuf(data.length()))
+		return;
+
+	// The tags and the body are queued as separate buffers so that the body
+	// can be shared with users who receive different tags.
+	if (data.tags)
+		WriteData(data.tags);
+	WriteData(data.body);
 }
 
 bool UserIOHandler::OnChangeLocalSocketAddress(const irc::sockets::sockaddrs& sa)
@@ -491,6 +515,7 @@ void LocalUser::FullConnect()
 	if (ServerInstance->Users.unknown_count)
 		ServerInstance->Users.unknown_count--;
 	this->connected = CONN_FULL;
+	ServerInstance->Users.GetIndex().Add(this);
 
 	FOREACH_MOD(OnPostConnect, (this));
 
@@ -512,6 +537,15 @@ void User::InvalidateCache()
 	cached_realuserhost.clear();
 	cached_mask.clear();
 	cached_realmask.clear();
+
+	// Bans are matched against the details above.
+	ResetBanCache();
+}
+
+void User::ResetBanCache()
+{
+	for (auto* memb : chans)
+		memb->banned.reset();
 }
 
 bool User::ChangeNick(const std::string& newnick, time_t newts)
@@ -618,7 +652,10 @@ irc::sockets::cidr_mask User::GetCIDRMask() const
 void User::ChangeRemoteAddress(const irc::sockets::sockaddrs& sa)
 {
 	const std::string oldip(client_sa.family() == AF_UNSPEC ? "" : GetAddress());
+	UserIndex& index = ServerInstance->Users.GetIndex();
+	index.Remove(this);
 	memcpy(&client_sa, &sa, sizeof(irc::sockets::sockaddrs));
+	index.Add(this);
 	this->InvalidateCache();
 
 	// If the users hostname was their IP then update it.
@@ -647,20 +684,19 @@ bool LocalUser::FindConnectClass()
 	ServerInstance->Logs.Debug("CONNECTCLASS", "Finding a connect class for {} ({}) ...",
 		uuid, GetRealMask());
 
+	// Only check the classes which the index says the user might match. These are in the
+	// same order as in the config so the class chosen is the same as checking every class.
+	ConnectClassIndex::ClassList candidates;
+	ServerInstance->Config->ClassIndex.Find(this, candidates);
+	ServerInstance->Logs.Debug("CONNECTCLASS", "{} of {} connect classes might be suitable for {} ({}).",
+		candidates.size(), ServerInstance->Config->ClassIndex.size(), uuid, GetRealMask());
+
 	std::optional<Numeric::Numeric> errnum;
-	for (const auto& klass : ServerInstance->Config->Classes)
+	for (const auto& klass : candidates)
 	{
 		ServerInstance->Logs.Debug("CONNECTCLASS", "Checking the {} connect class ...",
 			klass->GetName());
 
-		// Users can not be automatically assigned to a named class.
-		if (klass->type == ConnectClass::NAMED)
-		{
-			ServerInstance->Logs.Debug("CONNECTCLASS", "The {} connect class is not suitable as neither <connect:allow> nor <connect:deny> are set.",
-				klass->GetName());
-			continue;
-		}
-
 		ModResult modres;
 		FIRST_MOD_RESULT(OnPreChangeConnectClass, modres, (this, klass, errnum));
 		if (modres != MOD_RES_DENY)
@@ -707,13 +743,14 @@ void LocalUser::ChangeConnectClass(const std::shared_ptr<ConnectClass>& klass, b
 	FOREACH_MOD(OnPostChangeConnectClass, (this, force));
 }
 
-void LocalUser::Write(const ClientProtocol::SerializedMessage& text)
+void LocalUser::Write(const ClientProtocol::SerializedMessage& serialized)
 {
 	if (!eh.HasFd())
 		return;
 
 	if (ServerInstance->Config->RawLog)
 	{
+		const std::string& text = *serialized.body;
 		if (text.empty())
 			return;
 
@@ -721,12 +758,13 @@ void LocalUser::Write(const ClientProtocol::SerializedMessage& text)
 		if (nlpos == std::string::npos)
 			nlpos = text.length();
 
-		ServerInstance->Logs.RawIO("USEROUTPUT", "C[{}] O {}", uuid, std::string_view(text.c_str(), nlpos));
+		ServerInstance->Logs.RawIO("USEROUTPUT", "C[{}] O {}{}", uuid, serialized.tags ? *serialized.tags : "",
+			std::string_view(text.c_str(), nlpos));
 	}
 
-	eh.AddWriteBuf(text);
+	eh.AddWriteBuf(serialized);
 
-	const size_t bytessent = text.length() + 2;
+	const size_t bytessent = serialized.length() + 2;
 	ServerInstance->Stats.Sent += bytessent;
 	this->bytes_out += bytessent;
 	this->cmds_out++;
@@ -913,6 +951,9 @@ void User::ChangeRealName(const std::string& real)
 
 	this->realname.assign(real, 0, ServerInstance->Config->Limits.MaxReal);
 	this->realname.shrink_to_fit();
+
+	// Extbans can match the real name of a user.
+	ResetBanCache();
 }
 
 void User::ChangeDisplayedHost(const std::string& newhost)
@@ -922,11 +963,14 @@ void User::ChangeDisplayedHost(const std::string& newhost)
 
 	FOREACH_MOD(OnChangeHost, (this, newhost));
 
+	UserIndex& index = ServerInstance->Users.GetIndex();
+	index.Remove(this);
 	if (realhost == newhost)
 		this->displayhost.clear();
 	else
 		this->displayhost.assign(newhost, 0, ServerInstance->Config->Limits.MaxHost);
 	this->displayhost.shrink_to_fit();
+	index.Add(this);
 
 	this->InvalidateCache();
 
@@ -942,6 +986,11 @@ void User::ChangeRealHost(const std::string& newhost, bool resetdisplay)
 	if (!changehost && !resetdisplay)
 		return;
 
+	// The index is ordered by hostname so the user has to be removed
+	// from it while the hostname is changed.
+	UserIndex& index = ServerInstance->Users.GetIndex();
+	index.Remove(this);
+
 	// If the displayhost is not set and we are not resetting it then
 	// we need to copy it to the displayhost field.
 	if (displayhost.empty() && !resetdisplay)
@@ -956,6 +1005,7 @@ void User::ChangeRealHost(const std::string& newhost, bool resetdisplay)
 	// do anything else.
 	if (!changehost)
 	{
+		index.Add(this);
 		InvalidateCache();
 		return;
 	}
@@ -965,8 +1015,12 @@ void User::ChangeRealHost(const std::string& newhost, bool resetdisplay)
 	if (!initializing)
 		FOREACH_MOD(OnChangeRealHost, (this, newhost));
 
+	// A module may have changed the displayed host during the event which
+	// will have added the user back to the index.
+	index.Remove(this);
 	realhost = newhost;
 	realhost.shrink_to_fit();
+	index.Add(this);
 
 	this->InvalidateCache();
 
@@ -1154,6 +1208,212 @@ void ConnectClass::Update(const std::shared_ptr<ConnectClass>& src)
 	uniqueusername = src->uniqueusername;
 }
 
+namespace
+{
+	/** The kinds of mask which a connect class can be indexed by. */
+	enum class ConnectMaskType
+	{
+		/** The mask is an IP address or CIDR range. */
+		CIDR,
+
+		/** The mask is a hostname without any wildcards. */
+		HOST,
+
+		/** The mask is a hostname suffix in the format *.example.com. */
+		SUFFIX,
+
+		/** The mask can not be indexed. */
+		OTHER
+	};
+
+	/** Folds the case of a string in the same way as the matcher used for connect class hosts. */
+	std::string FoldConnectHost(const std::string& str, const unsigned char* map)
+	{
+		std::string out(str);
+		for (auto& chr : out)
+			chr = static_cast<char>(map[static_cast<unsigned char>(chr)]);
+		return out;
+	}
+
+	/** Builds the key of a CIDR mask in the CIDR index. */
+	std::string GetConnectCIDRKey(const irc::sockets::cidr_mask& cidr)
+	{
+		std::string key(reinterpret_cast<const char*>(cidr.bits), sizeof(cidr.bits));
+		key.push_back(static_cast<char>(cidr.type));
+		return key;
+	}
+
+	/** Works out how a connect class host mask should be indexed.
+	 * @param mask The mask to index.
+	 * @param map The case insensitivity map to fold hostnames with.
+	 * @param key The location to store the key of the mask.
+	 * @param length The location to store the prefix length if the mask is indexed as a CIDR range.
+	 * @return The kind of mask that was found.
+	 */
+	ConnectMaskType ClassifyConnectMask(const std::string& mask, const unsigned char* map, std::string& key, unsigned char& length)
+	{
+		// Masks in the format user@host are treated specially by irc::sockets::MatchCIDR.
+		if (mask.empty() || mask.find('@') != std::string::npos)
+			return ConnectMaskType::OTHER;
+
+		const std::string::size_type wildpos = mask.find_first_of("*?");
+		if (wildpos == std::string::npos)
+		{
+			const std::string::size_type slashpos = mask.rfind('/');
+			if (mask.find_first_not_of("0123456789abcdefABCDEF.:/") == std::string::npos)
+			{
+				// The mask might be an IP address or CIDR range. Only treat it as such
+				// if it would be treated as one by irc::sockets::MatchCIDR.
+				if (slashpos != std::string::npos && (slashpos == mask.length() - 1 || slashpos != mask.find('/')
+					|| mask.find_first_not_of("0123456789", slashpos + 1) != std::string::npos))
+				{
+					return ConnectMaskType::OTHER;
+				}
+
+				irc::sockets::sockaddrs sa(false);
+				if (sa.from_ip(mask.substr(0, slashpos)))
+				{
+					const irc::sockets::cidr_mask cidr(mask);
+					key = GetConnectCIDRKey(cidr);
+					length = cidr.length;
+					return ConnectMaskType::CIDR;
+				}
+			}
+
+			if (slashpos != std::string::npos)
+				return ConnectMaskType::OTHER;
+
+			key = FoldConnectHost(mask, map);
+			return ConnectMaskType::HOST;
+		}
+
+		if (wildpos == 0 && mask.length() > 2 && mask[1] == '.' && mask.find_first_of("*?", 1) == std::string::npos)
+		{
+			key = FoldConnectHost(mask.substr(1), map);
+			return ConnectMaskType::SUFFIX;
+		}
+
+		return ConnectMaskType::OTHER;
+	}
+}
+
+void ConnectClassIndex::Build(const ClassList& newclasses)
+{
+	// Named classes are only ever assigned explicitly so there is no need to index them.
+	classes.clear();
+	for (const auto& klass : newclasses)
+	{
+		if (klass->type != ConnectClass::NAMED)
+			classes.push_back(klass);
+	}
+	Rebuild();
+}
+
+void ConnectClassIndex::Rebuild()
+{
+	casemap = national_case_insensitive_map;
+	cidrclasses.clear();
+	hostclasses.clear();
+	suffixclasses.clear();
+	otherclasses.clear();
+
+	for (size_t pos = 0; pos < classes.size(); ++pos)
+	{
+		for (const auto& mask : classes[pos]->GetHosts())
+		{
+			std::string key;
+			unsigned char length = 0;
+			switch (ClassifyConnectMask(mask, casemap, key, length))
+			{
+				case ConnectMaskType::CIDR:
+					cidrclasses[length][key].push_back(pos);
+					break;
+
+				case ConnectMaskType::HOST:
+					hostclasses[key].push_back(pos);
+					break;
+
+				case ConnectMaskType::SUFFIX:
+					suffixclasses[key].push_back(pos);
+					break;
+
+				case ConnectMaskType::OTHER:
+					otherclasses.push_back(pos);
+					break;
+			}
+		}
+	}
+}
+
+void ConnectClassIndex::FindAddress(const irc::sockets::sockaddrs& sa, PositionList& positions) const
+{
+	if (sa.family() != AF_INET && sa.family() != AF_INET6)
+		return;
+
+	for (const auto& [length, lines] : cidrclasses)
+	{
+		auto iter = lines.find(GetConnectCIDRKey(irc::sockets::cidr_mask(sa, length)));
+		if (iter != lines.end())
+			positions.insert(positions.end(), iter->second.begin(), iter->second.end());
+	}
+}
+
+void ConnectClassIndex::FindHost(const std::string& host, PositionList& positions) const
+{
+	const std::string foldedhost = FoldConnectHost(host, casemap);
+	auto iter = hostclasses.find(foldedhost);
+	if (iter != hostclasses.end())
+		positions.insert(positions.end(), iter->second.begin(), iter->second.end());
+
+	if (suffixclasses.empty())
+		return;
+
+	for (std::string::size_type dotpos = foldedhost.find('.'); dotpos != std::string::npos; dotpos = foldedhost.find('.', dotpos + 1))
+	{
+		iter = suffixclasses.find(foldedhost.substr(dotpos));
+		if (iter != suffixclasses.end())
+			positions.insert(positions.end(), iter->second.begin(), iter->second.end());
+	}
+}
+
+void ConnectClassIndex::Find(LocalUser* user, ClassList& candidates)
+{
+	// The hostname keys need to be rebuilt if a module has changed the case mapping.
+	if (casemap != national_case_insensitive_map)
+		Rebuild();
+
+	PositionList positions(otherclasses);
+	FindAddress(user->client_sa, positions);
+	FindHost(user->GetRealHost(), positions);
+
+	// Classes are matched against both the hostname and the IP address so if the
+	// hostname is a different IP address or the address is matched as text we
+	// need to look both of them up.
+	const std::string& address = user->GetAddress();
+	if (user->GetRealHost() != address)
+	{
+		irc::sockets::sockaddrs sa(false);
+		if (!cidrclasses.empty() && sa.from_ip(user->GetRealHost()))
+			FindAddress(sa, positions);
+		FindHost(address, positions);
+	}
+
+	std::sort(positions.begin(), positions.end());
+	positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+
+	const in_port_t port = user->server_sa.port();
+	for (const auto pos : positions)
+	{
+		// The port is checked after the password so a class with a password is still a
+		// candidate in order to tell the user that their password is wrong.
+		const std::shared_ptr<ConnectClass>& klass = classes[pos];
+		if (klass->password.empty() && !klass->ports.empty() && !klass->ports.count(port))
+			continue;
+
+		candidates.push_back(klass);
+	}
+}
+
 AwayState::AwayState(const std::string& m, time_t t)
 	: message(m, 0, ServerInstance->Config->Limits.MaxAway)
 	, time(t ? t : ServerInstance->Time())
@@ -130,6 +130,274 @@ public:
 	}
 };
 
+/** Indexes the lines of a single type by the host or IP address mask they match against.
+ * Lines which match an IP address or CIDR range, an exact hostname, or a hostname suffix
+ * (e.g. *.example.com) can be found with a few hash lookups. Any other lines are kept in
+ * a residual list which is checked in full.
+ */
+class XLineIndex final
+{
+public:
+	/** A list of lines stored in the index. */
+	typedef std::vector<XLine*> LineList;
+
+private:
+	/** The kinds of mask which a line can be indexed by. */
+	enum MaskType
+	{
+		/** The mask is an IP address or CIDR range. */
+		MASK_CIDR,
+
+		/** The mask is a hostname without any wildcards. */
+		MASK_HOST,
+
+		/** The mask is a hostname suffix in the format *.example.com. */
+		MASK_SUFFIX,
+
+		/** The mask can not be indexed. */
+		MASK_OTHER
+	};
+
+	/** A map of lines keyed by a string. */
+	typedef std::unordered_map<std::string, LineList> LineMap;
+
+	/** Lines which match an IP address or CIDR range, keyed by prefix length and then by
+	 * the masked address.
+	 */
+	std::map<unsigned char, LineMap> cidrlines;
+
+	/** Lines which match an exact hostname, keyed by the lowercase hostname. */
+	LineMap hostlines;
+
+	/** Lines which match a hostname suffix, keyed by the lowercase suffix including the leading dot. */
+	LineMap suffixlines;
+
+	/** Lines which can not be indexed. */
+	LineList otherlines;
+
+	/** Retrieves the host or IP address mask which a line matches against.
+	 * @param line The line to get the mask of.
+	 * @param mask The location to store the mask.
+	 * @return True if the line has a mask that can be indexed; otherwise, false.
+	 */
+	static bool GetMask(XLine* line, std::string& mask)
+	{
+		// These types are always created by the core factories.
+		if (line->type == "G")
+			mask = static_cast<GLine*>(line)->hostmask;
+		else if (line->type == "K")
+			mask = static_cast<KLine*>(line)->hostmask;
+		else if (line->type == "E")
+			mask = static_cast<ELine*>(line)->hostmask;
+		else if (line->type == "Z")
+			mask = static_cast<ZLine*>(line)->ipaddr;
+		else
+			return false;
+		return true;
+	}
+
+	/** Converts a string to lowercase in the same way as the matcher used by the lines. */
+	static std::string ToLower(const std::string& str)
+	{
+		std::string out(str);
+		for (auto& chr : out)
+			chr = static_cast<char>(ascii_case_insensitive_map[static_cast<unsigned char>(chr)]);
+		return out;
+	}
+
+	/** Builds the key of a CIDR mask in the CIDR index. */
+	static std::string GetCIDRKey(const irc::sockets::cidr_mask& cidr)
+	{
+		std::string key(reinterpret_cast<const char*>(cidr.bits), sizeof(cidr.bits));
+		key.push_back(static_cast<char>(cidr.type));
+		return key;
+	}
+
+	/** Works out how a line should be indexed.
+	 * @param line The line to index.
+	 * @param key The location to store the key of the line.
+	 * @param length The location to store the prefix length if the line is indexed as a CIDR range.
+	 * @return The kind of mask the line matches against.
+	 */
+	static MaskType Classify(XLine* line, std::string& key, unsigned char& length)
+	{
+		std::string mask;
+		if (!GetMask(line, mask) || mask.empty())
+			return MASK_OTHER;
+
+		const std::string::size_type wildpos = mask.find_first_of("*?");
+		if (wildpos == std::string::npos)
+		{
+			const std::string::size_type slashpos = mask.rfind('/');
+			if (mask.find_first_not_of("0123456789abcdefABCDEF.:/") == std::string::npos)
+			{
+				// The mask might be an IP address or CIDR range. Only treat it as such
+				// if it would be treated as one by irc::sockets::MatchCIDR.
+				if (slashpos != std::string::npos && (slashpos == mask.length() - 1 || slashpos != mask.find('/')
+					|| mask.find_first_not_of("0123456789", slashpos + 1) != std::string::npos))
+				{
+					return MASK_OTHER;
+				}
+
+				irc::sockets::sockaddrs sa(false);
+				if (sa.from_ip(mask.substr(0, slashpos)))
+				{
+					const irc::sockets::cidr_mask cidr(mask);
+					key = GetCIDRKey(cidr);
+					length = cidr.length;
+					return MASK_CIDR;
+				}
+			}
+
+			if (mask.find('/') != std::string::npos)
+				return MASK_OTHER;
+
+			key = ToLower(mask);
+			return MASK_HOST;
+		}
+
+		if (wildpos == 0 && mask.length() > 2 && mask[1] == '.' && mask.find_first_of("*?", 1) == std::string::npos)
+		{
+			key = ToLower(mask.substr(1));
+			return MASK_SUFFIX;
+		}
+
+		return MASK_OTHER;
+	}
+
+	/** Adds the lines in a map which are stored under the specified key to a list. */
+	static void FindKey(const LineMap& lines, const std::string& key, LineList& candidates)
+	{
+		LineMap::const_iterator iter = lines.find(key);
+		if (iter != lines.end())
+			candidates.insert(candidates.end(), iter->second.begin(), iter->second.end());
+	}
+
+	/** Adds the lines which might match an IP address to a list. */
+	void FindAddress(const irc::sockets::sockaddrs& sa, LineList& candidates) const
+	{
+		if (sa.family() != AF_INET && sa.family() != AF_INET6)
+			return;
+
+		for (const auto& [length, lines] : cidrlines)
+			FindKey(lines, GetCIDRKey(irc::sockets::cidr_mask(sa, length)), candidates);
+	}
+
+	/** Adds the lines which might match a hostname to a list. */
+	void FindHost(const std::string& host, LineList& candidates) const
+	{
+		const std::string lowerhost = ToLower(host);
+		FindKey(hostlines, lowerhost, candidates);
+
+		if (suffixlines.empty())
+			return;
+
+		for (std::string::size_type dotpos = lowerhost.find('.'); dotpos != std::string::npos; dotpos = lowerhost.find('.', dotpos + 1))
+			FindKey(suffixlines, lowerhost.substr(dotpos), candidates);
+	}
+
+	/** Removes a line from the list stored under the specified key in a map.
+	 * @return True if the list is now empty and has been removed; otherwise, false.
+	 */
+	static bool RemoveKey(LineMap& lines, const std::string& key, XLine* line)
+	{
+		LineMap::iterator iter = lines.find(key);
+		if (iter == lines.end())
+			return false;
+
+		stdalgo::vector::swaperase(iter->second, line);
+		if (!iter->second.empty())
+			return false;
+
+		lines.erase(iter);
+		return true;
+	}
+
+public:
+	/** Adds a line to the index.
+	 * @param line The line to add.
+	 */
+	void Add(XLine* line)
+	{
+		std::string key;
+		unsigned char length = 0;
+		switch (Classify(line, key, length))
+		{
+			case MASK_CIDR:
+				cidrlines[length][key].push_back(line);
+				break;
+
+			case MASK_HOST:
+				hostlines[key].push_back(line);
+				break;
+
+			case MASK_SUFFIX:
+				suffixlines[key].push_back(line);
+				break;
+
+			case MASK_OTHER:
+				otherlines.push_back(line);
+				break;
+		}
+	}
+
+	/** Removes a line from the index.
+	 * @param line The line to remove.
+	 */
+	void Remove(XLine* line)
+	{
+		std::string key;
+		unsigned char length = 0;
+		switch (Classify(line, key, length))
+		{
+			case MASK_CIDR:
+			{
+				auto iter = cidrlines.find(length);
+				if (iter != cidrlines.end() && RemoveKey(iter->second, key, line) && iter->second.empty())
+					cidrlines.erase(iter);
+				break;
+			}
+
+			case MASK_HOST:
+				RemoveKey(hostlines, key, line);
+				break;
+
+			case MASK_SUFFIX:
+				RemoveKey(suffixlines, key, line);
+				break;
+
+			case MASK_OTHER:
+				stdalgo::vector::swaperase(otherlines, line);
+				break;
+		}
+	}
+
+	/** Finds the lines which might match a user. Every line which matches the user is
+	 * guaranteed to be found but the caller must check each line with XLine::Matches.
+	 * @param user The user to find lines for.
+	 * @param candidates The list to add the lines to. This may contain duplicates.
+	 */
+	void Find(User* user, LineList& candidates) const
+	{
+		candidates.insert(candidates.end(), otherlines.begin(), otherlines.end());
+
+		FindAddress(user->client_sa, candidates);
+		FindHost(user->GetRealHost(), candidates);
+
+		// Lines are matched against both the hostname and the IP address so if the
+		// hostname is a different IP address or the address is matched as text we
+		// need to look both of them up.
+		const std::string& address = user->GetAddress();
+		if (user->GetRealHost() != address)
+		{
+			irc::sockets::sockaddrs sa(false);
+			if (!cidrlines.empty() && sa.from_ip(user->GetRealHost()))
+				FindAddress(sa, candidates);
+			FindHost(address, candidates);
+		}
+	}
+};
+
 /*
  * This is now version 3 of the XLine subsystem, let's see if we can get it as nice and
  * efficient as we can this time so we can close this file and never ever touch it again ..
@@ -182,23 +450,21 @@ void XLineManager::CheckELines()
 	if (ELines.empty())
 		return;
 
+	XLineIndex::LineList candidates;
+	const XLineIndex& index = *line_indexes.at("E");
 	for (auto* u :  ServerInstance->Users.GetLocalUsers())
 	{
 		u->exempt = false;
 
-		/* This uses safe iteration to ensure that if a line expires here, it doesn't trash the iterator */
-		LookupIter safei;
-
-		for (LookupIter i = ELines.begin(); i != ELines.end(); )
+		candidates.clear();
+		index.Find(u, candidates);
+		for (auto* e : candidates)
 		{
-			safei = i;
-			safei++;
-
-			XLine* e = i->second;
 			if ((!e->duration || ServerInstance->Time() < e->expiry) && e->Matches(u))
+			{
 				u->exempt = true;
-
-			i = safei;
+				break;
+			}
 		}
 	}
 }
@@ -326,6 +592,12 @@ bool XLineManager::AddLine(XLine* line, User* user)
 		pending_lines.push_back(line);
 
 	lookup_lines[line->type][line->Displayable()] = line;
+
+	std::unique_ptr<XLineIndex>& index = line_indexes[line->type];
+	if (!index)
+		index = std::make_unique<XLineIndex>();
+	index->Add(line);
+
 	line->OnAdd();
 
 	FOREACH_MOD(OnAddLine, (user, line));
@@ -360,6 +632,7 @@ bool XLineManager::DelLine(const std::string& hostmask, const std::string& type,
 
 	stdalgo::erase(pending_lines, y->second);
 
+	RemoveFromIndex(y->second);
 	delete y->second;
 	x->second.erase(y);
 
@@ -377,32 +650,37 @@ XLine* XLineManager::MatchesLine(const std::string& type, User* user)
 {
 	ContainerIter x = lookup_lines.find(type);
 
-	if (x == lookup_lines.end())
+	if (x == lookup_lines.end() || x->second.empty())
 		return nullptr;
 
 	const time_t current = ServerInstance->Time();
 
-	LookupIter safei;
-
-	for (LookupIter i = x->second.begin(); i != x->second.end(); )
+	// Only check the lines which the index says might match the user. These are
+	// checked in the same order as the lookup table so that if more than one line
+	// matches the user the same one is returned as when checking every line.
+	XLineIndex::LineList candidates;
+	line_indexes.at(type)->Find(user, candidates);
+	std::sort(candidates.begin(), candidates.end(), [](const XLine* lhs, const XLine* rhs) {
+		return irc::insensitive_swo()(lhs->Displayable(), rhs->Displayable());
+	});
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+	for (auto* candidate : candidates)
 	{
-		safei = i;
-		safei++;
-
-		if (i->second->duration && current > i->second->expiry)
+		if (candidate->duration && current > candidate->expiry)
 		{
 			/* Expire the line, proceed to next one */
-			ExpireLine(x, i);
-			i = safei;
+			LookupIter i = x->second.find(candidate->Displayable());
+			if (i != x->second.end())
+				ExpireLine(x, i);
 			continue;
 		}
 
-		if (i->second->Matches(user))
+		if (candidate->Matches(user))
 		{
-			return i->second;
+			AddHit(type);
+			return candidate;
 		}
-
-		i = safei;
 	}
 	return nullptr;
 }
@@ -434,7 +712,10 @@ XLine* XLineManager::MatchesLine(const std::string& type, const std::string& pat
 				continue;
 			}
 			else
+			{
+				AddHit(type);
 				return i->second;
+			}
 		}
 
 		i = safei;
@@ -459,10 +740,18 @@ void XLineManager::ExpireLine(ContainerIter container, LookupIter item, bool sil
 	 */
 	stdalgo::erase(pending_lines, item->second);
 
+	RemoveFromIndex(item->second);
 	delete item->second;
 	container->second.erase(item);
 }
 
+void XLineManager::RemoveFromIndex(XLine* line)
+{
+	auto index = line_indexes.find(line->type);
+	if (index != line_indexes.end())
+		index->second->Remove(line);
+}
+
 // applies lines, removing clients and changing nicks etc as applicable
 void XLineManager::ApplyLines()
 {
@@ -479,6 +768,7 @@ void XLineManager::ApplyLines()
 		{
 			if (x->Matches(u))
 			{
+				AddHit(x->type);
 				x->Apply(u);
 
 				// If applying the X-line has killed the user then don't